@@ -27,7 +27,7 @@ let package = Package(
     .target(
       name: "NDSSDFormatCore",
       path: ".",
-      sources: ["src/SDFormat.cpp"],
+      sources: ["src"],
       publicHeadersPath: "include",
       cxxSettings: [
         .unsafeFlags([
@@ -63,7 +63,7 @@ let package = Package(
     ),
     .testTarget(
       name: "NDSSDFormatTests",
-      dependencies: ["NDSSDFormat"],
+      dependencies: ["NDSSDFormat", "NDSSDFormatCore"],
       path: "tests/NDSSDFormatTests",
       swiftSettings: [
         .swiftLanguageMode(.v6)
@@ -0,0 +1,127 @@
+import NDSSDFormatCore
+
+/// Formats large cards for targets other than the DS as exFAT.
+///
+/// Wraps the C exFAT functions the way ``SectorWriter`` wraps the FAT32
+/// ones, and follows the same layout profile and sector size. The volume
+/// has 128 KB clusters, one FAT, and a cluster heap that starts on the
+/// profile's alignment boundary; a card too large for an MBR gets a GPT.
+/// Every structure goes out in one or a few large writes, so a 1 TB card
+/// formats in a handful of writes.
+///
+/// ```swift
+/// let label = try VolumeLabel("CAMERA")
+/// let writer = try ExfatSectorWriter(
+///   fd: handle.fileDescriptor,
+///   byteCount: deviceSize,
+///   volumeLabel: label)
+/// try writer.format()
+/// ```
+public struct ExfatSectorWriter: Sendable {
+  /// An open file descriptor with write permissions to the target device.
+  private let fd: Int32
+
+  /// Total number of 512-byte sectors on the target device.
+  private let sectorCount: UInt64
+
+  /// The validated volume label written into the root directory.
+  private let label: VolumeLabel
+
+  /// The cluster size of the volume, in bytes.
+  public let clusterByteCount: UInt32
+
+  /// The number of clusters in the cluster heap.
+  public let clusterCount: UInt32
+
+  /// Creates an exFAT sector writer for the given device.
+  ///
+  /// - Parameters:
+  ///   - fd: An open file descriptor with write permissions.
+  ///   - byteCount: Total size of the device in bytes.
+  ///   - volumeLabel: A validated ``VolumeLabel``.
+  /// - Throws: ``FormatterError/invalidFileDescriptor`` if `fd` is not
+  ///   positive, or ``FormatterError`` if the device is too small for
+  ///   exFAT (under about 9 MB) or its sector size is not supported.
+  public init(fd: Int32, byteCount: UInt64, volumeLabel: VolumeLabel)
+    throws(FormatterError)
+  {
+    guard fd > 0 else {
+      throw .invalidFileDescriptor
+    }
+    var layout = SDFormatExfatLayout()
+    let errno = sdFormatGetExfatLayout(fd, byteCount / 512, &layout)
+    guard errno == 0 else {
+      throw FormatterError(errno: errno)
+    }
+    self.fd = fd
+    self.sectorCount = byteCount / 512
+    self.label = volumeLabel
+    self.clusterByteCount = layout.clusterBytes
+    self.clusterCount = layout.clusterCount
+  }
+
+  /// Writes the Master Boot Record with one exFAT partition entry, or a
+  /// GUID Partition Table on a card larger than 2 TiB.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeMasterBootRecord() throws(FormatterError) {
+    try check(sdFormatExfatWriteMBR(fd, sectorCount))
+  }
+
+  /// Writes the Main and Backup Boot Regions with their checksums.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeBootRegions() throws(FormatterError) {
+    try check(sdFormatExfatWriteBootRegions(fd, sectorCount))
+  }
+
+  /// Writes the FAT.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeFat() throws(FormatterError) {
+    try check(sdFormatExfatWriteFat(fd, sectorCount))
+  }
+
+  /// Writes the allocation bitmap in chunks of up to 8 MB.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeAllocationBitmap() throws(FormatterError) {
+    try check(sdFormatExfatWriteAllocationBitmap(fd, sectorCount))
+  }
+
+  /// Writes the up-case table.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeUpcaseTable() throws(FormatterError) {
+    try check(sdFormatExfatWriteUpcaseTable(fd, sectorCount))
+  }
+
+  /// Writes the root directory with the volume label.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeRootDirectory() throws(FormatterError) {
+    try check(sdFormatExfatWriteRootDirectory(fd, sectorCount, label.cChars))
+  }
+
+  /// Writes all six structures in order: MBR, boot regions, FAT,
+  /// allocation bitmap, up-case table, root directory.
+  ///
+  /// - Throws: ``FormatterError`` if a write fails.
+  public func format() throws(FormatterError) {
+    try writeMasterBootRecord()
+    try writeBootRegions()
+    try writeFat()
+    try writeAllocationBitmap()
+    try writeUpcaseTable()
+    try writeRootDirectory()
+  }
+
+  // MARK: - Private
+
+  /// Translates a C errno return into a Swift typed throw.
+  private func check(_ errno: Int32) throws(FormatterError) {
+    guard errno == 0 else {
+      throw FormatterError(errno: errno)
+    }
+  }
+}
@@ -0,0 +1,122 @@
+import NDSSDFormatCore
+
+/// Formats cards too small for ``SectorWriter`` as FAT16.
+///
+/// Wraps the C FAT16 functions the way ``SectorWriter`` wraps the FAT32
+/// ones. The layout follows `docs/fat16_forensic_analysis.md`: two 16-bit
+/// FATs, a fixed 512-entry root directory, and the smallest cluster size
+/// from 2 KB to 32 KB that keeps the volume under 65,525 clusters. The
+/// reserved sectors pad the metadata to 4 MB, so the data region starts on
+/// a 4 MB boundary.
+///
+/// ```swift
+/// let label = try VolumeLabel("NDS")
+/// let writer = try Fat16SectorWriter(
+///   fd: handle.fileDescriptor,
+///   byteCount: deviceSize,
+///   volumeLabel: label)
+/// try writer.format()
+/// ```
+public struct Fat16SectorWriter: Sendable {
+  /// An open file descriptor with write permissions to the target device.
+  private let fd: Int32
+
+  /// Total number of 512-byte sectors on the target device.
+  private let sectorCount: UInt64
+
+  /// The validated volume label written into the VBR and root directory.
+  private let label: VolumeLabel
+
+  /// The cluster size of the volume, in bytes.
+  public let clusterByteCount: UInt32
+
+  /// The number of data clusters of the volume.
+  public let clusterCount: UInt32
+
+  /// Minimum device size: about 16 MB.
+  ///
+  /// FAT16 needs at least 4,085 clusters. With the smallest cluster size
+  /// (2 KB), the 4 MB partition alignment, and the 4 MB of metadata that
+  /// is 32,724 sectors.
+  public static let minimumByteCount = UInt64(kSDFormatFat16MinSectors) * 512
+
+  /// Creates a FAT16 sector writer for the given device.
+  ///
+  /// - Parameters:
+  ///   - fd: An open file descriptor with write permissions.
+  ///   - byteCount: Total size of the device in bytes. A device larger
+  ///     than the largest FAT16 volume (2 GiB) gets a partition of that
+  ///     size.
+  ///   - volumeLabel: A validated ``VolumeLabel``.
+  /// - Throws: ``FormatterError/invalidFileDescriptor`` if `fd` is not
+  ///   positive, or ``FormatterError/tooSmall(actual:minimum:)`` if
+  ///   `byteCount` is below ``minimumByteCount``.
+  public init(fd: Int32, byteCount: UInt64, volumeLabel: VolumeLabel)
+    throws(FormatterError)
+  {
+    guard fd > 0 else {
+      throw .invalidFileDescriptor
+    }
+    var layout = SDFormatFat16Layout()
+    guard byteCount >= Self.minimumByteCount,
+      sdFormatGetFat16Layout(byteCount / 512, &layout) == 0
+    else {
+      throw .tooSmall(actual: byteCount, minimum: Self.minimumByteCount)
+    }
+    self.fd = fd
+    self.sectorCount = byteCount / 512
+    self.label = volumeLabel
+    self.clusterByteCount = layout.clusterBytes
+    self.clusterCount = layout.clusterCount
+  }
+
+  /// Writes the Master Boot Record with one FAT16 partition entry.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeMasterBootRecord() throws(FormatterError) {
+    try check(sdFormatFat16WriteMBR(fd, sectorCount))
+  }
+
+  /// Writes the FAT16 boot sector. FAT16 has no backup copy.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeVolumeBootRecord() throws(FormatterError) {
+    try check(
+      sdFormatFat16WriteVolumeBootRecord(fd, sectorCount, label.cChars))
+  }
+
+  /// Writes both FAT copies with one write.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeFat16Tables() throws(FormatterError) {
+    try check(sdFormatFat16WriteTables(fd, sectorCount))
+  }
+
+  /// Writes the fixed root directory region with a volume label entry.
+  ///
+  /// - Throws: ``FormatterError`` if the write fails.
+  public func writeRootDirectory() throws(FormatterError) {
+    try check(
+      sdFormatFat16WriteRootDirectory(fd, sectorCount, label.cChars))
+  }
+
+  /// Writes all four structures in order: MBR, VBR, FAT tables, root
+  /// directory.
+  ///
+  /// - Throws: ``FormatterError`` if a write fails.
+  public func format() throws(FormatterError) {
+    try writeMasterBootRecord()
+    try writeVolumeBootRecord()
+    try writeFat16Tables()
+    try writeRootDirectory()
+  }
+
+  // MARK: - Private
+
+  /// Translates a C errno return into a Swift typed throw.
+  private func check(_ errno: Int32) throws(FormatterError) {
+    guard errno == 0 else {
+      throw FormatterError(errno: errno)
+    }
+  }
+}
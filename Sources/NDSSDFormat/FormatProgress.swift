@@ -0,0 +1,23 @@
+import NDSSDFormatCore
+
+/// A progress event from ``SectorWriter/format(progress:)``.
+///
+/// One event is delivered after each step of the format but the last;
+/// the end of the format is reported by `format(progress:)` returning.
+public struct FormatProgress: Sendable, Equatable {
+  /// The step that just completed.
+  public let step: IOStatistics.Phase
+
+  /// Steps completed so far.
+  public let stepsDone: Int
+
+  /// Steps in the whole format.
+  public let stepCount: Int
+
+  /// Converts a C event.
+  init(_ event: SDFormatEvent) {
+    self.step = IOStatistics.Phase(rawValue: Int(event.phase)) ?? .other
+    self.stepsDone = Int(event.stepsDone)
+    self.stepCount = Int(event.stepCount)
+  }
+}
@@ -1,10 +1,15 @@
-import Darwin
+#if canImport(Darwin)
+  import Darwin
+#else
+  import Glibc
+#endif
 
 /// Errors thrown by ``SectorWriter`` operations.
 ///
-/// The ``invalidFileDescriptor`` and ``tooSmall`` cases are caught
-/// during initialization. The ``ioError(_:)`` case wraps the `errno`
-/// value from a failed I/O system call in the C formatting library.
+/// The ``invalidFileDescriptor``, ``tooSmall``, and
+/// ``invalidRootClusters(_:)`` cases are caught during initialization.
+/// The ``ioError(_:)`` case wraps the `errno` value from a failed I/O
+/// system call in the C formatting library.
 public enum FormatterError: Error, Equatable, Sendable {
   /// The file descriptor is not positive.
   case invalidFileDescriptor
@@ -20,6 +25,11 @@ public enum FormatterError: Error, Equatable, Sendable {
   case invalidDevice
   /// The device could not be unmounted (e.g., another process holds it open).
   case deviceBusy
+  /// The requested root directory size is outside
+  /// 1...``SectorWriter/maximumRootClusters``.
+  case invalidRootClusters(UInt32)
+  /// The task running ``SectorWriter/format(progress:)`` was cancelled.
+  case cancelled
 
   /// Creates a `FormatterError` from an `errno` value returned by a
   /// C formatting function.
@@ -27,7 +37,7 @@ public enum FormatterError: Error, Equatable, Sendable {
   /// - Parameter errno: The `errno` value from the failed I/O call.
   ///   Must be non-zero.
   public init(errno: Int32) {
-    self = .ioError(errno)
+    self = errno == ECANCELED ? .cancelled : .ioError(errno)
   }
 
   /// A human-readable description of the error suitable for logging.
@@ -47,6 +57,11 @@ public enum FormatterError: Error, Equatable, Sendable {
       "Invalid device: cannot query capacity or unexpected block size"
     case .deviceBusy:
       "Device busy: unmount failed"
+    case .invalidRootClusters(let count):
+      "Invalid root directory size: \(count) clusters, "
+        + "expected 1–\(SectorWriter.maximumRootClusters)"
+    case .cancelled:
+      "Formatting cancelled"
     }
   }
 }
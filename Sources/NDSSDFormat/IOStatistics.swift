@@ -0,0 +1,90 @@
+import NDSSDFormatCore
+
+/// A snapshot of the I/O statistics collected by the C library.
+///
+/// Collection is off by default; turn it on with
+/// ``SectorWriter/setStatisticsEnabled(_:)`` before formatting and read the
+/// result with ``SectorWriter/statistics()``.
+///
+/// ```swift
+/// SectorWriter.resetStatistics()
+/// SectorWriter.setStatisticsEnabled(true)
+/// try writer.writeFat32Tables()
+/// let fat = SectorWriter.statistics().phases[.fatTables]
+/// ```
+public struct IOStatistics: Sendable {
+  /// The formatting step that issued the I/O.
+  ///
+  /// Raw values match the `kSDFormatPhase` constants of the C API.
+  public enum Phase: Int, CaseIterable, Sendable {
+    /// Anything outside the steps below (probe, autotune, maintenance).
+    case other = 0
+    case masterBootRecord = 1
+    case volumeBootRecord = 2
+    case fsInfo = 3
+    case fatTables = 4
+    case rootDirectory = 5
+    case saveFiles = 6
+  }
+
+  /// System call counts and byte totals for one ``Phase``.
+  public struct PhaseCounters: Sendable, Equatable {
+    public var writeCalls: UInt64
+    public var bytesWritten: UInt64
+    public var readCalls: UInt64
+    public var bytesRead: UInt64
+    public var syncCalls: UInt64
+    /// Zero or discard commands the device (or file system) carried out
+    /// without a data transfer, and the bytes they covered.
+    public var offloadCalls: UInt64
+    public var offloadBytes: UInt64
+    /// Wall time spent in the phase.
+    public var elapsed: Duration
+  }
+
+  /// One non-empty bucket of the write latency histogram.
+  public struct LatencyBucket: Sendable, Equatable {
+    /// Shortest latency counted in this bucket.
+    public var lowerBound: Duration
+    /// Number of writes that fell in the bucket.
+    public var count: UInt64
+  }
+
+  /// Counters for every phase.
+  public var phases: [Phase: PhaseCounters]
+
+  /// Write latencies, log-linear, in increasing order. Empty buckets are
+  /// omitted.
+  public var writeLatency: [LatencyBucket]
+
+  /// Converts the C snapshot.
+  init(_ stats: SDFormatStats) {
+    var phases: [Phase: PhaseCounters] = [:]
+    withUnsafeBytes(of: stats.phases) { raw in
+      let counters = raw.bindMemory(to: SDFormatPhaseStats.self)
+      for phase in Phase.allCases {
+        let c = counters[phase.rawValue]
+        phases[phase] = PhaseCounters(
+          writeCalls: c.writeCalls, bytesWritten: c.bytesWritten,
+          readCalls: c.readCalls, bytesRead: c.bytesRead,
+          syncCalls: c.syncCalls, offloadCalls: c.offloadCalls,
+          offloadBytes: c.offloadBytes,
+          elapsed: .nanoseconds(Int64(clamping: c.elapsedNanoseconds)))
+      }
+    }
+    self.phases = phases
+
+    var buckets: [LatencyBucket] = []
+    withUnsafeBytes(of: stats.writeLatency) { raw in
+      for (index, count) in raw.bindMemory(to: UInt64.self).enumerated()
+      where count != 0 {
+        let microseconds = sdFormatLatencyBucketMicroseconds(UInt32(index))
+        buckets.append(
+          LatencyBucket(
+            lowerBound: .microseconds(Int64(clamping: microseconds)),
+            count: count))
+      }
+    }
+    self.writeLatency = buckets
+  }
+}
@@ -1,4 +1,5 @@
 import NDSSDFormatCore
+import Synchronization
 
 /// Groups the parameters for a formatting operation and provides
 /// throwing wrappers around the C formatting functions.
@@ -36,6 +37,17 @@ public struct SectorWriter: Sendable {
   /// The validated volume label written into the VBR and root directory.
   private let label: VolumeLabel
 
+  /// Number of contiguous clusters preallocated for the root directory.
+  ///
+  /// Passed to every C function whose output depends on the size of the
+  /// root directory (FSInfo, FAT tables, root directory), so all three
+  /// agree on the layout.
+  private let rootClusters: UInt32
+
+  /// Largest root directory, in 32 KB clusters (2 MB, the FAT limit of
+  /// 65,536 entries per directory).
+  public static let maximumRootClusters = UInt32(kSDFormatMaxRootClusters)
+
   /// Minimum device size: 2 GiB + 8 MB.
   ///
   /// FAT32 with 32KB clusters (required for DS flashcart compatibility)
@@ -44,7 +56,8 @@ public struct SectorWriter: Sendable {
   /// for the 4 MB partition alignment, reserved sectors, and two FAT
   /// copies. The extra 2^23 bytes (8 MB) covers this overhead.
   /// Marketed "2 GB" cards report ~2.01 GB and fall short; the next
-  /// standard size (4 GB) reports ~3.6 GB and works fine.
+  /// standard size (4 GB) reports ~3.6 GB and works fine. Smaller cards
+  /// are formatted FAT16 with ``Fat16SectorWriter``.
   public static let minimumByteCount: UInt64 = (1 << 31) + (1 << 23)
 
   /// Creates a sector writer for the given device.
@@ -52,24 +65,36 @@ public struct SectorWriter: Sendable {
   /// Validates all parameters before any I/O occurs:
   /// - The file descriptor must be positive.
   /// - The device must be at least 2 GiB.
+  /// - The root directory must span 1 to ``maximumRootClusters`` clusters.
   ///
   /// - Parameters:
   ///   - fd: An open file descriptor with write permissions.
   ///   - byteCount: Total size of the device in bytes.
   ///   - volumeLabel: A validated ``VolumeLabel``.
+  ///   - rootClusters: Contiguous clusters to preallocate for the root
+  ///     directory. Cards that will hold more than about a thousand
+  ///     long-named root entries list faster with a larger root.
   /// - Throws: ``FormatterError/invalidFileDescriptor`` if `fd` is
-  ///   not positive, or ``FormatterError/tooSmall(actual:minimum:)``
-  ///   if `byteCount` is below the minimum.
-  public init(fd: Int32, byteCount: UInt64, volumeLabel: VolumeLabel) throws(FormatterError) {
+  ///   not positive, ``FormatterError/tooSmall(actual:minimum:)``
+  ///   if `byteCount` is below the minimum, or
+  ///   ``FormatterError/invalidRootClusters(_:)`` if `rootClusters` is
+  ///   out of range.
+  public init(
+    fd: Int32, byteCount: UInt64, volumeLabel: VolumeLabel, rootClusters: UInt32 = 1
+  ) throws(FormatterError) {
     guard fd > 0 else {
       throw .invalidFileDescriptor
     }
     guard byteCount >= Self.minimumByteCount else {
       throw .tooSmall(actual: byteCount, minimum: Self.minimumByteCount)
     }
+    guard (1...Self.maximumRootClusters).contains(rootClusters) else {
+      throw .invalidRootClusters(rootClusters)
+    }
     self.fd = fd
     self.sectorCount = byteCount / 512
     self.label = volumeLabel
+    self.rootClusters = rootClusters
   }
 
   /// Writes the Master Boot Record to absolute sector 0.
@@ -90,21 +115,86 @@ public struct SectorWriter: Sendable {
   ///
   /// - Throws: ``FormatterError`` if the write fails.
   public func writeFSInfo() throws(FormatterError) {
-    try check(sdFormatWriteFSInfo(fd, sectorCount))
+    try check(sdFormatWriteFSInfo(fd, sectorCount, rootClusters))
   }
 
   /// Writes and zeroes both FAT copies.
   ///
   /// - Throws: ``FormatterError`` if the write fails.
   public func writeFat32Tables() throws(FormatterError) {
-    try check(sdFormatWriteFat32Tables(fd, sectorCount))
+    try check(sdFormatWriteFat32Tables(fd, sectorCount, rootClusters))
   }
 
-  /// Writes and zeroes the root directory cluster with a volume label entry.
+  /// Writes and zeroes the root directory clusters with a volume label entry.
   ///
   /// - Throws: ``FormatterError`` if the write fails.
   public func writeRootDirectory() throws(FormatterError) {
-    try check(sdFormatWriteRootDirectory(fd, sectorCount, label.cChars))
+    try check(
+      sdFormatWriteRootDirectory(fd, sectorCount, rootClusters, label.cChars))
+  }
+
+  // MARK: - Asynchronous Formatting
+
+  /// Formats the device without blocking a thread of the cooperative pool.
+  ///
+  /// Writes the same five structures as the write methods above, in the
+  /// same order, on a thread owned by the C library (`sdFormatBegin`),
+  /// and suspends until it finishes. Many cards can be formatted from one
+  /// process this way without starving other tasks.
+  ///
+  /// Cancelling the task stops the format before its next step. The step
+  /// in progress completes first, so the device is left partly formatted.
+  ///
+  /// ```swift
+  /// let (events, progress) = AsyncStream.makeStream(of: FormatProgress.self)
+  /// async let formatted: Void = writer.format(progress: progress)
+  /// for await event in events {
+  ///   print("\(event.step): \(event.stepsDone) of \(event.stepCount)")
+  /// }
+  /// try await formatted
+  /// ```
+  ///
+  /// - Parameter progress: Receives an event after each step but the last,
+  ///   and is finished when the format ends.
+  /// - Throws: ``FormatterError/cancelled`` if the task was cancelled, or
+  ///   ``FormatterError/ioError(_:)`` if a step fails.
+  public func format(
+    progress: AsyncStream<FormatProgress>.Continuation? = nil
+  ) async throws(FormatterError) {
+    defer { progress?.finish() }
+    let operation = FormatOperation(progress: progress)
+    let result = await withTaskCancellationHandler {
+      await withCheckedContinuation { continuation in
+        operation.begin(
+          fd: fd, sectorCount: sectorCount, rootClusters: rootClusters,
+          label: label, continuation: continuation)
+      }
+    } onCancel: {
+      operation.cancel()
+    }
+    try check(result)
+  }
+
+  // MARK: - Statistics
+
+  /// Starts or stops collecting I/O statistics, process-wide.
+  ///
+  /// While disabled (the default) the C library reads no clocks, so the
+  /// cost of leaving the hooks in place is negligible.
+  public static func setStatisticsEnabled(_ enabled: Bool) {
+    sdFormatEnableStats(enabled)
+  }
+
+  /// Sets every statistics counter to zero.
+  public static func resetStatistics() {
+    sdFormatResetStats()
+  }
+
+  /// Returns the statistics collected since the last reset.
+  public static func statistics() -> IOStatistics {
+    var stats = SDFormatStats()
+    sdFormatGetStats(&stats)
+    return IOStatistics(stats)
   }
 
   // MARK: - Private
@@ -123,3 +213,107 @@ public struct SectorWriter: Sendable {
     }
   }
 }
+
+/// The state of one ``SectorWriter/format(progress:)`` call, shared with
+/// the C event callback, which runs on the operation's thread.
+private final class FormatOperation: Sendable {
+  private struct State {
+    /// The C handle, from when `sdFormatBegin` returns until the final
+    /// event releases it.
+    var operation: OpaquePointer?
+    var cancelled = false
+    var finished = false
+    var continuation: CheckedContinuation<Int32, Never>?
+  }
+
+  private let progress: AsyncStream<FormatProgress>.Continuation?
+  private let state = Mutex(State())
+
+  init(progress: AsyncStream<FormatProgress>.Continuation?) {
+    self.progress = progress
+  }
+
+  /// Starts the C operation. `continuation` is resumed with its result.
+  ///
+  /// The callback holds a reference to `self` until the final event.
+  func begin(
+    fd: Int32, sectorCount: UInt64, rootClusters: UInt32,
+    label: VolumeLabel, continuation: CheckedContinuation<Int32, Never>
+  ) {
+    state.withLock { $0.continuation = continuation }
+    let context = Unmanaged.passRetained(self)
+    var operation: OpaquePointer?
+    let err = label.cChars.withUnsafeBufferPointer { chars in
+      var parameters = SDFormatParameters(
+        fd: fd, sectorCount: sectorCount, rootClusters: rootClusters,
+        label: chars.baseAddress, saves: nil, saveCount: 0)
+      return sdFormatBegin(
+        &parameters,
+        { context, event in
+          guard let context, let event else { return }
+          Unmanaged<FormatOperation>.fromOpaque(context)
+            .takeUnretainedValue().receive(event.pointee)
+        },
+        context.toOpaque(), &operation)
+    }
+    guard err == 0, let operation else {
+      context.release()
+      resume(returning: err)
+      return
+    }
+
+    // The final event may already have been delivered, and a cancellation
+    // may have arrived while starting
+    let finished = state.withLock {
+      if !$0.finished {
+        $0.operation = operation
+        if $0.cancelled {
+          sdFormatCancel(operation)
+        }
+      }
+      return $0.finished
+    }
+    if finished {
+      _ = sdFormatFinish(operation)
+    }
+  }
+
+  /// Asks the C operation to stop before its next step.
+  func cancel() {
+    state.withLock {
+      $0.cancelled = true
+      if let operation = $0.operation {
+        sdFormatCancel(operation)
+      }
+    }
+  }
+
+  /// Handles one event on the operation's thread.
+  private func receive(_ event: SDFormatEvent) {
+    guard event.finished else {
+      progress?.yield(FormatProgress(event))
+      return
+    }
+    // Without a handle yet, `begin` releases it once sdFormatBegin returns
+    let operation = state.withLock {
+      $0.finished = true
+      let operation = $0.operation
+      $0.operation = nil
+      return operation
+    }
+    if let operation {
+      _ = sdFormatFinish(operation)
+    }
+    resume(returning: event.result)
+    Unmanaged.passUnretained(self).release()
+  }
+
+  private func resume(returning result: Int32) {
+    let continuation = state.withLock {
+      let continuation = $0.continuation
+      $0.continuation = nil
+      return continuation
+    }
+    continuation?.resume(returning: result)
+  }
+}
@@ -10,7 +10,7 @@ struct SDFormat: AsyncParsableCommand {
     discussion: """
       Writes a deterministic FAT32 filesystem with 32KB clusters, MBR
       partition scheme, and 4MB alignment for R4i/Acekard flashcart
-      compatibility.
+      compatibility. Cards under 2 GB are formatted FAT16 instead.
 
       By default, treats the target as a block device: unmounts,
       detects capacity via Disk Arbitration, and prompts for
@@ -26,6 +26,9 @@ struct SDFormat: AsyncParsableCommand {
   @Flag(name: .long, help: "Treat target as a regular file (skip unmount and confirmation).")
   var file: Bool = false
 
+  @Option(name: .long, help: "Contiguous 32KB clusters to preallocate for the root directory (1–64).")
+  var rootClusters: UInt32 = 1
+
   mutating func run() async throws {
     var logger = Logger(label: "SDFormat")
     logger.logLevel = .info
@@ -70,10 +73,11 @@ struct SDFormat: AsyncParsableCommand {
       }
 
       let gigabytes = Double(byteCount) / 1_000_000_000.0
+      let fileSystem = byteCount < SectorWriter.minimumByteCount ? "FAT16" : "FAT32"
       print(
         """
         WARNING: You are about to ERASE \(targetPath) \
-        (\(String(format: "%.1f", gigabytes)) GB) and format it as FAT32.
+        (\(String(format: "%.1f", gigabytes)) GB) and format it as \(fileSystem).
         All data will be lost.
         """)
       print("Type 'yes' to continue: ", terminator: "")
@@ -97,32 +101,43 @@ struct SDFormat: AsyncParsableCommand {
     }
     defer { close(fd) }
 
+    // Cards too small for FAT32 are formatted FAT16, synchronously: the
+    // whole format is four small writes.
+    if byteCount < SectorWriter.minimumByteCount {
+      do {
+        let writer = try Fat16SectorWriter(
+          fd: fd, byteCount: byteCount, volumeLabel: label)
+        logger.info(
+          "FAT16: \(writer.clusterCount) clusters of \(writer.clusterByteCount / 1024) KB")
+        try writer.format()
+      } catch {
+        logger.error("\(error.localizedDescription)")
+        throw ExitCode.failure
+      }
+      logger.info("Formatting complete.")
+      return
+    }
+
     // Create the sector writer.
     let writer: SectorWriter
     do {
       writer = try SectorWriter(
-        fd: fd, byteCount: byteCount, volumeLabel: label)
+        fd: fd, byteCount: byteCount, volumeLabel: label,
+        rootClusters: rootClusters)
     } catch {
       logger.error("\(error.localizedDescription)")
       throw ExitCode.failure
     }
 
-    // Write all five filesystem structures.
+    // Write all five filesystem structures, logging each completed step.
+    let (events, progress) = AsyncStream.makeStream(of: FormatProgress.self)
+    async let formatted: Void = writer.format(progress: progress)
+    for await event in events {
+      logger.info(
+        "Wrote \(String(describing: event.step)) (\(event.stepsDone)/\(event.stepCount))")
+    }
     do {
-      logger.info("Writing MBR...")
-      try writer.writeMasterBootRecord()
-
-      logger.info("Writing VBR...")
-      try writer.writeVolumeBootRecord()
-
-      logger.info("Writing FSInfo...")
-      try writer.writeFSInfo()
-
-      logger.info("Writing FAT tables...")
-      try writer.writeFat32Tables()
-
-      logger.info("Writing root directory...")
-      try writer.writeRootDirectory()
+      try await formatted
     } catch {
       logger.error("\(error.localizedDescription)")
       throw ExitCode.failure
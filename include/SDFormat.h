@@ -14,6 +14,9 @@
 //   - Two mirrored FAT copies for data redundancy
 //   - Proper dirty volume flags in FAT[1] indicating clean shutdown
 //
+// Other device families (DSi, 3DS, generic SDHC/SDXC) are formatted by
+// selecting a layout profile; see "Layout Profiles" below.
+//
 // Architecture:
 //   Free C functions with extern "C" linkage. Each function writes one
 //   logical component of the filesystem. The caller manages the file
@@ -31,6 +34,7 @@
 #ifndef SD_FORMAT_H
 #define SD_FORMAT_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -46,12 +50,28 @@ extern "C" {
 //   - sectorCount: Total number of 512-byte sectors on the device
 //
 // The sectorCount parameter drives all layout calculations. For a device of
-// N bytes, sectorCount = N / 512.
+// N bytes, sectorCount = N / 512. A FAT32 volume holds at most 2^32 - 1
+// sectors and 0x0FFFFFF5 clusters; on a larger device (an SDUC card over
+// 2 TiB) the partition is capped at that size and the rest of the device
+// is left unpartitioned.
+//
+// Functions whose output depends on the size of the root directory also
+// take rootClusters: the number of contiguous clusters preallocated for it,
+// from 1 (the classic single 32 KB cluster, 1023 free entries) up to
+// kSDFormatMaxRootClusters. A card that will hold more than a few hundred
+// long-named entries in its root benefits from a larger value: the driver
+// never has to extend the root with a scattered cluster, so listing it
+// stays one sequential read. Every function must receive the same value.
 //
 // Return value:
-//   0 on success, or the errno value from the failed I/O operation.
-//   The caller is responsible for validating fd and sectorCount before
-//   calling these functions.
+//   0 on success, EINVAL if rootClusters is out of range, or the errno
+//   value from the failed I/O operation. The caller is responsible for
+//   validating fd and sectorCount before calling these functions.
+
+// kSDFormatMaxRootClusters: Largest root directory, in clusters. 64 × 32 KB
+// is 2 MB, the 65,536-entry limit the specification places on a directory.
+// A layout profile with larger clusters allows fewer (see sdFormatGetLayout).
+enum { kSDFormatMaxRootClusters = 64 };
 
 // sdFormatWriteMBR
 // ----------------
@@ -67,6 +87,12 @@ extern "C" {
 //   - PE_lbaStart = 8192 (4 MB alignment for NAND flash)
 //   - PE_chsStart/End = 0xFF 0xFF 0xFF (LBA mode indicator, required by macOS)
 //
+// A device with more logical sectors than an MBR can address (over 2 TiB
+// with 512-byte sectors) gets a GUID Partition Table instead: a protective
+// MBR (PE_type = 0xEE), the primary header and 128-entry array at LBA 1,
+// and the backup array and header at the end of the device. Its single
+// basic data partition covers the same sectors the MBR entry would.
+//
 // See: docs/mbr_x86_design.md, docs/canonical_file_system.md §MBR
 int sdFormatWriteMBR(int fd, uint64_t sectorCount);
 
@@ -101,8 +127,10 @@ int sdFormatWriteVolumeBootRecord(int fd, uint64_t sectorCount,
 // allocation. It contains:
 //   - FSI_leadSignature: 0x41615252 ("RRaA")
 //   - FSI_structSignature: 0x61417272 ("rrAa")
-//   - FSI_freeCount: Number of free clusters (computed from volume size)
-//   - FSI_nextFree: Hint for next free cluster (set to 3, after root dir)
+//   - FSI_freeCount: Number of free clusters (computed from volume size,
+//     minus the rootClusters root directory clusters)
+//   - FSI_nextFree: Hint for next free cluster (2 + rootClusters, the first
+//     cluster after the root directory)
 //   - FSI_trailSignature: 0xAA550000
 //
 // These values are advisory only. Per the Microsoft specification, filesystem
@@ -110,7 +138,7 @@ int sdFormatWriteVolumeBootRecord(int fd, uint64_t sectorCount,
 //
 // See: docs/canonical_file_system.md §FSInfo,
 // docs/microsoft_fat_specification.md
-int sdFormatWriteFSInfo(int fd, uint64_t sectorCount);
+int sdFormatWriteFSInfo(int fd, uint64_t sectorCount, uint32_t rootClusters);
 
 // sdFormatWriteFat32Tables
 // ------------------------
@@ -121,6 +149,9 @@ int sdFormatWriteFSInfo(int fd, uint64_t sectorCount);
 //   - FAT[1] (FAT_eocEntry): 0xFFFFFFFF — end-of-chain with clean volume flags
 //   - FAT[2]: 0x0FFFFFFF — marks root directory cluster as allocated (EOF)
 //
+// With rootClusters > 1 the root directory is a contiguous chain instead:
+// FAT[2] = 3, FAT[3] = 4, …, and FAT[rootClusters + 1] = 0x0FFFFFFF.
+//
 // The high bits of FAT[1] serve as dirty volume flags:
 //   - Bit 27 (0x08000000): Clean shutdown flag (1 = clean, 0 = dirty)
 //   - Bit 26 (0x04000000): No I/O errors flag (1 = no errors, 0 = errors)
@@ -134,7 +165,8 @@ int sdFormatWriteFSInfo(int fd, uint64_t sectorCount);
 //   Backup FAT:    sectors [kFatStartSector + fatSize .. + 2*fatSize - 1]
 //
 // See: docs/canonical_file_system.md §FAT Region
-int sdFormatWriteFat32Tables(int fd, uint64_t sectorCount);
+int sdFormatWriteFat32Tables(int fd, uint64_t sectorCount,
+                             uint32_t rootClusters);
 
 // sdFormatWriteRootDirectory
 // --------------------------
@@ -145,7 +177,9 @@ int sdFormatWriteFat32Tables(int fd, uint64_t sectorCount);
 // cluster is specified by BPB_rootCluster (always 2 in this implementation).
 //
 // This function:
-//   1. Zeros the entire first cluster of the data region (32 KB)
+//   1. Zeros the root directory clusters at the start of the data region
+//      (rootClusters × 32 KB), using the device's zeroing command where
+//      the host supports it
 //   2. Creates a directory entry with ATTR_VOLUME_ID (0x08) containing
 //      the volume label
 //
@@ -154,7 +188,1219 @@ int sdFormatWriteFat32Tables(int fd, uint64_t sectorCount);
 // others prefer VBR_volumeLabel. Writing both ensures maximum compatibility.
 //
 // See: docs/canonical_file_system.md §Directory Entry
-int sdFormatWriteRootDirectory(int fd, uint64_t sectorCount, const char* label);
+int sdFormatWriteRootDirectory(int fd, uint64_t sectorCount,
+                               uint32_t rootClusters, const char* label);
+
+// sdFormatWriteSaveFiles
+// ----------------------
+// Creates contiguous, zero-filled save files in the root directory.
+//
+// DS saves have a fixed size (512 B to 8 MB), and flashcart kernels create
+// a game's save file on its first launch, zero-filling it from the ARM9
+// while the user waits. This function creates the saves at format time so
+// the first launch is as fast as every later one. For each entry in
+// `saves`, the save name is the ROM's file name with its extension
+// replaced by ".sav" (any directory part of `romName` is ignored), e.g.
+// "Mario Kart DS.nds" → "Mario Kart DS.sav". The function writes:
+//
+//   1. Zeros over the data of every save, as one contiguous range, using
+//      the device's own zeroing command where the host supports it
+//   2. One contiguous cluster chain per file, starting right after the
+//      root directory, generated in memory and written to both FATs in a
+//      single pass
+//   3. The directory entries after the volume label in the root, sorted
+//      by case-folded name (see sdFormatSortDirectories), with long name
+//      entries for names that are not plain 8.3 names
+//   4. Both FSInfo copies, with the free count and next-free hint adjusted
+//      for the allocated clusters
+//
+// The function assumes the freshly formatted layout: call it once, after
+// sdFormatWriteRootDirectory. ROMs copied to the root directory later find
+// their saves next to them.
+//
+// Return value:
+//   0 on success, EINVAL if a ROM name does not give a valid file name or
+//   a save size is out of range, EEXIST if two ROMs map to the same save
+//   name, ENOSPC if the entries do not fit in the root directory or the
+//   saves do not fit on the volume, or the errno value from the failed
+//   I/O operation.
+
+typedef struct SDFormatSaveFile {
+  const char* romName;  // ROM file name (UTF-8), e.g. "Mario Kart DS.nds"
+  uint32_t saveSize;    // Save size in bytes, 512 B to 8 MB
+} SDFormatSaveFile;
+
+int sdFormatWriteSaveFiles(int fd, uint64_t sectorCount,
+                           uint32_t rootClusters,
+                           const SDFormatSaveFile* saves, uint32_t saveCount);
+
+// sdFormatReformatIncremental
+// ---------------------------
+// Formats the device like the five functions above, writing only the
+// sectors whose contents differ from the expected ones.
+//
+// Reformatting a card that already holds this layout mostly rewrites
+// sectors with the bytes they already contain, and every write costs the
+// card an erase-block program. This function reads each metadata extent in
+// 1 MB chunks and compares it with the layout for `sectorCount`,
+// `rootClusters`, and `label`:
+//
+//   - The MBR (LBA 0)
+//   - The reserved region (32 sectors: both VBRs, both FSInfo sectors, and
+//     the unused sectors between them, which are expected to be zero)
+//   - Both FATs
+//   - The root directory clusters
+//
+// Only the sectors that differ are written, each contiguous run with one
+// write. A blank FAT is zero beyond its first sector, so those chunks are
+// compared with an all-zero test rather than against a buffer. The
+// alignment gap and the data region beyond the root directory are not
+// touched, as with the individual functions. The VBR's volume ID is taken
+// from the clock, as in sdFormatWriteVolumeBootRecord, so both VBR copies
+// are rewritten unless the card was last formatted with the same label in
+// the same second. The new ID is what makes a wipe checkpoint of the old
+// volume stale (see sdFormatWipeFreeClusters).
+//
+// With kSDFormatDiscardTables, the FATs and the root directory (one
+// contiguous range) are discarded first. On a card whose discarded blocks
+// read back as zeros, the compare that follows finds only the first
+// sector of each FAT and the label sector to write, instead of 2 × fatSize
+// sectors of zeros. Discard gives no such guarantee in general (the old
+// discard_zeroes_data queue flag is gone from Linux), so nothing is
+// assumed: the compare reads the whole range back as usual, and any
+// sector that did not come back as zero is zeroed explicitly. A target
+// that cannot discard is simply compared.
+//
+// `report` receives the number of sectors compared and written, and
+// whether the discard was issued.
+//
+// Parameters:
+//   flags: kSDFormatDiscardTables, or 0.
+//
+// Return value:
+//   0 on success, EINVAL if rootClusters is out of range, or the errno
+//   value from the failed I/O operation. The fd must be open for reading
+//   and writing.
+
+enum {
+  kSDFormatDiscardTables = 1u << 0,  // Discard the FATs and root first
+};
+
+typedef struct SDFormatIncrementalReport {
+  uint64_t sectorsCompared;  // Sectors read back and compared
+  uint64_t sectorsWritten;   // Sectors that differed and were rewritten
+  bool tablesDiscarded;      // The FATs and root directory were discarded
+} SDFormatIncrementalReport;
+
+int sdFormatReformatIncremental(int fd, uint64_t sectorCount,
+                                uint32_t rootClusters, const char* label,
+                                uint32_t flags,
+                                SDFormatIncrementalReport* report);
+
+// -----------------------------------------------------------------------------
+// FAT16 Formatting
+// -----------------------------------------------------------------------------
+//
+// FAT32 with 32 KB clusters needs a device of at least 2 GiB + 8 MB. Smaller
+// cards (and older flashcarts that only read FAT16) are formatted with these
+// functions instead, called in order: MBR, VBR, tables, root directory.
+// They take the same sectorCount, and share the I/O helpers and the
+// statistics phases of the FAT32 functions.
+//
+// The layout follows docs/fat16_forensic_analysis.md, except that the
+// partition starts at the same 4 MB boundary as the FAT32 layout:
+//   - The VBR, then reserved sectors that pad the metadata to 4 MB (there
+//     is no FSInfo or backup VBR)
+//   - Two 16-bit FATs of at most 256 sectors each
+//   - A fixed 512-entry root directory region after the FATs, ending where
+//     the data region starts, on the 4 MB boundary after the partition's
+//   - The smallest cluster size from 2 KB to 32 KB that keeps the volume
+//     under 65,525 clusters (16 KB on a 1 GB card, 32 KB on a 2 GB card)
+//
+// A device larger than the largest FAT16 volume (65,524 clusters of 32 KB)
+// gets a partition of that size. The padding is not written, and the rest
+// of the metadata is under 300 KB, so a format is four writes.
+//
+// The maintenance functions below read FAT32 volumes only.
+//
+// Return value:
+//   0 on success, EINVAL if sectorCount is below kSDFormatFat16MinSectors,
+//   EOPNOTSUPP if the device's logical sectors are not 512 bytes, or the
+//   errno value from the failed I/O operation.
+
+// kSDFormatFat16MinSectors: The smallest device FAT16 can format (about
+// 16 MB): 4,085 clusters of 2 KB behind the 4 MB alignment gap and the
+// 4 MB of metadata.
+enum { kSDFormatFat16MinSectors = 32724 };
+
+// sdFormatGetFat16Layout
+// ----------------------
+// Reports the layout the FAT16 functions use for `sectorCount`, without
+// any I/O.
+
+typedef struct SDFormatFat16Layout {
+  uint32_t partitionSectors;  // PE_sectorCount, from sector 8192
+  uint32_t clusterBytes;      // 2 KB to 32 KB
+  uint32_t clusterCount;      // 4,085 to 65,524
+  uint32_t fatSectors;        // BPB_fatSize16, per copy
+} SDFormatFat16Layout;
+
+int sdFormatGetFat16Layout(uint64_t sectorCount, SDFormatFat16Layout* layout);
+
+// sdFormatFat16WriteMBR
+// ---------------------
+// Writes an MBR with one FAT16 entry: PE_type 0x06 (0x04 for a volume
+// under 32 MB), starting at sector 8192.
+int sdFormatFat16WriteMBR(int fd, uint64_t sectorCount);
+
+// sdFormatFat16WriteVolumeBootRecord
+// ----------------------------------
+// Writes the FAT16 boot sector at sector 8192: VBR_jmpBoot EB 3C 90, the
+// common BPB with BPB_rootEntryCount = 512 and BPB_fatSize16, and
+// VBR_fsType "FAT16   ".
+int sdFormatFat16WriteVolumeBootRecord(int fd, uint64_t sectorCount,
+                                       const char* label);
+
+// sdFormatFat16WriteTables
+// ------------------------
+// Writes both FATs with one write: FAT[0] = 0xFFF8, FAT[1] = 0xFFFF, and
+// every other entry free.
+int sdFormatFat16WriteTables(int fd, uint64_t sectorCount);
+
+// sdFormatFat16WriteRootDirectory
+// -------------------------------
+// Writes the 32-sector root directory region: the volume label entry,
+// then free entries.
+int sdFormatFat16WriteRootDirectory(int fd, uint64_t sectorCount,
+                                    const char* label);
+
+// -----------------------------------------------------------------------------
+// exFAT Formatting
+// -----------------------------------------------------------------------------
+//
+// Large cards for targets other than the DS (SDXC and SDUC cards in
+// cameras, phones, and PCs) are formatted exFAT with these functions,
+// called in order: MBR, boot regions, FAT, allocation bitmap, up-case
+// table, root directory. They take the same sectorCount, follow the layout
+// profile and sector size like the FAT32 functions, and share their I/O
+// helpers, GPT writer, and statistics phases (the allocation bitmap counts
+// as kSDFormatPhaseFAT, the up-case table as kSDFormatPhaseRootDirectory).
+//
+// The layout follows the Microsoft exFAT specification:
+//   - The partition starts at the profile's alignment boundary (PE_type
+//     0x07, or a GPT basic data partition on a device an MBR cannot
+//     address) and spans the rest of the device
+//   - The Main and Backup Boot Regions (12 sectors each, with checksums)
+//   - One FAT, from partition sector 24
+//   - 128 KB clusters, the cluster heap starting on an alignment boundary
+//   - Clusters 2… hold the allocation bitmap, then one cluster each for the
+//     up-case table and the root directory
+//
+// Every structure is written with one large write, except the FAT and the
+// allocation bitmap of a very large card, so a 1 TB card formats in a
+// handful of writes. The maintenance functions below read FAT32 volumes
+// only.
+//
+// Return value:
+//   0 on success, EINVAL if the device is too small for exFAT (under about
+//   9 MB with the default profile) or the label is not a valid file name,
+//   EOPNOTSUPP for logical sectors other than 512 and 4096 bytes, or the
+//   errno value from the failed I/O operation.
+
+// sdFormatGetExfatLayout
+// ----------------------
+// Reports the layout the exFAT functions use for `sectorCount` on the
+// device behind `fd` (whose sector size it depends on), without any I/O.
+
+typedef struct SDFormatExfatLayout {
+  uint64_t partitionSectors;   // VolumeLength, in logical sectors
+  uint32_t bytesPerSector;     // 512 or 4096
+  uint32_t clusterBytes;       // 128 KB
+  uint32_t clusterCount;       // ClusterCount
+  uint32_t fatSectors;         // FatLength
+  uint32_t clusterHeapOffset;  // ClusterHeapOffset, from the partition start
+} SDFormatExfatLayout;
+
+int sdFormatGetExfatLayout(int fd, uint64_t sectorCount,
+                           SDFormatExfatLayout* layout);
+
+// sdFormatExfatWriteMBR
+// ---------------------
+// Writes an MBR with one exFAT entry (PE_type 0x07), or a GPT on a device
+// with more sectors than an MBR can address, as sdFormatWriteMBR does.
+int sdFormatExfatWriteMBR(int fd, uint64_t sectorCount);
+
+// sdFormatExfatWriteBootRegions
+// -----------------------------
+// Writes the Main and Backup Boot Regions: the boot sector (FileSystemName
+// "EXFAT   "), 8 extended boot sectors, the OEM parameters and reserved
+// sectors, and the boot checksum sector.
+int sdFormatExfatWriteBootRegions(int fd, uint64_t sectorCount);
+
+// sdFormatExfatWriteFat
+// ---------------------
+// Writes the FAT: FatEntry[0] = 0xFFFFFFF8, FatEntry[1] = 0xFFFFFFFF, the
+// chains of the allocation bitmap, up-case table, and root directory, and
+// zeros.
+int sdFormatExfatWriteFat(int fd, uint64_t sectorCount);
+
+// sdFormatExfatWriteAllocationBitmap
+// ----------------------------------
+// Writes the allocation bitmap, in chunks of up to 8 MB, with the bits of
+// the bitmap, up-case table, and root directory clusters set.
+int sdFormatExfatWriteAllocationBitmap(int fd, uint64_t sectorCount);
+
+// sdFormatExfatWriteUpcaseTable
+// -----------------------------
+// Writes the up-case table: the 128 mandatory entries, which map a–z to
+// A–Z.
+int sdFormatExfatWriteUpcaseTable(int fd, uint64_t sectorCount);
+
+// sdFormatExfatWriteRootDirectory
+// -------------------------------
+// Writes the root directory cluster: the volume label entry (up to 11
+// UTF-16 characters, case preserved; none for an empty label), and the
+// allocation bitmap and up-case table entries.
+int sdFormatExfatWriteRootDirectory(int fd, uint64_t sectorCount,
+                                    const char* label);
+
+// -----------------------------------------------------------------------------
+// Layout Profiles
+// -----------------------------------------------------------------------------
+//
+// The formatting functions above lay the volume out for a device family,
+// selected with a process-wide layout profile. The default,
+// kSDFormatProfileR4, is the DS flashcart layout this header describes;
+// the others change the cluster size or the partition alignment:
+//
+//   Profile                  Cluster  Alignment  Reserved  FATs
+//   kSDFormatProfileR4       32 KB    4 MB       32        2
+//   kSDFormatProfileDSi      (alias of kSDFormatProfileR4)
+//   kSDFormatProfile3DS      64 KB    4 MB       32        2
+//   kSDFormatProfileSDXC     32 KB    16 MB      32        2
+//
+// The DSi's system and homebrew loaders read the flashcart layout, so
+// kSDFormatProfileDSi formats exactly as kSDFormatProfileR4 does. It is a
+// constant of its own so that DSi cards can get a layout of their own
+// later without an API change.
+//
+// Every formatting function of one format must run under the same
+// profile (sdFormatBegin takes care of this). The largest root directory
+// is 2 MB in every profile, so with 64 KB clusters rootClusters is at most
+// kSDFormatMaxRootClusters / 2.
+// FAT32 needs at least 65,525 clusters, which takes a larger device with
+// larger clusters: about 2 GB with 32 KB clusters and 4 GB with 64 KB.
+//
+// The maintenance functions read the layout from the volume and work with
+// any profile.
+
+enum {
+  kSDFormatProfileR4 = 0,  // R4, Acekard, and other DS flashcarts
+  kSDFormatProfileDSi,     // The DSi SD slot (same layout as R4)
+  kSDFormatProfile3DS,     // The 3DS SD slot
+  kSDFormatProfileSDXC,    // Generic SDHC and SDXC cards
+  kSDFormatProfileCount,
+};
+
+// The cluster size and the alignment are given in bytes, as they do not
+// depend on the sector size (see "Sector Size" below).
+typedef struct SDFormatLayout {
+  uint32_t clusterBytes;     // Bytes per cluster
+  uint32_t alignmentBytes;   // Where the partition starts
+  uint32_t reservedSectors;  // BPB_reservedSectorCount
+  uint32_t fatCount;         // BPB_fatCount
+  uint32_t maxRootClusters;  // Largest valid rootClusters
+} SDFormatLayout;
+
+// sdFormatSetLayoutProfile
+// ------------------------
+// Selects the process-wide layout profile.
+//
+// Return value:
+//   0 on success, or EINVAL if `profile` is not a kSDFormatProfile.
+int sdFormatSetLayoutProfile(uint32_t profile);
+
+// sdFormatGetLayoutProfile
+// ------------------------
+// The profile now in effect.
+uint32_t sdFormatGetLayoutProfile(void);
+
+// sdFormatGetLayout
+// -----------------
+// Describes the layout of `profile`.
+//
+// Return value:
+//   0 on success, or EINVAL if `profile` is not a kSDFormatProfile.
+int sdFormatGetLayout(uint32_t profile, SDFormatLayout* layout);
+
+// -----------------------------------------------------------------------------
+// Sector Size
+// -----------------------------------------------------------------------------
+//
+// SD cards have 512-byte sectors, but a USB reader or an external SSD may
+// present 4096-byte logical sectors (4Kn), or 512-byte sectors on 4096-byte
+// physical blocks (512e). The formatting functions query the device
+// (BLKSSZGET and BLKPBSZGET on Linux) and lay the volume out for what it
+// reports:
+//
+//   - 4Kn: BPB_bytesPerSector is 4096, and the partition table and the BPB
+//     count 4096-byte sectors. Clusters and the alignment keep their size
+//     in bytes; the reserved region keeps its size in sectors.
+//   - 512e and 4Kn: each FAT is rounded up to whole 4 KB blocks, so every
+//     cluster starts on a block, and every write covers whole blocks (a
+//     512-byte structure is written with the rest of its block).
+//
+// The formatting functions fail with EOPNOTSUPP on a device with another
+// logical size. sectorCount remains the number of 512-byte sectors in
+// every function.
+// An image file has 512-byte sectors unless a size is set here, which is
+// how 4Kn and 512e layouts are produced for testing.
+
+typedef struct SDFormatSectorSize {
+  uint32_t logicalBytes;   // The LBA unit, 512 or 4096
+  uint32_t physicalBytes;  // The unit the device programs
+} SDFormatSectorSize;
+
+// sdFormatSetSectorSize
+// ---------------------
+// Makes every device appear to have sector size `size`, process-wide, or
+// restores detection if `size` is NULL.
+//
+// Return value:
+//   0 on success, or EINVAL if the logical size is not 512 or 4096 or the
+//   physical size is not a power of two from the logical size to 64 KB.
+int sdFormatSetSectorSize(const SDFormatSectorSize* size);
+
+// sdFormatGetSectorSize
+// ---------------------
+// The sector size the formatting functions use for `fd`.
+//
+// Return value:
+//   0 on success. A device that reports no usable size yields 512/512.
+int sdFormatGetSectorSize(int fd, SDFormatSectorSize* size);
+
+// -----------------------------------------------------------------------------
+// Asynchronous Formatting
+// -----------------------------------------------------------------------------
+//
+// sdFormatBegin runs the whole format (the five functions above, then
+// sdFormatWriteSaveFiles if saves are given) on a thread of its own and
+// returns at once. The caller learns about progress and completion through
+// a callback, through a descriptor it can poll, or both, so one event loop
+// thread can drive dozens of formats at the same time. For C++ callers,
+// SDFormatAsync.h wraps an operation as a coroutine awaitable.
+//
+// Events:
+//   One event after each step but the last, with finished = false, then a
+//   final one with finished = true and the result: 0, ECANCELED if the
+//   format was cancelled, or the error of the step that failed (the step
+//   is in `phase`). The steps run in the order the functions are listed.
+//
+// Callback:
+//   Called on the operation's thread, once per event, in order. It must
+//   not block for long: the next step starts only after it returns.
+//
+// Event descriptor:
+//   sdFormatEventFd returns a descriptor that is readable while events are
+//   queued (an eventfd on Linux, the read end of a pipe elsewhere). Every
+//   event is queued whether or not there is a callback. When it becomes
+//   readable, call sdFormatPollEvent until it returns false.
+//
+// The operation copies `parameters`, including the label and the save
+// file names; they need not outlive the call. It also takes the layout
+// profile and the sector size when it begins, so sdFormatSetLayoutProfile
+// and sdFormatSetSectorSize only affect operations begun after them.
+
+typedef struct SDFormatParameters {
+  int fd;                         // Open for reading and writing
+  uint64_t sectorCount;           // Total 512-byte sectors on the device
+  uint32_t rootClusters;          // 1 to kSDFormatMaxRootClusters
+  const char* label;              // Volume label
+  const SDFormatSaveFile* saves;  // Saves to preallocate, or NULL
+  uint32_t saveCount;             // Entries in `saves`
+} SDFormatParameters;
+
+typedef struct SDFormatEvent {
+  uint32_t phase;      // kSDFormatPhase of the step the event is about
+  uint32_t stepsDone;  // Steps completed so far
+  uint32_t stepCount;  // Steps in the whole format (5, or 6 with saves)
+  bool finished;       // The last event; `result` is valid
+  int result;          // 0, ECANCELED, or errno
+} SDFormatEvent;
+
+typedef void (*SDFormatEventCallback)(void* context,
+                                      const SDFormatEvent* event);
+
+typedef struct SDFormatOperation SDFormatOperation;
+
+// sdFormatBegin
+// -------------
+// Validates `parameters` and starts the format. `callback` may be NULL.
+// *operation is set before the callback can first run.
+//
+// Return value:
+//   0 and a handle in *operation on success, EINVAL if rootClusters is
+//   out of range, or the errno value from creating the event descriptor
+//   or the thread.
+int sdFormatBegin(const SDFormatParameters* parameters,
+                  SDFormatEventCallback callback, void* context,
+                  SDFormatOperation** operation);
+
+// sdFormatEventFd
+// ---------------
+// The operation's event descriptor. It is owned by the operation and
+// closed by sdFormatFinish.
+int sdFormatEventFd(SDFormatOperation* operation);
+
+// sdFormatPollEvent
+// -----------------
+// Takes the oldest queued event. Returns false if there is none.
+bool sdFormatPollEvent(SDFormatOperation* operation, SDFormatEvent* event);
+
+// sdFormatCancel
+// --------------
+// Asks the operation to stop before its next step. A step in progress is
+// completed first, so the device is left partly formatted.
+void sdFormatCancel(SDFormatOperation* operation);
+
+// sdFormatFinish
+// --------------
+// Waits for the operation to finish and releases it. Must be called once
+// for every operation, and may be called from the callback of the last
+// event.
+//
+// Return value:
+//   The result of the format (see SDFormatEvent.result).
+int sdFormatFinish(SDFormatOperation* operation);
+
+// -----------------------------------------------------------------------------
+// Device Qualification Functions
+// -----------------------------------------------------------------------------
+//
+// These functions test the card itself before it is formatted. Both are
+// destructive: they overwrite sectors anywhere on the device with test
+// patterns. Each pattern sector carries its own LBA and a per-run random
+// value, so a sector that reads back another sector's pattern (an aliased
+// address on a counterfeit card) is told apart from one that lost its
+// data. Written ranges are synced and evicted from the host's page cache
+// before they are read back, so the data is read from the card.
+
+// sdFormatProbeCapacity
+// ---------------------
+// Finds the real capacity of a card in seconds (an f3probe-style probe).
+//
+// Counterfeit cards report a large capacity but hold much less: writes past
+// the real capacity are dropped, or wrap around onto lower addresses and
+// destroy data already there. Taking the reported sectorCount on trust
+// formats a volume that corrupts itself once it fills up.
+//
+// The probe writes a pattern sector at 256 LBAs spread evenly over
+// [0, sectorCount), in descending order, and reads all of them back. If
+// every sample verifies, the card holds sectorCount sectors. Otherwise the
+// capacity lies between the last good sample and the first bad one, and
+// the probe repeats with 64 samples in that interval (re-reading every
+// earlier sample, which exposes writes that wrapped onto it) until the
+// interval is at most 1 MB wide.
+//
+// Pass report->usableSectors as the sectorCount of the formatting
+// functions, so the volume never extends past storage that holds data.
+//
+// Return value:
+//   0 on success (inspect `report`), EINVAL if sectorCount is 0, or the
+//   errno value from the failed I/O operation. A sample that fails to
+//   read or write counts as bad rather than failing the probe.
+
+typedef struct SDFormatCapacityReport {
+  uint64_t usableSectors;   // Sectors below the first bad sample
+  uint32_t samplesWritten;  // Pattern sectors written in all rounds
+  uint32_t rounds;          // Sampling rounds (1 for a genuine card)
+} SDFormatCapacityReport;
+
+int sdFormatProbeCapacity(int fd, uint64_t sectorCount,
+                          SDFormatCapacityReport* report);
+
+// sdFormatSurfaceScan
+// -------------------
+// Writes and verifies a pattern over every sector of the card.
+//
+// The card is processed in 64 MB regions using 4 MB transfers from
+// page-aligned buffers (usable with O_DIRECT descriptors). Writing and
+// verifying are pipelined: while region N is read back and compared on a
+// second thread, region N + 1 is being written. For each region, the
+// write rate (including the sync) and the read rate are measured, and
+// `callback` (if not NULL) is called with them on the calling thread, in
+// region order, once the region is verified.
+//
+// Return value:
+//   0 on success (inspect `report`; bad sectors do not fail the scan), or
+//   the errno value from the failed I/O operation.
+
+typedef struct SDFormatScanRegion {
+  uint64_t startSector;        // First sector of the region
+  uint64_t sectorCount;        // Sectors in the region
+  uint64_t badSectors;         // Sectors that did not read back correctly
+  uint64_t firstBadSector;     // Lowest bad sector, or UINT64_MAX
+  double writeBytesPerSecond;  // Write throughput, including the sync
+  double readBytesPerSecond;   // Read-back throughput
+} SDFormatScanRegion;
+
+typedef void (*SDFormatScanCallback)(const SDFormatScanRegion* region,
+                                     void* context);
+
+typedef struct SDFormatScanReport {
+  uint64_t sectorsScanned;        // Sectors written and verified
+  uint64_t badSectors;            // Sectors that did not read back correctly
+  uint64_t firstBadSector;        // Lowest bad sector, or UINT64_MAX
+  double minWriteBytesPerSecond;  // Slowest region, write
+  double minReadBytesPerSecond;   // Slowest region, read
+} SDFormatScanReport;
+
+int sdFormatSurfaceScan(int fd, uint64_t sectorCount,
+                        SDFormatScanCallback callback, void* context,
+                        SDFormatScanReport* report);
+
+// -----------------------------------------------------------------------------
+// Write Tuning
+// -----------------------------------------------------------------------------
+//
+// Bulk zero writes (the FAT tables, and zeroing wherever the device cannot
+// zero a range itself) are issued as a number of equal transfers, several
+// of which may be in flight at once. The best transfer size and queue
+// depth differ between card models by a factor of several, so they are a
+// process-wide setting rather than a constant. The default is one 32 KB
+// transfer at a time.
+
+typedef struct SDFormatWriteTuning {
+  uint32_t transferBytes;  // Bytes per write, a multiple of 512, max 16 MB
+  uint32_t queueDepth;     // Writes in flight at once, 1 to 32
+} SDFormatWriteTuning;
+
+// sdFormatSetWriteTuning
+// ----------------------
+// Replaces the process-wide write tuning. Pass NULL to restore the default.
+//
+// Return value:
+//   0 on success, or EINVAL if a field is out of range.
+int sdFormatSetWriteTuning(const SDFormatWriteTuning* tuning);
+
+// sdFormatAutotune
+// ----------------
+// Finds the fastest write tuning for the card and applies it.
+//
+// The function benchmarks transfer sizes from 32 KB to 1 MB at queue
+// depths 1, 2, and 4, zeroing sectors 2048–8191 of the alignment gap (the
+// region between the MBR and the partition, which holds no data) with
+// each combination and syncing, and keeps the best. The region is left
+// zeroed, as the layout expects.
+//
+// On Linux, a card on a native SD host exposes its CID in sysfs. The
+// result is stored in the cache file at `cachePath` (if not NULL), keyed
+// by the model part of the CID (manufacturer, OEM, product name, and
+// revision; the serial number and date are ignored), and a later call for
+// a card of the same model applies the cached tuning without benchmarking.
+// A card without a readable CID (e.g. behind a USB reader) is benchmarked
+// every time.
+//
+// Return value:
+//   0 on success, or the errno value from the failed I/O operation. A
+//   cache file that cannot be written does not fail the call.
+
+typedef struct SDFormatAutotuneReport {
+  SDFormatWriteTuning tuning;  // The tuning now in effect
+  double bytesPerSecond;       // Its measured throughput, 0 if from cache
+  bool fromCache;              // Taken from the cache without benchmarking
+  bool cached;                 // Present in the cache after the call
+} SDFormatAutotuneReport;
+
+int sdFormatAutotune(int fd, const char* cachePath,
+                     SDFormatAutotuneReport* report);
+
+// -----------------------------------------------------------------------------
+// I/O Statistics
+// -----------------------------------------------------------------------------
+//
+// While enabled, the library counts every system call it makes against the
+// device, attributed to the formatting phase that made it, and records the
+// latency of each write in a histogram. Statistics are off by default;
+// disabled, the cost is one relaxed atomic load per call and no clock
+// reads. The counters are process-wide and accumulate until reset; each
+// call is attributed to the phase of the format that made it, however many
+// run at the same time.
+//
+// Phases:
+//   kSDFormatPhaseMBR:           sdFormatWriteMBR
+//   kSDFormatPhaseVBR:           sdFormatWriteVolumeBootRecord (the
+//                                incremental path: the reserved region)
+//   kSDFormatPhaseFSInfo:        sdFormatWriteFSInfo
+//   kSDFormatPhaseFAT:           sdFormatWriteFat32Tables
+//   kSDFormatPhaseRootDirectory: sdFormatWriteRootDirectory
+//   kSDFormatPhaseSaveFiles:     sdFormatWriteSaveFiles
+//   kSDFormatPhaseOther:         every other function
+//
+// Write latency histogram:
+//   Log-linear in microseconds, four buckets per power of two. Buckets 0–3
+//   hold 0–3 µs exactly; above that, a bucket spans a quarter of its power
+//   of two (e.g. 4, 5, 6, 7, then 8–9, 10–11, …), so every bucket is within
+//   25% of its lower bound. The last bucket, which starts at about two
+//   hours, also holds everything longer. sdFormatLatencyBucketMicroseconds
+//   returns a bucket's lower bound.
+
+enum {
+  kSDFormatPhaseOther = 0,
+  kSDFormatPhaseMBR,
+  kSDFormatPhaseVBR,
+  kSDFormatPhaseFSInfo,
+  kSDFormatPhaseFAT,
+  kSDFormatPhaseRootDirectory,
+  kSDFormatPhaseSaveFiles,
+  kSDFormatPhaseCount,
+};
+
+enum { kSDFormatLatencyBuckets = 128 };
+
+typedef struct SDFormatPhaseStats {
+  uint64_t writeCalls;          // pwrite calls
+  uint64_t bytesWritten;        // Bytes they transferred
+  uint64_t readCalls;           // pread calls
+  uint64_t bytesRead;           // Bytes they transferred
+  uint64_t syncCalls;           // fsync calls
+  uint64_t offloadCalls;        // Zero or discard ioctl/fallocate calls
+  uint64_t offloadBytes;        // Bytes they covered without a transfer
+  uint64_t elapsedNanoseconds;  // Wall time spent in the phase
+} SDFormatPhaseStats;
+
+typedef struct SDFormatStats {
+  SDFormatPhaseStats phases[kSDFormatPhaseCount];  // By kSDFormatPhase
+  uint64_t writeLatency[kSDFormatLatencyBuckets];  // Writes per bucket
+} SDFormatStats;
+
+// sdFormatEnableStats
+// -------------------
+// Starts or stops collecting. Counters keep their values while stopped.
+void sdFormatEnableStats(bool enabled);
+
+// sdFormatResetStats
+// ------------------
+// Sets every counter to zero.
+void sdFormatResetStats(void);
+
+// sdFormatGetStats
+// ----------------
+// Copies the counters. Each counter is read atomically, but a snapshot
+// taken while another thread formats is not consistent across counters.
+void sdFormatGetStats(SDFormatStats* stats);
+
+// sdFormatLatencyBucketMicroseconds
+// ---------------------------------
+// Lower bound of histogram bucket `bucket`, in microseconds.
+uint64_t sdFormatLatencyBucketMicroseconds(uint32_t bucket);
+
+// -----------------------------------------------------------------------------
+// I/O Tracing
+// -----------------------------------------------------------------------------
+//
+// A trace is a compact binary record of every system call the library
+// makes against one descriptor: the offset and length of each write, read,
+// sync, and zero or discard command, when it was issued, how long it took,
+// and its result (32 bytes per call; no data). A slow format captured on
+// one station can be replayed, with its original timing, against a loop
+// device or a suspect reader to find out which of them is the bottleneck.
+
+// sdFormatStartTrace
+// ------------------
+// Starts recording the I/O on `fd` to a new file at `path`. Only one trace
+// can be active at a time.
+//
+// Return value:
+//   0 on success, EBUSY if a trace is already active, or the errno value
+//   from creating the trace file.
+int sdFormatStartTrace(int fd, const char* path);
+
+// sdFormatStopTrace
+// -----------------
+// Stops recording, and flushes and closes the trace file.
+//
+// Return value:
+//   0 on success (or if no trace was active), or the errno value from the
+//   first failed write to the trace file. A failed trace is incomplete but
+//   still replays up to the failure.
+int sdFormatStopTrace(void);
+
+// sdFormatReplayTrace
+// -------------------
+// Issues the calls recorded in the trace at `tracePath` against `fd`, one
+// at a time, in the recorded order.
+//
+// By default each call is issued at its recorded time after the start of
+// the replay (or as soon as the previous call returns, if that is later);
+// with kSDFormatReplayFast, back to back. Writes write zeros. Zero and
+// discard commands go through the same selection as the library's own
+// (BLKZEROOUT or fallocate, with a buffered fallback for zeroing), so a
+// trace recorded on a card replays against an image file. Calls that fail
+// are counted and the replay continues.
+//
+// The target is overwritten wherever the original run wrote.
+//
+// Return value:
+//   0 on success (inspect `report`), EINVAL if the file is not a trace,
+//   or the errno value from reading the trace file.
+
+enum {
+  kSDFormatReplayFast = 1u << 0,  // Ignore the recorded timing
+};
+
+typedef struct SDFormatReplayReport {
+  uint64_t operations;             // Calls replayed
+  uint64_t failures;               // Calls that failed during the replay
+  uint64_t bytesWritten;           // Bytes written by replayed writes
+  uint64_t bytesRead;              // Bytes read by replayed reads
+  uint64_t recordedNanoseconds;    // Wall time of the recorded run
+  uint64_t elapsedNanoseconds;     // Wall time of the replay
+  uint64_t recordedIoNanoseconds;  // Time spent in calls, recorded
+  uint64_t replayedIoNanoseconds;  // Time spent in calls, replayed
+} SDFormatReplayReport;
+
+int sdFormatReplayTrace(int fd, const char* tracePath, uint32_t flags,
+                        SDFormatReplayReport* report);
+
+// -----------------------------------------------------------------------------
+// Content Hash Manifest
+// -----------------------------------------------------------------------------
+//
+// While a manifest is active, the library keeps the final contents of every
+// range it writes to one descriptor, and at the end emits their digests: one
+// per written extent, one per structure of the volume, and one for the
+// whole prefix of the device up to the last written byte. A QA station can
+// compare a card's manifest with the reference manifest for its size and
+// profile instead of reading the card back. Zeroed ranges are never
+// buffered or hashed byte by byte: a whole block of zeros has a precomputed
+// digest.
+//
+// Digests use the content hash: a range is cut into 4 MiB blocks from its
+// start, and its digest is H(H(block 0) || H(block 1) || ...), with H
+// SHA-256 or BLAKE3. The same digest can be computed from a read-back of
+// the range.
+//
+// Manifest File
+// -------------
+// Text, one record per line, hex digests:
+//
+//   sdformat-manifest 1 <sha256|blake3>
+//   extent <offset> <length> <structure> <digest>   (by offset)
+//   structure <name> <digest>                       (by structure)
+//   prefix <length> <unrecorded> <digest>
+//
+// An extent is a run of written bytes within one structure. A structure
+// digest is H of the concatenated digests of its extents, in offset order.
+// The structures are those of the FAT32 volume the written MBR (or GPT)
+// and VBR describe, whichever step wrote a range:
+//
+//   mbr     The partition table, the alignment gap, and the backup GPT
+//   vbr     The reserved region but FSInfo: both VBRs and boot sectors
+//   fsinfo  Both FSInfo sectors
+//   fat     Every FAT copy
+//   root    The clusters of the root directory
+//   saves   Every other data cluster
+//
+// Ranges of a FAT16 or exFAT volume are named after the step that wrote
+// them instead, as in the statistics ("other" for none of them).
+// Ranges of the prefix that were never written while the manifest was
+// active (or were discarded) are hashed as zeros and counted as
+// unrecorded, so a manifest with unrecorded bytes only matches a card that
+// was blank there.
+
+enum {
+  kSDFormatHashSHA256 = 0,
+  kSDFormatHashBLAKE3,
+  kSDFormatHashCount,
+};
+
+// sdFormatStartHashManifest
+// -------------------------
+// Starts recording what the library writes to `fd`, to be hashed with
+// `algorithm` (a kSDFormatHash constant). Only one manifest can be active
+// at a time. Data written while recording is kept in memory until the
+// manifest is stopped; zeros are not.
+//
+// Return value:
+//   0 on success, EBUSY if a manifest is already active, or EINVAL if
+//   `algorithm` is not a kSDFormatHash constant.
+int sdFormatStartHashManifest(int fd, uint32_t algorithm);
+
+// sdFormatStopHashManifest
+// ------------------------
+// Stops recording, computes the digests, and writes the manifest to `path`
+// (replaced atomically; NULL writes no file). The prefix is the first
+// `prefixBytes` bytes of the device, or, if `prefixBytes` is 0, everything
+// up to the last byte recorded.
+//
+// Return value:
+//   0 on success (inspect `report`), ENOENT if no manifest was active, or
+//   the errno value from writing the manifest file.
+
+typedef struct SDFormatHashManifestReport {
+  uint64_t prefixBytes;      // Length of the prefix hashed
+  uint64_t unrecordedBytes;  // Bytes of the prefix hashed as assumed zeros
+  uint32_t extentCount;      // Extent lines in the manifest
+  uint32_t algorithm;        // kSDFormatHash constant
+  uint8_t prefixDigest[32];  // Content hash of the prefix
+} SDFormatHashManifestReport;
+
+int sdFormatStopHashManifest(const char* path, uint64_t prefixBytes,
+                             SDFormatHashManifestReport* report);
+
+// -----------------------------------------------------------------------------
+// Simulated Devices
+// -----------------------------------------------------------------------------
+//
+// A simulator attached to a descriptor (normally an image file, which still
+// holds the data) makes every call on it take as long as it would on the
+// modeled device: a fixed overhead per command, a shared transfer rate, a
+// limit on commands in flight, and a read-modify-write penalty for writes
+// that break the sequential filling of an erase block. Write strategies
+// (transfer size, queue depth, offloaded zeroing) can then be compared on
+// any Linux host without the reader and card they are meant for, e.g. by
+// running sdFormatAutotune or a whole format against the simulator.
+//
+// Profile file:
+//   One "key value" pair per line; "#" starts a comment. Missing keys keep
+//   the default in parentheses.
+//
+//     command_us              Overhead of every command, µs (0)
+//     queue_depth             Commands serviced at once (1)
+//     bytes_per_second        Transfer rate, 0 for unlimited (0)
+//     erase_bytes_per_second  Zero-out and discard rate, 0 if the device
+//                             has no such command (0)
+//     erase_block_bytes       Erase block size, 0 for no merges (0)
+//     rmw_us                  Cost of one read-modify-write merge, µs (0)
+
+typedef struct SDFormatDeviceProfile {
+  uint32_t commandMicroseconds;  // Overhead of every command
+  uint32_t queueDepth;           // Commands serviced at once, at least 1
+  uint64_t bytesPerSecond;       // Transfer rate, 0 for unlimited
+  uint64_t eraseBytesPerSecond;  // Zero-out/discard rate, 0 if unsupported
+  uint32_t eraseBlockBytes;      // Erase block size, 0 for no merges
+  uint32_t rmwMicroseconds;      // Cost of one read-modify-write merge
+} SDFormatDeviceProfile;
+
+typedef struct SDFormatSimulatorReport {
+  uint64_t commands;          // Commands serviced
+  uint64_t bytesTransferred;  // Bytes written, read, or erased
+  uint64_t readModifyWrites;  // Erase block merges caused by writes
+  uint64_t busyNanoseconds;   // Sum of modeled command times
+} SDFormatSimulatorReport;
+
+// sdFormatLoadDeviceProfile
+// -------------------------
+// Reads a profile file.
+//
+// Return value:
+//   0 on success, ENOENT if the file cannot be opened, or EINVAL if a line
+//   has an unknown key or no numeric value.
+int sdFormatLoadDeviceProfile(const char* path,
+                              SDFormatDeviceProfile* profile);
+
+// sdFormatAttachSimulator
+// -----------------------
+// Starts simulating `profile` on `fd`. Only one descriptor can be simulated
+// at a time.
+//
+// Return value:
+//   0 on success, EINVAL if profile->queueDepth is 0, or EBUSY if a
+//   simulator is already attached.
+int sdFormatAttachSimulator(int fd, const SDFormatDeviceProfile* profile);
+
+// sdFormatDetachSimulator
+// -----------------------
+// Stops simulating and fills `report` (if not NULL) with the totals since
+// the simulator was attached. With a queue depth of 1, every total is a
+// function of the commands issued alone, so two runs of the same strategy
+// report the same values; wall time is subject to host scheduling.
+//
+// Return value:
+//   0.
+int sdFormatDetachSimulator(SDFormatSimulatorReport* report);
+
+// -----------------------------------------------------------------------------
+// Maintenance Functions
+// -----------------------------------------------------------------------------
+//
+// These functions operate on a volume that is already formatted. Instead of
+// taking a sectorCount, they locate the FAT32 partition through the MBR (or
+// GPT) and read the layout back from its BPB, so they also work on cards
+// formatted by other tools as long as the partition is the first entry.
+//
+// Return value:
+//   0 on success, EINVAL if the on-disk structures do not describe a FAT32
+//   volume with sectors of 512 to 4096 bytes, or the errno value from the
+//   failed I/O operation.
+
+// sdFormatRefreshFSInfo
+// ---------------------
+// Recomputes both FSInfo copies (partition sectors 1 and 7) from the FAT.
+//
+// sdFormatWriteFSInfo only knows the free count of a blank volume. After a
+// card has been used, FSI_freeCount is often stale, and some flashcart
+// kernels respond by walking the whole FAT at boot. This function scans the
+// primary FAT, counts free clusters (entries whose low 28 bits are zero),
+// and rewrites:
+//   - FSI_freeCount: the actual number of free clusters
+//   - FSI_nextFree: the first free cluster, or 0xFFFFFFFF if the volume is full
+//
+// The fd must be open for reading and writing.
+int sdFormatRefreshFSInfo(int fd);
+
+// sdFormatRelabel
+// ---------------
+// Changes the volume label of an existing volume without reformatting it.
+//
+// The label is stored three times: VBR_volumeLabel in the primary VBR and
+// in the backup VBR, and DIR_name of the ATTR_VOLUME_ID entry in the root
+// directory. This function locates the root directory through the BPB,
+// follows its cluster chain to the label entry, and rewrites exactly
+// those three sectors, issued back to back and followed by one sync. The
+// volume ID, the rest of the BPB, and every file are left untouched.
+//
+// The label is converted as by sdFormatWriteVolumeBootRecord (upper case,
+// space-padded or truncated to 11 characters). If the root directory has
+// no label entry, one is created in the first free slot.
+//
+// Return value:
+//   0 on success, EINVAL if the device does not hold a FAT32 volume,
+//   ENOSPC if the root directory has no label entry and no free slot, or
+//   the errno value from the failed I/O operation.
+int sdFormatRelabel(int fd, const char* label);
+
+// sdFormatCheck
+// -------------
+// Read-only consistency check of an existing volume (a "fsck-lite").
+//
+// The check covers four areas and records its findings in `report`:
+//
+//   Boot region: the MBR, the primary VBR, and the backup VBR are decoded
+//   and compared with each other. If the primary VBR is unusable the rest
+//   of the check runs on the geometry from the backup VBR.
+//
+//   FAT mirror: every sector of each additional FAT copy is compared with
+//   the primary FAT. The comparison runs in parallel chunks.
+//
+//   Cluster chains: every chain reachable from the root directory is
+//   walked against a visited-cluster bitmap, detecting chains that loop,
+//   chains that share clusters (cross-links), chains that run into a
+//   free, bad, or out-of-range cluster, and files whose DIR_fileSize does
+//   not match the chain length. Allocated clusters that no chain reaches
+//   are counted as lost.
+//
+//   FSInfo: the primary FSInfo sector is decoded and its free count is
+//   reported next to the count recomputed from the FAT.
+//
+// The FAT is read exactly once per copy. Memory use is one FAT copy plus
+// one bit per cluster (about 17 MB for a 128 GB card with 32 KB clusters).
+//
+// Return value:
+//   0 if the check ran to completion (inspect `report` for problems),
+//   EINVAL if neither VBR describes a FAT32 volume, or the errno value from
+//   a failed read. On error, `report` holds the findings gathered so far.
+
+typedef struct SDFormatCheckReport {
+  // Boot region
+  bool mbrValid;          // MBR (or GPT) with a FAT32 first partition entry
+  bool vbrValid;          // Primary VBR describes a FAT32 volume
+  bool backupVbrValid;    // Backup VBR describes a FAT32 volume
+  bool backupVbrMatches;  // Backup VBR is byte-identical to the primary
+  bool mbrMatchesVbr;     // Partition start and length agree with the BPB
+
+  // FAT region
+  uint32_t clusterCount;        // Data clusters on the volume
+  uint32_t fatMismatchSectors;  // Backup FAT sectors differing from primary
+
+  // Directory tree and cluster chains
+  uint32_t fileCount;          // Files reached from the root directory
+  uint32_t directoryCount;     // Directories, including the root
+  uint32_t brokenChains;       // Chains reaching a free/bad/invalid cluster
+  uint32_t loopedChains;       // Chains that revisit one of their clusters
+  uint32_t crossLinkedChains;  // Chains running into another chain
+  uint32_t sizeMismatches;     // Files whose size disagrees with the chain
+  uint32_t lostClusters;       // Allocated clusters no chain reaches
+
+  // FSInfo
+  bool fsInfoValid;          // All three FSInfo signatures are present
+  uint32_t fsInfoFreeCount;  // FSI_freeCount as stored on disk
+  uint32_t fsInfoNextFree;   // FSI_nextFree as stored on disk
+  uint32_t freeClusters;     // Free clusters counted in the primary FAT
+} SDFormatCheckReport;
+
+int sdFormatCheck(int fd, SDFormatCheckReport* report);
+
+// sdFormatRepair
+// --------------
+// Restores damaged primary structures from their on-disk backups.
+//
+// FAT32 keeps a backup VBR (partition sector 6), a backup FSInfo (sector 7)
+// and a second FAT copy. This function detects a corrupt primary and
+// copies the backup over it, without touching file data:
+//
+//   - VBR: restored when the primary no longer describes a FAT32 volume
+//     and the backup does.
+//   - FSInfo: restored when the primary has lost its signatures and the
+//     backup has them.
+//   - FAT: the two copies are compared in 1 MB chunks. A differing chunk
+//     is restored from the backup when the primary chunk holds more
+//     entries that cannot occur on a healthy volume (e.g. a clobbered
+//     FAT[0]/FAT[1] or links past the last cluster). Other differences are
+//     left alone and counted as unresolved.
+//
+// Each restore is a single large in-file copy (copy_file_range on Linux
+// where the target supports it, otherwise 1 MB read/write transfers). If
+// the FAT or FSInfo changed, both FSInfo copies are recomputed afterwards
+// as by sdFormatRefreshFSInfo.
+//
+// Return value:
+//   0 on success (inspect `report` for what was restored), EINVAL if
+//   neither VBR describes a FAT32 volume, or the errno value from the
+//   failed I/O operation.
+
+typedef struct SDFormatRepairReport {
+  bool vbrRestored;               // Primary VBR rewritten from the backup
+  bool fsInfoRestored;            // Primary FSInfo rewritten from the backup
+  uint32_t fatSectorsRestored;    // Primary FAT sectors taken from the backup
+  uint32_t fatSectorsUnresolved;  // Differing FAT sectors left unchanged
+} SDFormatRepairReport;
+
+int sdFormatRepair(int fd, SDFormatRepairReport* report);
+
+// sdFormatDefragment
+// ------------------
+// Makes fragmented ROM (.NDS) and save (.SAV) files contiguous.
+//
+// Several DS flashcart kernels require contiguous ROMs and saves, and the
+// rest slow down heavily when they are fragmented. This function walks the
+// directory tree, plans a minimal set of moves against the free space in
+// the FAT, and relocates each fragmented file:
+//
+//   - If the clusters right after a file's first extent are free, only the
+//     rest of the file moves there (extend in place).
+//   - Otherwise the whole file moves to the smallest free run that holds it.
+//   - Files for which no free run is large enough are skipped.
+//
+// Data is copied in large batched transfers. The FAT and directory updates
+// are crash-ordered (data, new chain, switch-over, free old chain, each
+// followed by fsync), so an interruption leaves every file intact and at
+// worst some lost clusters. FSInfo is recomputed at the end.
+//
+// The volume should pass sdFormatCheck before it is defragmented: chains
+// are trusted as found, and a cross-linked file would be moved along with
+// the file it shares clusters with.
+//
+// Parameters:
+//   flags: kSDFormatDefragAllFiles to process every regular file instead
+//          of only .NDS and .SAV files, or 0.
+//
+// Return value:
+//   0 on success (inspect `report`), EINVAL if the device does not hold a
+//   FAT32 volume, or the errno value from the failed I/O operation.
+
+enum {
+  kSDFormatDefragAllFiles = 1u << 0,  // Not just .NDS and .SAV files
+};
+
+typedef struct SDFormatDefragReport {
+  uint32_t filesExamined;      // Candidate files found in the tree
+  uint32_t filesFragmented;    // Candidates that were not contiguous
+  uint32_t filesDefragmented;  // Files made contiguous
+  uint32_t filesSkipped;       // Broken chain, or no free run large enough
+  uint32_t clustersMoved;      // Clusters copied to a new location
+} SDFormatDefragReport;
+
+int sdFormatDefragment(int fd, uint32_t flags, SDFormatDefragReport* report);
+
+// sdFormatSortDirectories
+// -----------------------
+// Rewrites every directory with its entries sorted and packed.
+//
+// DS flashcart menus list a folder in on-disk order after sorting it on
+// the ARM9, every time the folder is opened. With hundreds of ROMs that
+// takes seconds. This function puts each directory in display order once:
+//
+//   - Entries are sorted by case-folded long name (the short name where a
+//     file has no long name). The volume label and the "." and ".."
+//     entries stay first.
+//   - Each long name set stays immediately before its short entry.
+//   - Deleted entries and orphaned long name entries are removed, so the
+//     entries are packed at the start of the directory. Clusters at the
+//     end of a directory's chain that are no longer needed are freed, so
+//     a directory of up to 1024 slots becomes a single 32 KB cluster.
+//
+// Directories already in this form are not rewritten. Each directory is
+// written back and synced before its chain is shortened in every FAT copy,
+// and FSInfo is recomputed if clusters were freed. Only the directory
+// clusters themselves are rewritten; an interruption while a multi-cluster
+// directory is being written can leave that directory partly reordered.
+//
+// Return value:
+//   0 on success (inspect `report`), EINVAL if the device does not hold a
+//   FAT32 volume, or the errno value from the failed I/O operation.
+
+typedef struct SDFormatSortReport {
+  uint32_t directoriesExamined;   // Directories found, including the root
+  uint32_t directoriesRewritten;  // Directories whose contents changed
+  uint32_t directoriesSkipped;    // Directories with a broken chain
+  uint32_t entriesDropped;        // Deleted and orphaned slots removed
+  uint32_t clustersFreed;         // Directory clusters released
+} SDFormatSortReport;
+
+int sdFormatSortDirectories(int fd, SDFormatSortReport* report);
+
+// sdFormatWipeFreeClusters
+// ------------------------
+// Zeroes (or discards) every free cluster, throttled and resumable.
+//
+// Formatting writes only metadata, so the data of the card's previous
+// owner is still in the free clusters. This function clears them after
+// the fact, so a reprovisioning station can format a card in seconds and
+// leave the wipe to an idle reader. It reads the primary FAT once and
+// clears every cluster that is free at that point, from the first data
+// cluster upward, in ranges of up to 8 MB (BLKZEROOUT, or BLKDISCARD with
+// kSDFormatWipeDiscard, on a Linux block device; the buffered zero path
+// elsewhere). The root directory and any save files are allocated and are
+// not touched. The volume must not be written to during the wipe.
+//
+// Options:
+//   flags:          kSDFormatWipeDiscard to discard rather than zero. A
+//                   discarded range reads back as whatever the card
+//                   returns for unmapped blocks. Targets that cannot
+//                   discard are zeroed instead.
+//   bytesPerSecond: Average rate limit, or 0 for none. The wipe sleeps
+//                   between ranges to stay under it, leaving bandwidth to
+//                   other cards on the same host.
+//   progressPath:   File that records how far the wipe got, or NULL. The
+//                   file is rewritten (atomically, after a device sync)
+//                   every 256 MB and at the end. A later call with the
+//                   same file continues from there, provided the file
+//                   names this volume (same volume ID and cluster count).
+//
+// Return value:
+//   0 on success (inspect `report`), EINVAL if the device does not hold a
+//   FAT32 volume, or the errno value from the failed I/O operation.
+
+enum {
+  kSDFormatWipeDiscard = 1u << 0,  // Discard instead of writing zeros
+};
+
+typedef struct SDFormatWipeOptions {
+  uint32_t flags;            // kSDFormatWipeDiscard, or 0
+  uint64_t bytesPerSecond;   // Rate limit, 0 for unthrottled
+  const char* progressPath;  // Checkpoint file, or NULL
+} SDFormatWipeOptions;
+
+typedef struct SDFormatWipeReport {
+  uint32_t clustersFree;      // Free clusters on the volume
+  uint32_t clustersWiped;     // Clusters cleared by this call
+  uint32_t resumedAtCluster;  // Cluster resumed from, 0 for a fresh start
+} SDFormatWipeReport;
+
+int sdFormatWipeFreeClusters(int fd, const SDFormatWipeOptions* options,
+                             SDFormatWipeReport* report);
 
 #ifdef __cplusplus
 }
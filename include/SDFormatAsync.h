@@ -0,0 +1,159 @@
+// =============================================================================
+// SDFormatAsync.h
+// =============================================================================
+//
+// Header-only C++20 coroutine wrapper over the asynchronous formatting
+// functions of SDFormat.h.
+//
+//   sdformat::FormatTask format(sdformat::Format::Resumer post) {
+//     SDFormatParameters parameters = {fd, sectorCount, 1, "NDS", nullptr, 0};
+//     int err = co_await sdformat::Format(parameters, onProgress, post);
+//     ...
+//   }
+//
+// Awaiting a Format starts the operation with sdFormatBegin and suspends
+// the coroutine until the last event. The progress function is called for
+// every event before it, on the operation's thread. The coroutine is
+// resumed through the Resumer, which receives the coroutine handle on the
+// operation's thread: an event loop passes a function that posts the
+// handle to the loop, so that every coroutine runs on the loop thread and
+// one thread drives any number of formats. Without a Resumer the coroutine
+// resumes directly on the operation's thread. A format that fails to start,
+// or finishes before sdFormatBegin has returned, does not suspend at all.
+//
+// The header declares no coroutine return type of its own; any task type
+// whose promise allows co_await works (FormatTask above is the caller's).
+// It is ignored outside C++, so the C API's module map may include it.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_ASYNC_H
+#define SD_FORMAT_ASYNC_H
+
+#ifdef __cplusplus
+
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#include "SDFormat.h"
+
+namespace sdformat {
+
+// Format
+// ------
+// Awaitable format operation. co_await yields the result: 0, ECANCELED, or
+// errno. A Format can be awaited once, and must be (the operation is
+// started by co_await, and released when it finishes).
+
+class Format {
+ public:
+  using Progress = std::function<void(const SDFormatEvent&)>;
+  using Resumer = std::function<void(std::coroutine_handle<>)>;
+
+  explicit Format(const SDFormatParameters& parameters,
+                  Progress progress = {}, Resumer resumer = {})
+      : parameters_(parameters),
+        progress_(std::move(progress)),
+        resumer_(std::move(resumer)) {}
+
+  Format(const Format&) = delete;
+  Format& operator=(const Format&) = delete;
+
+  // cancel
+  // ------
+  // Asks the format to stop before its next step (sdFormatCancel). May be
+  // called from any thread until the coroutine resumes, including before
+  // the format has started.
+  void cancel() {
+    std::lock_guard lock(mutex_);
+    cancelled_ = true;
+    if (operation_ != nullptr) {
+      sdFormatCancel(operation_);
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  // Starts the operation. If it cannot start, resumes at once with the
+  // error. The final event may be delivered before sdFormatBegin returns;
+  // it then leaves the handle to be released here, and the coroutine
+  // resumes at once too. Otherwise the handle is published, and once the
+  // lock is released the final event may resume the coroutine (destroying
+  // this Format) at any time.
+  bool await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    SDFormatOperation* operation;
+    const int err =
+        sdFormatBegin(&parameters_, &Format::onEvent, this, &operation);
+    if (err != 0) {
+      result_ = err;
+      return false;
+    }
+    std::lock_guard lock(mutex_);
+    if (finished_) {
+      result_ = sdFormatFinish(operation);
+      return false;
+    }
+    operation_ = operation;
+    if (cancelled_) {
+      sdFormatCancel(operation);
+    }
+    return true;
+  }
+
+  int await_resume() const noexcept { return result_; }
+
+ private:
+  // onEvent
+  // -------
+  // The C callback. The last event takes the handle under the lock, so a
+  // concurrent cancel() cannot use it once released, and releases it
+  // (allowed from its own callback) before the coroutine is resumed, since
+  // resuming may destroy this Format. Without a handle yet, await_suspend
+  // releases it and resumes the coroutine.
+  static void onEvent(void* context, const SDFormatEvent* event) {
+    auto* self = static_cast<Format*>(context);
+    if (!event->finished) {
+      if (self->progress_) {
+        self->progress_(*event);
+      }
+      return;
+    }
+    SDFormatOperation* operation;
+    {
+      std::lock_guard lock(self->mutex_);
+      self->finished_ = true;
+      operation = std::exchange(self->operation_, nullptr);
+    }
+    if (operation == nullptr) {
+      return;
+    }
+    self->result_ = sdFormatFinish(operation);
+    if (self->resumer_) {
+      self->resumer_(self->handle_);
+    } else {
+      self->handle_.resume();
+    }
+  }
+
+  SDFormatParameters parameters_;
+  Progress progress_;
+  Resumer resumer_;
+  std::coroutine_handle<> handle_;
+  int result_ = 0;
+
+  // Guards the handle, from when sdFormatBegin returns until the final
+  // event releases it, and the flags
+  std::mutex mutex_;
+  SDFormatOperation* operation_ = nullptr;
+  bool cancelled_ = false;
+  bool finished_ = false;
+};
+
+}  // namespace sdformat
+
+#endif  // __cplusplus
+
+#endif  // SD_FORMAT_ASYNC_H
@@ -0,0 +1,397 @@
+// =============================================================================
+// ContentHash.cpp
+// =============================================================================
+//
+// Implementation of SHA-256, BLAKE3, and the block-list content hash used by
+// the hash manifest. Both hash functions are portable C++ (no SIMD or SHA
+// extensions), which is plenty for metadata: zero blocks, the bulk of every
+// range, are never hashed byte by byte.
+//
+// References:
+//   - FIPS 180-4, Secure Hash Standard, §6.2
+//   - The BLAKE3 specification (2021), §2 and its reference implementation
+//
+// =============================================================================
+
+#include "ContentHash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "SDFormat.h"
+
+// loadBigEndian / loadLittleEndian
+// --------------------------------
+
+static uint32_t loadBigEndian(const std::byte* bytes) {
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  return std::byteswap(value);
+}
+
+static uint32_t loadLittleEndian(const std::byte* bytes) {
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+// =============================================================================
+// SHA-256
+// =============================================================================
+
+static constexpr std::array<uint32_t, 8> kSha256InitialState = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static constexpr std::array<uint32_t, 64> kSha256RoundConstants = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+    0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+    0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+    0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+    0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+    0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+// sha256Compress
+// --------------
+// Folds one 64-byte block into `state`.
+
+static void sha256Compress(std::array<uint32_t, 8>& state,
+                           const std::byte* block) {
+  std::array<uint32_t, 64> w;
+  for (size_t i = 0; i < 16; i++) {
+    w[i] = loadBigEndian(block + 4 * i);
+  }
+  for (size_t i = 16; i < 64; i++) {
+    const uint32_t s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^
+                        (w[i - 15] >> 3);
+    const uint32_t s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^
+                        (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  auto [a, b, c, d, e, f, g, h] = state;
+  for (size_t i = 0; i < 64; i++) {
+    const uint32_t s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+    const uint32_t choice = (e & f) ^ (~e & g);
+    const uint32_t t1 = h + s1 + choice + kSha256RoundConstants[i] + w[i];
+    const uint32_t s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+    const uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  const std::array<uint32_t, 8> result = {a, b, c, d, e, f, g, h};
+  for (size_t i = 0; i < 8; i++) {
+    state[i] += result[i];
+  }
+}
+
+Sha256::Sha256() : state(kSha256InitialState), block{} {}
+
+void Sha256::update(std::span<const std::byte> data) {
+  totalBytes += data.size();
+  if (blockLength > 0) {
+    const size_t take = std::min(data.size(), block.size() - blockLength);
+    std::copy_n(data.begin(), take, block.begin() + blockLength);
+    blockLength += take;
+    data = data.subspan(take);
+    if (blockLength < block.size()) {
+      return;
+    }
+    sha256Compress(state, block.data());
+    blockLength = 0;
+  }
+  for (; data.size() >= block.size(); data = data.subspan(block.size())) {
+    sha256Compress(state, data.data());
+  }
+  std::copy(data.begin(), data.end(), block.begin());
+  blockLength = data.size();
+}
+
+Digest Sha256::finish() {
+  // Padding: 0x80, zeros, and the message length in bits (big-endian)
+  const uint64_t bits = totalBytes * 8;
+  std::array<std::byte, 72> padding{};
+  padding[0] = std::byte{0x80};
+  const size_t zeros = (119 - blockLength) % 64;
+  for (size_t i = 0; i < 8; i++) {
+    padding[1 + zeros + i] = static_cast<std::byte>(bits >> (56 - 8 * i));
+  }
+  update(std::span{padding}.first(1 + zeros + 8));
+
+  Digest digest;
+  for (size_t i = 0; i < 8; i++) {
+    const uint32_t word = std::byteswap(state[i]);
+    std::memcpy(&digest[4 * i], &word, sizeof(word));
+  }
+  return digest;
+}
+
+// =============================================================================
+// BLAKE3
+// =============================================================================
+
+static constexpr std::array<uint32_t, 8> kBlake3Iv = kSha256InitialState;
+
+static constexpr std::array<size_t, 16> kBlake3Permutation = {
+    2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8,
+};
+
+// kBlake3ChunkBytes: Bytes per chunk, the leaves of the tree.
+static constexpr uint64_t kBlake3ChunkBytes = 1024;
+
+// Domain flags of the compression function.
+static constexpr uint32_t kBlake3ChunkStart = 1 << 0;
+static constexpr uint32_t kBlake3ChunkEnd = 1 << 1;
+static constexpr uint32_t kBlake3Parent = 1 << 2;
+static constexpr uint32_t kBlake3Root = 1 << 3;
+
+using Blake3Words = std::array<uint32_t, 8>;
+
+// blake3Compress
+// --------------
+// The compression function, truncated to the 8 words hash mode uses.
+
+static Blake3Words blake3Compress(const Blake3Words& chainingValue,
+                                  const std::byte* block, uint64_t counter,
+                                  uint32_t blockLength, uint32_t flags) {
+  std::array<uint32_t, 16> m;
+  for (size_t i = 0; i < 16; i++) {
+    m[i] = loadLittleEndian(block + 4 * i);
+  }
+  std::array<uint32_t, 16> v = {
+      chainingValue[0], chainingValue[1], chainingValue[2], chainingValue[3],
+      chainingValue[4], chainingValue[5], chainingValue[6], chainingValue[7],
+      kBlake3Iv[0],     kBlake3Iv[1],     kBlake3Iv[2],     kBlake3Iv[3],
+      static_cast<uint32_t>(counter),   static_cast<uint32_t>(counter >> 32),
+      blockLength,      flags,
+  };
+
+  auto g = [&v](size_t a, size_t b, size_t c, size_t d, uint32_t x,
+                uint32_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = std::rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = std::rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = std::rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = std::rotr(v[b] ^ v[c], 7);
+  };
+  for (int round = 0; round < 7; round++) {
+    g(0, 4, 8, 12, m[0], m[1]);
+    g(1, 5, 9, 13, m[2], m[3]);
+    g(2, 6, 10, 14, m[4], m[5]);
+    g(3, 7, 11, 15, m[6], m[7]);
+    g(0, 5, 10, 15, m[8], m[9]);
+    g(1, 6, 11, 12, m[10], m[11]);
+    g(2, 7, 8, 13, m[12], m[13]);
+    g(3, 4, 9, 14, m[14], m[15]);
+    std::array<uint32_t, 16> permuted;
+    for (size_t i = 0; i < 16; i++) {
+      permuted[i] = m[kBlake3Permutation[i]];
+    }
+    m = permuted;
+  }
+
+  Blake3Words result;
+  for (size_t i = 0; i < 8; i++) {
+    result[i] = v[i] ^ v[i + 8];
+  }
+  return result;
+}
+
+// blake3Parent
+// ------------
+// Compresses two child chaining values into their parent's.
+
+static Blake3Words blake3Parent(const Blake3Words& left,
+                                const Blake3Words& right, uint32_t flags) {
+  std::array<std::byte, 64> block;
+  std::memcpy(block.data(), left.data(), 32);
+  std::memcpy(block.data() + 32, right.data(), 32);
+  return blake3Compress(kBlake3Iv, block.data(), 0, 64,
+                        kBlake3Parent | flags);
+}
+
+Blake3::Blake3() : chunkValue(kBlake3Iv), block{}, stack{} {}
+
+// update
+// ------
+// A full chunk is finished only once more input arrives, since the last
+// chunk of the input is compressed differently (as the root, if it is the
+// only one). Likewise for the last block of a chunk.
+
+void Blake3::update(std::span<const std::byte> data) {
+  while (!data.empty()) {
+    const uint64_t chunkLength = blocksCompressed * block.size() + blockLength;
+    if (chunkLength == kBlake3ChunkBytes) {
+      // Finish the chunk and merge every completed subtree
+      Blake3Words value = blake3Compress(
+          chunkValue, block.data(), chunkCounter, 64,
+          kBlake3ChunkEnd | (blocksCompressed == 0 ? kBlake3ChunkStart : 0));
+      chunkCounter++;
+      for (uint64_t total = chunkCounter; (total & 1) == 0; total >>= 1) {
+        value = blake3Parent(stack[--stackSize], value, 0);
+      }
+      stack[stackSize++] = value;
+      chunkValue = kBlake3Iv;
+      blocksCompressed = 0;
+      blockLength = 0;
+    }
+
+    if (blockLength == block.size()) {
+      chunkValue = blake3Compress(
+          chunkValue, block.data(), chunkCounter, 64,
+          blocksCompressed == 0 ? kBlake3ChunkStart : 0);
+      blocksCompressed++;
+      blockLength = 0;
+    }
+    const size_t take = std::min(data.size(), block.size() - blockLength);
+    std::copy_n(data.begin(), take, block.begin() + blockLength);
+    blockLength += take;
+    data = data.subspan(take);
+  }
+}
+
+Digest Blake3::finish() {
+  std::fill(block.begin() + blockLength, block.end(), std::byte{0});
+  const uint32_t chunkFlags =
+      kBlake3ChunkEnd | (blocksCompressed == 0 ? kBlake3ChunkStart : 0);
+  Blake3Words value;
+  if (stackSize == 0) {
+    value = blake3Compress(chunkValue, block.data(), chunkCounter,
+                           static_cast<uint32_t>(blockLength),
+                           chunkFlags | kBlake3Root);
+  } else {
+    value = blake3Compress(chunkValue, block.data(), chunkCounter,
+                           static_cast<uint32_t>(blockLength), chunkFlags);
+    for (size_t level = stackSize; level-- > 0;) {
+      value = blake3Parent(stack[level], value, level == 0 ? kBlake3Root : 0);
+    }
+  }
+
+  Digest digest;
+  std::memcpy(digest.data(), value.data(), digest.size());
+  return digest;
+}
+
+// =============================================================================
+// Hasher
+// =============================================================================
+
+Hasher::Hasher(uint32_t algorithm)
+    : state(algorithm == kSDFormatHashBLAKE3
+                ? std::variant<Sha256, Blake3>{Blake3{}}
+                : std::variant<Sha256, Blake3>{Sha256{}}) {}
+
+void Hasher::update(std::span<const std::byte> data) {
+  std::visit([&](auto& hash) { hash.update(data); }, state);
+}
+
+Digest Hasher::finish() {
+  return std::visit([](auto& hash) { return hash.finish(); }, state);
+}
+
+// =============================================================================
+// Content Hash
+// =============================================================================
+
+// zeroBytes
+// ---------
+// A small run of zeros to feed partial zero blocks from; small enough to
+// stay in the cache while it is hashed over and over.
+
+static std::span<const std::byte> zeroBytes() {
+  static constexpr std::array<std::byte, 64 << 10> kZeros{};
+  return kZeros;
+}
+
+// hashZeroBlock
+// -------------
+
+static Digest hashZeroBlock(uint32_t algorithm) {
+  Hasher hasher(algorithm);
+  for (uint64_t done = 0; done < kContentBlockBytes;
+       done += zeroBytes().size()) {
+    hasher.update(zeroBytes());
+  }
+  return hasher.finish();
+}
+
+// zeroBlockDigest
+// ---------------
+// Each digest is computed on first use, so a manifest pays only for the
+// algorithm it uses.
+
+const Digest& zeroBlockDigest(uint32_t algorithm) {
+  if (algorithm == kSDFormatHashBLAKE3) {
+    static const Digest kBlake3Digest = hashZeroBlock(kSDFormatHashBLAKE3);
+    return kBlake3Digest;
+  }
+  static const Digest kSha256Digest = hashZeroBlock(kSDFormatHashSHA256);
+  return kSha256Digest;
+}
+
+ContentHasher::ContentHasher(uint32_t algorithm)
+    : algorithm(algorithm), list(algorithm), block(algorithm) {}
+
+// closeBlock
+// ----------
+// Appends the digest of the current block to the list.
+
+static void closeBlock(ContentHasher& hasher, const Digest& digest) {
+  hasher.list.update(std::as_bytes(std::span{digest}));
+  hasher.block = Hasher(hasher.algorithm);
+  hasher.blockLength = 0;
+}
+
+void ContentHasher::update(std::span<const std::byte> data) {
+  while (!data.empty()) {
+    const auto take = static_cast<size_t>(
+        std::min<uint64_t>(data.size(), kContentBlockBytes - blockLength));
+    block.update(data.first(take));
+    blockLength += take;
+    data = data.subspan(take);
+    if (blockLength == kContentBlockBytes) {
+      closeBlock(*this, block.finish());
+    }
+  }
+}
+
+void ContentHasher::updateZeros(uint64_t length) {
+  while (length > 0) {
+    if (blockLength == 0 && length >= kContentBlockBytes) {
+      list.update(std::as_bytes(std::span{zeroBlockDigest(algorithm)}));
+      length -= kContentBlockBytes;
+      continue;
+    }
+    // Stop at the end of the block, so the next whole block is aligned
+    const auto take = static_cast<size_t>(
+        std::min({length, uint64_t{zeroBytes().size()},
+                  kContentBlockBytes - blockLength}));
+    update(zeroBytes().first(take));
+    length -= take;
+  }
+}
+
+Digest ContentHasher::finish() {
+  if (blockLength > 0) {
+    closeBlock(*this, block.finish());
+  }
+  return list.finish();
+}
@@ -0,0 +1,107 @@
+// =============================================================================
+// ContentHash.h
+// =============================================================================
+//
+// Internal header: the hash functions behind sdFormatStartHashManifest.
+// Not part of the public API.
+//
+// Content Hash
+// ------------
+// A range of bytes is hashed as a list of blocks: the range is cut into
+// kContentBlockBytes blocks from its start (the last one may be shorter),
+// each block is hashed, and the content hash is the hash of the block
+// digests concatenated:
+//
+//   contentHash(range) = H(H(block 0) ‖ H(block 1) ‖ … ‖ H(block n-1))
+//
+// where H is SHA-256 or BLAKE3 (32-byte output). A block of zeros has the
+// same digest wherever it is, so a zeroed range costs one precomputed
+// digest per block instead of hashing its bytes. The same value can be
+// computed from a read-back of the range, e.g. with a few lines of Python.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_CONTENT_HASH_H
+#define SD_FORMAT_CONTENT_HASH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <variant>
+
+// kContentBlockBytes: Block size of the content hash (4 MiB).
+inline constexpr uint64_t kContentBlockBytes = 4 << 20;
+
+// Digest: A SHA-256 or BLAKE3 digest.
+using Digest = std::array<uint8_t, 32>;
+
+// Sha256
+// ------
+// SHA-256 (FIPS 180-4).
+struct Sha256 {
+  Sha256();
+  void update(std::span<const std::byte> data);
+  Digest finish();
+
+  std::array<uint32_t, 8> state;
+  std::array<std::byte, 64> block;
+  size_t blockLength = 0;
+  uint64_t totalBytes = 0;
+};
+
+// Blake3
+// ------
+// BLAKE3 in hash mode with the default 32-byte output, without SIMD: one
+// chunk (1 KB) at a time, and a stack of chaining values for the tree.
+struct Blake3 {
+  Blake3();
+  void update(std::span<const std::byte> data);
+  Digest finish();
+
+  // The chunk being hashed
+  std::array<uint32_t, 8> chunkValue;
+  std::array<std::byte, 64> block;
+  size_t blockLength = 0;
+  uint32_t blocksCompressed = 0;
+  uint64_t chunkCounter = 0;
+
+  // Chaining values of completed subtrees, at most one per level
+  std::array<std::array<uint32_t, 8>, 54> stack;
+  size_t stackSize = 0;
+};
+
+// Hasher
+// ------
+// H for one of the kSDFormatHash algorithms.
+struct Hasher {
+  explicit Hasher(uint32_t algorithm);
+  void update(std::span<const std::byte> data);
+  Digest finish();
+
+  std::variant<Sha256, Blake3> state;
+};
+
+// ContentHasher
+// -------------
+// Computes the content hash of a range fed to it front to back, as bytes
+// or as runs of zeros. Whole zero blocks use the precomputed digest of
+// kContentBlockBytes zeros (see zeroBlockDigest).
+struct ContentHasher {
+  explicit ContentHasher(uint32_t algorithm);
+  void update(std::span<const std::byte> data);
+  void updateZeros(uint64_t length);
+  Digest finish();
+
+  uint32_t algorithm;
+  Hasher list;
+  Hasher block;
+  uint64_t blockLength = 0;
+};
+
+// zeroBlockDigest
+// ---------------
+// H of kContentBlockBytes zeros, computed once per algorithm.
+const Digest& zeroBlockDigest(uint32_t algorithm);
+
+#endif  // SD_FORMAT_CONTENT_HASH_H
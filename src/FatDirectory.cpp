@@ -0,0 +1,329 @@
+// =============================================================================
+// FatDirectory.cpp
+// =============================================================================
+//
+// Directory entry construction: UTF-8 → UTF-16 name decoding, short name
+// (basis name) generation, and long name entry encoding. See FatDirectory.h.
+//
+// The short name rules follow the "Basis-Name Generation Algorithm" and
+// "Numeric-Tail Generation Algorithm" sections of the Microsoft FAT
+// specification (docs/microsoft_fat_specification.md).
+//
+// =============================================================================
+
+#include "FatDirectory.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <bit>
+#include <ctime>
+#include <string>
+
+// =============================================================================
+// Names
+// =============================================================================
+
+// currentFatTimestamp
+// -------------------
+// Date: bits 0-4 day, 5-8 month, 9-15 years since 1980.
+// Time: bits 0-4 seconds/2, 5-10 minutes, 11-15 hours.
+
+FatTimestamp currentFatTimestamp() {
+  time_t now = time(nullptr);
+  struct tm local {};
+  localtime_r(&now, &local);
+
+  int year = std::clamp(local.tm_year + 1900 - 1980, 0, 127);
+  return FatTimestamp{
+      .date = static_cast<uint16_t>((year << 9) | ((local.tm_mon + 1) << 5) |
+                                    local.tm_mday),
+      .time = static_cast<uint16_t>((local.tm_hour << 11) |
+                                    (local.tm_min << 5) | (local.tm_sec / 2)),
+  };
+}
+
+// isLongNameChar
+// --------------
+// Characters other than these are allowed in long names.
+
+static bool isLongNameChar(char32_t c) {
+  return c >= 0x20 && std::u32string_view{U"\"*/:<>?\\|"}.find(c) ==
+                          std::u32string_view::npos;
+}
+
+// decodeLongName
+// --------------
+// Strict UTF-8 decoder: rejects overlong forms, surrogates, and code points
+// above U+10FFFF. Supplementary characters become surrogate pairs.
+
+int decodeLongName(std::string_view utf8, std::u16string& name) {
+  name.clear();
+
+  for (size_t i = 0; i < utf8.size();) {
+    auto lead = static_cast<unsigned char>(utf8[i]);
+    size_t length = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+    if ((lead >= 0x80 && lead < 0xC2) || lead > 0xF4 ||
+        i + length > utf8.size()) {
+      return EINVAL;
+    }
+
+    char32_t c = length == 1 ? lead : lead & (0x7F >> length);
+    for (size_t k = 1; k < length; k++) {
+      auto next = static_cast<unsigned char>(utf8[i + k]);
+      if ((next & 0xC0) != 0x80) {
+        return EINVAL;
+      }
+      c = (c << 6) | (next & 0x3F);
+    }
+    static constexpr char32_t kMinimum[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (c < kMinimum[length] || c > 0x10FFFF ||
+        (c >= 0xD800 && c <= 0xDFFF) || !isLongNameChar(c)) {
+      return EINVAL;
+    }
+
+    if (c >= 0x10000) {
+      name.push_back(static_cast<char16_t>(0xD800 + ((c - 0x10000) >> 10)));
+      name.push_back(static_cast<char16_t>(0xDC00 + ((c - 0x10000) & 0x3FF)));
+    } else {
+      name.push_back(static_cast<char16_t>(c));
+    }
+    i += length;
+  }
+
+  // Trailing spaces and periods are not part of a long name
+  while (!name.empty() && (name.back() == u' ' || name.back() == u'.')) {
+    name.pop_back();
+  }
+  if (name.empty() || name.size() > kLongNameMaxChars) {
+    return EINVAL;
+  }
+  return 0;
+}
+
+// foldLongName
+// ------------
+
+std::u16string foldLongName(std::u16string_view name) {
+  std::u16string folded{name};
+  for (char16_t& c : folded) {
+    if (c >= u'a' && c <= u'z') {
+      c = static_cast<char16_t>(c - u'a' + u'A');
+    }
+  }
+  return folded;
+}
+
+// sortDirectoryRecords
+// --------------------
+// Stable, so records whose names fold to the same key keep their order.
+
+void sortDirectoryRecords(std::vector<DirectoryRecord>& records) {
+  std::stable_sort(records.begin(), records.end(),
+                   [](const DirectoryRecord& a, const DirectoryRecord& b) {
+                     return foldLongName(a.longName) <
+                            foldLongName(b.longName);
+                   });
+}
+
+// shortNameChecksum
+// -----------------
+
+uint8_t shortNameChecksum(const ShortName& name) {
+  uint8_t sum = 0;
+  for (char c : name) {
+    sum = static_cast<uint8_t>(((sum & 1) << 7) + (sum >> 1) +
+                               static_cast<uint8_t>(c));
+  }
+  return sum;
+}
+
+// =============================================================================
+// Short Names
+// =============================================================================
+
+// BasisName
+// ---------
+// The short name derived from a long name before uniqueness is considered.
+
+struct BasisName {
+  ShortName name;
+
+  // Characters used in the 8-character base portion.
+  size_t baseLength;
+
+  // A character had to be replaced by '_'.
+  bool lossy;
+
+  // The long name did not fit 8.3 (too long, spaces, extra or leading
+  // periods), so characters were dropped.
+  bool truncated;
+
+  // The long name contains lower-case letters.
+  bool mixedCase;
+};
+
+// toShortNameChar
+// ---------------
+// Upper-cases `c` and replaces characters that are invalid in short names
+// (including every non-ASCII character) with '_'.
+
+static char toShortNameChar(char16_t c, BasisName& basis) {
+  if (c >= u'a' && c <= u'z') {
+    basis.mixedCase = true;
+    return static_cast<char>(c - u'a' + 'A');
+  }
+  if ((c >= u'A' && c <= u'Z') || (c >= u'0' && c <= u'9') ||
+      (c < 0x80 && std::u16string_view{u"$%'-_@~`!(){}^#&"}.find(c) !=
+                       std::u16string_view::npos)) {
+    return static_cast<char>(c);
+  }
+  basis.lossy = true;
+  return '_';
+}
+
+// makeBasisName
+// -------------
+// Spaces and leading periods are dropped. The extension is whatever follows
+// the last remaining period; other periods are dropped from the base.
+
+static BasisName makeBasisName(std::u16string_view longName) {
+  BasisName basis{};
+  basis.name.fill(' ');
+
+  size_t start = longName.find_first_not_of(u'.');
+  if (start == std::u16string_view::npos) {
+    start = longName.size();
+  }
+  basis.truncated = start != 0;
+
+  size_t lastDot = longName.rfind(u'.');
+  size_t baseEnd = lastDot != std::u16string_view::npos && lastDot >= start
+                       ? lastDot
+                       : longName.size();
+
+  for (size_t i = start; i < baseEnd; i++) {
+    char16_t c = longName[i];
+    if (c == u' ' || c == u'.' || basis.baseLength == 8) {
+      basis.truncated = true;
+      continue;
+    }
+    basis.name[basis.baseLength++] = toShortNameChar(c, basis);
+  }
+
+  size_t extensionLength = 0;
+  for (size_t i = baseEnd + 1; i < longName.size(); i++) {
+    char16_t c = longName[i];
+    if (c == u' ' || extensionLength == 3) {
+      basis.truncated = true;
+      continue;
+    }
+    basis.name[8 + extensionLength++] = toShortNameChar(c, basis);
+  }
+
+  return basis;
+}
+
+// withNumericTail
+// ---------------
+// The basis name with "~N" replacing the end of the base portion.
+
+static ShortName withNumericTail(const BasisName& basis, uint32_t n) {
+  std::string tail = "~" + std::to_string(n);
+  size_t keep = std::min(basis.baseLength, 8 - tail.size());
+
+  ShortName name = basis.name;
+  std::fill(name.begin() + static_cast<ptrdiff_t>(keep), name.begin() + 8,
+            ' ');
+  std::copy(tail.begin(), tail.end(),
+            name.begin() + static_cast<ptrdiff_t>(keep));
+  return name;
+}
+
+// =============================================================================
+// Entry Encoding
+// =============================================================================
+
+// appendLongNameEntries
+// ---------------------
+// Emits the long name set for `longName`, highest-numbered entry first.
+
+static void appendLongNameEntries(std::u16string_view longName,
+                                  uint8_t checksum,
+                                  std::vector<DirectoryEntryBytes>& entries) {
+  const size_t count =
+      (longName.size() + kLongNameCharsPerEntry - 1) / kLongNameCharsPerEntry;
+
+  for (size_t order = count; order >= 1; order--) {
+    // The 13 characters of this entry: name, then 0x0000, then 0xFFFF
+    std::array<uint16_t, kLongNameCharsPerEntry> chars;
+    size_t first = (order - 1) * kLongNameCharsPerEntry;
+    for (size_t i = 0; i < chars.size(); i++) {
+      size_t index = first + i;
+      chars[i] = index < longName.size()    ? longName[index]
+                 : index == longName.size() ? 0x0000
+                                            : 0xFFFF;
+    }
+
+    const LongNameEntry entry = {
+        .order = static_cast<uint8_t>(
+            order | (order == count ? kLongNameLastEntry : 0)),
+        .name1 = {chars[0], chars[1], chars[2], chars[3], chars[4]},
+        .checksum = checksum,
+        .name2 = {chars[5], chars[6], chars[7], chars[8], chars[9],
+                  chars[10]},
+        .name3 = {chars[11], chars[12]},
+    };
+    entries.push_back(std::bit_cast<DirectoryEntryBytes>(entry));
+  }
+}
+
+// appendDirectoryRecord
+// ---------------------
+
+int appendDirectoryRecord(const DirectoryRecord& record,
+                          const FatTimestamp& timestamp, DirectoryNames& names,
+                          std::vector<DirectoryEntryBytes>& entries) {
+  std::u16string folded = foldLongName(record.longName);
+  if (names.foldedLongNames.contains(folded)) {
+    return EEXIST;
+  }
+
+  // Pick a short name that is unique in this directory
+  BasisName basis = makeBasisName(record.longName);
+  ShortName shortName = basis.name;
+  bool needsTail = basis.lossy || basis.truncated || basis.baseLength == 0 ||
+                   names.shortNames.contains(shortName);
+  for (uint32_t n = 1; needsTail; n++) {
+    if (n > 999999) {
+      return EEXIST;  // Every numeric tail is taken
+    }
+    shortName = withNumericTail(basis, n);
+    needsTail = names.shortNames.contains(shortName);
+  }
+
+  bool needsLongName = basis.lossy || basis.truncated || basis.mixedCase ||
+                       shortName != basis.name;
+  if (needsLongName) {
+    appendLongNameEntries(record.longName, shortNameChecksum(shortName),
+                          entries);
+  }
+
+  const DirectoryEntry entry = {
+      .name = shortName,
+      .attributes = record.attributes,
+      .creationTime = timestamp.time,
+      .creationDate = timestamp.date,
+      .lastAccessDate = timestamp.date,
+      .firstClusterHigh = static_cast<uint16_t>(record.firstCluster >> 16),
+      .writeTime = timestamp.time,
+      .writeDate = timestamp.date,
+      .firstClusterLow = static_cast<uint16_t>(record.firstCluster & 0xFFFF),
+      .fileSize = record.fileSize,
+  };
+  entries.push_back(std::bit_cast<DirectoryEntryBytes>(entry));
+
+  names.shortNames.insert(shortName);
+  names.foldedLongNames.insert(std::move(folded));
+  return 0;
+}
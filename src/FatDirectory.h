@@ -0,0 +1,122 @@
+// =============================================================================
+// FatDirectory.h
+// =============================================================================
+//
+// Internal header: building directory entries for files the library creates.
+// Not part of the public API.
+//
+// A file whose name is not a plain upper-case 8.3 name needs a VFAT long
+// name set in front of its short entry, and the short entry needs a unique
+// "basis name" with a numeric tail (GAMEFI~1.SAV). This header turns a
+// UTF-8 name plus an allocation into the 32-byte slots that go on disk.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_FAT_DIRECTORY_H
+#define SD_FORMAT_FAT_DIRECTORY_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FatStructures.h"
+
+// DirectoryEntryBytes
+// -------------------
+// One 32-byte directory slot (short or long name entry) as raw bytes.
+using DirectoryEntryBytes = std::array<std::byte, sizeof(DirectoryEntry)>;
+
+// ShortName
+// ---------
+// DIR_name: 8-character base and 3-character extension, space-padded.
+using ShortName = std::array<char, 11>;
+
+// FatTimestamp
+// ------------
+// A date and time in directory entry encoding (DIR_writeDate/DIR_writeTime).
+struct FatTimestamp {
+  uint16_t date;
+  uint16_t time;
+};
+
+// currentFatTimestamp
+// -------------------
+// The local time now, in directory entry encoding.
+FatTimestamp currentFatTimestamp();
+
+// decodeLongName
+// --------------
+// Converts a UTF-8 file name to the UTF-16 form stored in long name entries.
+//
+// Trailing spaces and periods are dropped, as the specification requires.
+//
+// Returns:
+//   0 on success, or EINVAL if the name is not valid UTF-8, is empty, is
+//   longer than 255 UTF-16 units, or contains a character that is illegal
+//   in long names (control characters and " * / : < > ? \ |).
+int decodeLongName(std::string_view utf8, std::u16string& name);
+
+// foldLongName
+// ------------
+// Case-folds a long name for comparison. FAT compares names without regard
+// to case; only ASCII letters are folded, which is what the DS menus do.
+std::u16string foldLongName(std::u16string_view name);
+
+// shortNameChecksum
+// -----------------
+// LDIR_checksum of a short name (the rotate-and-add sum from the spec).
+uint8_t shortNameChecksum(const ShortName& name);
+
+// DirectoryNames
+// --------------
+// Names already used in one directory, so new entries stay unique.
+struct DirectoryNames {
+  std::set<ShortName> shortNames;
+  std::set<std::u16string> foldedLongNames;
+};
+
+// DirectoryRecord
+// ---------------
+// A file or subdirectory to emit.
+struct DirectoryRecord {
+  // Long name in UTF-16, as produced by decodeLongName.
+  std::u16string longName;
+
+  // DIR_attributes (kAttrArchive for files, kAttrDirectory for folders).
+  uint8_t attributes;
+
+  // First cluster of the data, or 0 for an empty file.
+  uint32_t firstCluster;
+
+  // DIR_fileSize (0 for directories).
+  uint32_t fileSize;
+};
+
+// sortDirectoryRecords
+// --------------------
+// Orders records by case-folded long name, the order DS menus display.
+// Emitting a directory in this order lets a menu that lists entries in
+// on-disk order skip sorting them on the ARM9.
+void sortDirectoryRecords(std::vector<DirectoryRecord>& records);
+
+// appendDirectoryRecord
+// ---------------------
+// Appends the long name set (if the name needs one) and the short entry
+// for `record` to `entries`, and records the names used in `names`.
+//
+// The short name is the specification's basis name. A numeric tail is
+// added when the conversion was lossy, the name did not fit 8.3, or the
+// basis is already taken. A name that is a valid upper-case 8.3 name is
+// stored as a short entry alone.
+//
+// Returns:
+//   0 on success, or EEXIST if the directory already holds the name.
+int appendDirectoryRecord(const DirectoryRecord& record,
+                          const FatTimestamp& timestamp, DirectoryNames& names,
+                          std::vector<DirectoryEntryBytes>& entries);
+
+#endif  // SD_FORMAT_FAT_DIRECTORY_H
@@ -0,0 +1,1186 @@
+// =============================================================================
+// FatStructures.h
+// =============================================================================
+//
+// Internal header: layout constants and packed on-disk structures shared by
+// the library's translation units. Not part of the public API.
+//
+// SDFormat.cpp writes these structures; the maintenance functions (FSInfo
+// refresh, consistency check) read them back with std::bit_cast. The on-disk
+// layout overview and naming conventions are documented at the top of
+// SDFormat.cpp.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_FAT_STRUCTURES_H
+#define SD_FORMAT_FAT_STRUCTURES_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// =============================================================================
+// Constants
+// =============================================================================
+//
+// These constants define the fixed parameters of the filesystem layout.
+// The values are chosen specifically for Nintendo DS flashcart compatibility.
+
+// -----------------------------------------------------------------------------
+// Sector and Cluster Geometry
+// -----------------------------------------------------------------------------
+
+// kSectorSize: The fundamental unit of disk I/O.
+// All FAT filesystems use 512-byte sectors (the original IBM PC sector size).
+// Every structure offset and size in this implementation is a multiple of 512.
+static constexpr uint32_t kSectorSize = 512;
+
+// kSectorsPerCluster: The allocation unit size, expressed in sectors.
+// A cluster is the minimum allocation unit for file data. Larger clusters
+// reduce FAT table size but waste space for small files.
+//
+// 64 sectors × 512 bytes = 32,768 bytes (32 KB) per cluster.
+//
+// This specific value is CRITICAL for DS flashcart compatibility. The ARM9
+// bootloader in most flashcarts expects 32 KB clusters. Using a different
+// cluster size will cause the bootloader to fail to locate files.
+static constexpr uint32_t kSectorsPerCluster = 64;
+
+// kPartitionAlignmentSectors: Where the partition begins (in sectors).
+// This value determines the gap between the MBR (sector 0) and the partition
+// start. The alignment serves two purposes:
+//
+//   1. NAND Flash Optimization: Flash memory is organized into erase blocks,
+//      typically 128 KB or larger. Aligning the partition to a 4 MB boundary
+//      ensures filesystem structures don't straddle erase block boundaries,
+//      reducing write amplification and improving performance.
+//
+//   2. Modern Standard: The 1 MB (2048 sector) or 4 MB (8192 sector) alignment
+//      has become standard practice for SSDs and flash media.
+//
+// 8192 sectors × 512 bytes = 4,194,304 bytes (4 MB).
+static constexpr uint32_t kPartitionAlignmentSectors = 8192;
+
+// kReservedSectors: Sectors at the start of the partition before the FAT.
+// The reserved region contains the VBR, FSInfo, and their backups.
+// The Microsoft spec recommends 32 reserved sectors for FAT32 volumes.
+//
+// Reserved region layout (partition-relative sectors):
+//   Sector 0:   Primary VBR (Volume Boot Record)
+//   Sector 1:   Primary FSInfo
+//   Sectors 2-5: Unused (zeroed)
+//   Sector 6:   Backup VBR
+//   Sector 7:   Backup FSInfo
+//   Sectors 8-31: Unused (zeroed)
+static constexpr uint32_t kReservedSectors = 32;
+
+// kFatCount: Number of File Allocation Table copies.
+// FAT32 traditionally maintains two identical FAT copies for redundancy.
+// If the primary FAT becomes corrupted, filesystem repair tools can restore
+// it from the backup. The BPB_extFlags field can disable mirroring (using
+// only one active FAT), but we use the default mirrored configuration.
+static constexpr uint32_t kFatCount = 2;
+
+// -----------------------------------------------------------------------------
+// Signature and Type Constants
+// -----------------------------------------------------------------------------
+
+// kMbrSignature: The "magic number" at the end of a valid MBR.
+// Located at bytes 510-511 (offsets 0x1FE-0x1FF) of sector 0.
+// The bytes are 0x55 at offset 510 and 0xAA at offset 511, which reads
+// as 0xAA55 when interpreted as a little-endian 16-bit word.
+// The BIOS checks this signature before attempting to boot from a disk.
+static constexpr uint16_t kMbrSignature = 0xAA55;
+
+// kPartitionTypeFat32Lba: MBR partition type code for FAT32 with LBA.
+// Type 0x0C indicates FAT32 using Logical Block Addressing (as opposed to
+// the obsolete Cylinder-Head-Sector addressing). This is the standard
+// partition type for FAT32 volumes larger than 8 GB.
+// See: docs/mbr_x86_design.md "Partition Type"
+static constexpr uint8_t kPartitionTypeFat32Lba = 0x0C;
+
+// kPartitionTypeGptProtective: MBR partition type of the protective entry
+// in front of a GUID Partition Table. It covers the whole disk (as far as
+// 32-bit LBAs reach), so MBR-only tools see the disk as in use.
+static constexpr uint8_t kPartitionTypeGptProtective = 0xEE;
+
+// kMbrMaxSectors: Sectors an MBR can address. PE_lbaStart and
+// PE_sectorCount are 32-bit, so a disk with more sectors (over 2 TiB with
+// 512-byte sectors) is partitioned with a GUID Partition Table instead.
+static constexpr uint64_t kMbrMaxSectors = uint64_t{1} << 32;
+
+// kMbrBootstrapSize: Size of the bootstrap code area in the MBR.
+// The first 446 bytes of the MBR can contain executable code that the BIOS
+// loads and executes during boot. Since we're formatting data cards (not
+// bootable system disks), we zero this area.
+static constexpr uint32_t kMbrBootstrapSize = 446;
+
+// kVbrSignature: Boot signature at the end of the Volume Boot Record.
+// Same value as kMbrSignature, but located at the end of the VBR (the first
+// sector of the partition). This signature validates the boot sector.
+static constexpr uint16_t kVbrSignature = 0xAA55;
+
+// kAttrVolumeId: Directory entry attribute for volume label entries.
+// A directory entry with this attribute (0x08) contains the volume's name
+// rather than a file or subdirectory. Only the root directory should contain
+// a volume label entry.
+// See: docs/canonical_file_system.md §File Attributes
+static constexpr uint8_t kAttrVolumeId = 0x08;
+
+// kAttrDirectory: Directory entry attribute for subdirectories.
+static constexpr uint8_t kAttrDirectory = 0x10;
+
+// kAttrArchive: Directory entry attribute set on newly created files.
+static constexpr uint8_t kAttrArchive = 0x20;
+
+// kAttrLongName: Attribute combination marking a VFAT long filename entry.
+// (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID)
+static constexpr uint8_t kAttrLongName = 0x0F;
+
+// kLongNameLastEntry: Flag in LDIR_order marking the first physical (and
+// highest numbered) long name entry of a set.
+static constexpr uint8_t kLongNameLastEntry = 0x40;
+
+// kLongNameCharsPerEntry: UCS-2 characters stored in one long name entry.
+static constexpr uint32_t kLongNameCharsPerEntry = 13;
+
+// kLongNameMaxChars: Longest long name the specification allows.
+static constexpr uint32_t kLongNameMaxChars = 255;
+
+// kDirEntryFree / kDirEntryDeleted: Special values of DIR_name[0].
+// 0x00 marks the end of the directory; 0xE5 marks a deleted entry.
+static constexpr uint8_t kDirEntryFree = 0x00;
+static constexpr uint8_t kDirEntryDeleted = 0xE5;
+
+// -----------------------------------------------------------------------------
+// FAT32-Specific Constants
+// -----------------------------------------------------------------------------
+
+// kRootCluster: The cluster number where the root directory begins.
+// In FAT32, the root directory is stored in the data region like any other
+// directory (unlike FAT12/FAT16 where it had a fixed location between the
+// FAT and data regions). Cluster numbering starts at 2 because clusters 0
+// and 1 are reserved for FAT metadata.
+static constexpr uint32_t kRootCluster = 2;
+
+// kMediaDescriptor: Media type byte stored in BPB_mediaDescriptor and FAT[0].
+// 0xF8 indicates a "fixed" (non-removable) disk, which is the standard value
+// for hard disks and SD cards. 0xF0 would indicate removable media like
+// floppy disks. This byte occupies the low 8 bits of FAT[0].
+static constexpr uint8_t kMediaDescriptor = 0xF8;
+
+// kFsInfoSector: Partition-relative sector number of the FSInfo structure.
+// The FSInfo sector immediately follows the VBR (which is sector 0 of the
+// partition). This value is stored in BPB_fsInfoSector.
+static constexpr uint32_t kFsInfoSector = 1;
+
+// kBackupBootSector: Partition-relative sector number of the backup VBR.
+// FAT32 requires a backup copy of the boot sector for disaster recovery.
+// Sector 6 is the Microsoft-recommended location. This value is stored
+// in BPB_backupBootSector.
+static constexpr uint32_t kBackupBootSector = 6;
+
+// kFat32EntryMask: The bits of a FAT32 entry that hold the cluster number.
+// FAT32 entries are 32 bits wide on disk, but only the low 28 bits are
+// meaningful. The top 4 bits are reserved and must be preserved on write
+// and ignored on read, so a free entry is any entry whose low 28 bits are 0.
+static constexpr uint32_t kFat32EntryMask = 0x0FFFFFFF;
+
+// kFsInfoUnknown: Sentinel for FSI_freeCount and FSI_nextFree.
+// Tells the driver that the value is not known and must be computed by
+// scanning the FAT.
+static constexpr uint32_t kFsInfoUnknown = 0xFFFFFFFF;
+
+// kFat32BadCluster: FAT32 entry value marking a cluster as unusable.
+static constexpr uint32_t kFat32BadCluster = 0x0FFFFFF7;
+
+// kFat32EndOfChainMin: Smallest FAT32 entry value meaning end-of-chain.
+// Any masked entry in [0x0FFFFFF8, 0x0FFFFFFF] terminates a cluster chain;
+// formatters conventionally write 0x0FFFFFFF.
+static constexpr uint32_t kFat32EndOfChainMin = 0x0FFFFFF8;
+
+// kFat32EndOfChain: The end-of-chain value this library writes.
+static constexpr uint32_t kFat32EndOfChain = 0x0FFFFFFF;
+
+// kFat32MaxClusters: Most data clusters a FAT32 volume can have. Cluster
+// numbers run from 2 to 0x0FFFFFF6; 0x0FFFFFF7 is the bad cluster mark.
+static constexpr uint32_t kFat32MaxClusters = 0x0FFFFFF5;
+
+// kFat32MaxSectors: Largest BPB_totalSectors32, the other bound on a FAT32
+// volume's size (2 TiB with 512-byte sectors).
+static constexpr uint64_t kFat32MaxSectors = 0xFFFFFFFF;
+
+// -----------------------------------------------------------------------------
+// FAT16-Specific Constants
+// -----------------------------------------------------------------------------
+//
+// Cards under 2 GB are too small for FAT32 with 32 KB clusters (it needs
+// at least 65,525 clusters), so they are formatted FAT16. The parameters
+// follow docs/fat16_forensic_analysis.md, which a 1 GB card formatted this
+// way was validated against on a flashcart.
+
+// kPartitionTypeFat16 / kPartitionTypeFat16Small: MBR partition types of
+// a FAT16 volume of at least 65,536 sectors (32 MB), and of a smaller one.
+// 0x06 is the type of the validated configuration.
+static constexpr uint8_t kPartitionTypeFat16 = 0x06;
+static constexpr uint8_t kPartitionTypeFat16Small = 0x04;
+
+// kFat16MinClusters / kFat16MaxClusters: The cluster count range that
+// makes a volume FAT16. Fewer clusters is FAT12, more is FAT32.
+static constexpr uint32_t kFat16MinClusters = 4085;
+static constexpr uint32_t kFat16MaxClusters = 65524;
+
+// kFat16MinSectorsPerCluster / kFat16MaxSectorsPerCluster: Cluster sizes
+// used, 2 KB to 32 KB. Like macOS, the smallest that keeps the cluster
+// count within kFat16MaxClusters is chosen: 2 KB at 64 MB, 16 KB at 1 GB,
+// and 32 KB (the size DS flashcarts read fastest) at 2 GB.
+static constexpr uint32_t kFat16MinSectorsPerCluster = 4;
+static constexpr uint32_t kFat16MaxSectorsPerCluster = 64;
+
+// kFat16MetadataSectors: The reserved sectors, both FATs, and the root
+// directory region together. FAT16 has no FSInfo or backup boot sector,
+// so the boot sector is followed by padding reserved sectors that make the
+// metadata fill the first 4 MB of the partition, and the data region
+// starts on the next 4 MB boundary like the partition itself.
+static constexpr uint32_t kFat16MetadataSectors = kPartitionAlignmentSectors;
+
+// kFat16RootEntryCount: BPB_rootEntryCount, the fixed root directory
+// region between the FATs and the data region (512 entries, 32 sectors).
+static constexpr uint32_t kFat16RootEntryCount = 512;
+static constexpr uint32_t kFat16RootSectors =
+    kFat16RootEntryCount * 32 / kSectorSize;
+
+// kFat16EndOfChain: The end-of-chain value FAT[1] holds (clean flags set).
+static constexpr uint16_t kFat16EndOfChain = 0xFFFF;
+
+// -----------------------------------------------------------------------------
+// exFAT Constants
+// -----------------------------------------------------------------------------
+//
+// Large cards for targets other than the DS are formatted exFAT. LBAs and
+// sector counts in the boot sector are partition-relative, in the device's
+// logical sectors.
+//
+// See: Microsoft exFAT File System Specification (2019)
+
+// kPartitionTypeExfat: MBR partition type of an exFAT (or NTFS) volume.
+static constexpr uint8_t kPartitionTypeExfat = 0x07;
+
+// kExfatClusterBytes: Cluster size, the value Windows and the SD
+// Association's formatter use for SDXC cards.
+static constexpr uint32_t kExfatClusterBytes = 128 << 10;
+
+// kExfatBootRegionSectors: Sectors of the Main (and of the Backup) Boot
+// Region: boot sector, 8 extended boot sectors, OEM parameters, a
+// reserved sector, and the boot checksum sector.
+static constexpr uint32_t kExfatBootRegionSectors = 12;
+static constexpr uint32_t kExfatChecksumSector = 11;
+
+// kExfatMaxClusters: Largest ClusterCount (cluster numbers stop short of
+// the bad cluster mark 0xFFFFFFF7).
+static constexpr uint32_t kExfatMaxClusters = 0xFFFFFFF5;
+
+// kExfatMediaEntry / kExfatEndOfChain: FatEntry[0] and the value that ends
+// a cluster chain (also FatEntry[1]).
+static constexpr uint32_t kExfatMediaEntry = 0xFFFFFFF8;
+static constexpr uint32_t kExfatEndOfChain = 0xFFFFFFFF;
+
+// kExfatEntryAllocationBitmap / kExfatEntryUpcaseTable /
+// kExfatEntryVolumeLabel: EntryType of the critical primary directory
+// entries in the root directory. Clearing bit 7 (InUse) marks an entry
+// unused, which for the volume label means the volume has none.
+static constexpr uint8_t kExfatEntryAllocationBitmap = 0x81;
+static constexpr uint8_t kExfatEntryUpcaseTable = 0x82;
+static constexpr uint8_t kExfatEntryVolumeLabel = 0x83;
+static constexpr uint8_t kExfatEntryInUse = 0x80;
+
+// kExfatMaxLabelChars: VolumeLabel holds up to 11 UTF-16 code units.
+static constexpr uint32_t kExfatMaxLabelChars = 11;
+
+// -----------------------------------------------------------------------------
+// GPT Constants
+// -----------------------------------------------------------------------------
+
+// Guid: A GUID in its on-disk byte order (the first three fields
+// little-endian, the last two big-endian).
+using Guid = std::array<uint8_t, 16>;
+
+// kGptBasicDataType: Partition type GUID of a FAT or NTFS data partition,
+// EBD0A0A2-B9E5-4433-87C0-68B6B72699C7.
+static constexpr Guid kGptBasicDataType = {
+    0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44,
+    0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7,
+};
+
+// kGptEntryCount / kGptEntrySize: The partition entry array every GPT tool
+// writes, 128 entries of 128 bytes (16 KB). Only the first entry is used.
+static constexpr uint32_t kGptEntryCount = 128;
+static constexpr uint32_t kGptEntrySize = 128;
+static constexpr uint32_t kGptEntryArrayBytes = kGptEntryCount * kGptEntrySize;
+
+// kGptHeaderSize: GPT_headerSize, the bytes covered by GPT_headerCrc32.
+static constexpr uint32_t kGptHeaderSize = 92;
+
+// =============================================================================
+// Layout Profiles
+// =============================================================================
+//
+// The constants above are the layout of the DS flashcarts the library was
+// written for. Other device families read the same FAT32 structures with a
+// different cluster size or alignment, so the formatter is written against
+// a layout profile: a type whose members are all compile-time constants.
+// SDFormat.cpp instantiates its layout math and sector builders once per
+// profile and sector format (SectorLayout below), and the C API selects an
+// instantiation at run time (sdFormatSetLayoutProfile, and the device's
+// sector size), so each one stays constant-folded.
+//
+// Every profile keeps at least the 4 MB alignment gap: sdFormatAutotune
+// benchmarks in bytes 1–4 MB of it, which must lie before the partition.
+
+// LayoutProfile
+// -------------
+// The sector-size independent part of a layout.
+//
+// ClusterBytes:     Cluster size, a power of two up to 64 KB
+// AlignmentBytes:   Where the partition starts, a multiple of 4 MB
+// ReservedSectors:  BPB_reservedSectorCount, room for sectors 0–7
+// FatCount:         BPB_fatCount, 1 or 2
+
+template <uint32_t ClusterBytes, uint32_t AlignmentBytes,
+          uint32_t ReservedSectors, uint32_t FatCount>
+struct LayoutProfile {
+  static constexpr uint32_t kClusterBytes = ClusterBytes;
+  static constexpr uint32_t kAlignmentBytes = AlignmentBytes;
+  static constexpr uint32_t kReservedSectors = ReservedSectors;
+  static constexpr uint32_t kFatCount = FatCount;
+
+  // kMaxRootClusters: The 65,536-entry directory limit (2 MB) in clusters.
+  static constexpr uint32_t kMaxRootClusters = (65536 * 32) / ClusterBytes;
+
+  static_assert(std::has_single_bit(ClusterBytes) && ClusterBytes <= 65536,
+                "clusters must be a power of two up to 64 KB");
+  static_assert(AlignmentBytes % (kPartitionAlignmentSectors * kSectorSize) ==
+                    0,
+                "the partition must start on a 4 MB boundary");
+  static_assert(ReservedSectors > kBackupBootSector + 1,
+                "the reserved region must hold the backup FSInfo");
+  static_assert(FatCount == 1 || FatCount == 2, "BPB_fatCount must be 1 or 2");
+};
+
+// R4Profile: DS flashcarts (R4, Acekard, and their clones). The bootloaders
+// require 32 KB clusters; this is the layout described in SDFormat.cpp.
+using R4Profile =
+    LayoutProfile<kSectorsPerCluster * kSectorSize,
+                  kPartitionAlignmentSectors * kSectorSize, kReservedSectors,
+                  kFatCount>;
+
+// DsiProfile: The DSi's own SD slot (SDHC, up to 32 GB). The system and the
+// homebrew loaders on it read the flashcart layout, so for now it is an
+// alias of R4Profile; kSDFormatProfileDSi exists so the two can diverge
+// without an API change.
+using DsiProfile = R4Profile;
+
+// N3dsProfile: The 3DS SD slot. 64 KB clusters, which the 3DS reads as well
+// as 32 KB, halve the FAT and the chain length of its large title files.
+using N3dsProfile = LayoutProfile<64 << 10, 4 << 20, 32, 2>;
+
+// SdxcProfile: Generic SDHC and SDXC cards. The partition starts on a 16 MB
+// boundary, the largest boundary unit the SD specification assigns to
+// these cards (and a multiple of the smaller ones).
+using SdxcProfile = LayoutProfile<32 << 10, 16 << 20, 32, 2>;
+
+// SectorLayout
+// ------------
+// A profile laid out on a device with `BytesPerSector`-byte logical
+// sectors (its LBA unit and BPB_bytesPerSector) that programs
+// `BlockBytes`-byte physical blocks. Sector counts and LBAs are in logical
+// sectors.
+//
+// Three sector formats are instantiated: 512n (512/512, every SD card and
+// image file), 512e (512/4096), and 4Kn (4096/4096). With blocks larger
+// than a sector, the FAT is rounded up to whole blocks, so the data region
+// and every cluster start on a block boundary.
+
+template <typename Profile, uint32_t BytesPerSector, uint32_t BlockBytes>
+struct SectorLayout : Profile {
+  static constexpr uint32_t kBytesPerSector = BytesPerSector;
+  static constexpr uint32_t kBlockBytes = BlockBytes;
+
+  // kUnitsPerSector: 512-byte units (the SectorIO addressing unit) per
+  // logical sector.
+  static constexpr uint32_t kUnitsPerSector = BytesPerSector / kSectorSize;
+
+  // kBlockSectors: Logical sectors per physical block.
+  static constexpr uint32_t kBlockSectors = BlockBytes / BytesPerSector;
+
+  static constexpr uint32_t kSectorsPerCluster =
+      Profile::kClusterBytes / BytesPerSector;
+  static constexpr uint32_t kAlignmentSectors =
+      Profile::kAlignmentBytes / BytesPerSector;
+
+  // kFatStartSector: Absolute LBA where the FAT region begins.
+  // From this point, the FAT occupies (kFatCount × fatSizeSectors) sectors.
+  static constexpr uint32_t kFatStartSector =
+      kAlignmentSectors + Profile::kReservedSectors;
+
+  static_assert(BytesPerSector == 512 || BytesPerSector == 4096,
+                "BPB_bytesPerSector must be 512 or 4096");
+  static_assert(BlockBytes % BytesPerSector == 0 &&
+                    Profile::kClusterBytes % BlockBytes == 0,
+                "a block must hold whole sectors and a cluster whole blocks");
+  static_assert(kSectorsPerCluster <= 128,
+                "BPB_sectorsPerCluster must be at most 128");
+  static_assert(kFatStartSector % kBlockSectors == 0,
+                "the FAT must start on a block boundary");
+};
+
+// =============================================================================
+// On-Disk Structures
+// =============================================================================
+//
+// These packed structures map directly to the binary layout on disk.
+// All structures use __attribute__((packed)) to ensure no padding is inserted
+// between fields. All multi-byte values are stored little-endian.
+//
+// The structures are declared `const` where possible to enable
+// aggregate initialization with designated initializers (C++20).
+
+// -----------------------------------------------------------------------------
+// PartitionEntry — 16-byte partition table entry within the MBR
+// -----------------------------------------------------------------------------
+//
+// Each entry describes one partition on the disk. The MBR contains space for
+// four entries, though we only use the first one.
+//
+// See: docs/mbr_x86_design.md §Partition Table Entry Format
+// See: docs/canonical_file_system.md §Master Boot Record (MBR)
+
+struct PartitionEntry {
+  // PE_status: Boot indicator flag.
+  // 0x80 = Active/bootable partition (the BIOS will attempt to boot from it)
+  // 0x00 = Inactive partition
+  // Only one partition should be marked active.
+  uint8_t status;
+
+  // PE_chsStart: Cylinder-Head-Sector address of the partition's first sector.
+  // CHS addressing is obsolete (limited to ~8 GB), so we set all bytes to 0xFF
+  // to indicate "use LBA instead." macOS specifically requires this value for
+  // partitions using LBA addressing.
+  //
+  // CHS encoding (when used): byte[0] = head, byte[1] = sector | (cyl_hi << 6),
+  // byte[2] = cyl_lo. But we just use {0xFF, 0xFF, 0xFF}.
+  uint8_t chsStart[3];
+
+  // PE_type: Partition type code identifying the filesystem.
+  // 0x0C = FAT32 with LBA addressing
+  // 0x0B = FAT32 with CHS addressing (not used)
+  // See docs/mbr_x86_design.md for the full list of partition type codes.
+  uint8_t type;
+
+  // PE_chsEnd: CHS address of the partition's last sector.
+  // Same encoding and rationale as chsStart — set to 0xFF for LBA mode.
+  uint8_t chsEnd[3];
+
+  // PE_lbaStart: Logical Block Address of the partition's first sector.
+  // This is the sector number (counting from 0 at the start of the disk)
+  // where the partition begins. For us, this equals kPartitionAlignmentSectors.
+  uint32_t lbaStart;
+
+  // PE_sectorCount: Total number of sectors in the partition.
+  // The partition spans from lbaStart to (lbaStart + sectorCount - 1).
+  uint32_t sectorCount;
+} __attribute__((packed));
+
+// -----------------------------------------------------------------------------
+// MasterBootRecord — 512-byte structure at absolute sector 0 (LBA 0)
+// -----------------------------------------------------------------------------
+//
+// The MBR is the very first sector on the disk. It contains:
+//   1. Bootstrap code (446 bytes) — executable code for BIOS boot (unused here)
+//   2. Partition table (4 × 16 bytes) — describes up to 4 primary partitions
+//   3. Boot signature (2 bytes) — 0xAA55 validates the sector
+//
+// Note: The optional "Unique Disk ID" (4 bytes at offset 0x1B8) and reserved
+// field (2 bytes at offset 0x1BC) are implicitly zero within our bootstrap
+// area, as we don't use them.
+//
+// See: docs/mbr_x86_design.md §MBR Structure
+
+struct MasterBootRecord {
+  // MBR_bootstrap: Bootstrap code area.
+  // On a bootable disk, this contains executable code that the BIOS loads
+  // to address 0x7C00 and executes. Since we're formatting data cards, we
+  // leave this area zeroed.
+  std::byte bootstrap[kMbrBootstrapSize];
+
+  // MBR_partitions: Partition table with four 16-byte entries.
+  // We use only partitions[0]; the rest remain zeroed (empty entries).
+  PartitionEntry partitions[4];
+
+  // MBR_signature: Boot signature validating this sector as an MBR.
+  // Must be 0xAA55 (bytes 0x55, 0xAA at offsets 510, 511).
+  uint16_t signature;
+} __attribute__((packed));
+
+// -----------------------------------------------------------------------------
+// BiosParameterBlock — 53-byte structure embedded within the VBR
+// -----------------------------------------------------------------------------
+//
+// The BPB describes the volume's geometry and FAT parameters. It begins at
+// byte offset 0x00B of the VBR and consists of two parts:
+//   1. Common BPB (offsets 0x00B–0x023, 25 bytes) — shared by FAT12/16/32
+//   2. FAT32 Extended BPB (offsets 0x024–0x03F, 28 bytes) — FAT32-specific
+//
+// The BPB is the most critical metadata structure. Corruption here makes
+// the volume unmountable, which is why FAT32 requires a backup copy.
+//
+// See: docs/canonical_file_system.md §Volume Boot Record (VBR)
+// See: docs/microsoft_fat_specification.md §Boot Sector and BPB
+
+struct BiosParameterBlock {
+  // =========================================================================
+  // Common BPB Fields (offsets 0x00B–0x023, shared by FAT12/FAT16/FAT32)
+  // =========================================================================
+
+  // BPB_bytesPerSector: Bytes per logical sector.
+  // Valid values: 512, 1024, 2048, 4096. We always use 512.
+  const uint16_t bytesPerSector{kSectorSize};
+
+  // BPB_sectorsPerCluster: Allocation unit size in sectors.
+  // Must be a power of 2: 1, 2, 4, 8, 16, 32, 64, or 128.
+  // We use 64 (= 32 KB clusters) for DS compatibility.
+  const uint8_t sectorsPerCluster{kSectorsPerCluster};
+
+  // BPB_reservedSectorCount: Sectors before the FAT region.
+  // Includes the boot sector itself. For FAT32, the Microsoft spec
+  // recommends 32 reserved sectors.
+  const uint16_t reservedSectorCount{kReservedSectors};
+
+  // BPB_fatCount: Number of FAT copies.
+  // The spec recommends 2 for redundancy. Some implementations use 1.
+  const uint8_t fatCount{kFatCount};
+
+  // BPB_rootEntryCount: Maximum root directory entries (FAT12/FAT16 only).
+  // MUST be 0 for FAT32, since FAT32 stores the root directory in the
+  // data region as a regular cluster chain.
+  const uint16_t rootEntryCount{0};
+
+  // BPB_totalSectors16: 16-bit total sector count.
+  // Used only if the volume has fewer than 65536 sectors.
+  // MUST be 0 for FAT32 (use totalSectors32 instead).
+  const uint16_t totalSectors16{0};
+
+  // BPB_mediaDescriptor: Media type byte.
+  // 0xF8 = fixed (non-removable) disk, 0xF0 = removable media.
+  // This value is also stored in the low byte of FAT[0].
+  const uint8_t mediaDescriptor{kMediaDescriptor};
+
+  // BPB_fatSize16: 16-bit sectors per FAT (FAT12/FAT16 only).
+  // MUST be 0 for FAT32 (use fatSize32 instead).
+  const uint16_t fatSize16{0};
+
+  // BPB_sectorsPerTrack: Sectors per track for INT 13h BIOS calls.
+  // Relevant only for CHS geometry on old systems. Standard value: 63.
+  const uint16_t sectorsPerTrack{63};
+
+  // BPB_headCount: Number of heads for INT 13h geometry.
+  // Standard value for large disks: 255.
+  const uint16_t headCount{255};
+
+  // BPB_hiddenSectors: Sectors preceding this partition on the disk.
+  // Equals PE_lbaStart from the partition table entry.
+  // Used by the boot code to locate the partition.
+  const uint32_t hiddenSectors{kPartitionAlignmentSectors};
+
+  // BPB_totalSectors32: 32-bit total sector count of the partition.
+  // This is the partition size, not the entire disk size.
+  // Computed as: diskSectorCount - kPartitionAlignmentSectors.
+  const uint32_t totalSectors32;
+
+  // =========================================================================
+  // FAT32 Extended BPB Fields (offsets 0x024–0x03F)
+  // =========================================================================
+
+  // BPB_fatSize32: 32-bit sectors per FAT.
+  // Computed by fatSizeSectors() using the Microsoft spec formula.
+  const uint32_t fatSize32;
+
+  // BPB_extFlags: FAT mirroring and active FAT flags.
+  // Bits 0-3: Zero-based number of the active FAT (only if bit 7 is set)
+  // Bits 4-6: Reserved
+  // Bit 7: 0 = FAT is mirrored to all copies; 1 = only one FAT is active
+  // We use 0 (all FATs mirrored).
+  const uint16_t extFlags{0};
+
+  // BPB_fsVersion: FAT32 filesystem version.
+  // High byte = major version, low byte = minor version.
+  // MUST be 0x0000 per the Microsoft spec.
+  const uint16_t fsVersion{0};
+
+  // BPB_rootCluster: First cluster of the root directory.
+  // In FAT32, the root directory is a regular cluster chain starting here.
+  // Typically 2 (the first usable data cluster).
+  const uint32_t rootCluster{kRootCluster};
+
+  // BPB_fsInfoSector: Sector number of the FSInfo structure.
+  // This is a partition-relative sector number. Typically 1.
+  const uint16_t fsInfoSector{kFsInfoSector};
+
+  // BPB_backupBootSector: Sector number of the backup boot sector.
+  // Also partition-relative. Typically 6 per Microsoft recommendation.
+  // 0 means no backup exists, but FAT32 should always have a backup.
+  const uint16_t backupBootSector{kBackupBootSector};
+
+  // BPB_reserved: Reserved space within the extended BPB.
+  // Must be zero. Occupies 12 bytes at offsets 0x034–0x03F.
+  const std::array<std::byte, 12> reserved{};
+} __attribute__((packed));
+
+static_assert(sizeof(BiosParameterBlock) == 53,
+              "BiosParameterBlock must be 53 bytes");
+
+// -----------------------------------------------------------------------------
+// VolumeBootRecord — 512-byte structure at partition sector 0
+// -----------------------------------------------------------------------------
+//
+// The VBR (also called "boot sector") is the first sector of the partition.
+// It contains the BPB and additional boot-related fields. A backup copy
+// resides at sector 6 (BPB_backupBootSector).
+//
+// Note: The Microsoft spec uses "BS_" prefix for VBR fields outside the BPB.
+// We use "VBR_" prefix for clarity (see docs/canonical_file_system.md).
+//
+// Layout:
+//   0x000–0x002: VBR_jmpBoot (3 bytes)
+//   0x003–0x00A: VBR_oemName (8 bytes)
+//   0x00B–0x03F: BiosParameterBlock (53 bytes)
+//   0x040–0x059: VBR fields outside BPB (26 bytes)
+//   0x05A–0x1FD: VBR_bootCode (420 bytes)
+//   0x1FE–0x1FF: VBR_signature (2 bytes)
+//
+// See: docs/canonical_file_system.md §VBR Structure Overview
+
+struct VolumeBootRecord {
+  // =========================================================================
+  // VBR Header (offsets 0x000–0x00A)
+  // =========================================================================
+
+  // VBR_jmpBoot: Jump instruction to skip over the BPB to boot code.
+  // Two valid forms exist:
+  //   0xEB xx 0x90: Short jump (EB) + 1-byte offset + NOP (90)
+  //   0xE9 xx xx:   Near jump (E9) + 2-byte offset
+  //
+  // For FAT32, the standard is 0xEB 0x58 0x90, which jumps to offset 0x5A
+  // (the start of the boot code area). The 0x58 is the signed displacement
+  // from the instruction following the jump.
+  const std::array<uint8_t, 3> jmpBoot{0xEB, 0x58, 0x90};
+
+  // VBR_oemName: OEM name/identifier string (8 characters).
+  // This is informational only — it doesn't affect filesystem operation.
+  // "MSWIN4.1" is the recommended value for maximum compatibility, as
+  // some older systems check this string.
+  const std::array<char, 8> oemName{'M', 'S', 'W', 'I', 'N', '4', '.', '1'};
+
+  // =========================================================================
+  // BIOS Parameter Block (offsets 0x00B–0x03F)
+  // =========================================================================
+
+  // Embedded BPB structure containing all volume geometry parameters.
+  const BiosParameterBlock bpb;
+
+  // =========================================================================
+  // VBR Fields Outside BPB (offsets 0x040–0x059)
+  // =========================================================================
+  //
+  // These fields are part of the boot sector but NOT part of the BPB proper.
+  // The Microsoft spec prefixes them with "BS_"; we use "VBR_" for clarity.
+
+  // VBR_driveNumber: INT 13h drive number for BIOS disk access.
+  // 0x80 = first hard disk, 0x00 = floppy drive A:.
+  // The boot code uses this to identify which drive to read from.
+  const uint8_t driveNumber{0x80};
+
+  // VBR_reserved1: Reserved byte.
+  // Originally used by Windows NT for dirty volume flags.
+  // Set to 0x00.
+  const uint8_t reserved1{0};
+
+  // VBR_bootSignature: Extended boot signature.
+  // 0x29 indicates that the following three fields (volumeId, volumeLabel,
+  // fsType) are present and valid. 0x28 means only volumeId is valid.
+  const uint8_t bootSignature{0x29};
+
+  // VBR_volumeId: Volume serial number.
+  // A unique identifier for the volume, typically generated from the
+  // date and time of formatting. Used by operating systems to detect
+  // when removable media has been changed.
+  const uint32_t volumeId;
+
+  // VBR_volumeLabel: Volume label (11 characters, space-padded, uppercase).
+  // Should match the volume label in the root directory's ATTR_VOLUME_ID
+  // entry. Some systems display this label, others display the directory
+  // entry's label — write both to ensure compatibility.
+  const std::array<char, 11> volumeLabel;
+
+  // VBR_fsType: Filesystem type string (8 characters).
+  // "FAT32   " for FAT32 volumes. This is INFORMATIONAL ONLY — the
+  // Microsoft spec explicitly states: "Do NOT use this field to determine
+  // FAT type." The FAT type must be determined by counting clusters.
+  const std::array<char, 8> fsType{'F', 'A', 'T', '3', '2', ' ', ' ', ' '};
+
+  // =========================================================================
+  // VBR Tail (offsets 0x05A–0x1FF)
+  // =========================================================================
+
+  // VBR_bootCode: Bootstrap code area.
+  // On a bootable volume, this contains executable code that loads the
+  // operating system. Since we're formatting data cards, this is zeroed.
+  const std::array<std::byte, 420> bootCode{};
+
+  // VBR_signature: Boot sector signature.
+  // Must be 0xAA55 (byte 0x55 at offset 510, byte 0xAA at offset 511).
+  // Validates this sector as a legitimate boot sector.
+  const uint16_t signature{kVbrSignature};
+} __attribute__((packed));
+
+static_assert(sizeof(VolumeBootRecord) == 512,
+              "VolumeBootRecord must be 512 bytes");
+
+// -----------------------------------------------------------------------------
+// Fat16VolumeBootRecord — 512-byte FAT16 boot sector at partition sector 0
+// -----------------------------------------------------------------------------
+//
+// The common BPB (offsets 0x00B–0x023) is followed directly by the VBR
+// fields that FAT32 moves behind its extended BPB. There is no backup
+// copy.
+//
+// Layout:
+//   0x000–0x002: VBR_jmpBoot (EB 3C 90, jumping over the shorter BPB)
+//   0x003–0x00A: VBR_oemName
+//   0x00B–0x023: Common BPB fields (25 bytes)
+//   0x024–0x03D: VBR fields outside BPB (26 bytes)
+//   0x03E–0x1FD: VBR_bootCode (448 bytes)
+//   0x1FE–0x1FF: VBR_signature
+//
+// See: docs/fat16_forensic_analysis.md §VBR (Sector 1)
+
+struct Fat16VolumeBootRecord {
+  const std::array<uint8_t, 3> jmpBoot{0xEB, 0x3C, 0x90};
+  const std::array<char, 8> oemName{'M', 'S', 'W', 'I', 'N', '4', '.', '1'};
+
+  // Common BPB fields, as in BiosParameterBlock
+  const uint16_t bytesPerSector{kSectorSize};
+  const uint8_t sectorsPerCluster;
+  const uint16_t reservedSectorCount;
+  const uint8_t fatCount{kFatCount};
+  const uint16_t rootEntryCount{kFat16RootEntryCount};
+
+  // BPB_totalSectors16 for a volume under 65,536 sectors, otherwise
+  // BPB_totalSectors32; the other is zero.
+  const uint16_t totalSectors16;
+  const uint8_t mediaDescriptor{kMediaDescriptor};
+
+  // BPB_fatSize16: Sectors per FAT (at most 256).
+  const uint16_t fatSize16;
+  const uint16_t sectorsPerTrack{63};
+  const uint16_t headCount{255};
+  const uint32_t hiddenSectors{kPartitionAlignmentSectors};
+  const uint32_t totalSectors32;
+
+  // VBR fields outside BPB, as in VolumeBootRecord
+  const uint8_t driveNumber{0x80};
+  const uint8_t reserved1{0};
+  const uint8_t bootSignature{0x29};
+  const uint32_t volumeId;
+  const std::array<char, 11> volumeLabel;
+  const std::array<char, 8> fsType{'F', 'A', 'T', '1', '6', ' ', ' ', ' '};
+
+  const std::array<std::byte, 448> bootCode{};
+  const uint16_t signature{kVbrSignature};
+} __attribute__((packed));
+
+static_assert(sizeof(Fat16VolumeBootRecord) == 512,
+              "Fat16VolumeBootRecord must be 512 bytes");
+static_assert(offsetof(Fat16VolumeBootRecord, bootCode) == 0x3E,
+              "VBR_jmpBoot must land on the FAT16 boot code");
+
+// -----------------------------------------------------------------------------
+// ExfatBootSector — 512-byte Main Boot Sector at partition sector 0 (and
+// the Backup Boot Sector at sector 12)
+// -----------------------------------------------------------------------------
+//
+// Where FAT puts the BPB, exFAT requires zeros (MustBeZero), so that FAT
+// drivers do not mistake the volume for one of theirs. With sectors
+// larger than 512 bytes the rest of the sector is zero.
+//
+// See: exFAT specification §3.1 Main and Backup Boot Sector Structure
+
+struct ExfatBootSector {
+  const std::array<uint8_t, 3> jumpBoot{0xEB, 0x76, 0x90};
+  const std::array<char, 8> fileSystemName{'E', 'X', 'F', 'A',
+                                           'T', ' ', ' ', ' '};
+  const std::array<std::byte, 53> mustBeZero{};
+
+  // PartitionOffset / VolumeLength: Where the partition starts on the
+  // device and its length, in sectors.
+  const uint64_t partitionOffset;
+  const uint64_t volumeLength;
+
+  // FatOffset / FatLength / ClusterHeapOffset: Partition-relative start
+  // and length of the FAT, and the start of cluster 2, in sectors.
+  const uint32_t fatOffset;
+  const uint32_t fatLength;
+  const uint32_t clusterHeapOffset;
+  const uint32_t clusterCount;
+  const uint32_t firstClusterOfRootDirectory;
+  const uint32_t volumeSerialNumber;
+
+  // FileSystemRevision: 1.00.
+  const uint16_t fileSystemRevision{0x0100};
+
+  // VolumeFlags / PercentInUse: Excluded from the boot checksum, as the
+  // driver updates them in place.
+  const uint16_t volumeFlags{0};
+  const uint8_t bytesPerSectorShift;
+  const uint8_t sectorsPerClusterShift;
+  const uint8_t numberOfFats{1};
+  const uint8_t driveSelect{0x80};
+  const uint8_t percentInUse{0};
+  const std::array<std::byte, 7> reserved{};
+  const std::array<std::byte, 390> bootCode{};
+  const uint16_t bootSignature{kVbrSignature};
+} __attribute__((packed));
+
+static_assert(sizeof(ExfatBootSector) == 512,
+              "ExfatBootSector must be 512 bytes");
+static_assert(offsetof(ExfatBootSector, volumeFlags) == 106 &&
+                  offsetof(ExfatBootSector, percentInUse) == 112,
+              "the checksum skips bytes 106, 107, and 112");
+
+// -----------------------------------------------------------------------------
+// ExfatDirectoryEntry — 32-byte allocation bitmap or up-case table entry of
+// the root directory
+// -----------------------------------------------------------------------------
+//
+// The two critical primary entries share a layout: EntryType, one flags
+// byte (BitmapFlags; reserved in the up-case table entry), and the
+// FirstCluster and DataLength of the structure. The up-case table entry
+// stores its TableChecksum at offset 4.
+//
+// See: exFAT specification §7.1 and §7.2
+
+struct ExfatDirectoryEntry {
+  uint8_t entryType;
+  uint8_t flags;
+  std::array<std::byte, 2> reserved1;
+  uint32_t tableChecksum;
+  std::array<std::byte, 12> reserved2;
+  uint32_t firstCluster;
+  uint64_t dataLength;
+} __attribute__((packed));
+
+static_assert(sizeof(ExfatDirectoryEntry) == 32,
+              "ExfatDirectoryEntry must be 32 bytes");
+
+// -----------------------------------------------------------------------------
+// ExfatVolumeLabelEntry — 32-byte volume label entry of the root directory
+// -----------------------------------------------------------------------------
+//
+// See: exFAT specification §7.3
+
+struct ExfatVolumeLabelEntry {
+  uint8_t entryType;
+  uint8_t characterCount;
+  std::array<uint16_t, kExfatMaxLabelChars> volumeLabel;
+  std::array<std::byte, 8> reserved;
+} __attribute__((packed));
+
+static_assert(sizeof(ExfatVolumeLabelEntry) == 32,
+              "ExfatVolumeLabelEntry must be 32 bytes");
+
+// -----------------------------------------------------------------------------
+// FSInfo — 512-byte structure at partition sector 1 (and backup at sector 7)
+// -----------------------------------------------------------------------------
+//
+// The FSInfo (File System Information) sector caches information about free
+// space to accelerate cluster allocation. Without FSInfo, the filesystem
+// driver would need to scan the entire FAT to find free clusters.
+//
+// IMPORTANT: FSInfo values are advisory hints only. Per the Microsoft spec,
+// drivers must validate these values against the actual FAT on mount, as
+// they may be stale if the volume was not cleanly unmounted.
+//
+// See: docs/canonical_file_system.md §FS Information Sector (FSInfo)
+// See: docs/microsoft_fat_specification.md §FSInfo Structure (FAT32)
+
+struct FSInfo {
+  // FSI_leadSignature: Lead signature for structure validation.
+  // Value: 0x41615252, which is ASCII "RRaA" (little-endian).
+  // Provides a quick sanity check that this sector contains FSInfo data.
+  const uint32_t leadSignature{0x41615252};
+
+  // FSI_reserved1: Reserved area (480 bytes).
+  // Must be zero. This large reserved block exists for future expansion.
+  const std::array<std::byte, 480> reserved1{};
+
+  // FSI_structSignature: Structure signature for additional validation.
+  // Value: 0x61417272, which is ASCII "rrAa" (little-endian).
+  // Located just before the actual data fields.
+  const uint32_t structSignature{0x61417272};
+
+  // FSI_freeCount: Last known count of free clusters on the volume.
+  // 0xFFFFFFFF indicates the count is unknown and must be computed by
+  // scanning the FAT. We set this to the actual computed free count
+  // during formatting.
+  const uint32_t freeCount;
+
+  // FSI_nextFree: Hint for the next free cluster to allocate.
+  // The driver can start searching for free clusters from this point.
+  // 0xFFFFFFFF indicates no hint (start from cluster 2).
+  // We set this to 3 (the cluster after the root directory).
+  const uint32_t nextFree{3};
+
+  // FSI_reserved2: Second reserved area (12 bytes).
+  // Must be zero.
+  const std::array<std::byte, 12> reserved2{};
+
+  // FSI_trailSignature: Trail signature for structure validation.
+  // Value: 0xAA550000 (note: NOT the same as the boot signature 0xAA55).
+  // Validates the end of the FSInfo structure.
+  const uint32_t trailSignature{0xAA550000};
+} __attribute__((packed));
+
+static_assert(sizeof(FSInfo) == 512, "FSInfo must be 512 bytes");
+
+// -----------------------------------------------------------------------------
+// DirectoryEntry — 32-byte structure for files, directories, and volume labels
+// -----------------------------------------------------------------------------
+//
+// A directory is a file whose data consists of a sequence of 32-byte entries.
+// Each entry describes a file, subdirectory, or (in the root directory) the
+// volume label.
+//
+// For formatting, we only create one entry: the volume label in the root
+// directory. This entry has ATTR_VOLUME_ID set and contains the volume name
+// in the DIR_name field.
+//
+// See: docs/canonical_file_system.md §Directory Entry
+// See: docs/microsoft_fat_specification.md §Directory Entry Format
+
+struct DirectoryEntry {
+  // DIR_name: Short filename (8.3 format, 11 characters total).
+  // For files: 8-character base name + 3-character extension, space-padded.
+  // For volume labels: 11-character label, space-padded, uppercase.
+  // The dot between base and extension is NOT stored.
+  //
+  // Special values in DIR_name[0]:
+  //   0x00: Entry is free and all following entries are also free
+  //   0x05: First character is actually 0xE5 (Kanji compatibility)
+  //   0x2E: Dot entry ("." or "..")
+  //   0xE5: Entry has been deleted
+  const std::array<char, 11> name;
+
+  // DIR_attributes: File attribute bitmask.
+  // Bit 0 (0x01): ATTR_READ_ONLY
+  // Bit 1 (0x02): ATTR_HIDDEN
+  // Bit 2 (0x04): ATTR_SYSTEM
+  // Bit 3 (0x08): ATTR_VOLUME_ID — this entry is the volume label
+  // Bit 4 (0x10): ATTR_DIRECTORY — this entry is a subdirectory
+  // Bit 5 (0x20): ATTR_ARCHIVE — file has been modified since last backup
+  //
+  // The combination 0x0F (ATTR_LONG_NAME) indicates a VFAT long filename entry.
+  // For a volume label entry, we set only ATTR_VOLUME_ID (0x08).
+  const uint8_t attributes{kAttrVolumeId};
+
+  // DIR_ntReserved: Reserved for Windows NT lowercase flags.
+  // Must be 0 for volume label entries.
+  const uint8_t ntReserved{0};
+
+  // DIR_creationTimeTenths: Creation time, sub-second component.
+  // Range 0–199, representing 0–1.99 seconds in 10ms increments.
+  // Optional; we set to 0.
+  const uint8_t creationTimeTenths{0};
+
+  // DIR_creationTime: Creation time (2-second granularity).
+  // Bits 0-4: Seconds/2 (0-29), Bits 5-10: Minutes (0-59), Bits 11-15: Hours.
+  // Optional for volume labels; we set to 0.
+  const uint16_t creationTime{0};
+
+  // DIR_creationDate: Creation date.
+  // Bits 0-4: Day (1-31), Bits 5-8: Month (1-12), Bits 9-15: Year from 1980.
+  // Optional for volume labels; we set to 0.
+  const uint16_t creationDate{0};
+
+  // DIR_lastAccessDate: Last access date (same format as creationDate).
+  // Optional for volume labels; we set to 0.
+  const uint16_t lastAccessDate{0};
+
+  // DIR_firstClusterHigh: High 16 bits of the first cluster number.
+  // Must be 0 for volume label entries (they have no associated data).
+  const uint16_t firstClusterHigh{0};
+
+  // DIR_writeTime: Last modification time (same format as creationTime).
+  // Optional for volume labels; we set to 0.
+  const uint16_t writeTime{0};
+
+  // DIR_writeDate: Last modification date (same format as creationDate).
+  // Optional for volume labels; we set to 0.
+  const uint16_t writeDate{0};
+
+  // DIR_firstClusterLow: Low 16 bits of the first cluster number.
+  // Must be 0 for volume label entries.
+  const uint16_t firstClusterLow{0};
+
+  // DIR_fileSize: File size in bytes (32-bit).
+  // Must be 0 for volume labels and directories.
+  const uint32_t fileSize{0};
+} __attribute__((packed));
+
+static_assert(sizeof(DirectoryEntry) == 32, "DirectoryEntry must be 32 bytes");
+
+// -----------------------------------------------------------------------------
+// LongNameEntry — 32-byte VFAT long filename entry
+// -----------------------------------------------------------------------------
+//
+// A file whose name does not fit the 8.3 short name format is preceded by a
+// set of long name entries. Each carries 13 UCS-2 characters of the name,
+// split over three fields. The entries are stored in reverse order, so the
+// entry holding the end of the name comes first (with kLongNameLastEntry
+// set in LDIR_order) and entry 1 sits immediately before the short entry.
+//
+// The name is terminated by 0x0000 when it does not fill the last entry,
+// and the remaining characters are padded with 0xFFFF.
+//
+// See: docs/microsoft_fat_specification.md §Long File Name Implementation
+
+struct LongNameEntry {
+  // LDIR_order: Position of this entry in the set (1-based), OR'ed with
+  // kLongNameLastEntry for the last one.
+  const uint8_t order;
+
+  // LDIR_name1: Characters 1-5 of this entry's portion of the name.
+  const std::array<uint16_t, 5> name1;
+
+  // LDIR_attributes: Always ATTR_LONG_NAME.
+  const uint8_t attributes{kAttrLongName};
+
+  // LDIR_type: Zero for long name entries.
+  const uint8_t type{0};
+
+  // LDIR_checksum: shortNameChecksum of the short entry that follows the set.
+  const uint8_t checksum;
+
+  // LDIR_name2: Characters 6-11.
+  const std::array<uint16_t, 6> name2;
+
+  // LDIR_firstClusterLow: Must be zero.
+  const uint16_t firstClusterLow{0};
+
+  // LDIR_name3: Characters 12-13.
+  const std::array<uint16_t, 2> name3;
+} __attribute__((packed));
+
+static_assert(sizeof(LongNameEntry) == 32, "LongNameEntry must be 32 bytes");
+
+// -----------------------------------------------------------------------------
+// RootDirSector — Helper structure for writing the root directory
+// -----------------------------------------------------------------------------
+//
+// The root directory begins at cluster 2 (BPB_rootCluster). We initialize
+// only the first sector of the cluster, placing the volume label entry at
+// the very beginning. The rest of the cluster is zeroed.
+
+struct RootDirSector {
+  // The volume label entry at the start of the root directory.
+  const DirectoryEntry volumeLabel;
+
+  // Padding to fill the 512-byte sector.
+  // Remaining directory entries would follow here, but for a freshly
+  // formatted volume, they're all zero (free entries).
+  const std::array<std::byte, 480> padding{};
+} __attribute__((packed));
+
+static_assert(sizeof(RootDirSector) == 512, "RootDirSector must be 512 bytes");
+
+// -----------------------------------------------------------------------------
+// GptHeader — 512-byte GUID Partition Table header at LBA 1 (and backup at
+// the last LBA of the disk)
+// -----------------------------------------------------------------------------
+//
+// The header locates the partition entry array and records the usable LBA
+// range. The primary and backup headers differ only in GPT_myLba,
+// GPT_alternateLba, GPT_partitionEntryLba, and the CRC. LBAs count the
+// device's logical sectors.
+//
+// See: UEFI Specification §5.3 GUID Partition Table (GPT) Disk Layout
+
+struct GptHeader {
+  // GPT_signature: "EFI PART".
+  std::array<char, 8> signature{'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T'};
+
+  // GPT_revision: 1.0.
+  uint32_t revision{0x00010000};
+
+  // GPT_headerSize: kGptHeaderSize.
+  uint32_t headerSize{kGptHeaderSize};
+
+  // GPT_headerCrc32: CRC-32 of the first GPT_headerSize bytes, computed
+  // with this field zero.
+  uint32_t headerCrc32{0};
+
+  uint32_t reserved{0};
+
+  // GPT_myLba / GPT_alternateLba: This header's LBA and the other one's.
+  uint64_t myLba;
+  uint64_t alternateLba;
+
+  // GPT_firstUsableLba / GPT_lastUsableLba: The range partitions may use,
+  // between the primary and the backup entry arrays.
+  uint64_t firstUsableLba;
+  uint64_t lastUsableLba;
+
+  // GPT_diskGuid: Identifies the disk.
+  Guid diskGuid;
+
+  // GPT_partitionEntryLba: First LBA of this header's entry array.
+  uint64_t partitionEntryLba;
+
+  // GPT_partitionEntryCount / GPT_partitionEntrySize.
+  uint32_t partitionEntryCount{kGptEntryCount};
+  uint32_t partitionEntrySize{kGptEntrySize};
+
+  // GPT_partitionEntryArrayCrc32: CRC-32 of the whole entry array.
+  uint32_t partitionEntryArrayCrc32;
+
+  std::array<std::byte, 420> padding{};
+} __attribute__((packed));
+
+static_assert(sizeof(GptHeader) == 512, "GptHeader must be 512 bytes");
+
+// -----------------------------------------------------------------------------
+// GptPartitionEntry — 128-byte entry of the GPT partition entry array
+// -----------------------------------------------------------------------------
+
+struct GptPartitionEntry {
+  // GPTE_typeGuid: kGptBasicDataType; all zeros marks an unused entry.
+  Guid typeGuid;
+
+  // GPTE_uniqueGuid: Identifies the partition.
+  Guid uniqueGuid;
+
+  // GPTE_firstLba / GPTE_lastLba: The partition, both ends inclusive.
+  uint64_t firstLba;
+  uint64_t lastLba;
+
+  // GPTE_attributes: No flags set.
+  uint64_t attributes;
+
+  // GPTE_name: UTF-16LE partition name, zero-padded.
+  std::array<uint16_t, 36> name;
+} __attribute__((packed));
+
+static_assert(sizeof(GptPartitionEntry) == kGptEntrySize,
+              "GptPartitionEntry must be 128 bytes");
+
+#endif  // SD_FORMAT_FAT_STRUCTURES_H
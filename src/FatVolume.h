@@ -0,0 +1,327 @@
+// =============================================================================
+// FatVolume.h
+// =============================================================================
+//
+// Internal header: read-side model of an existing FAT32 volume. Not part of
+// the public API.
+//
+// The formatting functions derive every layout value from sectorCount. The
+// maintenance functions work on volumes that were formatted earlier (possibly
+// on a different host, possibly by a different tool) and must instead read
+// the layout back from the MBR and the BPB, load the FAT, and walk the
+// directory tree. This header collects those building blocks.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_FAT_VOLUME_H
+#define SD_FORMAT_FAT_VOLUME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "FatStructures.h"
+
+// -----------------------------------------------------------------------------
+// Volume Geometry
+// -----------------------------------------------------------------------------
+
+// VolumeGeometry
+// --------------
+// Layout of an existing FAT32 volume, decoded from its MBR and VBR.
+// All sector numbers are absolute LBAs unless noted otherwise.
+//
+// Sectors here are 512-byte units, the SectorIO addressing unit, whatever
+// the volume's BPB_bytesPerSector: on a 4Kn volume every LBA, offset, and
+// size below is eight times its BPB value.
+
+struct VolumeGeometry {
+  // Absolute LBA of the VBR (PE_lbaStart of the FAT32 partition).
+  uint64_t partitionStart;
+
+  // Absolute LBA of the first sector of the primary FAT.
+  uint64_t fatStart;
+
+  // Absolute LBA of cluster 2.
+  uint64_t dataStart;
+
+  // BPB_fatSize32: sectors per FAT copy.
+  uint32_t fatSizeSectors;
+
+  // BPB_fatCount: number of FAT copies.
+  uint32_t fatCount;
+
+  // BPB_sectorsPerCluster.
+  uint32_t sectorsPerCluster;
+
+  // Number of data clusters. Valid cluster numbers are 2..clusterCount+1.
+  uint32_t clusterCount;
+
+  // BPB_rootCluster: first cluster of the root directory.
+  uint32_t rootCluster;
+
+  // Partition-relative sectors of the FSInfo structure and its backup.
+  uint32_t fsInfoSector;
+  uint32_t backupFsInfoSector;
+
+  // BPB_backupBootSector: partition-relative sector of the backup VBR.
+  uint32_t backupBootSector;
+
+  // BPB_bytesPerSector in 512-byte units: the length of the VBR and of
+  // each FSInfo copy.
+  uint32_t unitsPerSector;
+};
+
+// decodeVolumeGeometry
+// --------------------
+// Derives the volume layout from a VBR located at `partitionStart` (in
+// 512-byte units).
+//
+// The VBR is rejected unless it carries the boot signature and describes a
+// FAT32 volume with sectors of 512 to 4096 bytes whose FAT is large enough
+// for its cluster count.
+//
+// Returns:
+//   0 on success, or EINVAL if the VBR does not describe such a volume.
+int decodeVolumeGeometry(const VolumeBootRecord& vbr, uint64_t partitionStart,
+                         VolumeGeometry& geometry);
+
+// readVolumeGeometry
+// ------------------
+// Locates the FAT32 partition with findFat32Partition and decodes its
+// primary VBR.
+//
+// Only the first partition table entry is considered, matching what
+// sdFormatWriteMBR produces.
+//
+// Returns:
+//   0 on success, EINVAL if the structures are not a FAT32 volume, or
+//   errno from the failed I/O call.
+int readVolumeGeometry(int fd, VolumeGeometry& geometry);
+
+// isFat32PartitionEntry
+// ---------------------
+// True if `entry` is a non-empty FAT32 partition (type 0x0B or 0x0C).
+bool isFat32PartitionEntry(const PartitionEntry& entry);
+
+// PartitionLocation
+// -----------------
+// The FAT32 partition as the partition table describes it.
+struct PartitionLocation {
+  // First sector of the partition in 512-byte units, like every LBA in
+  // VolumeGeometry.
+  uint64_t start;
+
+  // PE_lbaStart (or GPTE_firstLba) and the partition's length, as stored:
+  // in the device's logical sectors (see deviceSectorSize).
+  uint64_t lbaStart;
+  uint64_t sectorCount;
+};
+
+// findFat32Partition
+// ------------------
+// Locates the FAT32 partition: the first MBR entry, or, behind a
+// protective MBR, the first entry of the GUID Partition Table if it is a
+// basic data partition. The GPT header and entry array must carry valid
+// CRCs.
+//
+// Returns:
+//   0 on success, EINVAL if there is no such partition, or errno from the
+//   failed I/O call.
+int findFat32Partition(int fd, PartitionLocation& partition);
+
+// ByteReader
+// ----------
+// Fills `bytes` from byte `offset` of a device, or of something standing in
+// for one. Returns 0 or an errno value.
+using ByteReader =
+    std::function<int(uint64_t offset, std::span<std::byte> bytes)>;
+
+// locateFat32Partition
+// --------------------
+// findFat32Partition for a device read through `read`, whose logical
+// sectors are `units` 512-byte units. For callers without a descriptor to
+// read, such as the hash manifest, which decodes what it recorded.
+int locateFat32Partition(const ByteReader& read, uint32_t units,
+                         PartitionLocation& partition);
+
+// crc32
+// -----
+// The CRC-32 (IEEE 802.3) that GPT headers and entry arrays carry.
+uint32_t crc32(std::span<const std::byte> data);
+
+// hasFsInfoSignatures
+// -------------------
+// True if all three FSInfo signatures (lead, struct, trail) are present.
+bool hasFsInfoSignatures(const FSInfo& fsinfo);
+
+// clusterLba
+// ----------
+// Absolute LBA of the first sector of `cluster`.
+inline uint64_t clusterLba(const VolumeGeometry& geometry, uint32_t cluster) {
+  return geometry.dataStart +
+         uint64_t{cluster - kRootCluster} * geometry.sectorsPerCluster;
+}
+
+// isClusterNumber
+// ---------------
+// True if `value` (a masked FAT entry or a directory entry's first cluster)
+// names a data cluster that exists on this volume.
+inline bool isClusterNumber(const VolumeGeometry& geometry, uint32_t value) {
+  return value >= kRootCluster &&
+         value - kRootCluster < geometry.clusterCount;
+}
+
+// -----------------------------------------------------------------------------
+// FAT Access
+// -----------------------------------------------------------------------------
+
+// countFreeEntries
+// ----------------
+// Counts FAT32 entries whose 28-bit cluster value is zero.
+uint32_t countFreeEntries(std::span<const uint32_t> entries);
+
+// findFirstFreeEntry
+// ------------------
+// Returns the index of the first free FAT32 entry, or entries.size() if
+// every entry is allocated.
+size_t findFirstFreeEntry(std::span<const uint32_t> entries);
+
+// readFat
+// -------
+// Loads FAT copy `copy` (0 = primary) into `fat`.
+//
+// The result holds every entry of the copy, including the two reserved
+// entries and the padding at the end of the last FAT sector, so `fat[c]` is
+// the entry for cluster c.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int readFat(int fd, const VolumeGeometry& geometry, uint32_t copy,
+            std::vector<uint32_t>& fat);
+
+// readFatEntry
+// ------------
+// Reads the masked entry for `cluster` from the primary FAT on disk. For
+// callers that follow one short chain and do not need the whole FAT.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int readFatEntry(int fd, const VolumeGeometry& geometry, uint32_t cluster,
+                 uint32_t& value);
+
+// followChain
+// -----------
+// Appends the clusters of the chain starting at `firstCluster` to `chain`.
+//
+// The walk stops at an end-of-chain entry. It fails if the chain leaves the
+// valid cluster range (free, bad, or out-of-range entry) or grows beyond
+// `maxClusters`, which bounds the walk on a looped chain. Callers pass the
+// largest legal size of the object: 4 GiB for files, 2 MB for directories.
+//
+// Returns:
+//   0 on success, or EINVAL if the chain is broken or too long. On failure,
+//   `chain` holds the clusters visited before the problem was detected.
+int followChain(const VolumeGeometry& geometry, std::span<const uint32_t> fat,
+                uint32_t firstCluster, uint64_t maxClusters,
+                std::vector<uint32_t>& chain);
+
+// refreshFsInfo
+// -------------
+// Recounts free clusters in the primary FAT and rewrites both FSInfo copies
+// with the actual FSI_freeCount and the first free cluster as FSI_nextFree.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int refreshFsInfo(int fd, const VolumeGeometry& geometry);
+
+// setFatEntry
+// -----------
+// Updates one entry of an in-memory FAT (as loaded by readFat), preserving
+// its reserved top 4 bits, and records the FAT sector that now needs to be
+// written in `dirtySectors`.
+void setFatEntry(std::vector<uint32_t>& fat, uint32_t cluster, uint32_t value,
+                 std::vector<uint32_t>& dirtySectors);
+
+// flushFatSectors
+// ---------------
+// Writes the recorded FAT sectors (in any order, possibly repeated) from
+// the in-memory FAT to every FAT copy, clears the list, and syncs.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int flushFatSectors(int fd, const VolumeGeometry& geometry,
+                    std::span<const uint32_t> fat,
+                    std::vector<uint32_t>& sectors);
+
+// isPlausibleFatEntry
+// -------------------
+// True if FAT entry `index` could appear on a healthy volume: FAT[0] must
+// carry the media descriptor, FAT[1] an end-of-chain value, every cluster
+// entry must be free, bad, end-of-chain, or a valid cluster number, and the
+// padding entries after the last cluster must be zero.
+bool isPlausibleFatEntry(const VolumeGeometry& geometry, uint64_t index,
+                         uint32_t value);
+
+// maxFileClusters / maxDirectoryClusters
+// --------------------------------------
+// Upper bounds for followChain. DIR_fileSize is 32 bits, so a file spans
+// at most 4 GiB. The spec caps a directory at 65,536 entries (2 MB).
+uint64_t maxFileClusters(const VolumeGeometry& geometry);
+uint64_t maxDirectoryClusters(const VolumeGeometry& geometry);
+
+// -----------------------------------------------------------------------------
+// Directory Tree
+// -----------------------------------------------------------------------------
+
+// firstClusterOf
+// --------------
+// Combines DIR_firstClusterHigh and DIR_firstClusterLow.
+inline uint32_t firstClusterOf(const DirectoryEntry& entry) {
+  return (uint32_t{entry.firstClusterHigh} << 16) | entry.firstClusterLow;
+}
+
+// DirectorySlot
+// -------------
+// One short directory entry found while walking the tree, plus where it
+// lives on disk so callers can rewrite it.
+
+struct DirectorySlot {
+  // The decoded 32-byte short entry.
+  DirectoryEntry entry;
+
+  // Absolute byte offset of the entry on the device.
+  uint64_t offset;
+
+  // First cluster of the directory that contains the entry.
+  uint32_t parentCluster;
+
+  // Depth below the root directory (0 for entries in the root).
+  uint32_t depth;
+};
+
+// DirectoryVisitor
+// ----------------
+// Called once per file or subdirectory entry. Long-name entries, deleted
+// entries, the volume label, and the "." / ".." entries are skipped. For a
+// subdirectory, returning false prevents the walk from descending into it.
+using DirectoryVisitor = std::function<bool(const DirectorySlot&)>;
+
+// walkDirectoryTree
+// -----------------
+// Visits every entry reachable from the root directory, depth-first.
+//
+// Directories are read whole (their full cluster chain) and parsed until
+// the first free (0x00) entry. A directory whose chain is broken is parsed
+// as far as it can be read. Each directory is entered at most once, so a
+// corrupt tree cannot make the walk loop.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int walkDirectoryTree(int fd, const VolumeGeometry& geometry,
+                      std::span<const uint32_t> fat,
+                      const DirectoryVisitor& visit);
+
+#endif  // SD_FORMAT_FAT_VOLUME_H
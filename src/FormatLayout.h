@@ -0,0 +1,56 @@
+// =============================================================================
+// FormatLayout.h
+// =============================================================================
+//
+// Internal header: the FAT32 formatting steps of SDFormat.h with their
+// layout passed in. Not part of the public API.
+//
+// The public sdFormatWrite* functions read the layout profile and sector
+// size each time they are called. An asynchronous format takes them once,
+// when it begins, and runs every step with that FormatLayout, so changing
+// either while it runs cannot leave one card with an MBR and a VBR or FAT
+// built for different layouts.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_FORMAT_LAYOUT_H
+#define SD_FORMAT_FORMAT_LAYOUT_H
+
+#include <cstdint>
+
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// FormatLayout
+// ------------
+// What the formatting steps lay a volume out for.
+
+struct FormatLayout {
+  uint32_t profile;       // kSDFormatProfile constant
+  SectorSize sectorSize;  // Of the device being formatted
+};
+
+// currentFormatLayout
+// -------------------
+// The layout the public functions use for `fd`: the profile set with
+// sdFormatSetLayoutProfile and the device's sector size (or the override).
+FormatLayout currentFormatLayout(int fd);
+
+// writeFormat*
+// ------------
+// sdFormatWriteMBR and the other FAT32 steps, for `layout`.
+int writeFormatMBR(int fd, const FormatLayout& layout, uint64_t sectorCount);
+int writeFormatVolumeBootRecord(int fd, const FormatLayout& layout,
+                                uint64_t sectorCount, const char* label);
+int writeFormatFSInfo(int fd, const FormatLayout& layout,
+                      uint64_t sectorCount, uint32_t rootClusters);
+int writeFormatFat32Tables(int fd, const FormatLayout& layout,
+                           uint64_t sectorCount, uint32_t rootClusters);
+int writeFormatRootDirectory(int fd, const FormatLayout& layout,
+                             uint64_t sectorCount, uint32_t rootClusters,
+                             const char* label);
+int writeFormatSaveFiles(int fd, const FormatLayout& layout,
+                         uint64_t sectorCount, uint32_t rootClusters,
+                         const SDFormatSaveFile* saves, uint32_t saveCount);
+
+#endif  // SD_FORMAT_FORMAT_LAYOUT_H
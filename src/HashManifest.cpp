@@ -0,0 +1,577 @@
+// =============================================================================
+// HashManifest.cpp
+// =============================================================================
+//
+// Implementation of the content hash manifest: the recorder SectorIO feeds
+// through recordContent, recordZeros, and forgetContent, and the public
+// functions sdFormatStartHashManifest and sdFormatStopHashManifest.
+//
+// Recording
+// ---------
+// The recorded contents are a map of non-overlapping pieces keyed by start
+// offset, each holding a copy of the bytes written there or, for zeros,
+// nothing. A new piece replaces whatever it overlaps (trimming the pieces
+// at its ends), so a sector that was zeroed, written, and patched by a
+// read-modify-write ends up as the bytes of the last write. Hashing waits
+// until the manifest is stopped for the same reason: the FAT, FSInfo, and
+// directories are rewritten in place during a format, and only their final
+// contents are on the card. Adjacent zero pieces of one phase are merged,
+// so a zeroed region stays one piece however many writes it took.
+//
+// Structures
+// ----------
+// The phase that last wrote a range says little about what it holds: the
+// save file step rewrites FSInfo, the first sector of each FAT, and the
+// first root sector. So when the manifest is stopped, the recorded MBR (or
+// GPT) and VBR are decoded and every range is assigned to the structure
+// the volume layout puts there. Only ranges of something that is not a
+// FAT32 volume (a FAT16 or exFAT format) keep the phase that wrote them.
+//
+// =============================================================================
+
+#include "HashManifest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ContentHash.h"
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "IOStats.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+std::atomic<int> gHashedFd{-1};
+
+// kAlgorithmNames: Manifest names of the kSDFormatHash constants.
+static constexpr const char* kAlgorithmNames[kSDFormatHashCount] = {
+    "sha256",
+    "blake3",
+};
+
+// kStructureNames: Manifest names of the structures, which are numbered
+// like the kSDFormatPhase constant of the step that writes each, and named
+// as in FormatImage's statistics.
+static constexpr const char* kStructureNames[kSDFormatPhaseCount] = {
+    "other", "mbr", "vbr", "fsinfo", "fat", "root", "saves",
+};
+
+// Piece
+// -----
+// Recorded contents of [start, end), where start is the piece's key.
+
+struct Piece {
+  uint64_t end;
+  uint32_t phase;
+  std::vector<std::byte> bytes;  // Empty for zeros
+
+  bool isZeros() const { return bytes.empty(); }
+};
+
+using PieceMap = std::map<uint64_t, Piece>;
+
+// Recorder state, guarded by gManifestMutex.
+static std::mutex gManifestMutex;
+static bool gManifestActive = false;
+static uint32_t gManifestAlgorithm = kSDFormatHashSHA256;
+static PieceMap gPieces;
+
+// =============================================================================
+// Recording
+// =============================================================================
+
+// slicePiece
+// ----------
+// The part [from, to) of `piece`, which starts at `start`.
+
+static Piece slicePiece(const Piece& piece, uint64_t start, uint64_t from,
+                        uint64_t to) {
+  Piece slice{.end = to, .phase = piece.phase, .bytes = {}};
+  if (!piece.isZeros()) {
+    slice.bytes.assign(
+        piece.bytes.begin() + static_cast<ptrdiff_t>(from - start),
+        piece.bytes.begin() + static_cast<ptrdiff_t>(to - start));
+  }
+  return slice;
+}
+
+// clearRange
+// ----------
+// Removes [start, end) from the recorded contents, trimming the pieces
+// that extend past either end. Requires the lock.
+
+static void clearRange(uint64_t start, uint64_t end) {
+  auto it = gPieces.upper_bound(start);
+  if (it != gPieces.begin() && std::prev(it)->second.end > start) {
+    --it;
+  }
+  while (it != gPieces.end() && it->first < end) {
+    const uint64_t pieceStart = it->first;
+    const Piece piece = std::move(it->second);
+    it = gPieces.erase(it);
+    if (pieceStart < start) {
+      gPieces.emplace(pieceStart, slicePiece(piece, pieceStart, pieceStart,
+                                             start));
+    }
+    if (piece.end > end) {
+      gPieces.emplace(end, slicePiece(piece, pieceStart, end, piece.end));
+    }
+  }
+}
+
+// insertZeros
+// -----------
+// Records [start, end) as zeros written in `phase`, merging it with zero
+// pieces of the same phase on either side. Requires the lock.
+
+static void insertZeros(uint64_t start, uint64_t end, uint32_t phase) {
+  clearRange(start, end);
+  auto next = gPieces.lower_bound(start);
+  if (next != gPieces.end() && next->first == end &&
+      next->second.isZeros() && next->second.phase == phase) {
+    end = next->second.end;
+    next = gPieces.erase(next);
+  }
+  if (next != gPieces.begin()) {
+    Piece& before = std::prev(next)->second;
+    if (before.end == start && before.isZeros() && before.phase == phase) {
+      before.end = end;
+      return;
+    }
+  }
+  gPieces.emplace_hint(next, start, Piece{.end = end, .phase = phase,
+                                          .bytes = {}});
+}
+
+void recordContent(uint64_t offset, std::span<const std::byte> data) {
+  if (data.empty()) {
+    return;
+  }
+  if (isZeroFilled(data)) {
+    recordZeros(offset, data.size());
+    return;
+  }
+  const uint32_t phase = activePhase();
+  std::vector<std::byte> bytes(data.begin(), data.end());
+  std::lock_guard lock(gManifestMutex);
+  if (!gManifestActive) {
+    return;  // Stopped while the write was in flight
+  }
+  clearRange(offset, offset + data.size());
+  gPieces.emplace(offset, Piece{.end = offset + data.size(), .phase = phase,
+                                .bytes = std::move(bytes)});
+}
+
+void recordZeros(uint64_t offset, uint64_t length) {
+  if (length == 0) {
+    return;
+  }
+  const uint32_t phase = activePhase();
+  std::lock_guard lock(gManifestMutex);
+  if (gManifestActive) {
+    insertZeros(offset, offset + length, phase);
+  }
+}
+
+void forgetContent(uint64_t offset, uint64_t length) {
+  std::lock_guard lock(gManifestMutex);
+  if (gManifestActive) {
+    clearRange(offset, offset + length);
+  }
+}
+
+// =============================================================================
+// Volume Layout
+// =============================================================================
+
+// Region
+// ------
+// [start, end) of the device, in bytes, holds `structure`.
+
+struct Region {
+  uint64_t start;
+  uint64_t end;
+  uint32_t structure;
+};
+
+// readRecorded
+// ------------
+// Copies the recorded contents at `offset` into `bytes`, with zeros where
+// nothing was recorded.
+
+static void readRecorded(const PieceMap& pieces, uint64_t offset,
+                         std::span<std::byte> bytes) {
+  std::fill(bytes.begin(), bytes.end(), std::byte{0});
+  const uint64_t end = offset + bytes.size();
+  auto it = pieces.upper_bound(offset);
+  if (it != pieces.begin() && std::prev(it)->second.end > offset) {
+    --it;
+  }
+  for (; it != pieces.end() && it->first < end; ++it) {
+    const Piece& piece = it->second;
+    if (piece.isZeros()) {
+      continue;
+    }
+    const uint64_t from = std::max(offset, it->first);
+    const uint64_t to = std::min(end, piece.end);
+    std::copy(piece.bytes.begin() + static_cast<ptrdiff_t>(from - it->first),
+              piece.bytes.begin() + static_cast<ptrdiff_t>(to - it->first),
+              bytes.begin() + static_cast<ptrdiff_t>(from - offset));
+  }
+}
+
+// rootDirectoryRegions
+// --------------------
+// The clusters of the root directory chain, as runs of adjacent clusters,
+// followed through the recorded primary FAT. The walk stops at the end of
+// the chain, at anything but a cluster number, or at the 2 MB a directory
+// can hold.
+
+static std::vector<Region> rootDirectoryRegions(
+    const PieceMap& pieces, const VolumeGeometry& geometry) {
+  std::vector<Region> regions;
+  const uint64_t clusterBytes =
+      uint64_t{geometry.sectorsPerCluster} * kSectorSize;
+  uint32_t cluster = geometry.rootCluster;
+  for (uint64_t i = 0; i < maxDirectoryClusters(geometry) &&
+                       isClusterNumber(geometry, cluster);
+       i++) {
+    const uint64_t start = clusterLba(geometry, cluster) * kSectorSize;
+    if (!regions.empty() && regions.back().end == start) {
+      regions.back().end += clusterBytes;
+    } else {
+      regions.push_back({.start = start,
+                         .end = start + clusterBytes,
+                         .structure = kSDFormatPhaseRootDirectory});
+    }
+    uint32_t entry;
+    readRecorded(pieces,
+                 geometry.fatStart * kSectorSize + uint64_t{cluster} * 4,
+                 std::as_writable_bytes(std::span{&entry, 1}));
+    cluster = entry & kFat32EntryMask;
+  }
+  std::sort(regions.begin(), regions.end(),
+            [](const Region& a, const Region& b) { return a.start < b.start; });
+  return regions;
+}
+
+// mapVolume
+// ---------
+// The structures of the FAT32 volume the recorded contents describe, in
+// offset order and covering the whole device:
+//
+//   mbr     Everything before the partition (the MBR or GPT and the
+//           alignment gap) and after it (the backup GPT)
+//   vbr     The reserved region, except for the FSInfo sectors
+//   fsinfo  FSInfo and its backup
+//   fat     Every FAT copy
+//   root    The clusters of the root directory chain
+//   saves   Every other data cluster
+//
+// The logical sector size is the one under which the partition table and
+// the BPB agree. Empty if no FAT32 volume is found.
+
+static std::vector<Region> mapVolume(const PieceMap& pieces) {
+  auto read = [&pieces](uint64_t offset, std::span<std::byte> bytes) {
+    readRecorded(pieces, offset, bytes);
+    return 0;
+  };
+  for (uint32_t units : {1u, 4096u / kSectorSize}) {
+    PartitionLocation partition;
+    VolumeGeometry geometry;
+    SectorBytes raw;
+    if (locateFat32Partition(read, units, partition) != 0) {
+      continue;
+    }
+    read(partition.start * kSectorSize, raw);
+    if (decodeVolumeGeometry(std::bit_cast<VolumeBootRecord>(raw),
+                             partition.start, geometry) != 0 ||
+        geometry.unitsPerSector != units) {
+      continue;
+    }
+
+    const uint64_t start = partition.start * kSectorSize;
+    const uint64_t sectorBytes = uint64_t{units} * kSectorSize;
+    const uint64_t fatStart = geometry.fatStart * kSectorSize;
+    const uint64_t dataStart = geometry.dataStart * kSectorSize;
+    const uint64_t end = start + partition.sectorCount * sectorBytes;
+    std::vector<Region> regions;
+    auto append = [&regions](uint64_t from, uint64_t to, uint32_t structure) {
+      if (from < to) {
+        regions.push_back({.start = from, .end = to, .structure = structure});
+      }
+    };
+    append(0, start, kSDFormatPhaseMBR);
+
+    uint64_t position = start;
+    for (uint32_t sector :
+         {std::min(geometry.fsInfoSector, geometry.backupFsInfoSector),
+          std::max(geometry.fsInfoSector, geometry.backupFsInfoSector)}) {
+      const uint64_t fsInfo = start + uint64_t{sector} * kSectorSize;
+      if (fsInfo < position || fsInfo + sectorBytes > fatStart) {
+        continue;
+      }
+      append(position, fsInfo, kSDFormatPhaseVBR);
+      append(fsInfo, fsInfo + sectorBytes, kSDFormatPhaseFSInfo);
+      position = fsInfo + sectorBytes;
+    }
+    append(position, fatStart, kSDFormatPhaseVBR);
+    append(fatStart, dataStart, kSDFormatPhaseFAT);
+
+    position = dataStart;
+    for (const Region& root : rootDirectoryRegions(pieces, geometry)) {
+      if (root.start < position || root.end > end) {
+        continue;  // A looped or out-of-range chain
+      }
+      append(position, root.start, kSDFormatPhaseSaveFiles);
+      append(root.start, root.end, root.structure);
+      position = root.end;
+    }
+    append(position, end, kSDFormatPhaseSaveFiles);
+    append(end, UINT64_MAX, kSDFormatPhaseMBR);
+    return regions;
+  }
+  return {};
+}
+
+// structureAt
+// -----------
+// The structure at `offset` of a piece written in `phase`, and where the
+// range it belongs to ends: from `regions` if they cover `offset`,
+// otherwise the phase, up to the next region.
+
+static std::pair<uint32_t, uint64_t> structureAt(
+    const std::vector<Region>& regions, uint64_t offset, uint32_t phase) {
+  auto it = std::upper_bound(regions.begin(), regions.end(), offset,
+                             [](uint64_t value, const Region& region) {
+                               return value < region.start;
+                             });
+  if (it != regions.begin() && std::prev(it)->end > offset) {
+    const Region& region = *std::prev(it);
+    return {region.structure, region.end};
+  }
+  return {phase, it != regions.end() ? it->start : UINT64_MAX};
+}
+
+// =============================================================================
+// Manifest
+// =============================================================================
+
+// Extent
+// ------
+// A run of adjacent recorded bytes of one structure.
+
+struct Extent {
+  uint64_t start;
+  uint64_t end;
+  uint32_t structure;
+  Digest digest;
+};
+
+// hashPiece
+// ---------
+// Feeds the part [from, to) of `piece`, which starts at `start`, to
+// `hasher`.
+
+static void hashPiece(ContentHasher& hasher, uint64_t start,
+                      const Piece& piece, uint64_t from, uint64_t to) {
+  if (piece.isZeros()) {
+    hasher.updateZeros(to - from);
+  } else {
+    hasher.update(std::span{piece.bytes}.subspan(from - start, to - from));
+  }
+}
+
+// collectExtents
+// --------------
+// Cuts the recorded contents into extents, splitting pieces where the
+// structure changes.
+
+static std::vector<Extent> collectExtents(const PieceMap& pieces,
+                                          const std::vector<Region>& regions,
+                                          uint32_t algorithm) {
+  std::vector<Extent> extents;
+  std::optional<ContentHasher> hasher;
+  for (const auto& [start, piece] : pieces) {
+    for (uint64_t position = start; position < piece.end;) {
+      const auto [structure, limit] =
+          structureAt(regions, position, piece.phase);
+      const uint64_t end = std::min(piece.end, limit);
+      if (extents.empty() || extents.back().end != position ||
+          extents.back().structure != structure) {
+        if (hasher) {
+          extents.back().digest = hasher->finish();
+        }
+        extents.push_back({.start = position, .end = position,
+                           .structure = structure, .digest = {}});
+        hasher.emplace(algorithm);
+      }
+      hashPiece(*hasher, start, piece, position, end);
+      extents.back().end = end;
+      position = end;
+    }
+  }
+  if (hasher) {
+    extents.back().digest = hasher->finish();
+  }
+  return extents;
+}
+
+// hashPrefix
+// ----------
+// Content hash of [0, prefixBytes), with unrecorded ranges hashed as zeros
+// and counted into `unrecorded`.
+
+static Digest hashPrefix(const PieceMap& pieces, uint32_t algorithm,
+                         uint64_t prefixBytes, uint64_t& unrecorded) {
+  ContentHasher hasher(algorithm);
+  uint64_t position = 0;
+  unrecorded = 0;
+  for (const auto& [start, piece] : pieces) {
+    if (start >= prefixBytes) {
+      break;
+    }
+    if (start > position) {
+      hasher.updateZeros(start - position);
+      unrecorded += start - position;
+    }
+    position = std::min(piece.end, prefixBytes);
+    hashPiece(hasher, start, piece, start, position);
+  }
+  if (prefixBytes > position) {
+    hasher.updateZeros(prefixBytes - position);
+    unrecorded += prefixBytes - position;
+  }
+  return hasher.finish();
+}
+
+// toHex
+// -----
+
+static std::string toHex(const Digest& digest) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  for (uint8_t byte : digest) {
+    hex += kDigits[byte >> 4];
+    hex += kDigits[byte & 0xF];
+  }
+  return hex;
+}
+
+// writeManifest
+// -------------
+// Replaces the manifest atomically (write, fsync, rename).
+
+static int writeManifest(const char* path, const std::string& contents) {
+  const std::string temporary = std::string{path} + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+  int err = writeBytes(fd, 0, std::as_bytes(std::span{contents}));
+  if (err == 0) {
+    err = syncDevice(fd);
+  }
+  close(fd);
+  if (err == 0 && std::rename(temporary.c_str(), path) != 0) {
+    err = errno;
+  }
+  return err;
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatStartHashManifest
+// -------------------------
+
+int sdFormatStartHashManifest(int fd, uint32_t algorithm) {
+  if (algorithm >= kSDFormatHashCount) {
+    return EINVAL;
+  }
+  std::lock_guard lock(gManifestMutex);
+  if (gManifestActive) {
+    return EBUSY;
+  }
+  gManifestActive = true;
+  gManifestAlgorithm = algorithm;
+  gPieces.clear();
+  gHashedFd.store(fd, std::memory_order_relaxed);
+  return 0;
+}
+
+// sdFormatStopHashManifest
+// ------------------------
+// The recorded contents are taken out of the recorder first, so hashing
+// (which can take a while for a large prefix) runs without the lock.
+
+int sdFormatStopHashManifest(const char* path, uint64_t prefixBytes,
+                             SDFormatHashManifestReport* report) {
+  *report = {};
+  PieceMap pieces;
+  uint32_t algorithm;
+  {
+    std::lock_guard lock(gManifestMutex);
+    if (!gManifestActive) {
+      return ENOENT;
+    }
+    gHashedFd.store(-1, std::memory_order_relaxed);
+    gManifestActive = false;
+    pieces.swap(gPieces);
+    algorithm = gManifestAlgorithm;
+  }
+
+  if (prefixBytes == 0 && !pieces.empty()) {
+    prefixBytes = std::prev(pieces.end())->second.end;
+  }
+  const std::vector<Extent> extents =
+      collectExtents(pieces, mapVolume(pieces), algorithm);
+  uint64_t unrecorded = 0;
+  const Digest prefix = hashPrefix(pieces, algorithm, prefixBytes, unrecorded);
+
+  report->prefixBytes = prefixBytes;
+  report->unrecordedBytes = unrecorded;
+  report->extentCount = static_cast<uint32_t>(extents.size());
+  report->algorithm = algorithm;
+  std::memcpy(report->prefixDigest, prefix.data(), prefix.size());
+  if (path == nullptr) {
+    return 0;
+  }
+
+  std::string contents = "sdformat-manifest 1 " +
+                         std::string{kAlgorithmNames[algorithm]} + "\n";
+  std::optional<Hasher> structures[kSDFormatPhaseCount];
+  for (const Extent& extent : extents) {
+    contents += "extent " + std::to_string(extent.start) + " " +
+                std::to_string(extent.end - extent.start) + " " +
+                kStructureNames[extent.structure] + " " +
+                toHex(extent.digest) + "\n";
+    std::optional<Hasher>& structure = structures[extent.structure];
+    if (!structure) {
+      structure.emplace(algorithm);
+    }
+    structure->update(std::as_bytes(std::span{extent.digest}));
+  }
+  for (uint32_t structure = 0; structure < kSDFormatPhaseCount;
+       structure++) {
+    if (structures[structure]) {
+      contents += std::string{"structure "} + kStructureNames[structure] +
+                  " " + toHex(structures[structure]->finish()) + "\n";
+    }
+  }
+  contents += "prefix " + std::to_string(prefixBytes) + " " +
+              std::to_string(unrecorded) + " " + toHex(prefix) + "\n";
+  return writeManifest(path, contents);
+}
@@ -0,0 +1,50 @@
+// =============================================================================
+// HashManifest.h
+// =============================================================================
+//
+// Internal header: the content recorder behind sdFormatStartHashManifest.
+// Not part of the public API.
+//
+// SectorIO reports every range it changes on the recorded descriptor: the
+// bytes of each successful write, the extent of each zeroing, and each
+// discard or copy offload, whose result it cannot see. The recorder keeps
+// the latest contents of every byte it was told about, tagged with the
+// statistics phase that wrote it, so sdFormatStopHashManifest can hash the
+// final contents without reading the device back. Zeros are kept as
+// extents, never as bytes.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_HASH_MANIFEST_H
+#define SD_FORMAT_HASH_MANIFEST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// gHashedFd: The descriptor being recorded, or -1. Read through
+// hashManifestEnabled.
+extern std::atomic<int> gHashedFd;
+
+// hashManifestEnabled
+// -------------------
+// True while the contents written to `fd` are being recorded.
+inline bool hashManifestEnabled(int fd) {
+  return gHashedFd.load(std::memory_order_relaxed) == fd;
+}
+
+// recordContent / recordZeros
+// ---------------------------
+// `offset` now holds `data`, or `length` zeros. Data that is all zeros is
+// kept as a zero extent. Safe to call from several threads at once.
+void recordContent(uint64_t offset, std::span<const std::byte> data);
+void recordZeros(uint64_t offset, uint64_t length);
+
+// forgetContent
+// -------------
+// The contents of the range are no longer known (a discard, or a copy the
+// kernel made). The range counts as unrecorded until it is written again.
+void forgetContent(uint64_t offset, uint64_t length);
+
+#endif  // SD_FORMAT_HASH_MANIFEST_H
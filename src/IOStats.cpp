@@ -0,0 +1,189 @@
+// =============================================================================
+// IOStats.cpp
+// =============================================================================
+//
+// Implementation of the I/O statistics: the recording functions SectorIO
+// calls, PhaseScope, and the public functions sdFormatEnableStats,
+// sdFormatResetStats, sdFormatGetStats, and
+// sdFormatLatencyBucketMicroseconds.
+//
+// Every counter is a relaxed atomic, so the worker threads of zeroSectors
+// can record without a lock. A phase's counters are updated independently;
+// only the totals at the end of a run are meant to be read.
+//
+// =============================================================================
+
+#include "IOStats.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <utility>
+
+#include "Tracepoints.h"
+
+std::atomic<bool> gIOStatsEnabled{false};
+
+// PhaseCounters
+// -------------
+// The atomic counterpart of SDFormatPhaseStats.
+
+struct PhaseCounters {
+  std::atomic<uint64_t> writeCalls;
+  std::atomic<uint64_t> bytesWritten;
+  std::atomic<uint64_t> readCalls;
+  std::atomic<uint64_t> bytesRead;
+  std::atomic<uint64_t> syncCalls;
+  std::atomic<uint64_t> offloadCalls;
+  std::atomic<uint64_t> offloadBytes;
+  std::atomic<uint64_t> elapsedNanoseconds;
+};
+
+static PhaseCounters gPhases[kSDFormatPhaseCount];
+static std::atomic<uint64_t> gWriteLatency[kSDFormatLatencyBuckets];
+
+// gCurrentPhase: The phase of the calling thread's innermost PhaseScope.
+static thread_local uint32_t gCurrentPhase = kSDFormatPhaseOther;
+
+// add
+// ---
+
+static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+  counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+// currentPhase
+// ------------
+
+static PhaseCounters& currentPhase() {
+  return gPhases[gCurrentPhase];
+}
+
+// latencyBucket
+// -------------
+// The histogram bucket for `microseconds`: the value itself below 4, then
+// four buckets per power of two, chosen by the two bits after the leading
+// one.
+
+static uint32_t latencyBucket(uint64_t microseconds) {
+  if (microseconds < 4) {
+    return static_cast<uint32_t>(microseconds);
+  }
+  const auto exponent = static_cast<uint32_t>(std::bit_width(microseconds)) - 1;
+  const auto fraction =
+      static_cast<uint32_t>((microseconds >> (exponent - 2)) & 3);
+  return std::min<uint32_t>(4 * (exponent - 1) + fraction,
+                            kSDFormatLatencyBuckets - 1);
+}
+
+// =============================================================================
+// Recording
+// =============================================================================
+
+uint64_t monotonicNanoseconds() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void recordWriteCall(size_t bytes, uint64_t nanoseconds) {
+  PhaseCounters& phase = currentPhase();
+  add(phase.writeCalls, 1);
+  add(phase.bytesWritten, bytes);
+  add(gWriteLatency[latencyBucket(nanoseconds / 1000)], 1);
+}
+
+void recordReadCall(size_t bytes) {
+  PhaseCounters& phase = currentPhase();
+  add(phase.readCalls, 1);
+  add(phase.bytesRead, bytes);
+}
+
+void recordSyncCall() { add(currentPhase().syncCalls, 1); }
+
+void recordOffloadCall(uint64_t bytes) {
+  PhaseCounters& phase = currentPhase();
+  add(phase.offloadCalls, 1);
+  add(phase.offloadBytes, bytes);
+}
+
+// PhaseScope
+// ----------
+// The clock is read only while statistics are enabled; a scope entered
+// while disabled records no elapsed time even if they are enabled before
+// it exits. Also fires the phase_start and phase_end probes.
+
+PhaseScope::PhaseScope(uint32_t phase)
+    : phase(phase),
+      previous(std::exchange(gCurrentPhase, phase)),
+      start(ioStatsEnabled() ? monotonicNanoseconds() : 0) {
+  SDFORMAT_TRACE1(phase_start, phase);
+}
+
+PhaseScope::~PhaseScope() {
+  if (start != 0 && ioStatsEnabled()) {
+    add(gPhases[phase].elapsedNanoseconds, monotonicNanoseconds() - start);
+  }
+  SDFORMAT_TRACE1(phase_end, phase);
+  gCurrentPhase = previous;
+}
+
+// activePhase / adoptPhase
+// ------------------------
+
+uint32_t activePhase() { return gCurrentPhase; }
+
+void adoptPhase(uint32_t phase) { gCurrentPhase = phase; }
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+void sdFormatEnableStats(bool enabled) {
+  gIOStatsEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void sdFormatResetStats(void) {
+  for (PhaseCounters& phase : gPhases) {
+    for (std::atomic<uint64_t>* counter :
+         {&phase.writeCalls, &phase.bytesWritten, &phase.readCalls,
+          &phase.bytesRead, &phase.syncCalls, &phase.offloadCalls,
+          &phase.offloadBytes, &phase.elapsedNanoseconds}) {
+      counter->store(0, std::memory_order_relaxed);
+    }
+  }
+  for (std::atomic<uint64_t>& bucket : gWriteLatency) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+void sdFormatGetStats(SDFormatStats* stats) {
+  auto load = [](const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+  };
+  for (uint32_t i = 0; i < kSDFormatPhaseCount; i++) {
+    const PhaseCounters& phase = gPhases[i];
+    stats->phases[i] = {
+        .writeCalls = load(phase.writeCalls),
+        .bytesWritten = load(phase.bytesWritten),
+        .readCalls = load(phase.readCalls),
+        .bytesRead = load(phase.bytesRead),
+        .syncCalls = load(phase.syncCalls),
+        .offloadCalls = load(phase.offloadCalls),
+        .offloadBytes = load(phase.offloadBytes),
+        .elapsedNanoseconds = load(phase.elapsedNanoseconds),
+    };
+  }
+  for (uint32_t i = 0; i < kSDFormatLatencyBuckets; i++) {
+    stats->writeLatency[i] = load(gWriteLatency[i]);
+  }
+}
+
+uint64_t sdFormatLatencyBucketMicroseconds(uint32_t bucket) {
+  bucket = std::min<uint32_t>(bucket, kSDFormatLatencyBuckets - 1);
+  if (bucket < 4) {
+    return bucket;
+  }
+  return uint64_t{4 + bucket % 4} << (bucket / 4 - 1);
+}
@@ -0,0 +1,84 @@
+// =============================================================================
+// IOStats.h
+// =============================================================================
+//
+// Internal header: the I/O statistics behind sdFormatGetStats. Not part of
+// the public API.
+//
+// SectorIO records every system call it makes against the current phase,
+// and the public functions mark their phases with a PhaseScope. While
+// statistics are disabled (the default), each recording site costs one
+// relaxed atomic load and a predictable branch; no clock is read.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_IO_STATS_H
+#define SD_FORMAT_IO_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "SDFormat.h"
+
+// gIOStatsEnabled: Set by sdFormatEnableStats. Read through ioStatsEnabled.
+extern std::atomic<bool> gIOStatsEnabled;
+
+// ioStatsEnabled
+// --------------
+inline bool ioStatsEnabled() {
+  return gIOStatsEnabled.load(std::memory_order_relaxed);
+}
+
+// monotonicNanoseconds
+// --------------------
+// A steady clock reading, for latencies.
+uint64_t monotonicNanoseconds();
+
+// recordWriteCall / recordReadCall
+// --------------------------------
+// One pwrite or pread that transferred `bytes` (0 if it failed) and took
+// `nanoseconds`. Writes also go into the latency histogram.
+void recordWriteCall(size_t bytes, uint64_t nanoseconds);
+void recordReadCall(size_t bytes);
+
+// recordSyncCall / recordOffloadCall
+// ----------------------------------
+// One fsync, or one zero or discard command that covered `bytes` without
+// transferring them (BLKZEROOUT, BLKDISCARD, fallocate).
+void recordSyncCall();
+void recordOffloadCall(uint64_t bytes);
+
+// PhaseScope
+// ----------
+// Attributes the I/O of its lifetime to `phase` (one of the kSDFormatPhase
+// constants) and adds its duration to the phase's elapsed time. Scopes nest;
+// the previous phase is restored on exit. The phase belongs to the calling
+// thread, so concurrent formats on other threads keep their own; a worker
+// thread doing I/O for a scope takes its phase with adoptPhase.
+struct PhaseScope {
+  explicit PhaseScope(uint32_t phase);
+  ~PhaseScope();
+
+  PhaseScope(const PhaseScope&) = delete;
+  PhaseScope& operator=(const PhaseScope&) = delete;
+
+  uint32_t phase;
+  uint32_t previous;
+  uint64_t start;
+};
+
+// activePhase
+// -----------
+// The kSDFormatPhase constant of the calling thread's innermost PhaseScope,
+// or kSDFormatPhaseOther outside any.
+uint32_t activePhase();
+
+// adoptPhase
+// ----------
+// Attributes the calling thread's I/O to `phase` (the activePhase of the
+// thread it works for) from now on. Adds no elapsed time and fires no
+// probes; those belong to the scope on the other thread.
+void adoptPhase(uint32_t phase);
+
+#endif  // SD_FORMAT_IO_STATS_H
@@ -0,0 +1,299 @@
+// =============================================================================
+// IOTrace.cpp
+// =============================================================================
+//
+// Implementation of I/O tracing: the recorder SectorIO feeds through
+// traceOperation, and the public functions sdFormatStartTrace,
+// sdFormatStopTrace, and sdFormatReplayTrace.
+//
+// Recording
+// ---------
+// Records are collected in a 64 KB buffer under a mutex (the zeroSectors
+// workers record concurrently) and appended to the trace file whenever it
+// fills. The trace file is written with plain write calls, never through
+// SectorIO, so writing the trace is not itself traced.
+//
+// =============================================================================
+
+#include "IOTrace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "FatStructures.h"
+#include "IOStats.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+std::atomic<int> gTracedFd{-1};
+
+// kTraceBufferRecords: Records collected before they are appended (64 KB).
+static constexpr size_t kTraceBufferRecords = 2048;
+
+// kReplayBufferBytes: Largest transfer the replay issues with one call.
+// Longer recorded transfers are split.
+static constexpr size_t kReplayBufferBytes = 16 << 20;
+
+// Recorder state, guarded by gTraceMutex.
+static std::mutex gTraceMutex;
+static int gTraceFile = -1;
+static uint64_t gTraceStart = 0;
+static int gTraceError = 0;
+static std::vector<TraceRecord> gTraceBuffer;
+
+// =============================================================================
+// Recording
+// =============================================================================
+
+// appendAll
+// ---------
+// Appends `bytes` to the trace file, retrying short writes and EINTR.
+
+static int appendAll(int fd, std::span<const std::byte> bytes) {
+  while (!bytes.empty()) {
+    ssize_t written = write(fd, bytes.data(), bytes.size());
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;  // Interrupted; retry
+      }
+      return errno;
+    }
+    bytes = bytes.subspan(static_cast<size_t>(written));
+  }
+  return 0;
+}
+
+// flushTraceBuffer
+// ----------------
+// Appends the buffered records. After the first failure, records are
+// dropped and the error is kept for sdFormatStopTrace. Requires the lock.
+
+static void flushTraceBuffer() {
+  if (gTraceError == 0) {
+    gTraceError = appendAll(gTraceFile, std::as_bytes(std::span{gTraceBuffer}));
+  }
+  gTraceBuffer.clear();
+}
+
+void traceOperation(uint16_t operation, uint64_t offset, uint64_t length,
+                    uint64_t start, uint64_t duration, int result) {
+  std::lock_guard lock(gTraceMutex);
+  if (gTraceFile < 0) {
+    return;  // Stopped while the call was in flight
+  }
+  gTraceBuffer.push_back(TraceRecord{
+      .timestamp = start > gTraceStart ? start - gTraceStart : 0,
+      .offset = offset,
+      .length = length,
+      .duration = static_cast<uint32_t>(
+          std::min<uint64_t>(duration, UINT32_MAX)),
+      .operation = operation,
+      .result = static_cast<int16_t>(result),
+  });
+  if (gTraceBuffer.size() >= kTraceBufferRecords) {
+    flushTraceBuffer();
+  }
+}
+
+// =============================================================================
+// Replay
+// =============================================================================
+
+// replayOperation
+// ---------------
+// Issues one recorded call against `fd`. `zeros` holds kReplayBufferBytes
+// of zeros and `scratch` as much space for reads.
+
+static int replayOperation(int fd, const TraceRecord& record,
+                           std::span<const std::byte> zeros,
+                           std::span<std::byte> scratch,
+                           SDFormatReplayReport& report) {
+  const auto offset = static_cast<off_t>(record.offset);
+  const auto sector = static_cast<off_t>(record.offset / kSectorSize);
+  const uint64_t sectors = record.length / kSectorSize;
+
+  switch (record.operation) {
+    case kTraceWrite:
+    case kTraceRead:
+      for (uint64_t done = 0; done < record.length;) {
+        const auto chunk = static_cast<size_t>(
+            std::min<uint64_t>(record.length - done, kReplayBufferBytes));
+        const off_t at = offset + static_cast<off_t>(done);
+        int err = record.operation == kTraceWrite
+                      ? writeBytes(fd, at, zeros.first(chunk))
+                      : readBytes(fd, at, scratch.first(chunk));
+        if (err != 0) {
+          return err;
+        }
+        if (record.operation == kTraceWrite) {
+          report.bytesWritten += chunk;
+        } else {
+          report.bytesRead += chunk;
+        }
+        done += chunk;
+      }
+      return 0;
+    case kTraceSync:
+      return syncDevice(fd);
+    case kTraceZeroDevice:
+    case kTraceZeroFile:
+      return zeroRegion(fd, sector, sectors);
+    case kTraceDiscardDevice:
+    case kTraceDiscardFile:
+      return discardRegion(fd, sector, sectors);
+    default:
+      return EINVAL;
+  }
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatStartTrace
+// ------------------
+
+int sdFormatStartTrace(int fd, const char* path) {
+  std::lock_guard lock(gTraceMutex);
+  if (gTraceFile >= 0) {
+    return EBUSY;
+  }
+
+  int file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file < 0) {
+    return errno;
+  }
+  TraceHeader header{};
+  std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.recordSize = sizeof(TraceRecord);
+  if (int err = appendAll(file, std::as_bytes(std::span{&header, 1}));
+      err != 0) {
+    close(file);
+    return err;
+  }
+
+  gTraceFile = file;
+  gTraceError = 0;
+  gTraceBuffer.reserve(kTraceBufferRecords);
+  gTraceStart = monotonicNanoseconds();
+  gTracedFd.store(fd, std::memory_order_relaxed);
+  return 0;
+}
+
+// sdFormatStopTrace
+// -----------------
+
+int sdFormatStopTrace(void) {
+  std::lock_guard lock(gTraceMutex);
+  if (gTraceFile < 0) {
+    return 0;
+  }
+
+  gTracedFd.store(-1, std::memory_order_relaxed);
+  flushTraceBuffer();
+  int err = gTraceError;
+  if (fsync(gTraceFile) != 0 && err == 0) {
+    err = errno;
+  }
+  close(gTraceFile);
+  gTraceFile = -1;
+  return err;
+}
+
+// sdFormatReplayTrace
+// -------------------
+// The trace is read kTraceBufferRecords at a time. Replay time is measured
+// from just before the first call, so a trace whose first call was recorded
+// late (after setup work) does not start with a long sleep. Records are in
+// completion order, so with concurrent writers a record can carry an
+// earlier timestamp than the one before it; it is issued immediately.
+
+int sdFormatReplayTrace(int fd, const char* tracePath, uint32_t flags,
+                        SDFormatReplayReport* report) {
+  using Clock = std::chrono::steady_clock;
+  *report = {};
+
+  int trace = open(tracePath, O_RDONLY | O_CLOEXEC);
+  if (trace < 0) {
+    return errno;
+  }
+  struct stat info;
+  TraceHeader header;
+  int err = fstat(trace, &info) == 0 ? 0 : errno;
+  if (err == 0 && info.st_size < off_t{sizeof(TraceHeader)}) {
+    err = EINVAL;
+  }
+  if (err == 0) {
+    err = readBytes(trace, 0, std::as_writable_bytes(std::span{&header, 1}));
+  }
+  if (err == 0 &&
+      (std::memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0 ||
+       header.version != kTraceVersion ||
+       header.recordSize != sizeof(TraceRecord))) {
+    err = EINVAL;
+  }
+  if (err != 0) {
+    close(trace);
+    return err;
+  }
+
+  const uint64_t recordCount =
+      (static_cast<uint64_t>(info.st_size) - sizeof(TraceHeader)) /
+      sizeof(TraceRecord);
+  const std::vector<std::byte> zeros(kReplayBufferBytes);
+  std::vector<std::byte> scratch(kReplayBufferBytes);
+  std::vector<TraceRecord> records;
+
+  uint64_t firstTimestamp = 0;
+  const Clock::time_point begin = Clock::now();
+  for (uint64_t index = 0; index < recordCount; index += records.size()) {
+    records.resize(static_cast<size_t>(
+        std::min<uint64_t>(recordCount - index, kTraceBufferRecords)));
+    const auto offset = static_cast<off_t>(sizeof(TraceHeader) +
+                                           index * sizeof(TraceRecord));
+    err = readBytes(trace, offset, std::as_writable_bytes(std::span{records}));
+    if (err != 0) {
+      break;
+    }
+
+    for (const TraceRecord& record : records) {
+      if (report->operations == 0) {
+        firstTimestamp = record.timestamp;
+      }
+      const uint64_t due = record.timestamp > firstTimestamp
+                               ? record.timestamp - firstTimestamp
+                               : 0;
+      if ((flags & kSDFormatReplayFast) == 0) {
+        std::this_thread::sleep_until(begin + std::chrono::nanoseconds(due));
+      }
+
+      const uint64_t start = monotonicNanoseconds();
+      if (replayOperation(fd, record, zeros, scratch, *report) != 0) {
+        report->failures++;
+      }
+      report->replayedIoNanoseconds += monotonicNanoseconds() - start;
+      report->recordedIoNanoseconds += record.duration;
+      report->recordedNanoseconds =
+          std::max(report->recordedNanoseconds, due + record.duration);
+      report->operations++;
+    }
+  }
+  report->elapsedNanoseconds = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           begin)
+          .count());
+
+  close(trace);
+  return err;
+}
@@ -0,0 +1,89 @@
+// =============================================================================
+// IOTrace.h
+// =============================================================================
+//
+// Internal header: the I/O trace recorder behind sdFormatStartTrace and the
+// trace file format read by sdFormatReplayTrace. Not part of the public API.
+//
+// Trace File
+// ----------
+// A 16-byte TraceHeader followed by one 32-byte TraceRecord per system call
+// issued against the traced descriptor, in the order the calls returned.
+// All fields are little-endian. Data is not recorded: a replayed write
+// writes zeros, which is what the formatter writes almost everywhere.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_IO_TRACE_H
+#define SD_FORMAT_IO_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+
+// kTraceMagic / kTraceVersion: TraceHeader.magic and TraceHeader.version.
+inline constexpr char kTraceMagic[8] = {'S', 'D', 'F', 'T', 'R', 'A', 'C', 'E'};
+inline constexpr uint32_t kTraceVersion = 1;
+
+// TraceOperation: TraceRecord.operation, the system call that was made.
+inline constexpr uint16_t kTraceWrite = 1;           // pwrite
+inline constexpr uint16_t kTraceRead = 2;            // pread
+inline constexpr uint16_t kTraceSync = 3;            // fsync
+inline constexpr uint16_t kTraceZeroDevice = 4;      // BLKZEROOUT
+inline constexpr uint16_t kTraceZeroFile = 5;        // FALLOC_FL_ZERO_RANGE
+inline constexpr uint16_t kTraceDiscardDevice = 6;   // BLKDISCARD
+inline constexpr uint16_t kTraceDiscardFile = 7;     // FALLOC_FL_PUNCH_HOLE
+
+// TraceHeader
+// -----------
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;  // sizeof(TraceRecord)
+} __attribute__((packed));
+
+static_assert(sizeof(TraceHeader) == 16, "TraceHeader must be 16 bytes");
+
+// TraceRecord
+// -----------
+
+struct TraceRecord {
+  // Submission time, in nanoseconds since sdFormatStartTrace.
+  uint64_t timestamp;
+
+  // Byte offset and length of the range. A successful pwrite or pread
+  // records the bytes it transferred; 0 for fsync.
+  uint64_t offset;
+  uint64_t length;
+
+  // Time the call took, in nanoseconds, saturated at UINT32_MAX (4.3 s).
+  uint32_t duration;
+
+  // kTrace... operation.
+  uint16_t operation;
+
+  // 0, or the errno the call failed with.
+  int16_t result;
+} __attribute__((packed));
+
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must be 32 bytes");
+
+// gTracedFd: The descriptor being traced, or -1. Read through ioTraceEnabled.
+extern std::atomic<int> gTracedFd;
+
+// ioTraceEnabled
+// --------------
+// True while I/O on `fd` is being recorded.
+inline bool ioTraceEnabled(int fd) {
+  return gTracedFd.load(std::memory_order_relaxed) == fd;
+}
+
+// traceOperation
+// --------------
+// Appends a record for a call that started at monotonic time `start` (see
+// monotonicNanoseconds) and took `duration` nanoseconds. Safe to call from
+// several threads at once.
+void traceOperation(uint16_t operation, uint64_t offset, uint64_t length,
+                    uint64_t start, uint64_t duration, int result);
+
+#endif  // SD_FORMAT_IO_TRACE_H
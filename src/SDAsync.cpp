@@ -0,0 +1,327 @@
+// =============================================================================
+// SDAsync.cpp
+// =============================================================================
+//
+// Implementation of the asynchronous formatting functions: sdFormatBegin,
+// sdFormatEventFd, sdFormatPollEvent, sdFormatCancel, and sdFormatFinish.
+//
+// Ownership
+// ---------
+// An operation's state is shared between the caller's handle and the
+// detached thread that runs the format, and is freed when both have let
+// go. The thread marks the operation finished before it delivers the last
+// event, so sdFormatFinish may be called from that event's callback
+// without waiting for the callback to return.
+//
+// =============================================================================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "FatStructures.h"
+#include "FormatLayout.h"
+#include "SDFormat.h"
+
+// OperationState
+// --------------
+
+struct OperationState {
+  // Copy of the parameters; `saves` points into `romNames`.
+  SDFormatParameters parameters;
+  std::string label;
+  std::vector<std::string> romNames;
+  std::vector<SDFormatSaveFile> saves;
+
+  // The profile and sector size in effect when the operation began, used
+  // by every step
+  FormatLayout layout;
+
+  SDFormatEventCallback callback;
+  void* context;
+  std::atomic<bool> cancelled{false};
+
+  // Event descriptor: an eventfd on Linux (both ends the same), a pipe
+  // elsewhere.
+  int readFd = -1;
+  int writeFd = -1;
+
+  // Guarded by `mutex`
+  std::mutex mutex;
+  std::condition_variable finishedChanged;
+  std::deque<SDFormatEvent> events;
+  bool finished = false;
+  int result = 0;
+
+  ~OperationState() {
+    if (writeFd >= 0 && writeFd != readFd) {
+      close(writeFd);
+    }
+    if (readFd >= 0) {
+      close(readFd);
+    }
+  }
+};
+
+// SDFormatOperation: The caller's handle.
+struct SDFormatOperation {
+  std::shared_ptr<OperationState> state;
+};
+
+// =============================================================================
+// Event Descriptor
+// =============================================================================
+
+// openEventFd
+// -----------
+
+static int openEventFd(OperationState& state) {
+#if defined(__linux__)
+  state.readFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (state.readFd < 0) {
+    return errno;
+  }
+  state.writeFd = state.readFd;
+#else
+  int ends[2];
+  if (pipe(ends) != 0) {
+    return errno;
+  }
+  state.readFd = ends[0];
+  state.writeFd = ends[1];
+  for (int fd : ends) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  return 0;
+}
+
+// signalEventFd / drainEventFd
+// ----------------------------
+// Make the descriptor readable, and not readable. A full pipe is already
+// readable, so a failed write needs no handling.
+
+static void signalEventFd(const OperationState& state) {
+#if defined(__linux__)
+  const uint64_t one = 1;
+  static_cast<void>(write(state.writeFd, &one, sizeof(one)));
+#else
+  const char one = 1;
+  static_cast<void>(write(state.writeFd, &one, sizeof(one)));
+#endif
+}
+
+static void drainEventFd(const OperationState& state) {
+  char buffer[64];
+  while (read(state.readFd, buffer, sizeof(buffer)) > 0) {
+  }
+}
+
+// =============================================================================
+// Running
+// =============================================================================
+
+// deliver
+// -------
+// Queues an event and calls the callback. The last event also publishes
+// the result, before the callback runs.
+
+static void deliver(OperationState& state, const SDFormatEvent& event) {
+  {
+    std::lock_guard lock(state.mutex);
+    state.events.push_back(event);
+    signalEventFd(state);
+    if (event.finished) {
+      state.finished = true;
+      state.result = event.result;
+    }
+  }
+  if (event.finished) {
+    state.finishedChanged.notify_all();
+  }
+  if (state.callback != nullptr) {
+    state.callback(state.context, &event);
+  }
+}
+
+// kSteps: The phases of a format, in order. The last is run only when
+// there are saves to preallocate.
+static constexpr uint32_t kSteps[] = {
+    kSDFormatPhaseMBR, kSDFormatPhaseVBR,           kSDFormatPhaseFSInfo,
+    kSDFormatPhaseFAT, kSDFormatPhaseRootDirectory, kSDFormatPhaseSaveFiles,
+};
+
+// runStep
+// -------
+
+static int runStep(const OperationState& state, uint32_t phase) {
+  const SDFormatParameters& p = state.parameters;
+  const FormatLayout& layout = state.layout;
+  switch (phase) {
+    case kSDFormatPhaseMBR:
+      return writeFormatMBR(p.fd, layout, p.sectorCount);
+    case kSDFormatPhaseVBR:
+      return writeFormatVolumeBootRecord(p.fd, layout, p.sectorCount,
+                                         p.label);
+    case kSDFormatPhaseFSInfo:
+      return writeFormatFSInfo(p.fd, layout, p.sectorCount, p.rootClusters);
+    case kSDFormatPhaseFAT:
+      return writeFormatFat32Tables(p.fd, layout, p.sectorCount,
+                                    p.rootClusters);
+    case kSDFormatPhaseRootDirectory:
+      return writeFormatRootDirectory(p.fd, layout, p.sectorCount,
+                                      p.rootClusters, p.label);
+    default:
+      return writeFormatSaveFiles(p.fd, layout, p.sectorCount,
+                                  p.rootClusters, p.saves, p.saveCount);
+  }
+}
+
+// runOperation
+// ------------
+// The body of the operation's thread: the steps in order, an event after
+// each, and the final event.
+
+static void runOperation(const std::shared_ptr<OperationState>& state) {
+  const SDFormatParameters& p = state->parameters;
+  const uint32_t stepCount = p.saveCount > 0 ? 6 : 5;
+
+  SDFormatEvent event = {
+      .phase = kSDFormatPhaseOther,
+      .stepsDone = 0,
+      .stepCount = stepCount,
+      .finished = false,
+      .result = 0,
+  };
+  for (uint32_t step = 0; step < stepCount; step++) {
+    event.phase = kSteps[step];
+    if (state->cancelled.load(std::memory_order_relaxed)) {
+      event.result = ECANCELED;
+      break;
+    }
+    if (int err = runStep(*state, kSteps[step]); err != 0) {
+      event.result = err;
+      break;
+    }
+    event.stepsDone++;
+    if (event.stepsDone < event.stepCount) {
+      deliver(*state, event);
+    }
+  }
+  event.finished = true;
+  deliver(*state, event);
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatBegin
+// -------------
+
+int sdFormatBegin(const SDFormatParameters* parameters,
+                  SDFormatEventCallback callback, void* context,
+                  SDFormatOperation** operation) {
+  *operation = nullptr;
+  const FormatLayout formatLayout = currentFormatLayout(parameters->fd);
+  SDFormatLayout layout;
+  sdFormatGetLayout(formatLayout.profile, &layout);
+  if (parameters->rootClusters < 1 ||
+      parameters->rootClusters > layout.maxRootClusters ||
+      (parameters->saveCount > 0 && parameters->saves == nullptr)) {
+    return EINVAL;
+  }
+
+  auto state = std::make_shared<OperationState>();
+  state->callback = callback;
+  state->context = context;
+  state->label = parameters->label != nullptr ? parameters->label : "";
+  for (uint32_t i = 0; i < parameters->saveCount; i++) {
+    state->romNames.emplace_back(parameters->saves[i].romName);
+  }
+  for (uint32_t i = 0; i < parameters->saveCount; i++) {
+    state->saves.push_back(
+        {state->romNames[i].c_str(), parameters->saves[i].saveSize});
+  }
+  state->parameters = *parameters;
+  state->parameters.label = state->label.c_str();
+  state->parameters.saves = state->saves.data();
+  state->layout = formatLayout;
+  if (int err = openEventFd(*state); err != 0) {
+    return err;
+  }
+
+  // The handle is published before the thread starts, so a callback can
+  // already use it
+  *operation = new SDFormatOperation{state};
+  try {
+    std::thread([state] { runOperation(state); }).detach();
+  } catch (const std::system_error& error) {
+    delete *operation;
+    *operation = nullptr;
+    return error.code().value();
+  }
+  return 0;
+}
+
+// sdFormatEventFd
+// ---------------
+
+int sdFormatEventFd(SDFormatOperation* operation) {
+  return operation->state->readFd;
+}
+
+// sdFormatPollEvent
+// -----------------
+// The descriptor is drained only once the queue is found empty, under the
+// same lock deliver() holds while queueing, so it is readable whenever
+// events are waiting (and at most once more after the last is taken).
+
+bool sdFormatPollEvent(SDFormatOperation* operation, SDFormatEvent* event) {
+  OperationState& state = *operation->state;
+  std::lock_guard lock(state.mutex);
+  if (state.events.empty()) {
+    drainEventFd(state);
+    return false;
+  }
+  *event = state.events.front();
+  state.events.pop_front();
+  return true;
+}
+
+// sdFormatCancel
+// --------------
+
+void sdFormatCancel(SDFormatOperation* operation) {
+  operation->state->cancelled.store(true, std::memory_order_relaxed);
+}
+
+// sdFormatFinish
+// --------------
+
+int sdFormatFinish(SDFormatOperation* operation) {
+  int result;
+  {
+    OperationState& state = *operation->state;
+    std::unique_lock lock(state.mutex);
+    state.finishedChanged.wait(lock, [&state] { return state.finished; });
+    result = state.result;
+  }
+  delete operation;
+  return result;
+}
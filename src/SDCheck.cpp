@@ -0,0 +1,425 @@
+// =============================================================================
+// SDCheck.cpp
+// =============================================================================
+//
+// Implementation of sdFormatCheck, a read-only consistency checker for
+// FAT32 volumes.
+//
+// The checker is built for triaging returned cards quickly, so it makes a
+// single pass over each structure:
+//
+//   1. Boot region — MBR, primary VBR, backup VBR (3 sector reads)
+//   2. FAT region  — each FAT copy read once, in parallel chunks; the
+//                    primary copy stays in memory for the chain walk
+//   3. Data region — only directory clusters are read
+//   4. FSInfo      — 1 sector read
+//
+// Cluster ownership is tracked in a bitmap (one bit per cluster). A chain
+// that runs into a cluster already set in the bitmap is either looping back
+// onto itself or cross-linked with an earlier chain; the two cases are told
+// apart by re-walking the current chain, which only happens on error.
+//
+// =============================================================================
+
+#include <errno.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// =============================================================================
+// FAT Mirror Comparison
+// =============================================================================
+
+// kCompareChunkSectors: FAT sectors read per request by each worker (1 MB).
+static constexpr uint32_t kCompareChunkSectors = 2048;
+
+// kMaxCompareWorkers: Upper bound on comparison threads.
+// A single SD card rarely benefits from more than a few outstanding reads;
+// beyond that the threads only contend for the same queue.
+static constexpr unsigned kMaxCompareWorkers = 8;
+
+// compareFatRange
+// ---------------
+// Reads FAT sectors [firstSector, endSector) of the primary copy into
+// `fat`, reads the same range of every other copy, and counts the sectors
+// that differ. A whole-chunk memcmp handles the common (identical) case;
+// the per-sector comparison only runs on a chunk that differs.
+
+static int compareFatRange(int fd, const VolumeGeometry& geometry,
+                           uint32_t firstSector, uint32_t endSector,
+                           std::span<uint32_t> fat,
+                           uint32_t& mismatchSectors) {
+  constexpr size_t kEntriesPerSector = kSectorSize / sizeof(uint32_t);
+  std::vector<std::byte> mirror(size_t{kCompareChunkSectors} * kSectorSize);
+
+  for (uint32_t sector = firstSector; sector < endSector;
+       sector += kCompareChunkSectors) {
+    uint32_t sectors = std::min(kCompareChunkSectors, endSector - sector);
+    auto primary = std::as_writable_bytes(
+        fat.subspan(size_t{sector} * kEntriesPerSector,
+                    size_t{sectors} * kEntriesPerSector));
+
+    off_t primaryOffset =
+        static_cast<off_t>((geometry.fatStart + sector) * kSectorSize);
+    if (int err = readBytes(fd, primaryOffset, primary); err != 0) {
+      return err;
+    }
+
+    for (uint32_t copy = 1; copy < geometry.fatCount; copy++) {
+      auto backup = std::span{mirror}.first(primary.size());
+      off_t backupOffset = primaryOffset + static_cast<off_t>(
+                                               uint64_t{copy} *
+                                               geometry.fatSizeSectors *
+                                               kSectorSize);
+      if (int err = readBytes(fd, backupOffset, backup); err != 0) {
+        return err;
+      }
+      if (std::memcmp(primary.data(), backup.data(), primary.size()) == 0) {
+        continue;
+      }
+      for (size_t offset = 0; offset < primary.size(); offset += kSectorSize) {
+        if (std::memcmp(primary.data() + offset, backup.data() + offset,
+                        kSectorSize) != 0) {
+          mismatchSectors++;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+// loadAndCompareFats
+// ------------------
+// Loads the primary FAT into `fat` while comparing it with every other
+// copy. The FAT is split into one contiguous range per worker thread; the
+// workers use positioned reads, so they share the file descriptor safely.
+
+static int loadAndCompareFats(int fd, const VolumeGeometry& geometry,
+                              std::vector<uint32_t>& fat,
+                              uint32_t& mismatchSectors) {
+  fat.resize(size_t{geometry.fatSizeSectors} * kSectorSize / sizeof(uint32_t));
+
+  unsigned workers = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                kMaxCompareWorkers);
+  uint32_t perWorker = (geometry.fatSizeSectors + workers - 1) / workers;
+  // Keep each worker's range a whole number of chunks where possible
+  perWorker = std::max(perWorker, kCompareChunkSectors);
+
+  std::vector<std::thread> threads;
+  std::vector<int> errors(workers, 0);
+  std::vector<uint32_t> mismatches(workers, 0);
+  threads.reserve(workers);
+
+  for (unsigned worker = 0; worker < workers; worker++) {
+    uint64_t first = uint64_t{worker} * perWorker;
+    if (first >= geometry.fatSizeSectors) {
+      break;
+    }
+    auto end = static_cast<uint32_t>(
+        std::min<uint64_t>(first + perWorker, geometry.fatSizeSectors));
+    auto compare = [&, worker, first, end] {
+      errors[worker] =
+          compareFatRange(fd, geometry, static_cast<uint32_t>(first), end,
+                          fat, mismatches[worker]);
+    };
+    try {
+      threads.emplace_back(compare);
+    } catch (const std::system_error&) {
+      // Out of threads: compare this range on the calling thread
+      compare();
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (unsigned worker = 0; worker < workers; worker++) {
+    if (errors[worker] != 0) {
+      return errors[worker];
+    }
+    mismatchSectors += mismatches[worker];
+  }
+  return 0;
+}
+
+// =============================================================================
+// Cluster Chain Validation
+// =============================================================================
+
+// ClusterBitmap
+// -------------
+// One bit per FAT entry, set when a chain claims the cluster.
+
+struct ClusterBitmap {
+  std::vector<uint64_t> words;
+
+  explicit ClusterBitmap(size_t bits) : words((bits + 63) / 64) {}
+
+  bool test(uint32_t cluster) const {
+    return (words[cluster / 64] >> (cluster % 64)) & 1;
+  }
+
+  void set(uint32_t cluster) {
+    words[cluster / 64] |= uint64_t{1} << (cluster % 64);
+  }
+};
+
+// ChainStatus
+// -----------
+// Outcome of walking one cluster chain.
+
+enum class ChainStatus {
+  kOk,           // Ended in an end-of-chain entry
+  kBroken,       // Reached a free, bad, reserved, or out-of-range cluster
+  kLooped,       // Revisited one of its own clusters
+  kCrossLinked,  // Reached a cluster claimed by an earlier chain
+};
+
+// chainContains
+// -------------
+// True if `target` is among the first `length` clusters of the chain
+// starting at `firstCluster`. Only called after a collision, to tell a
+// loop from a cross-link.
+
+static bool chainContains(std::span<const uint32_t> fat, uint32_t firstCluster,
+                          uint64_t length, uint32_t target) {
+  uint32_t cluster = firstCluster;
+  for (uint64_t i = 0; i < length; i++) {
+    if (cluster == target) {
+      return true;
+    }
+    cluster = fat[cluster] & kFat32EntryMask;
+  }
+  return false;
+}
+
+// claimChain
+// ----------
+// Walks the chain starting at `firstCluster`, setting each cluster in
+// `claimed`. `length` receives the number of clusters claimed.
+
+static ChainStatus claimChain(const VolumeGeometry& geometry,
+                              std::span<const uint32_t> fat,
+                              ClusterBitmap& claimed, uint32_t firstCluster,
+                              uint64_t& length) {
+  length = 0;
+  uint32_t cluster = firstCluster;
+
+  while (true) {
+    if (!isClusterNumber(geometry, cluster)) {
+      return ChainStatus::kBroken;
+    }
+    if (claimed.test(cluster)) {
+      return chainContains(fat, firstCluster, length, cluster)
+                 ? ChainStatus::kLooped
+                 : ChainStatus::kCrossLinked;
+    }
+    claimed.set(cluster);
+    length++;
+
+    uint32_t next = fat[cluster] & kFat32EntryMask;
+    if (next >= kFat32EndOfChainMin) {
+      return ChainStatus::kOk;
+    }
+    cluster = next;
+  }
+}
+
+// recordChainStatus
+// -----------------
+// Adds a non-OK chain status to the matching report counter.
+
+static void recordChainStatus(ChainStatus status, SDFormatCheckReport& report) {
+  switch (status) {
+    case ChainStatus::kOk:
+      break;
+    case ChainStatus::kBroken:
+      report.brokenChains++;
+      break;
+    case ChainStatus::kLooped:
+      report.loopedChains++;
+      break;
+    case ChainStatus::kCrossLinked:
+      report.crossLinkedChains++;
+      break;
+  }
+}
+
+// checkChains
+// -----------
+// Claims the root directory chain, then every chain reachable from the
+// directory tree, and finally counts allocated clusters left unclaimed.
+
+static int checkChains(int fd, const VolumeGeometry& geometry,
+                       std::span<const uint32_t> fat,
+                       SDFormatCheckReport& report) {
+  const uint64_t clusterBytes =
+      uint64_t{geometry.sectorsPerCluster} * kSectorSize;
+  ClusterBitmap claimed(fat.size());
+  uint64_t length = 0;
+
+  report.directoryCount = 1;
+  recordChainStatus(
+      claimChain(geometry, fat, claimed, geometry.rootCluster, length),
+      report);
+
+  int err = walkDirectoryTree(
+      fd, geometry, fat, [&](const DirectorySlot& slot) {
+        const DirectoryEntry& entry = slot.entry;
+        const bool isDirectory = (entry.attributes & kAttrDirectory) != 0;
+        const uint32_t firstCluster = firstClusterOf(entry);
+
+        if (isDirectory) {
+          report.directoryCount++;
+        } else {
+          report.fileCount++;
+        }
+
+        // Empty files have no chain; everything else must have one
+        if (firstCluster == 0) {
+          if (isDirectory) {
+            report.brokenChains++;
+          } else if (entry.fileSize != 0) {
+            report.sizeMismatches++;
+          }
+          return false;
+        }
+
+        ChainStatus status =
+            claimChain(geometry, fat, claimed, firstCluster, length);
+        recordChainStatus(status, report);
+
+        if (!isDirectory && status == ChainStatus::kOk &&
+            length != (entry.fileSize + clusterBytes - 1) / clusterBytes) {
+          report.sizeMismatches++;
+        }
+
+        // Never descend into a directory that shares clusters with
+        // something already walked; its contents are not trustworthy.
+        return status != ChainStatus::kCrossLinked;
+      });
+  if (err != 0) {
+    return err;
+  }
+
+  for (uint32_t cluster = kRootCluster;
+       cluster < geometry.clusterCount + kRootCluster; cluster++) {
+    uint32_t value = fat[cluster] & kFat32EntryMask;
+    if (value != 0 && value != kFat32BadCluster && !claimed.test(cluster)) {
+      report.lostClusters++;
+    }
+  }
+  return 0;
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatCheck
+// -------------
+// Runs the four check phases in order. The boot region decides which
+// geometry the later phases use: the primary VBR when it is valid,
+// otherwise the backup at the standard sector 6.
+
+int sdFormatCheck(int fd, SDFormatCheckReport* report) {
+  *report = {};
+  SectorBytes raw;
+
+  // ---------------------------------------------------------------------------
+  // Boot region
+  // ---------------------------------------------------------------------------
+
+  PartitionLocation partition;
+  if (int err = findFat32Partition(fd, partition); err == 0) {
+    report->mbrValid = true;
+  } else if (err != EINVAL) {
+    return err;
+  }
+
+  // Without a usable partition table, assume the layout sdFormatWriteMBR
+  // produces
+  uint64_t partitionStart =
+      report->mbrValid ? partition.start : kPartitionAlignmentSectors;
+
+  SectorBytes primaryRaw;
+  if (int err = readSector(fd, partitionStart, primaryRaw); err != 0) {
+    return err;
+  }
+  const auto primaryVbr = std::bit_cast<VolumeBootRecord>(primaryRaw);
+  VolumeGeometry geometry;
+  report->vbrValid =
+      decodeVolumeGeometry(primaryVbr, partitionStart, geometry) == 0;
+
+  // Without the primary, the backup is taken to be at logical sector 6
+  const uint32_t units = deviceSectorSize(fd).logicalBytes / kSectorSize;
+  uint32_t backupSector = report->vbrValid ? geometry.backupBootSector
+                                           : kBackupBootSector * units;
+  if (int err = readSector(fd, partitionStart + backupSector, raw); err != 0) {
+    return err;
+  }
+  const auto backupVbr = std::bit_cast<VolumeBootRecord>(raw);
+  VolumeGeometry backupGeometry;
+  report->backupVbrValid =
+      decodeVolumeGeometry(backupVbr, partitionStart, backupGeometry) == 0;
+  report->backupVbrMatches = primaryRaw == raw;
+
+  if (!report->vbrValid) {
+    if (!report->backupVbrValid) {
+      return EINVAL;
+    }
+    geometry = backupGeometry;
+  }
+  const VolumeBootRecord& vbr = report->vbrValid ? primaryVbr : backupVbr;
+  report->mbrMatchesVbr = report->mbrValid &&
+                          vbr.bpb.hiddenSectors == partition.lbaStart &&
+                          vbr.bpb.totalSectors32 == partition.sectorCount;
+  report->clusterCount = geometry.clusterCount;
+
+  // ---------------------------------------------------------------------------
+  // FAT region
+  // ---------------------------------------------------------------------------
+
+  std::vector<uint32_t> fat;
+  if (int err = loadAndCompareFats(fd, geometry, fat,
+                                   report->fatMismatchSectors);
+      err != 0) {
+    return err;
+  }
+  report->freeClusters = countFreeEntries(
+      std::span{fat}.subspan(kRootCluster, geometry.clusterCount));
+
+  // ---------------------------------------------------------------------------
+  // Directory tree and cluster chains
+  // ---------------------------------------------------------------------------
+
+  if (int err = checkChains(fd, geometry, fat, *report); err != 0) {
+    return err;
+  }
+
+  // ---------------------------------------------------------------------------
+  // FSInfo
+  // ---------------------------------------------------------------------------
+
+  if (int err = readSector(fd, partitionStart + geometry.fsInfoSector, raw);
+      err != 0) {
+    return err;
+  }
+  const auto fsinfo = std::bit_cast<FSInfo>(raw);
+  report->fsInfoValid = hasFsInfoSignatures(fsinfo);
+  report->fsInfoFreeCount = fsinfo.freeCount;
+  report->fsInfoNextFree = fsinfo.nextFree;
+
+  return 0;
+}
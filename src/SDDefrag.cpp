@@ -0,0 +1,425 @@
+// =============================================================================
+// SDDefrag.cpp
+// =============================================================================
+//
+// Implementation of sdFormatDefragment: makes ROM and save files contiguous.
+//
+// DS flashcart kernels stream ROMs and saves by cluster. Several of them
+// require contiguous files outright, and the rest slow down heavily when
+// every cluster boundary means a FAT lookup and a seek.
+//
+// Planning
+// --------
+// Only fragmented files are touched. For each one (largest first), the
+// planner picks the cheapest of two relocations using a map of free runs
+// built from the FAT:
+//
+//   Extend in place — if the clusters right after the file's first extent
+//   are free, only the clusters after that extent move:
+//
+//     before:  [A A A] . . . [x x] [A A]        A = file, . = free
+//     after:   [A A A  A A] . .  [x x] . .
+//
+//   Relocate — otherwise the whole file moves to the smallest free run that
+//   can hold it (best fit), keeping large runs available for large files.
+//
+// Crash Ordering
+// --------------
+// Every relocation is committed in four steps, each followed by a sync:
+//
+//   1. Copy the data into the new (still free) clusters.
+//   2. Link the new clusters in every FAT copy.
+//   3. Switch the file over with a single small write: the directory
+//      entry's first cluster (relocate) or the FAT entry of the last kept
+//      cluster (extend in place).
+//   4. Free the old clusters in every FAT copy.
+//
+// A crash before step 3 leaves the file untouched and some lost clusters;
+// a crash after it leaves the file intact at its new location and some
+// lost clusters. The file never references a half-written cluster.
+//
+// =============================================================================
+
+#include <errno.h>
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// kDefragBufferBytes: Size of the copy buffer.
+// Source clusters are gathered into this buffer and written to the
+// destination run with one write per buffer.
+static constexpr size_t kDefragBufferBytes = 8 << 20;
+
+// =============================================================================
+// Free Space
+// =============================================================================
+
+// FreeRuns
+// --------
+// Free clusters as a map from the first cluster of each run to its length.
+// Adjacent runs are merged on insertion, so a run is always maximal.
+
+using FreeRuns = std::map<uint32_t, uint32_t>;
+
+static FreeRuns collectFreeRuns(const VolumeGeometry& geometry,
+                                std::span<const uint32_t> fat) {
+  FreeRuns runs;
+  uint32_t end = geometry.clusterCount + kRootCluster;
+  for (uint32_t cluster = kRootCluster; cluster < end;) {
+    if ((fat[cluster] & kFat32EntryMask) != 0) {
+      cluster++;
+      continue;
+    }
+    uint32_t start = cluster;
+    while (cluster < end && (fat[cluster] & kFat32EntryMask) == 0) {
+      cluster++;
+    }
+    runs.emplace(start, cluster - start);
+  }
+  return runs;
+}
+
+// isFreeRange
+// -----------
+// True if clusters [first, first + count) are all inside one free run.
+
+static bool isFreeRange(const FreeRuns& runs, uint32_t first, uint32_t count) {
+  auto it = runs.upper_bound(first);
+  if (it == runs.begin()) {
+    return false;
+  }
+  --it;
+  return uint64_t{first} + count <= uint64_t{it->first} + it->second;
+}
+
+// takeRange
+// ---------
+// Removes clusters [first, first + count) from the free runs. The range
+// must lie inside a single run (see isFreeRange).
+
+static void takeRange(FreeRuns& runs, uint32_t first, uint32_t count) {
+  auto it = std::prev(runs.upper_bound(first));
+  uint32_t runStart = it->first;
+  uint32_t runEnd = it->first + it->second;
+  runs.erase(it);
+  if (runStart < first) {
+    runs.emplace(runStart, first - runStart);
+  }
+  if (first + count < runEnd) {
+    runs.emplace(first + count, runEnd - (first + count));
+  }
+}
+
+// releaseCluster
+// --------------
+// Returns one cluster to the free runs, merging with its neighbours.
+
+static void releaseCluster(FreeRuns& runs, uint32_t cluster) {
+  uint32_t start = cluster;
+  uint32_t length = 1;
+
+  auto next = runs.find(cluster + 1);
+  if (next != runs.end()) {
+    length += next->second;
+    runs.erase(next);
+  }
+  auto prev = runs.lower_bound(cluster);
+  if (prev != runs.begin()) {
+    --prev;
+    if (prev->first + prev->second == cluster) {
+      start = prev->first;
+      length += prev->second;
+      runs.erase(prev);
+    }
+  }
+  runs.emplace(start, length);
+}
+
+// findBestFit
+// -----------
+// Returns the first cluster of the smallest free run holding `count`
+// clusters, or 0 if no run is large enough.
+
+static uint32_t findBestFit(const FreeRuns& runs, uint32_t count) {
+  uint32_t best = 0;
+  uint32_t bestLength = 0;
+  for (const auto& [start, length] : runs) {
+    if (length >= count && (best == 0 || length < bestLength)) {
+      best = start;
+      bestLength = length;
+    }
+  }
+  return best;
+}
+
+// =============================================================================
+// Committing Changes
+// =============================================================================
+
+// copyClusters
+// ------------
+// Copies the data of `source` (in chain order) into the contiguous run
+// starting at `destination`. Source clusters that are adjacent on disk are
+// read with one call; the destination is written one full buffer at a time.
+
+static int copyClusters(int fd, const VolumeGeometry& geometry,
+                        std::span<const uint32_t> source,
+                        uint32_t destination) {
+  const size_t clusterBytes = size_t{geometry.sectorsPerCluster} * kSectorSize;
+  const size_t clustersPerBuffer =
+      std::max<size_t>(1, kDefragBufferBytes / clusterBytes);
+  std::vector<std::byte> buffer(clustersPerBuffer * clusterBytes);
+
+  for (size_t done = 0; done < source.size();) {
+    size_t batch = std::min(clustersPerBuffer, source.size() - done);
+
+    for (size_t i = 0; i < batch;) {
+      size_t j = i + 1;
+      while (j < batch && source[done + j] == source[done + j - 1] + 1) {
+        j++;
+      }
+      uint64_t offset = clusterLba(geometry, source[done + i]) * kSectorSize;
+      auto slice = std::span{buffer}.subspan(i * clusterBytes,
+                                             (j - i) * clusterBytes);
+      if (int err = readBytes(fd, static_cast<off_t>(offset), slice);
+          err != 0) {
+        return err;
+      }
+      i = j;
+    }
+
+    uint32_t target = destination + static_cast<uint32_t>(done);
+    uint64_t offset = clusterLba(geometry, target) * kSectorSize;
+    if (int err = writeBytes(fd, static_cast<off_t>(offset),
+                             std::span{buffer}.first(batch * clusterBytes));
+        err != 0) {
+      return err;
+    }
+    done += batch;
+  }
+
+  return syncDevice(fd);
+}
+
+// writeFirstCluster
+// -----------------
+// Rewrites a directory entry with a new first cluster, keeping every other
+// field. The entry is 32 bytes inside one sector, so the update is atomic;
+// on a device with larger physical blocks its block is rewritten whole.
+
+static int writeFirstCluster(int fd, const DirectorySlot& slot,
+                             uint32_t firstCluster) {
+  const DirectoryEntry& old = slot.entry;
+  const DirectoryEntry updated = {
+      .name = old.name,
+      .attributes = old.attributes,
+      .ntReserved = old.ntReserved,
+      .creationTimeTenths = old.creationTimeTenths,
+      .creationTime = old.creationTime,
+      .creationDate = old.creationDate,
+      .lastAccessDate = old.lastAccessDate,
+      .firstClusterHigh = static_cast<uint16_t>(firstCluster >> 16),
+      .writeTime = old.writeTime,
+      .writeDate = old.writeDate,
+      .firstClusterLow = static_cast<uint16_t>(firstCluster & 0xFFFF),
+      .fileSize = old.fileSize,
+  };
+  if (int err = writeAlignedBytes(fd, static_cast<off_t>(slot.offset),
+                                  std::as_bytes(std::span{&updated, 1}),
+                                  deviceSectorSize(fd).physicalBytes);
+      err != 0) {
+    return err;
+  }
+  return syncDevice(fd);
+}
+
+// =============================================================================
+// Planning
+// =============================================================================
+
+// FragmentedFile
+// --------------
+// A candidate file and its current cluster chain.
+
+struct FragmentedFile {
+  DirectorySlot slot;
+  std::vector<uint32_t> chain;
+};
+
+// isDefragCandidate
+// -----------------
+// True for regular files with the extension of a DS ROM (.NDS) or save
+// (.SAV), or for every regular file when `allFiles` is set.
+
+static bool isDefragCandidate(const DirectoryEntry& entry, bool allFiles) {
+  if ((entry.attributes & kAttrDirectory) != 0) {
+    return false;
+  }
+  if (allFiles) {
+    return true;
+  }
+  std::string_view extension{entry.name.data() + 8, 3};
+  return extension == "NDS" || extension == "SAV";
+}
+
+// firstExtentLength
+// -----------------
+// Number of clusters at the start of `chain` that are contiguous on disk.
+
+static uint32_t firstExtentLength(std::span<const uint32_t> chain) {
+  uint32_t length = 1;
+  while (length < chain.size() && chain[length] == chain[length - 1] + 1) {
+    length++;
+  }
+  return length;
+}
+
+// relocateFile
+// ------------
+// Moves everything after the first `keep` clusters of the file to the
+// free run starting at `destination`, following the four-step commit
+// order described at the top of this file.
+
+static int relocateFile(int fd, const VolumeGeometry& geometry,
+                        std::vector<uint32_t>& fat, FreeRuns& runs,
+                        const FragmentedFile& file, uint32_t keep,
+                        uint32_t destination) {
+  auto moving = std::span{file.chain}.subspan(keep);
+  auto count = static_cast<uint32_t>(moving.size());
+  std::vector<uint32_t> dirty;
+
+  takeRange(runs, destination, count);
+
+  // 1. Data
+  if (int err = copyClusters(fd, geometry, moving, destination); err != 0) {
+    return err;
+  }
+
+  // 2. New chain
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t cluster = destination + i;
+    setFatEntry(fat, cluster, i + 1 < count ? cluster + 1 : kFat32EndOfChain,
+                dirty);
+  }
+  if (int err = flushFatSectors(fd, geometry, fat, dirty); err != 0) {
+    return err;
+  }
+
+  // 3. Switch
+  if (keep == 0) {
+    if (int err = writeFirstCluster(fd, file.slot, destination); err != 0) {
+      return err;
+    }
+  } else {
+    setFatEntry(fat, file.chain[keep - 1], destination, dirty);
+    if (int err = flushFatSectors(fd, geometry, fat, dirty); err != 0) {
+      return err;
+    }
+  }
+
+  // 4. Old clusters
+  for (uint32_t cluster : moving) {
+    setFatEntry(fat, cluster, 0, dirty);
+    releaseCluster(runs, cluster);
+  }
+  return flushFatSectors(fd, geometry, fat, dirty);
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatDefragment
+// ------------------
+// Collects the fragmented candidates in one tree walk, then relocates them
+// largest first. The FAT is held in memory for planning and written back
+// one dirty sector range at a time by each commit step.
+
+int sdFormatDefragment(int fd, uint32_t flags, SDFormatDefragReport* report) {
+  *report = {};
+
+  VolumeGeometry geometry;
+  if (int err = readVolumeGeometry(fd, geometry); err != 0) {
+    return err;
+  }
+  std::vector<uint32_t> fat;
+  if (int err = readFat(fd, geometry, 0, fat); err != 0) {
+    return err;
+  }
+
+  // Collect fragmented candidates
+  const bool allFiles = (flags & kSDFormatDefragAllFiles) != 0;
+  std::vector<FragmentedFile> fragmented;
+  int err = walkDirectoryTree(
+      fd, geometry, fat, [&](const DirectorySlot& slot) {
+        uint32_t firstCluster = firstClusterOf(slot.entry);
+        if (!isDefragCandidate(slot.entry, allFiles) ||
+            !isClusterNumber(geometry, firstCluster)) {
+          return true;
+        }
+        report->filesExamined++;
+
+        FragmentedFile file{slot, {}};
+        if (followChain(geometry, fat, firstCluster, maxFileClusters(geometry),
+                        file.chain) != 0) {
+          report->filesSkipped++;  // Broken chain: leave it to the checker
+          return true;
+        }
+        if (firstExtentLength(file.chain) < file.chain.size()) {
+          fragmented.push_back(std::move(file));
+        }
+        return true;
+      });
+  if (err != 0) {
+    return err;
+  }
+  report->filesFragmented = static_cast<uint32_t>(fragmented.size());
+
+  // Largest first, so best fit does not split the runs they need. Sorting
+  // needs move assignment, which FragmentedFile lacks (every field of the
+  // DirectoryEntry in its slot is const), so indices are sorted instead.
+  std::vector<size_t> order(fragmented.size());
+  std::iota(order.begin(), order.end(), size_t{0});
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return fragmented[a].chain.size() > fragmented[b].chain.size();
+  });
+
+  FreeRuns runs = collectFreeRuns(geometry, fat);
+  for (size_t index : order) {
+    const FragmentedFile& file = fragmented[index];
+    auto length = static_cast<uint32_t>(file.chain.size());
+    uint32_t keep = firstExtentLength(file.chain);
+    uint32_t destination = file.chain[0] + keep;
+
+    if (!isFreeRange(runs, destination, length - keep)) {
+      keep = 0;
+      destination = findBestFit(runs, length);
+      if (destination == 0) {
+        report->filesSkipped++;  // No free run is large enough
+        continue;
+      }
+    }
+
+    if (int err = relocateFile(fd, geometry, fat, runs, file, keep,
+                               destination);
+        err != 0) {
+      return err;
+    }
+    report->filesDefragmented++;
+    report->clustersMoved += length - keep;
+  }
+
+  if (report->filesDefragmented == 0) {
+    return 0;
+  }
+  return refreshFsInfo(fd, geometry);
+}
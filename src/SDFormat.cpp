@@ -32,10 +32,17 @@
 //   │  └─ Backup FAT        fatSizeSectors sectors (identical copy)         │
 //   ├───────────────────────────────────────────────────────────────────────┤
 //   │ dataStartSector       Data Region                                     │
-//   │  ├─ Cluster 2         Root directory (first 32 KB)                    │
-//   │  └─ Clusters 3–N      Available for file data                         │
+//   │  ├─ Cluster 2…        Root directory (rootClusters × 32 KB)           │
+//   │  └─ Remaining         Available for file data                         │
 //   └───────────────────────────────────────────────────────────────────────┘
 //
+// This is the flashcart layout (R4Profile). The other layout profiles in
+// FatStructures.h change the cluster size or the alignment gap; the
+// regions and their order stay the same. On a device with 4096-byte
+// logical sectors the sector numbers count 4 KB sectors (SectorLayout).
+// A device too large for an MBR starts with a protective MBR and a GPT
+// instead, and ends with the backup GPT (sdFormatWriteMBR).
+//
 // Naming Conventions
 // ------------------
 // This implementation uses canonical names from docs/canonical_file_system.md:
@@ -47,6 +54,30 @@
 //   - PE_ prefix:  Partition table entry fields
 //   - k prefix:    Compile-time constants (e.g., kSectorSize, kFatCount)
 //
+// Source Organization
+// -------------------
+//   - FatStructures.h — layout constants and packed on-disk structures
+//   - SectorIO.h/.cpp — positioned read/write helpers
+//   - IOStats.h/.cpp — per-phase I/O counters and the write latency histogram
+//   - IOTrace.h/.cpp — I/O trace recording and replay
+//   - ContentHash.h/.cpp — SHA-256, BLAKE3, and the block-list content hash
+//   - HashManifest.h/.cpp — content recording and the hash manifest
+//   - Tracepoints.h/.cpp — USDT probes for bpftrace and perf
+//   - SimulatedDevice.h/.cpp — device timing model for benchmarking
+//   - FatVolume.h/.cpp — reading an existing volume back (geometry, FAT,
+//     cluster chains, directory tree)
+//   - FatDirectory.h/.cpp — building directory entries (long names, short
+//     name generation) for files the library creates
+//   - SDFormat.cpp — layout math and the formatting functions (this file)
+//   - SDCheck.cpp — the consistency checker
+//   - SDRepair.cpp — restoring primary structures from their backups
+//   - SDDefrag.cpp — making ROM and save files contiguous
+//   - SDSort.cpp — sorting and packing directories
+//   - SDWipe.cpp — zeroing or discarding free clusters after a format
+//   - SDProbe.cpp — fake-capacity probe and surface scan
+//   - SDTune.cpp — write tuning and the per-card-model autotuner
+//   - SDAsync.cpp — asynchronous formatting (wrapped by SDFormatAsync.h)
+//
 // Reference Documentation
 // -----------------------
 //   - docs/canonical_file_system.md — Primary reference for field names
@@ -59,619 +90,28 @@
 #include "SDFormat.h"
 
 #include <errno.h>
-#include <unistd.h>
 
 #include <algorithm>
 #include <array>
-#include <cassert>
+#include <atomic>
+#include <bit>
 #include <cctype>
+#include <cstddef>
+#include <cstring>
 #include <ctime>
+#include <random>
 #include <span>
+#include <string>
 #include <string_view>
+#include <vector>
 
-// =============================================================================
-// Constants
-// =============================================================================
-//
-// These constants define the fixed parameters of the filesystem layout.
-// The values are chosen specifically for Nintendo DS flashcart compatibility.
-
-// -----------------------------------------------------------------------------
-// Sector and Cluster Geometry
-// -----------------------------------------------------------------------------
-
-// kSectorSize: The fundamental unit of disk I/O.
-// All FAT filesystems use 512-byte sectors (the original IBM PC sector size).
-// Every structure offset and size in this implementation is a multiple of 512.
-static constexpr uint32_t kSectorSize = 512;
-
-// kSectorsPerCluster: The allocation unit size, expressed in sectors.
-// A cluster is the minimum allocation unit for file data. Larger clusters
-// reduce FAT table size but waste space for small files.
-//
-// 64 sectors × 512 bytes = 32,768 bytes (32 KB) per cluster.
-//
-// This specific value is CRITICAL for DS flashcart compatibility. The ARM9
-// bootloader in most flashcarts expects 32 KB clusters. Using a different
-// cluster size will cause the bootloader to fail to locate files.
-static constexpr uint32_t kSectorsPerCluster = 64;
-
-// kPartitionAlignmentSectors: Where the partition begins (in sectors).
-// This value determines the gap between the MBR (sector 0) and the partition
-// start. The alignment serves two purposes:
-//
-//   1. NAND Flash Optimization: Flash memory is organized into erase blocks,
-//      typically 128 KB or larger. Aligning the partition to a 4 MB boundary
-//      ensures filesystem structures don't straddle erase block boundaries,
-//      reducing write amplification and improving performance.
-//
-//   2. Modern Standard: The 1 MB (2048 sector) or 4 MB (8192 sector) alignment
-//      has become standard practice for SSDs and flash media.
-//
-// 8192 sectors × 512 bytes = 4,194,304 bytes (4 MB).
-static constexpr uint32_t kPartitionAlignmentSectors = 8192;
-
-// kReservedSectors: Sectors at the start of the partition before the FAT.
-// The reserved region contains the VBR, FSInfo, and their backups.
-// The Microsoft spec recommends 32 reserved sectors for FAT32 volumes.
-//
-// Reserved region layout (partition-relative sectors):
-//   Sector 0:   Primary VBR (Volume Boot Record)
-//   Sector 1:   Primary FSInfo
-//   Sectors 2-5: Unused (zeroed)
-//   Sector 6:   Backup VBR
-//   Sector 7:   Backup FSInfo
-//   Sectors 8-31: Unused (zeroed)
-static constexpr uint32_t kReservedSectors = 32;
-
-// kFatCount: Number of File Allocation Table copies.
-// FAT32 traditionally maintains two identical FAT copies for redundancy.
-// If the primary FAT becomes corrupted, filesystem repair tools can restore
-// it from the backup. The BPB_extFlags field can disable mirroring (using
-// only one active FAT), but we use the default mirrored configuration.
-static constexpr uint32_t kFatCount = 2;
-
-// kFatStartSector: Absolute LBA where the FAT region begins.
-// This is computed as: partition start + reserved sectors.
-// From this point, the FAT occupies (kFatCount × fatSizeSectors) sectors.
-static constexpr uint32_t kFatStartSector =
-    kPartitionAlignmentSectors + kReservedSectors;
-
-// -----------------------------------------------------------------------------
-// Signature and Type Constants
-// -----------------------------------------------------------------------------
-
-// kMbrSignature: The "magic number" at the end of a valid MBR.
-// Located at bytes 510-511 (offsets 0x1FE-0x1FF) of sector 0.
-// The bytes are 0x55 at offset 510 and 0xAA at offset 511, which reads
-// as 0xAA55 when interpreted as a little-endian 16-bit word.
-// The BIOS checks this signature before attempting to boot from a disk.
-static constexpr uint16_t kMbrSignature = 0xAA55;
-
-// kPartitionTypeFat32Lba: MBR partition type code for FAT32 with LBA.
-// Type 0x0C indicates FAT32 using Logical Block Addressing (as opposed to
-// the obsolete Cylinder-Head-Sector addressing). This is the standard
-// partition type for FAT32 volumes larger than 8 GB.
-// See: docs/mbr_x86_design.md "Partition Type"
-static constexpr uint8_t kPartitionTypeFat32Lba = 0x0C;
-
-// kMbrBootstrapSize: Size of the bootstrap code area in the MBR.
-// The first 446 bytes of the MBR can contain executable code that the BIOS
-// loads and executes during boot. Since we're formatting data cards (not
-// bootable system disks), we zero this area.
-static constexpr uint32_t kMbrBootstrapSize = 446;
-
-// kVbrSignature: Boot signature at the end of the Volume Boot Record.
-// Same value as kMbrSignature, but located at the end of the VBR (the first
-// sector of the partition). This signature validates the boot sector.
-static constexpr uint16_t kVbrSignature = 0xAA55;
-
-// kAttrVolumeId: Directory entry attribute for volume label entries.
-// A directory entry with this attribute (0x08) contains the volume's name
-// rather than a file or subdirectory. Only the root directory should contain
-// a volume label entry.
-// See: docs/canonical_file_system.md §File Attributes
-static constexpr uint8_t kAttrVolumeId = 0x08;
-
-// -----------------------------------------------------------------------------
-// FAT32-Specific Constants
-// -----------------------------------------------------------------------------
-
-// kRootCluster: The cluster number where the root directory begins.
-// In FAT32, the root directory is stored in the data region like any other
-// directory (unlike FAT12/FAT16 where it had a fixed location between the
-// FAT and data regions). Cluster numbering starts at 2 because clusters 0
-// and 1 are reserved for FAT metadata.
-static constexpr uint32_t kRootCluster = 2;
-
-// kMediaDescriptor: Media type byte stored in BPB_mediaDescriptor and FAT[0].
-// 0xF8 indicates a "fixed" (non-removable) disk, which is the standard value
-// for hard disks and SD cards. 0xF0 would indicate removable media like
-// floppy disks. This byte occupies the low 8 bits of FAT[0].
-static constexpr uint8_t kMediaDescriptor = 0xF8;
-
-// kFsInfoSector: Partition-relative sector number of the FSInfo structure.
-// The FSInfo sector immediately follows the VBR (which is sector 0 of the
-// partition). This value is stored in BPB_fsInfoSector.
-static constexpr uint32_t kFsInfoSector = 1;
-
-// kBackupBootSector: Partition-relative sector number of the backup VBR.
-// FAT32 requires a backup copy of the boot sector for disaster recovery.
-// Sector 6 is the Microsoft-recommended location. This value is stored
-// in BPB_backupBootSector.
-static constexpr uint32_t kBackupBootSector = 6;
-
-// =============================================================================
-// On-Disk Structures
-// =============================================================================
-//
-// These packed structures map directly to the binary layout on disk.
-// All structures use __attribute__((packed)) to ensure no padding is inserted
-// between fields. All multi-byte values are stored little-endian.
-//
-// The structures are declared `const` where possible to enable
-// aggregate initialization with designated initializers (C++20).
-
-// -----------------------------------------------------------------------------
-// PartitionEntry — 16-byte partition table entry within the MBR
-// -----------------------------------------------------------------------------
-//
-// Each entry describes one partition on the disk. The MBR contains space for
-// four entries, though we only use the first one.
-//
-// See: docs/mbr_x86_design.md §Partition Table Entry Format
-// See: docs/canonical_file_system.md §Master Boot Record (MBR)
-
-struct PartitionEntry {
-  // PE_status: Boot indicator flag.
-  // 0x80 = Active/bootable partition (the BIOS will attempt to boot from it)
-  // 0x00 = Inactive partition
-  // Only one partition should be marked active.
-  uint8_t status;
-
-  // PE_chsStart: Cylinder-Head-Sector address of the partition's first sector.
-  // CHS addressing is obsolete (limited to ~8 GB), so we set all bytes to 0xFF
-  // to indicate "use LBA instead." macOS specifically requires this value for
-  // partitions using LBA addressing.
-  //
-  // CHS encoding (when used): byte[0] = head, byte[1] = sector | (cyl_hi << 6),
-  // byte[2] = cyl_lo. But we just use {0xFF, 0xFF, 0xFF}.
-  uint8_t chsStart[3];
-
-  // PE_type: Partition type code identifying the filesystem.
-  // 0x0C = FAT32 with LBA addressing
-  // 0x0B = FAT32 with CHS addressing (not used)
-  // See docs/mbr_x86_design.md for the full list of partition type codes.
-  uint8_t type;
-
-  // PE_chsEnd: CHS address of the partition's last sector.
-  // Same encoding and rationale as chsStart — set to 0xFF for LBA mode.
-  uint8_t chsEnd[3];
-
-  // PE_lbaStart: Logical Block Address of the partition's first sector.
-  // This is the sector number (counting from 0 at the start of the disk)
-  // where the partition begins. For us, this equals kPartitionAlignmentSectors.
-  uint32_t lbaStart;
-
-  // PE_sectorCount: Total number of sectors in the partition.
-  // The partition spans from lbaStart to (lbaStart + sectorCount - 1).
-  uint32_t sectorCount;
-} __attribute__((packed));
-
-// -----------------------------------------------------------------------------
-// MasterBootRecord — 512-byte structure at absolute sector 0 (LBA 0)
-// -----------------------------------------------------------------------------
-//
-// The MBR is the very first sector on the disk. It contains:
-//   1. Bootstrap code (446 bytes) — executable code for BIOS boot (unused here)
-//   2. Partition table (4 × 16 bytes) — describes up to 4 primary partitions
-//   3. Boot signature (2 bytes) — 0xAA55 validates the sector
-//
-// Note: The optional "Unique Disk ID" (4 bytes at offset 0x1B8) and reserved
-// field (2 bytes at offset 0x1BC) are implicitly zero within our bootstrap
-// area, as we don't use them.
-//
-// See: docs/mbr_x86_design.md §MBR Structure
-
-struct MasterBootRecord {
-  // MBR_bootstrap: Bootstrap code area.
-  // On a bootable disk, this contains executable code that the BIOS loads
-  // to address 0x7C00 and executes. Since we're formatting data cards, we
-  // leave this area zeroed.
-  std::byte bootstrap[kMbrBootstrapSize];
-
-  // MBR_partitions: Partition table with four 16-byte entries.
-  // We use only partitions[0]; the rest remain zeroed (empty entries).
-  PartitionEntry partitions[4];
-
-  // MBR_signature: Boot signature validating this sector as an MBR.
-  // Must be 0xAA55 (bytes 0x55, 0xAA at offsets 510, 511).
-  uint16_t signature;
-} __attribute__((packed));
-
-// -----------------------------------------------------------------------------
-// BiosParameterBlock — 53-byte structure embedded within the VBR
-// -----------------------------------------------------------------------------
-//
-// The BPB describes the volume's geometry and FAT parameters. It begins at
-// byte offset 0x00B of the VBR and consists of two parts:
-//   1. Common BPB (offsets 0x00B–0x023, 25 bytes) — shared by FAT12/16/32
-//   2. FAT32 Extended BPB (offsets 0x024–0x03F, 28 bytes) — FAT32-specific
-//
-// The BPB is the most critical metadata structure. Corruption here makes
-// the volume unmountable, which is why FAT32 requires a backup copy.
-//
-// See: docs/canonical_file_system.md §Volume Boot Record (VBR)
-// See: docs/microsoft_fat_specification.md §Boot Sector and BPB
-
-struct BiosParameterBlock {
-  // =========================================================================
-  // Common BPB Fields (offsets 0x00B–0x023, shared by FAT12/FAT16/FAT32)
-  // =========================================================================
-
-  // BPB_bytesPerSector: Bytes per logical sector.
-  // Valid values: 512, 1024, 2048, 4096. We always use 512.
-  const uint16_t bytesPerSector{kSectorSize};
-
-  // BPB_sectorsPerCluster: Allocation unit size in sectors.
-  // Must be a power of 2: 1, 2, 4, 8, 16, 32, 64, or 128.
-  // We use 64 (= 32 KB clusters) for DS compatibility.
-  const uint8_t sectorsPerCluster{kSectorsPerCluster};
-
-  // BPB_reservedSectorCount: Sectors before the FAT region.
-  // Includes the boot sector itself. For FAT32, the Microsoft spec
-  // recommends 32 reserved sectors.
-  const uint16_t reservedSectorCount{kReservedSectors};
-
-  // BPB_fatCount: Number of FAT copies.
-  // The spec recommends 2 for redundancy. Some implementations use 1.
-  const uint8_t fatCount{kFatCount};
-
-  // BPB_rootEntryCount: Maximum root directory entries (FAT12/FAT16 only).
-  // MUST be 0 for FAT32, since FAT32 stores the root directory in the
-  // data region as a regular cluster chain.
-  const uint16_t rootEntryCount{0};
-
-  // BPB_totalSectors16: 16-bit total sector count.
-  // Used only if the volume has fewer than 65536 sectors.
-  // MUST be 0 for FAT32 (use totalSectors32 instead).
-  const uint16_t totalSectors16{0};
-
-  // BPB_mediaDescriptor: Media type byte.
-  // 0xF8 = fixed (non-removable) disk, 0xF0 = removable media.
-  // This value is also stored in the low byte of FAT[0].
-  const uint8_t mediaDescriptor{kMediaDescriptor};
-
-  // BPB_fatSize16: 16-bit sectors per FAT (FAT12/FAT16 only).
-  // MUST be 0 for FAT32 (use fatSize32 instead).
-  const uint16_t fatSize16{0};
-
-  // BPB_sectorsPerTrack: Sectors per track for INT 13h BIOS calls.
-  // Relevant only for CHS geometry on old systems. Standard value: 63.
-  const uint16_t sectorsPerTrack{63};
-
-  // BPB_headCount: Number of heads for INT 13h geometry.
-  // Standard value for large disks: 255.
-  const uint16_t headCount{255};
-
-  // BPB_hiddenSectors: Sectors preceding this partition on the disk.
-  // Equals PE_lbaStart from the partition table entry.
-  // Used by the boot code to locate the partition.
-  const uint32_t hiddenSectors{kPartitionAlignmentSectors};
-
-  // BPB_totalSectors32: 32-bit total sector count of the partition.
-  // This is the partition size, not the entire disk size.
-  // Computed as: diskSectorCount - kPartitionAlignmentSectors.
-  const uint32_t totalSectors32;
-
-  // =========================================================================
-  // FAT32 Extended BPB Fields (offsets 0x024–0x03F)
-  // =========================================================================
-
-  // BPB_fatSize32: 32-bit sectors per FAT.
-  // Computed by fatSizeSectors() using the Microsoft spec formula.
-  const uint32_t fatSize32;
-
-  // BPB_extFlags: FAT mirroring and active FAT flags.
-  // Bits 0-3: Zero-based number of the active FAT (only if bit 7 is set)
-  // Bits 4-6: Reserved
-  // Bit 7: 0 = FAT is mirrored to all copies; 1 = only one FAT is active
-  // We use 0 (all FATs mirrored).
-  const uint16_t extFlags{0};
-
-  // BPB_fsVersion: FAT32 filesystem version.
-  // High byte = major version, low byte = minor version.
-  // MUST be 0x0000 per the Microsoft spec.
-  const uint16_t fsVersion{0};
-
-  // BPB_rootCluster: First cluster of the root directory.
-  // In FAT32, the root directory is a regular cluster chain starting here.
-  // Typically 2 (the first usable data cluster).
-  const uint32_t rootCluster{kRootCluster};
-
-  // BPB_fsInfoSector: Sector number of the FSInfo structure.
-  // This is a partition-relative sector number. Typically 1.
-  const uint16_t fsInfoSector{kFsInfoSector};
-
-  // BPB_backupBootSector: Sector number of the backup boot sector.
-  // Also partition-relative. Typically 6 per Microsoft recommendation.
-  // 0 means no backup exists, but FAT32 should always have a backup.
-  const uint16_t backupBootSector{kBackupBootSector};
-
-  // BPB_reserved: Reserved space within the extended BPB.
-  // Must be zero. Occupies 12 bytes at offsets 0x034–0x03F.
-  const std::array<std::byte, 12> reserved{};
-} __attribute__((packed));
-
-static_assert(sizeof(BiosParameterBlock) == 53,
-              "BiosParameterBlock must be 53 bytes");
-
-// -----------------------------------------------------------------------------
-// VolumeBootRecord — 512-byte structure at partition sector 0
-// -----------------------------------------------------------------------------
-//
-// The VBR (also called "boot sector") is the first sector of the partition.
-// It contains the BPB and additional boot-related fields. A backup copy
-// resides at sector 6 (BPB_backupBootSector).
-//
-// Note: The Microsoft spec uses "BS_" prefix for VBR fields outside the BPB.
-// We use "VBR_" prefix for clarity (see docs/canonical_file_system.md).
-//
-// Layout:
-//   0x000–0x002: VBR_jmpBoot (3 bytes)
-//   0x003–0x00A: VBR_oemName (8 bytes)
-//   0x00B–0x03F: BiosParameterBlock (53 bytes)
-//   0x040–0x059: VBR fields outside BPB (26 bytes)
-//   0x05A–0x1FD: VBR_bootCode (420 bytes)
-//   0x1FE–0x1FF: VBR_signature (2 bytes)
-//
-// See: docs/canonical_file_system.md §VBR Structure Overview
-
-struct VolumeBootRecord {
-  // =========================================================================
-  // VBR Header (offsets 0x000–0x00A)
-  // =========================================================================
-
-  // VBR_jmpBoot: Jump instruction to skip over the BPB to boot code.
-  // Two valid forms exist:
-  //   0xEB xx 0x90: Short jump (EB) + 1-byte offset + NOP (90)
-  //   0xE9 xx xx:   Near jump (E9) + 2-byte offset
-  //
-  // For FAT32, the standard is 0xEB 0x58 0x90, which jumps to offset 0x5A
-  // (the start of the boot code area). The 0x58 is the signed displacement
-  // from the instruction following the jump.
-  const std::array<uint8_t, 3> jmpBoot{0xEB, 0x58, 0x90};
-
-  // VBR_oemName: OEM name/identifier string (8 characters).
-  // This is informational only — it doesn't affect filesystem operation.
-  // "MSWIN4.1" is the recommended value for maximum compatibility, as
-  // some older systems check this string.
-  const std::array<char, 8> oemName{'M', 'S', 'W', 'I', 'N', '4', '.', '1'};
-
-  // =========================================================================
-  // BIOS Parameter Block (offsets 0x00B–0x03F)
-  // =========================================================================
-
-  // Embedded BPB structure containing all volume geometry parameters.
-  const BiosParameterBlock bpb;
-
-  // =========================================================================
-  // VBR Fields Outside BPB (offsets 0x040–0x059)
-  // =========================================================================
-  //
-  // These fields are part of the boot sector but NOT part of the BPB proper.
-  // The Microsoft spec prefixes them with "BS_"; we use "VBR_" for clarity.
-
-  // VBR_driveNumber: INT 13h drive number for BIOS disk access.
-  // 0x80 = first hard disk, 0x00 = floppy drive A:.
-  // The boot code uses this to identify which drive to read from.
-  const uint8_t driveNumber{0x80};
-
-  // VBR_reserved1: Reserved byte.
-  // Originally used by Windows NT for dirty volume flags.
-  // Set to 0x00.
-  const uint8_t reserved1{0};
-
-  // VBR_bootSignature: Extended boot signature.
-  // 0x29 indicates that the following three fields (volumeId, volumeLabel,
-  // fsType) are present and valid. 0x28 means only volumeId is valid.
-  const uint8_t bootSignature{0x29};
-
-  // VBR_volumeId: Volume serial number.
-  // A unique identifier for the volume, typically generated from the
-  // date and time of formatting. Used by operating systems to detect
-  // when removable media has been changed.
-  const uint32_t volumeId;
-
-  // VBR_volumeLabel: Volume label (11 characters, space-padded, uppercase).
-  // Should match the volume label in the root directory's ATTR_VOLUME_ID
-  // entry. Some systems display this label, others display the directory
-  // entry's label — write both to ensure compatibility.
-  const std::array<char, 11> volumeLabel;
-
-  // VBR_fsType: Filesystem type string (8 characters).
-  // "FAT32   " for FAT32 volumes. This is INFORMATIONAL ONLY — the
-  // Microsoft spec explicitly states: "Do NOT use this field to determine
-  // FAT type." The FAT type must be determined by counting clusters.
-  const std::array<char, 8> fsType{'F', 'A', 'T', '3', '2', ' ', ' ', ' '};
-
-  // =========================================================================
-  // VBR Tail (offsets 0x05A–0x1FF)
-  // =========================================================================
-
-  // VBR_bootCode: Bootstrap code area.
-  // On a bootable volume, this contains executable code that loads the
-  // operating system. Since we're formatting data cards, this is zeroed.
-  const std::array<std::byte, 420> bootCode{};
-
-  // VBR_signature: Boot sector signature.
-  // Must be 0xAA55 (byte 0x55 at offset 510, byte 0xAA at offset 511).
-  // Validates this sector as a legitimate boot sector.
-  const uint16_t signature{kVbrSignature};
-} __attribute__((packed));
-
-static_assert(sizeof(VolumeBootRecord) == 512,
-              "VolumeBootRecord must be 512 bytes");
-
-// -----------------------------------------------------------------------------
-// FSInfo — 512-byte structure at partition sector 1 (and backup at sector 7)
-// -----------------------------------------------------------------------------
-//
-// The FSInfo (File System Information) sector caches information about free
-// space to accelerate cluster allocation. Without FSInfo, the filesystem
-// driver would need to scan the entire FAT to find free clusters.
-//
-// IMPORTANT: FSInfo values are advisory hints only. Per the Microsoft spec,
-// drivers must validate these values against the actual FAT on mount, as
-// they may be stale if the volume was not cleanly unmounted.
-//
-// See: docs/canonical_file_system.md §FS Information Sector (FSInfo)
-// See: docs/microsoft_fat_specification.md §FSInfo Structure (FAT32)
-
-struct FSInfo {
-  // FSI_leadSignature: Lead signature for structure validation.
-  // Value: 0x41615252, which is ASCII "RRaA" (little-endian).
-  // Provides a quick sanity check that this sector contains FSInfo data.
-  const uint32_t leadSignature{0x41615252};
-
-  // FSI_reserved1: Reserved area (480 bytes).
-  // Must be zero. This large reserved block exists for future expansion.
-  const std::array<std::byte, 480> reserved1{};
-
-  // FSI_structSignature: Structure signature for additional validation.
-  // Value: 0x61417272, which is ASCII "rrAa" (little-endian).
-  // Located just before the actual data fields.
-  const uint32_t structSignature{0x61417272};
-
-  // FSI_freeCount: Last known count of free clusters on the volume.
-  // 0xFFFFFFFF indicates the count is unknown and must be computed by
-  // scanning the FAT. We set this to the actual computed free count
-  // during formatting.
-  const uint32_t freeCount;
-
-  // FSI_nextFree: Hint for the next free cluster to allocate.
-  // The driver can start searching for free clusters from this point.
-  // 0xFFFFFFFF indicates no hint (start from cluster 2).
-  // We set this to 3 (the cluster after the root directory).
-  const uint32_t nextFree{3};
-
-  // FSI_reserved2: Second reserved area (12 bytes).
-  // Must be zero.
-  const std::array<std::byte, 12> reserved2{};
-
-  // FSI_trailSignature: Trail signature for structure validation.
-  // Value: 0xAA550000 (note: NOT the same as the boot signature 0xAA55).
-  // Validates the end of the FSInfo structure.
-  const uint32_t trailSignature{0xAA550000};
-} __attribute__((packed));
-
-static_assert(sizeof(FSInfo) == 512, "FSInfo must be 512 bytes");
-
-// -----------------------------------------------------------------------------
-// DirectoryEntry — 32-byte structure for files, directories, and volume labels
-// -----------------------------------------------------------------------------
-//
-// A directory is a file whose data consists of a sequence of 32-byte entries.
-// Each entry describes a file, subdirectory, or (in the root directory) the
-// volume label.
-//
-// For formatting, we only create one entry: the volume label in the root
-// directory. This entry has ATTR_VOLUME_ID set and contains the volume name
-// in the DIR_name field.
-//
-// See: docs/canonical_file_system.md §Directory Entry
-// See: docs/microsoft_fat_specification.md §Directory Entry Format
-
-struct DirectoryEntry {
-  // DIR_name: Short filename (8.3 format, 11 characters total).
-  // For files: 8-character base name + 3-character extension, space-padded.
-  // For volume labels: 11-character label, space-padded, uppercase.
-  // The dot between base and extension is NOT stored.
-  //
-  // Special values in DIR_name[0]:
-  //   0x00: Entry is free and all following entries are also free
-  //   0x05: First character is actually 0xE5 (Kanji compatibility)
-  //   0x2E: Dot entry ("." or "..")
-  //   0xE5: Entry has been deleted
-  const std::array<char, 11> name;
-
-  // DIR_attributes: File attribute bitmask.
-  // Bit 0 (0x01): ATTR_READ_ONLY
-  // Bit 1 (0x02): ATTR_HIDDEN
-  // Bit 2 (0x04): ATTR_SYSTEM
-  // Bit 3 (0x08): ATTR_VOLUME_ID — this entry is the volume label
-  // Bit 4 (0x10): ATTR_DIRECTORY — this entry is a subdirectory
-  // Bit 5 (0x20): ATTR_ARCHIVE — file has been modified since last backup
-  //
-  // The combination 0x0F (ATTR_LONG_NAME) indicates a VFAT long filename entry.
-  // For a volume label entry, we set only ATTR_VOLUME_ID (0x08).
-  const uint8_t attributes{kAttrVolumeId};
-
-  // DIR_ntReserved: Reserved for Windows NT lowercase flags.
-  // Must be 0 for volume label entries.
-  const uint8_t ntReserved{0};
-
-  // DIR_creationTimeTenths: Creation time, sub-second component.
-  // Range 0–199, representing 0–1.99 seconds in 10ms increments.
-  // Optional; we set to 0.
-  const uint8_t creationTimeTenths{0};
-
-  // DIR_creationTime: Creation time (2-second granularity).
-  // Bits 0-4: Seconds/2 (0-29), Bits 5-10: Minutes (0-59), Bits 11-15: Hours.
-  // Optional for volume labels; we set to 0.
-  const uint16_t creationTime{0};
-
-  // DIR_creationDate: Creation date.
-  // Bits 0-4: Day (1-31), Bits 5-8: Month (1-12), Bits 9-15: Year from 1980.
-  // Optional for volume labels; we set to 0.
-  const uint16_t creationDate{0};
-
-  // DIR_lastAccessDate: Last access date (same format as creationDate).
-  // Optional for volume labels; we set to 0.
-  const uint16_t lastAccessDate{0};
-
-  // DIR_firstClusterHigh: High 16 bits of the first cluster number.
-  // Must be 0 for volume label entries (they have no associated data).
-  const uint16_t firstClusterHigh{0};
-
-  // DIR_writeTime: Last modification time (same format as creationTime).
-  // Optional for volume labels; we set to 0.
-  const uint16_t writeTime{0};
-
-  // DIR_writeDate: Last modification date (same format as creationDate).
-  // Optional for volume labels; we set to 0.
-  const uint16_t writeDate{0};
-
-  // DIR_firstClusterLow: Low 16 bits of the first cluster number.
-  // Must be 0 for volume label entries.
-  const uint16_t firstClusterLow{0};
-
-  // DIR_fileSize: File size in bytes (32-bit).
-  // Must be 0 for volume labels and directories.
-  const uint32_t fileSize{0};
-} __attribute__((packed));
-
-static_assert(sizeof(DirectoryEntry) == 32, "DirectoryEntry must be 32 bytes");
-
-// -----------------------------------------------------------------------------
-// RootDirSector — Helper structure for writing the root directory
-// -----------------------------------------------------------------------------
-//
-// The root directory begins at cluster 2 (BPB_rootCluster). We initialize
-// only the first sector of the cluster, placing the volume label entry at
-// the very beginning. The rest of the cluster is zeroed.
-
-struct RootDirSector {
-  // The volume label entry at the start of the root directory.
-  const DirectoryEntry volumeLabel;
-
-  // Padding to fill the 512-byte sector.
-  // Remaining directory entries would follow here, but for a freshly
-  // formatted volume, they're all zero (free entries).
-  const std::array<std::byte, 480> padding{};
-} __attribute__((packed));
-
-static_assert(sizeof(RootDirSector) == 512, "RootDirSector must be 512 bytes");
+#include "FatDirectory.h"
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "FormatLayout.h"
+#include "HashManifest.h"
+#include "IOStats.h"
+#include "SectorIO.h"
 
 // =============================================================================
 // Volume Label Preparation
@@ -720,18 +160,75 @@ static std::array<char, 11> prepareVolumeLabel(const char* label) {
 // These functions compute partition geometry values from the total sector
 // count. They implement the formulas from the Microsoft FAT specification,
 // using descriptive variable names as documented in canonical_file_system.md.
+// Each is instantiated per layout (FatStructures.h §Layout Profiles), so for
+// a given profile and sector format the constants fold into the formulas.
+//
+// `sectorCount` is in 512-byte units, as everywhere in the API; the results
+// are in the layout's logical sectors. All intermediate values are 64-bit,
+// so a device of any size yields a valid (if capped) layout.
+
+// usesGuidPartitionTable
+// ----------------------
+// True if the device has more logical sectors than an MBR can address
+// (over 2 TiB with 512-byte sectors, as on SDUC cards). Such a device is
+// partitioned with a GPT.
+
+template <typename Layout>
+static constexpr bool usesGuidPartitionTable(uint64_t sectorCount) {
+  return sectorCount / Layout::kUnitsPerSector > kMbrMaxSectors;
+}
+
+// gptEntrySectors
+// ---------------
+// Sectors of one GPT partition entry array (32, or 4 with 4 KB sectors).
+
+template <typename Layout>
+static constexpr uint32_t gptEntrySectors() {
+  return kGptEntryArrayBytes / Layout::kBytesPerSector;
+}
+
+// maxVolumeSectors
+// ----------------
+// The largest FAT32 volume of the layout. Two limits apply:
+// BPB_totalSectors32 is 32-bit (2 TiB with 512-byte sectors), and a volume
+// may have at most kFat32MaxClusters clusters (8 TiB with 32 KB clusters).
+// The cluster limit is expressed as the volume that holds exactly that
+// many clusters and a FAT large enough for them.
+
+template <typename Layout>
+static constexpr uint64_t maxVolumeSectors() {
+  constexpr uint64_t kFatBytes =
+      (uint64_t{kFat32MaxClusters} + kRootCluster) * sizeof(uint32_t);
+  constexpr uint64_t kFatSectors =
+      (kFatBytes + Layout::kBlockBytes - 1) / Layout::kBlockBytes *
+      Layout::kBlockSectors;
+  constexpr uint64_t kClusterLimit =
+      Layout::kReservedSectors + Layout::kFatCount * kFatSectors +
+      uint64_t{kFat32MaxClusters} * Layout::kSectorsPerCluster;
+  return std::min(kFat32MaxSectors, kClusterLimit);
+}
 
 // partitionSectorCount
 // --------------------
 // Computes the number of sectors in the FAT32 partition.
 //
-// The partition begins at kPartitionAlignmentSectors (4 MB into the disk)
-// and extends to the end of the device. This value becomes:
-//   - PE_sectorCount in the partition table entry
+// The partition begins at Layout::kAlignmentSectors (4 MB into the disk
+// for the flashcart layout) and extends to the end of the device, less
+// the backup GPT at the end if there is one. This value becomes:
+//   - PE_sectorCount in the partition table entry (or the GPT entry)
 //   - BPB_totalSectors32 in the BIOS Parameter Block
+//
+// A device larger than maxVolumeSectors gets a partition of that size; the
+// rest of the device is left unpartitioned.
 
-static uint64_t partitionSectorCount(uint64_t sectorCount) {
-  return sectorCount - kPartitionAlignmentSectors;
+template <typename Layout>
+static constexpr uint64_t partitionSectorCount(uint64_t sectorCount) {
+  uint64_t available =
+      sectorCount / Layout::kUnitsPerSector - Layout::kAlignmentSectors;
+  if (usesGuidPartitionTable<Layout>(sectorCount)) {
+    available -= gptEntrySectors<Layout>() + 1;
+  }
+  return std::min(available, maxVolumeSectors<Layout>());
 }
 
 // fatSizeSectors
@@ -759,24 +256,37 @@ static uint64_t partitionSectorCount(uint64_t sectorCount) {
 // The "+ fatCount" term accounts for the fact that adding one FAT sector
 // requires space in ALL FAT copies, slightly reducing available data space.
 //
+// With larger sectors the 256 becomes bytesPerSector / 2 (2048 for 4096-byte
+// sectors), and on a device with blocks larger than a sector the result is
+// rounded up to whole blocks so that the data region starts on one.
+//
 // The result may be up to 8 sectors larger than strictly necessary (a safe
 // over-estimate), but will never be too small.
 
-static uint32_t fatSizeSectors(uint64_t sectorCount) {
+template <typename Layout>
+static constexpr uint32_t fatSizeSectors(uint64_t sectorCount) {
   // sectorsToAllocate: Total sectors available for FAT + data regions
   // (partition size minus the reserved region)
   uint64_t sectorsToAllocate =
-      partitionSectorCount(sectorCount) - kReservedSectors;
+      partitionSectorCount<Layout>(sectorCount) - Layout::kReservedSectors;
 
   // sectorsPerFatEntry: How many data sectors each FAT sector can track.
   // For FAT32 with 64 sectors/cluster: (256 × 64 + 2) / 2 = 8193
   // This means each FAT sector (128 entries × 64 sectors/cluster = 8192
   // data sectors) plus a small correction for the FAT copy overhead.
-  uint64_t sectorsPerFatEntry = (256 * kSectorsPerCluster + kFatCount) / 2;
+  uint64_t sectorsPerFatEntry =
+      (Layout::kBytesPerSector / 2 * Layout::kSectorsPerCluster +
+       Layout::kFatCount) /
+      2;
 
   // Ceiling division: (a + b - 1) / b computes ceil(a / b) in integer math
-  return static_cast<uint32_t>((sectorsToAllocate + (sectorsPerFatEntry - 1)) /
-                               sectorsPerFatEntry);
+  uint64_t fatSize =
+      (sectorsToAllocate + (sectorsPerFatEntry - 1)) / sectorsPerFatEntry;
+  if constexpr (Layout::kBlockSectors > 1) {
+    fatSize = (fatSize + Layout::kBlockSectors - 1) / Layout::kBlockSectors *
+              Layout::kBlockSectors;
+  }
+  return static_cast<uint32_t>(fatSize);
 }
 
 // dataStartSector
@@ -785,12 +295,29 @@ static uint32_t fatSizeSectors(uint64_t sectorCount) {
 //
 // The data region immediately follows the FAT region:
 //   dataStartSector = partitionStart + reservedSectors + (fatCount × fatSize)
-//                   = kFatStartSector + (2 × fatSizeSectors)
+//                   = kFatStartSector + (fatCount × fatSizeSectors)
 //
 // This is where the root directory (cluster 2) begins.
 
-static uint32_t dataStartSector(uint64_t sectorCount) {
-  return kFatStartSector + (kFatCount * fatSizeSectors(sectorCount));
+template <typename Layout>
+static constexpr uint64_t dataStartSector(uint64_t sectorCount) {
+  return Layout::kFatStartSector +
+         (uint64_t{Layout::kFatCount} * fatSizeSectors<Layout>(sectorCount));
+}
+
+// totalClusterCount
+// -----------------
+// Computes the number of data clusters.
+//
+// Total clusters = totalDataSectors / sectorsPerCluster
+
+template <typename Layout>
+static constexpr uint32_t totalClusterCount(uint64_t sectorCount) {
+  // Total data sectors = partition size - reserved - FAT regions
+  uint64_t totalDataSectors =
+      partitionSectorCount<Layout>(sectorCount) - Layout::kReservedSectors -
+      (uint64_t{Layout::kFatCount} * fatSizeSectors<Layout>(sectorCount));
+  return static_cast<uint32_t>(totalDataSectors / Layout::kSectorsPerCluster);
 }
 
 // freeClusterCount
@@ -798,179 +325,175 @@ static uint32_t dataStartSector(uint64_t sectorCount) {
 // Computes the number of free clusters after formatting.
 //
 // After formatting:
-//   - Cluster 2 is allocated for the root directory
+//   - Clusters 2 .. 2 + rootClusters - 1 are allocated for the root directory
 //   - All other clusters are free
 //
-// Total clusters = totalDataSectors / sectorsPerCluster
-// Free clusters = totalClusters - 1 (minus the root directory cluster)
+// Free clusters = totalClusters - rootClusters
 //
 // This value is stored in FSI_freeCount.
 
-static uint32_t freeClusterCount(uint64_t sectorCount) {
-  // Total data sectors = partition size - reserved - FAT regions
-  uint32_t totalDataSectors =
-      static_cast<uint32_t>(partitionSectorCount(sectorCount)) -
-      kReservedSectors - (kFatCount * fatSizeSectors(sectorCount));
+template <typename Layout>
+static uint32_t freeClusterCount(uint64_t sectorCount, uint32_t rootClusters) {
+  // The FAT size formula over-estimates, so even the largest volume stays
+  // within the FAT32 cluster limit
+  static_assert(totalClusterCount<Layout>(uint64_t{1} << 48) <=
+                kFat32MaxClusters);
+
+  // Subtract the root directory clusters (starting at cluster 2)
+  return totalClusterCount<Layout>(sectorCount) - rootClusters;
+}
 
-  // Total clusters in the data region
-  uint32_t totalClusters = totalDataSectors / kSectorsPerCluster;
+// isValidRootClusterCount
+// -----------------------
+// The root directory spans 1 to Layout::kMaxRootClusters clusters. The
+// upper bound is the specification's 65,536-entry directory limit (2 MB).
 
-  // Subtract 1 for the root directory cluster (cluster 2)
-  return totalClusters - 1;
+template <typename Layout>
+static bool isValidRootClusterCount(uint32_t rootClusters) {
+  static_assert(Layout::kMaxRootClusters <= kSDFormatMaxRootClusters);
+  return rootClusters >= 1 && rootClusters <= Layout::kMaxRootClusters;
 }
 
 // =============================================================================
-// I/O Helpers
+// Cluster Chains and Save Files
 // =============================================================================
-//
-// Low-level functions for writing data to the block device or image file.
-// All public formatting functions use these helpers for actual I/O.
-
-// writeBytes
-// ----------
-// Writes a span of bytes to a specific byte offset in the file.
-//
-// Handles partial writes by looping until all bytes are written or an
-// error occurs. Also handles EINTR (interrupted system call) by retrying.
-//
-// Parameters:
-//   fd:     File descriptor open for writing
-//   offset: Byte offset from the start of the file
-//   data:   Span of bytes to write
-//
-// Returns:
-//   0 on success, or errno from the failed lseek/write call.
 
-static int writeBytes(int fd, off_t offset, std::span<const std::byte> data) {
-  // Seek to the target offset
-  if (lseek(fd, offset, SEEK_SET) == -1) {
-    return errno;
+// kSaveSizeMin / kSaveSizeMax: Smallest (4 Kbit EEPROM) and largest
+// (64 Mbit flash) save sizes used by DS cartridges.
+static constexpr uint32_t kSaveSizeMin = 512;
+static constexpr uint32_t kSaveSizeMax = 8 << 20;
+
+// saveFileName
+// ------------
+// "roms/Mario Kart DS.nds" → "Mario Kart DS.sav". A name without an
+// extension (or a dot-file) gets ".sav" appended.
+
+static std::string saveFileName(std::string_view romName) {
+  romName = romName.substr(romName.rfind('/') + 1);
+  size_t dot = romName.rfind('.');
+  if (dot != std::string_view::npos && dot != 0) {
+    romName = romName.substr(0, dot);
   }
+  return std::string{romName} + ".sav";
+}
 
-  // Write data, handling partial writes and interrupts
-  const std::byte* ptr = data.data();
-  size_t remaining = data.size();
+// writeClusterRuns
+// ----------------
+// Writes contiguous cluster chains into both FAT copies in one pass.
+//
+// The runs are laid out back to back from `firstCluster`: run i occupies
+// `lengths[i]` clusters, each linked to the next, the last marked
+// end-of-chain. The FAT blocks covering the runs are read from the primary
+// FAT (so the entries around them are preserved), patched in memory, and
+// written to both copies, at most 1 MB at a time so that memory stays
+// bounded however many clusters the runs cover. A block is the device's
+// physical block, a sector on most cards; each FAT copy starts on one.
+
+template <typename Layout>
+static int writeClusterRuns(int fd, uint32_t fatSize, uint32_t firstCluster,
+                            std::span<const uint32_t> lengths) {
+  constexpr uint32_t kEntriesPerBlock = Layout::kBlockBytes / sizeof(uint32_t);
+  constexpr uint64_t kChunkBlocks = (1 << 20) / Layout::kBlockBytes;
+
+  uint64_t clusterCount = 0;
+  for (uint32_t length : lengths) {
+    clusterCount += length;
+  }
+  if (clusterCount == 0) {
+    return 0;
+  }
 
-  while (remaining > 0) {
-    ssize_t written = write(fd, ptr, remaining);
+  const uint64_t endCluster = firstCluster + clusterCount;
+  const uint64_t firstBlock = firstCluster / kEntriesPerBlock;
+  const uint64_t lastBlock = (endCluster - 1) / kEntriesPerBlock;
+  std::vector<uint32_t> fat(static_cast<size_t>(
+      std::min(lastBlock - firstBlock + 1, kChunkBlocks) * kEntriesPerBlock));
+
+  // `run` and `position` track the cluster being linked within its run
+  auto run = lengths.begin();
+  uint32_t position = 0;
+  uint64_t cluster = firstCluster;
+  for (uint64_t block = firstBlock; block <= lastBlock;) {
+    const uint64_t blocks = std::min(lastBlock - block + 1, kChunkBlocks);
+    auto bytes = std::as_writable_bytes(std::span{fat}).first(
+        static_cast<size_t>(blocks) * Layout::kBlockBytes);
+    auto offset = static_cast<off_t>(
+        uint64_t{Layout::kFatStartSector} * Layout::kBytesPerSector +
+        block * Layout::kBlockBytes);
+    if (int err = readBytes(fd, offset, bytes); err != 0) {
+      return err;
+    }
 
-    if (written == -1) {
-      if (errno == EINTR) {
-        continue;  // Interrupted; retry
+    const uint64_t base = block * kEntriesPerBlock;
+    const uint64_t chunkEnd =
+        std::min(endCluster, base + blocks * kEntriesPerBlock);
+    for (; cluster < chunkEnd; cluster++) {
+      while (position == *run) {
+        ++run;
+        position = 0;
       }
-      return errno;
+      position++;
+      fat[cluster - base] = position == *run
+                                ? kFat32EndOfChain
+                                : static_cast<uint32_t>(cluster + 1);
     }
 
-    ptr += written;
-    remaining -= static_cast<size_t>(written);
+    for (uint32_t copy = 0; copy < Layout::kFatCount; copy++) {
+      off_t copyOffset = offset + static_cast<off_t>(uint64_t{copy} * fatSize *
+                                                     Layout::kBytesPerSector);
+      if (int err = writeBytes(fd, copyOffset, bytes); err != 0) {
+        return err;
+      }
+    }
+    block += blocks;
   }
-
   return 0;
 }
 
-// writeSector
-// -----------
-// Writes a single 512-byte structure to a specific LBA on the device.
-//
-// Accepts any type that is exactly kSectorSize bytes, enforced at compile
-// time via static_assert. Converts the sector number to a byte offset and
-// delegates to writeBytes.
+// =============================================================================
+// Metadata Sectors
+// =============================================================================
 //
-// Parameters:
-//   fd:        File descriptor open for writing
-//   sectorLba: Logical Block Address (sector number, 0-based)
-//   sector:    Reference to a 512-byte structure to write
+// Each formatting function writes sectors built by one of these helpers, and
+// sdFormatReformatIncremental compares the device against the same sectors,
+// so both paths always agree on the expected contents.
 //
-// Returns:
-//   0 on success, or errno from the failed I/O call.
+// The structures are 512 bytes. With larger logical sectors each occupies
+// the start of its sector and the rest is zero, as the specification
+// requires of the boot sector and FSInfo.
 
-template <typename T>
-static int writeSector(int fd, off_t sectorLba, const T& sector) {
+// writeLogicalSector / writeLogicalSectorAndBackup
+// ------------------------------------------------
+// Writes a structure as logical sector `lba` of the layout, padded with
+// zeros to the sector size and aligned to whole blocks.
+
+template <typename Layout, typename T>
+static int writeLogicalSector(int fd, uint64_t lba, const T& sector) {
   static_assert(sizeof(T) == kSectorSize);
-  off_t offset = sectorLba * kSectorSize;
-  return writeBytes(fd, offset, std::as_bytes(std::span{&sector, 1}));
+  std::array<std::byte, Layout::kBytesPerSector> bytes{};
+  const auto structure = std::bit_cast<SectorBytes>(sector);
+  std::copy(structure.begin(), structure.end(), bytes.begin());
+  return writeAlignedBytes(
+      fd, static_cast<off_t>(lba * Layout::kBytesPerSector), bytes,
+      Layout::kBlockBytes);
 }
 
-// writeSectorAndBackupSector
-// --------------------------
-// Writes the same 512-byte structure to two LBAs (primary and backup).
-//
-// FAT32 stores backup copies of critical structures (VBR at sector 6,
-// FSInfo at sector 7, FAT reserved entries at the start of FAT 2).
-// This helper ensures both copies are written identically.
-
-template <typename T>
-static int writeSectorAndBackupSector(int fd, off_t primaryLba, off_t backupLba,
-                                      const T& sector) {
-  if (int err = writeSector(fd, primaryLba, sector); err != 0) {
+template <typename Layout, typename T>
+static int writeLogicalSectorAndBackup(int fd, uint64_t primaryLba,
+                                       uint64_t backupLba, const T& sector) {
+  if (int err = writeLogicalSector<Layout>(fd, primaryLba, sector);
+      err != 0) {
     return err;
   }
-  return writeSector(fd, backupLba, sector);
-}
-
-// zeroSectors
-// -----------
-// Writes zeros to a contiguous range of sectors.
-//
-// Uses a cluster-sized buffer (32 KB) for efficiency, writing multiple
-// sectors per system call when possible.
-//
-// Parameters:
-//   fd:          File descriptor open for writing
-//   startSector: First sector (LBA) to zero
-//   sectorCount: Number of sectors to zero
-//
-// Returns:
-//   0 on success, or errno from the failed I/O call.
-
-static int zeroSectors(int fd, off_t startSector, uint32_t sectorCount) {
-  // Use a cluster-sized buffer for efficient bulk zeroing
-  static constexpr uint32_t kClusterBytes = kSectorsPerCluster * kSectorSize;
-  std::byte buffer[kClusterBytes] = {};  // Zero-initialized
-
-  off_t offset = startSector * kSectorSize;
-  uint32_t remaining = sectorCount;
-
-  while (remaining > 0) {
-    // Write up to one cluster at a time
-    uint32_t toWrite = std::min(remaining, kSectorsPerCluster);
-    uint32_t bytes = toWrite * kSectorSize;
-
-    if (int err = writeBytes(fd, offset, std::span{buffer, bytes}); err != 0) {
-      return err;
-    }
-
-    remaining -= toWrite;
-    offset += bytes;
-  }
-
-  return 0;
+  return writeLogicalSector<Layout>(fd, backupLba, sector);
 }
 
-// =============================================================================
-// Public API Implementation
-// =============================================================================
-
-// sdFormatWriteMBR
-// ----------------
-// Writes the Master Boot Record to absolute sector 0.
-//
-// The MBR layout (512 bytes total):
-//   Offset 0x000: 446 bytes of bootstrap code (zeroed — not a boot disk)
-//   Offset 0x1BE: 16-byte partition entry 1 (FAT32 LBA partition)
-//   Offset 0x1CE: 16-byte partition entry 2 (zeroed — unused)
-//   Offset 0x1DE: 16-byte partition entry 3 (zeroed — unused)
-//   Offset 0x1EE: 16-byte partition entry 4 (zeroed — unused)
-//   Offset 0x1FE: 2-byte signature (0xAA55)
-//
-// The single partition entry specifies:
-//   - Active/bootable status (0x80)
-//   - FAT32 LBA type (0x0C)
-//   - Starting at sector 8192 (4 MB alignment)
-//   - Extending to the end of the device
+// makeMasterBootRecord
+// --------------------
 
-int sdFormatWriteMBR(int fd, uint64_t sectorCount) {
-  const MasterBootRecord mbr = {
+template <typename Layout>
+static MasterBootRecord makeMasterBootRecord(uint64_t sectorCount) {
+  return MasterBootRecord{
       // bootstrap is implicitly zeroed (not a boot disk)
       .partitions =
           {
@@ -984,184 +507,1944 @@ int sdFormatWriteMBR(int fd, uint64_t sectorCount) {
 
                   .chsEnd = {0xFF, 0xFF, 0xFF},
 
-                  // Partition starts at 4 MB boundary (8192 sectors)
-                  .lbaStart = kPartitionAlignmentSectors,
+                  // Partition starts at the alignment boundary (4 MB,
+                  // 8192 sectors, for the flashcart layout)
+                  .lbaStart = Layout::kAlignmentSectors,
 
                   // Partition extends to the end of the device
-                  .sectorCount =
-                      static_cast<uint32_t>(partitionSectorCount(sectorCount)),
+                  .sectorCount = static_cast<uint32_t>(
+                      partitionSectorCount<Layout>(sectorCount)),
               },
               // partitions[1–3] are implicitly zeroed (unused)
           },
       .signature = kMbrSignature,  // 0xAA55
   };
+}
+
+// makeProtectiveMbr
+// -----------------
+// The MBR in front of a GPT: one entry of type 0xEE from LBA 1 to the end
+// of the disk, or as far as PE_sectorCount reaches.
+
+template <typename Layout>
+static MasterBootRecord makeProtectiveMbr(uint64_t sectorCount) {
+  const uint64_t diskSectors = sectorCount / Layout::kUnitsPerSector;
+  return MasterBootRecord{
+      .partitions =
+          {
+              PartitionEntry{
+                  .status = 0x00,
+                  .chsStart = {0x00, 0x02, 0x00},
+                  .type = kPartitionTypeGptProtective,
+                  .chsEnd = {0xFF, 0xFF, 0xFF},
+                  .lbaStart = 1,
+                  .sectorCount = static_cast<uint32_t>(
+                      std::min<uint64_t>(diskSectors - 1, 0xFFFFFFFF)),
+              },
+          },
+      .signature = kMbrSignature,
+  };
+}
 
-  // Write to sector 0 (absolute LBA 0)
-  return writeSector(fd, 0, mbr);
+// randomGuid
+// ----------
+// A version 4 (random) GUID in on-disk byte order.
+
+static Guid randomGuid() {
+  std::random_device random;
+  Guid guid;
+  for (size_t i = 0; i < guid.size(); i += sizeof(uint32_t)) {
+    const uint32_t value = random();
+    std::memcpy(&guid[i], &value, sizeof(value));
+  }
+  guid[7] = static_cast<uint8_t>((guid[7] & 0x0F) | 0x40);  // Version 4
+  guid[8] = static_cast<uint8_t>((guid[8] & 0x3F) | 0x80);  // RFC 4122
+  return guid;
 }
 
-// sdFormatWriteVolumeBootRecord
-// -----------------------------
-// Writes both the primary VBR (sector 0 of partition) and backup (sector 6).
-//
-// The VBR contains critical filesystem metadata including:
-//   - Jump instruction and OEM name
-//   - Complete BIOS Parameter Block with FAT32 geometry
-//   - Volume serial number and label
-//   - Filesystem type string
-//   - Boot sector signature
-//
-// Both the primary and backup copies are identical. The backup exists for
-// disaster recovery — if sector 0 of the partition becomes unreadable,
-// repair tools can restore the BPB from sector 6.
+// GptRegion
+// ---------
+// A contiguous run of GPT sectors as written: each structure at the start
+// of its logical sector, the rest zero. `lba` is in logical sectors.
+
+struct GptRegion {
+  uint64_t lba;
+  std::vector<std::byte> bytes;
+};
+
+// makeGuidPartitionTable
+// ----------------------
+// The two regions of a GPT with one basic data partition of
+// `partitionSectors` sectors at the alignment boundary (the FAT32 or exFAT
+// volume):
+//
+//   LBA 0                       Protective MBR
+//   LBA 1                       Primary header
+//   LBA 2 …                     Primary entry array (16 KB)
+//   …
+//   lastLba - entrySectors …    Backup entry array
+//   lastLba                     Backup header
+//
+// The disk and partition GUIDs are random, so every call yields a new
+// table.
+
+template <typename Layout>
+static std::array<GptRegion, 2> makeGuidPartitionTable(
+    uint64_t sectorCount, uint64_t partitionSectors) {
+  constexpr size_t kSectorBytes = Layout::kBytesPerSector;
+  constexpr uint64_t kEntrySectors = gptEntrySectors<Layout>();
+  constexpr std::u16string_view kPartitionName = u"Basic data partition";
+  const uint64_t lastLba = sectorCount / Layout::kUnitsPerSector - 1;
+
+  std::array<GptPartitionEntry, kGptEntryCount> entries{};
+  entries[0] = {
+      .typeGuid = kGptBasicDataType,
+      .uniqueGuid = randomGuid(),
+      .firstLba = Layout::kAlignmentSectors,
+      .lastLba = Layout::kAlignmentSectors + partitionSectors - 1,
+      .attributes = 0,
+      .name = {},
+  };
+  std::array<uint16_t, 36> name{};
+  std::copy(kPartitionName.begin(), kPartitionName.end(), name.begin());
+  entries[0].name = name;
+  const auto entryBytes = std::as_bytes(std::span{entries});
+
+  GptHeader primary{};
+  primary.myLba = 1;
+  primary.alternateLba = lastLba;
+  primary.firstUsableLba = 2 + kEntrySectors;
+  primary.lastUsableLba = lastLba - kEntrySectors - 1;
+  primary.diskGuid = randomGuid();
+  primary.partitionEntryLba = 2;
+  primary.partitionEntryArrayCrc32 = crc32(entryBytes);
+
+  GptHeader backup = primary;
+  backup.myLba = lastLba;
+  backup.alternateLba = 1;
+  backup.partitionEntryLba = lastLba - kEntrySectors;
+
+  // The header CRC covers GPT_headerSize bytes, with the CRC field zero
+  for (GptHeader* header : {&primary, &backup}) {
+    header->headerCrc32 =
+        crc32(std::as_bytes(std::span{header, 1}).first(kGptHeaderSize));
+  }
 
-int sdFormatWriteVolumeBootRecord(int fd, uint64_t sectorCount,
-                                  const char* label) {
-  // Prepare the 11-character volume label (uppercase, space-padded)
-  auto volumeLabel = prepareVolumeLabel(label);
+  std::array<GptRegion, 2> regions = {
+      GptRegion{0, std::vector<std::byte>((2 + kEntrySectors) * kSectorBytes)},
+      GptRegion{lastLba - kEntrySectors,
+                std::vector<std::byte>((kEntrySectors + 1) * kSectorBytes)},
+  };
+  auto place = [](GptRegion& region, uint64_t lba,
+                  std::span<const std::byte> data) {
+    std::copy(data.begin(), data.end(),
+              region.bytes.begin() +
+                  static_cast<ptrdiff_t>((lba - region.lba) * kSectorBytes));
+  };
+  const auto mbr =
+      std::bit_cast<SectorBytes>(makeProtectiveMbr<Layout>(sectorCount));
+  place(regions[0], 0, mbr);
+  place(regions[0], 1, std::as_bytes(std::span{&primary, 1}));
+  place(regions[0], 2, entryBytes);
+  place(regions[1], backup.partitionEntryLba, entryBytes);
+  place(regions[1], lastLba, std::as_bytes(std::span{&backup, 1}));
+  return regions;
+}
+
+// writeGuidPartitionTable
+// -----------------------
+// Writes a new GPT: the protective MBR, primary header, and entry array
+// with one write, and the backup entry array and header at the end of the
+// device with another.
+
+template <typename Layout>
+static int writeGuidPartitionTable(int fd, uint64_t sectorCount,
+                                   uint64_t partitionSectors) {
+  for (const GptRegion& region :
+       makeGuidPartitionTable<Layout>(sectorCount, partitionSectors)) {
+    if (int err = writeAlignedBytes(
+            fd, static_cast<off_t>(region.lba * Layout::kBytesPerSector),
+            region.bytes, Layout::kBlockBytes);
+        err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
 
-  // Construct the VBR using designated initializers
-  // Only the variable fields need explicit values; others use defaults
-  const VolumeBootRecord vbr = {
+// makeVolumeBootRecord
+// --------------------
+// The volume ID is taken from the clock, so every call yields a new one.
+
+template <typename Layout>
+static VolumeBootRecord makeVolumeBootRecord(uint64_t sectorCount,
+                                             const char* label) {
+  // Only the profile and variable fields need explicit values; others use
+  // defaults
+  return VolumeBootRecord{
       .bpb =
           {
+              .bytesPerSector = Layout::kBytesPerSector,
+              .sectorsPerCluster = Layout::kSectorsPerCluster,
+              .reservedSectorCount = Layout::kReservedSectors,
+              .fatCount = Layout::kFatCount,
+              .hiddenSectors = Layout::kAlignmentSectors,
+
               // Partition size in sectors
-              .totalSectors32 =
-                  static_cast<uint32_t>(partitionSectorCount(sectorCount)),
+              .totalSectors32 = static_cast<uint32_t>(
+                  partitionSectorCount<Layout>(sectorCount)),
 
               // Computed FAT size in sectors
-              .fatSize32 = fatSizeSectors(sectorCount),
+              .fatSize32 = fatSizeSectors<Layout>(sectorCount),
           },
 
       // Volume serial number from current timestamp
       .volumeId = static_cast<uint32_t>(time(nullptr)),
 
-      // Volume label (must match root directory entry)
-      .volumeLabel = volumeLabel,
+      // Volume label, uppercase and space-padded (must match the root
+      // directory entry)
+      .volumeLabel = prepareVolumeLabel(label),
   };
-
-  // Write primary VBR (partition sector 0) and backup VBR (partition sector 6)
-  return writeSectorAndBackupSector(
-      fd, kPartitionAlignmentSectors,
-      kPartitionAlignmentSectors + kBackupBootSector, vbr);
 }
 
-// sdFormatWriteFSInfo
-// -------------------
-// Writes both the primary FSInfo (sector 1) and backup (sector 7).
-//
-// The FSInfo structure provides hints to accelerate cluster allocation:
-//   - FSI_freeCount: Number of free clusters on the volume
-//   - FSI_nextFree: Where to start searching for free space
-//
-// For a freshly formatted volume:
-//   - freeCount = total clusters - 1 (minus the root directory cluster)
-//   - nextFree = 3 (first cluster after root directory)
+// makeFsInfo
+// ----------
+// FSInfo of a blank volume whose root directory is `rootClusters` long.
 
-int sdFormatWriteFSInfo(int fd, uint64_t sectorCount) {
-  // Construct FSInfo with computed free cluster count
-  const FSInfo fsinfo = {
-      .freeCount = freeClusterCount(sectorCount),
-      // nextFree defaults to 3 (cluster after root directory)
+template <typename Layout>
+static FSInfo makeFsInfo(uint64_t sectorCount, uint32_t rootClusters) {
+  return FSInfo{
+      .freeCount = freeClusterCount<Layout>(sectorCount, rootClusters),
+      .nextFree = kRootCluster + rootClusters,
   };
+}
+
+// FatSector
+// ---------
+// One sector of FAT32 entries (128 × 4 bytes).
+using FatSector = std::array<uint32_t, kSectorSize / sizeof(uint32_t)>;
+
+// makeFirstFatSector
+// ------------------
+// The first sector of each FAT copy: the reserved entries and the root
+// directory chain. Every later sector of a blank FAT is zero.
+
+static_assert(kRootCluster + kSDFormatMaxRootClusters <=
+                  std::tuple_size_v<FatSector>,
+              "the longest root chain must fit in the first FAT sector");
+
+static FatSector makeFirstFatSector(uint32_t rootClusters) {
+  FatSector sector{};
+
+  // FAT[0]: Media descriptor (0xF8) with upper bits set
+  // Stored as 0xFFFFFF00 | 0xF8 = 0xFFFFFFF8 in the spec's notation,
+  // but for FAT32 only 28 bits matter, so 0x0FFFFFF8 is equivalent.
+  sector[0] = 0xFFFFFF00 | kMediaDescriptor;
+
+  // FAT[1]: Clean shutdown flags (all bits set = clean)
+  sector[1] = 0xFFFFFFFF;
 
-  // Write primary FSInfo (partition sector 1) and backup (partition sector 7)
-  return writeSectorAndBackupSector(
-      fd, kPartitionAlignmentSectors + kFsInfoSector,
-      kPartitionAlignmentSectors + kBackupBootSector + 1, fsinfo);
+  // FAT[2..]: Root directory chain, the last cluster end-of-chain
+  uint32_t lastCluster = kRootCluster + rootClusters - 1;
+  for (uint32_t cluster = kRootCluster; cluster < lastCluster; cluster++) {
+    sector[cluster] = cluster + 1;
+  }
+  sector[lastCluster] = kFat32EndOfChain;
+  return sector;
 }
 
-// sdFormatWriteFat32Tables
-// ------------------------
-// Initializes both FAT copies (primary and backup).
-//
-// FAT initialization involves:
-//   1. Zeroing all FAT sectors (marks all clusters as free)
-//   2. Writing the reserved entries FAT[0], FAT[1], and FAT[2]
-//
-// Reserved FAT entries:
-//   FAT[0] (FAT_mediaEntry): 0x0FFFFFF8
-//     - Low byte = media descriptor (0xF8 for fixed disk)
-//     - Upper bytes = 0xFFFFFF (all 1s)
-//
-//   FAT[1] (FAT_eocEntry): 0xFFFFFFFF
-//     - End-of-chain marker with dirty volume flags
-//     - Bit 27 set = clean shutdown (volume properly unmounted)
-//     - Bit 26 set = no I/O errors encountered
-//     - All bits set indicates a clean, error-free volume
-//
-//   FAT[2]: 0x0FFFFFFF
-//     - Marks the root directory cluster as allocated
-//     - End-of-chain marker (root directory is one cluster)
+// makeRootDirSector
+// -----------------
 
-int sdFormatWriteFat32Tables(int fd, uint64_t sectorCount) {
-  // First sector of each FAT containing the three reserved entries.
-  // The array is 128 uint32_t values (512 bytes = 1 sector).
-  // Entries 0-2 are initialized; entries 3-127 are implicitly zero.
-  const uint32_t fatSector[128] = {
-      // FAT[0]: Media descriptor (0xF8) with upper bits set
-      // Stored as 0xFFFFFF00 | 0xF8 = 0xFFFFFFF8 in the spec's notation,
-      // but for FAT32 only 28 bits matter, so 0x0FFFFFF8 is equivalent.
-      0xFFFFFF00 | kMediaDescriptor,
-
-      // FAT[1]: Clean shutdown flags (all bits set = clean)
-      0xFFFFFFFF,
-
-      // FAT[2]: Root directory cluster (allocated, end-of-chain)
-      0x0FFFFFFF,
+static RootDirSector makeRootDirSector(const char* label) {
+  return RootDirSector{
+      .volumeLabel =
+          {
+              .name = prepareVolumeLabel(label),
+              // attributes defaults to kAttrVolumeId (0x08)
+              // All other fields default to 0
+          },
+      // padding is implicitly zeroed
   };
+}
 
-  uint32_t fatSize = fatSizeSectors(sectorCount);
+// =============================================================================
+// Incremental Reformat
+// =============================================================================
 
-  // Zero both FAT copies (contiguous on disk)
-  if (int err = zeroSectors(fd, kFatStartSector, 2 * fatSize); err != 0) {
-    return err;
-  }
+// ExpectedSector
+// --------------
+// A sector of an extent that is expected to hold something other than
+// zeros. `index` is relative to the start of the extent, in 512-byte units
+// like the extent itself; a larger logical sector is the structure
+// followed by zeros.
+
+struct ExpectedSector {
+  uint64_t index;
+  SectorBytes bytes;
+};
+
+// reconcileExtent
+// ---------------
+// Brings `sectorCount` sectors from `startLba` to their expected contents:
+// the sectors listed in `expected` (sorted by index), and zeros everywhere
+// else. The extent is read in 1 MB chunks; a chunk with no listed sector
+// that reads back as zeros is accepted with one isZeroFilled scan. Within
+// a chunk, each run of differing sectors is rewritten with one write. The
+// I/O is counted against statistics phase `phase`. A hash manifest records
+// every chunk with its expected contents, written or already in place.
+//
+// Sectors are compared and rewritten in blocks of `blockSectors`, the
+// device's physical block, so no write covers part of a block. The extent
+// must consist of whole blocks.
+
+static int reconcileExtent(int fd, uint32_t phase, uint32_t blockSectors,
+                           uint64_t startLba, uint64_t sectorCount,
+                           std::span<const ExpectedSector> expected,
+                           SDFormatIncrementalReport& report) {
+  constexpr uint64_t kChunkSectors = 2048;
+  PhaseScope scope(phase);
+
+  const auto bufferSectors =
+      static_cast<size_t>(std::min(sectorCount, kChunkSectors));
+  std::vector<std::byte> current(bufferSectors * kSectorSize);
+  std::vector<std::byte> wanted(current.size());
+  auto next = expected.begin();
+
+  for (uint64_t chunkStart = 0; chunkStart < sectorCount;) {
+    const auto chunkSectors = static_cast<size_t>(
+        std::min(sectorCount - chunkStart, kChunkSectors));
+    auto chunk = std::span{current}.first(chunkSectors * kSectorSize);
+    const auto offset =
+        static_cast<off_t>((startLba + chunkStart) * kSectorSize);
+    if (int err = readBytes(fd, offset, chunk); err != 0) {
+      return err;
+    }
+    report.sectorsCompared += chunkSectors;
+
+    const uint64_t chunkEnd = chunkStart + chunkSectors;
+    const bool expectsZeros = next == expected.end() || next->index >= chunkEnd;
+    if (expectsZeros && isZeroFilled(chunk)) {
+      if (hashManifestEnabled(fd)) {
+        recordZeros(static_cast<uint64_t>(offset), chunk.size());
+      }
+      chunkStart = chunkEnd;
+      continue;
+    }
 
-  // Write reserved entries to first sector of each FAT
-  return writeSectorAndBackupSector(fd, kFatStartSector,
-                                    kFatStartSector + fatSize, fatSector);
+    // Build the expected chunk, then write each run of differing sectors
+    std::fill(wanted.begin(), wanted.end(), std::byte{0});
+    for (; next != expected.end() && next->index < chunkEnd; ++next) {
+      std::copy(next->bytes.begin(), next->bytes.end(),
+                wanted.begin() + static_cast<ptrdiff_t>(
+                                     (next->index - chunkStart) * kSectorSize));
+    }
+    const size_t blockBytes = size_t{blockSectors} * kSectorSize;
+    auto differs = [&](size_t sector) {
+      return !std::equal(chunk.begin() + sector * kSectorSize,
+                         chunk.begin() + sector * kSectorSize + blockBytes,
+                         wanted.begin() + sector * kSectorSize);
+    };
+    for (size_t sector = 0; sector < chunkSectors;) {
+      if (!differs(sector)) {
+        sector += blockSectors;
+        continue;
+      }
+      size_t runEnd = sector + blockSectors;
+      while (runEnd < chunkSectors && differs(runEnd)) {
+        runEnd += blockSectors;
+      }
+      if (int err = writeBytes(
+              fd, offset + static_cast<off_t>(sector * kSectorSize),
+              std::span{wanted}.subspan(sector * kSectorSize,
+                                        (runEnd - sector) * kSectorSize));
+          err != 0) {
+        return err;
+      }
+      report.sectorsWritten += runEnd - sector;
+      sector = runEnd;
+    }
+    if (hashManifestEnabled(fd)) {
+      recordContent(static_cast<uint64_t>(offset),
+                    std::span{wanted}.first(chunk.size()));
+    }
+    chunkStart = chunkEnd;
+  }
+  return 0;
 }
 
-// sdFormatWriteRootDirectory
-// --------------------------
-// Initializes the root directory cluster (cluster 2) with a volume label.
-//
-// The root directory in FAT32 is stored in the data region like any other
-// directory. Its location is determined by BPB_rootCluster (always 2 here).
-//
-// Initialization steps:
-//   1. Zero the entire cluster (32 KB = 64 sectors)
-//   2. Create a volume label entry (DIR_attributes = ATTR_VOLUME_ID)
+// =============================================================================
+// FAT16 Layout
+// =============================================================================
 //
-// The volume label entry appears at the very beginning of the root directory.
-// A freshly formatted volume has only this one entry; all others are free
-// (zeroed, with DIR_name[0] = 0x00 indicating the end of directory entries).
+// Cards too small for FAT32 with 32 KB clusters are formatted FAT16
+// (FatStructures.h §FAT16-Specific Constants). The partition starts at the
+// flashcart layout's 4 MB boundary, which also keeps sdFormatAutotune's
+// scratch range outside the volume:
+//
+//   Sector 8192                VBR, then padding (reservedSectors in all)
+//   fatStart                   Primary FAT (fatSize sectors)
+//   fatStart + fatSize         Backup FAT
+//   fatStart + 2 × fatSize     Root directory region (32 sectors)
+//   Sector 16384               Cluster 2…
+//
+// The metadata takes at most 545 sectors; the reserved region is padded so
+// that it fills kFat16MetadataSectors and the data region starts on a 4 MB
+// boundary, where the card's erase units begin. Every cluster size then
+// divides the distance from it to any erase unit boundary, so no cluster
+// straddles two.
+//
+// The cluster size depends on the volume size, so unlike the FAT32
+// profiles the layout is planned from the sector count at run time. FAT16
+// volumes use 512-byte logical sectors; every card that small does.
+
+// Fat16Plan
+// ---------
+// The layout of a FAT16 volume. A clusterCount of zero means the device is
+// too small for FAT16.
+
+struct Fat16Plan {
+  uint32_t partitionSectors;
+  uint32_t sectorsPerCluster;
+  uint32_t reservedSectors;
+  uint32_t fatSize;
+  uint32_t clusterCount;
+};
+
+// kFat16MaxVolumeSectors: The largest FAT16 volume, kFat16MaxClusters
+// clusters of 32 KB (2 GiB). A larger device gets a partition of this size;
+// the rest is left unpartitioned.
+static constexpr uint64_t kFat16MaxVolumeSectors =
+    kFat16MetadataSectors +
+    uint64_t{kFat16MaxClusters} * kFat16MaxSectorsPerCluster;
+
+// planFat16
+// ---------
+// Tries each cluster size from 2 KB up and takes the first that keeps the
+// cluster count within kFat16MaxClusters. With the data region at a fixed
+// offset, the cluster count follows from the partition size alone, and
+// each FAT is just large enough for it (256 FAT16 entries per sector):
+//
+//   clusterCount = (partitionSectors - kFat16MetadataSectors)
+//                  / sectorsPerCluster
+//   fatSize = ceil((clusterCount + 2) / 256)
+//   reservedSectors = kFat16MetadataSectors - 2 × fatSize - rootSectors
+//
+// A 1 GB card (2,097,152 sectors) gets 16 KB clusters, as on the card in
+// docs/fat16_forensic_analysis.md, with 65,024 clusters and 255-sector
+// FATs. That card's partition started at sector 1 and its data region
+// right after 545 metadata sectors, hence its 65,518 clusters.
+
+static constexpr Fat16Plan planFat16(uint64_t sectorCount) {
+  if (sectorCount <= kPartitionAlignmentSectors) {
+    return {};
+  }
+  const uint64_t available = sectorCount - kPartitionAlignmentSectors;
+  for (uint32_t sectorsPerCluster = kFat16MinSectorsPerCluster;
+       sectorsPerCluster <= kFat16MaxSectorsPerCluster;
+       sectorsPerCluster *= 2) {
+    const uint64_t partitionSectors =
+        std::min(available, kFat16MaxVolumeSectors);
+    if (partitionSectors <= kFat16MetadataSectors) {
+      return {};
+    }
+    const uint64_t clusterCount =
+        (partitionSectors - kFat16MetadataSectors) / sectorsPerCluster;
+    if (clusterCount <= kFat16MaxClusters) {
+      if (clusterCount < kFat16MinClusters) {
+        return {};
+      }
+      const uint64_t fatSize =
+          ((clusterCount + kRootCluster) * sizeof(uint16_t) + kSectorSize -
+           1) / kSectorSize;
+      return Fat16Plan{
+          .partitionSectors = static_cast<uint32_t>(partitionSectors),
+          .sectorsPerCluster = sectorsPerCluster,
+          .reservedSectors = static_cast<uint32_t>(
+              kFat16MetadataSectors - kFatCount * fatSize -
+              kFat16RootSectors),
+          .fatSize = static_cast<uint32_t>(fatSize),
+          .clusterCount = static_cast<uint32_t>(clusterCount),
+      };
+    }
+  }
+  return {};
+}
 
-int sdFormatWriteRootDirectory(int fd, uint64_t sectorCount,
-                               const char* label) {
-  // Prepare the volume label (11 characters, uppercase, space-padded)
-  auto volumeLabel = prepareVolumeLabel(label);
+static_assert(planFat16(kSDFormatFat16MinSectors).clusterCount != 0 &&
+                  planFat16(kSDFormatFat16MinSectors - 1).clusterCount == 0,
+              "kSDFormatFat16MinSectors must be the smallest FAT16 device");
+static_assert(planFat16(kPartitionAlignmentSectors + kFat16MaxVolumeSectors)
+                      .clusterCount == kFat16MaxClusters,
+              "the largest FAT16 volume must use every cluster");
 
-  // Calculate the absolute LBA of cluster 2 (root directory)
-  uint32_t dataStart = dataStartSector(sectorCount);
+// fat16FatStartSector / fat16RootStartSector
+// ------------------------------------------
+// Absolute LBAs of the primary FAT and the root directory region. The data
+// region (cluster 2) follows the root directory region.
 
-  // Zero the entire first cluster of the data region
-  if (int err = zeroSectors(fd, dataStart, kSectorsPerCluster); err != 0) {
-    return err;
-  }
+static constexpr uint64_t fat16FatStartSector(const Fat16Plan& plan) {
+  return kPartitionAlignmentSectors + plan.reservedSectors;
+}
 
-  // Create the root directory's first sector with the volume label entry
-  const RootDirSector rootDirSector = {
-      .volumeLabel =
+static constexpr uint64_t fat16RootStartSector(const Fat16Plan& plan) {
+  return fat16FatStartSector(plan) + uint64_t{kFatCount} * plan.fatSize;
+}
+
+static_assert(fat16RootStartSector(planFat16(2097152)) + kFat16RootSectors ==
+                  2 * kPartitionAlignmentSectors,
+              "the FAT16 data region must start 4 MB into the partition");
+
+// makeFat16MasterBootRecord
+// -------------------------
+// As makeMasterBootRecord, with a FAT16 partition type.
+
+static MasterBootRecord makeFat16MasterBootRecord(const Fat16Plan& plan) {
+  return MasterBootRecord{
+      .partitions =
           {
-              .name = volumeLabel,
-              // attributes defaults to kAttrVolumeId (0x08)
-              // All other fields default to 0
+              PartitionEntry{
+                  .status = 0x80,
+                  .chsStart = {0xFF, 0xFF, 0xFF},
+                  .type = plan.partitionSectors < 0x10000
+                              ? kPartitionTypeFat16Small
+                              : kPartitionTypeFat16,
+                  .chsEnd = {0xFF, 0xFF, 0xFF},
+                  .lbaStart = kPartitionAlignmentSectors,
+                  .sectorCount = plan.partitionSectors,
+              },
           },
-      // padding is implicitly zeroed
+      .signature = kMbrSignature,
   };
+}
+
+// makeFat16VolumeBootRecord
+// -------------------------
+// The volume ID is taken from the clock, as in makeVolumeBootRecord.
+
+static Fat16VolumeBootRecord makeFat16VolumeBootRecord(const Fat16Plan& plan,
+                                                       const char* label) {
+  const bool small = plan.partitionSectors < 0x10000;
+  return Fat16VolumeBootRecord{
+      .sectorsPerCluster = static_cast<uint8_t>(plan.sectorsPerCluster),
+      .reservedSectorCount = static_cast<uint16_t>(plan.reservedSectors),
+      .totalSectors16 =
+          static_cast<uint16_t>(small ? plan.partitionSectors : 0),
+      .fatSize16 = static_cast<uint16_t>(plan.fatSize),
+      .totalSectors32 = small ? 0 : plan.partitionSectors,
+      .volumeId = static_cast<uint32_t>(time(nullptr)),
+      .volumeLabel = prepareVolumeLabel(label),
+  };
+}
+
+// withFat16Plan
+// -------------
+// Calls `function` with the plan for `sectorCount`. Returns EINVAL if the
+// device is too small for FAT16, and EOPNOTSUPP if its logical sectors are
+// not 512 bytes.
 
-  // Write the volume label entry to the first sector of the root directory
-  return writeSector(fd, dataStart, rootDirSector);
+template <typename Function>
+static int withFat16Plan(int fd, uint64_t sectorCount, Function function) {
+  if (deviceSectorSize(fd).logicalBytes != kSectorSize) {
+    return EOPNOTSUPP;
+  }
+  const Fat16Plan plan = planFat16(sectorCount);
+  if (plan.clusterCount == 0) {
+    return EINVAL;
+  }
+  return function(plan);
+}
+
+// =============================================================================
+// exFAT Layout
+// =============================================================================
+//
+// Large cards for targets other than the DS are formatted exFAT
+// (FatStructures.h §exFAT Constants). The partition starts at the layout's
+// alignment boundary, as the FAT32 one does; within it, in the layout's
+// logical sectors:
+//
+//   Sector 0                   Main Boot Region (12 sectors)
+//   Sector 12                  Backup Boot Region (12 sectors)
+//   fatOffset                  The FAT (sector 24, rounded up to a block)
+//   clusterHeapOffset          Cluster heap, on the next alignment boundary
+//    ├─ Cluster 2…             Allocation bitmap (bitmapClusters)
+//    ├─ Next cluster           Up-case table
+//    └─ Next cluster           Root directory
+//
+// Starting the cluster heap on an alignment boundary of the device keeps
+// every 128 KB cluster within one erase unit. exFAT has a single FAT, and
+// the allocation bitmap, not the FAT, records which clusters are free.
+
+// ExfatPlan
+// ---------
+// The layout of an exFAT volume, in logical sectors. A clusterCount of zero
+// means the device is too small.
+
+struct ExfatPlan {
+  uint64_t volumeLength;
+  uint32_t fatOffset;
+  uint32_t fatLength;
+  uint32_t clusterHeapOffset;
+  uint32_t clusterCount;
+  uint32_t bitmapClusters;
+};
+
+// kExfatUpcaseEntries: Entries of the up-case table: the 128 the
+// specification makes mandatory (§7.2.5.1), which map a–z to A–Z.
+static constexpr uint32_t kExfatUpcaseEntries = 128;
+
+// planExfat
+// ---------
+// The partition spans the device as in partitionSectorCount, up to the
+// largest volume exFAT can address. The FAT is sized for every cluster the
+// partition could hold, and the cluster heap takes the rest from the next
+// alignment boundary. The reserved clusters (the bitmap, the up-case
+// table, and the root directory) must leave at least one free.
+
+template <typename Layout>
+static constexpr ExfatPlan planExfat(uint64_t sectorCount) {
+  constexpr uint64_t kSectorsPerCluster =
+      kExfatClusterBytes / Layout::kBytesPerSector;
+  constexpr uint64_t kBlockSectors = Layout::kBlockSectors;
+  constexpr uint64_t kAlignment = Layout::kAlignmentSectors;
+  auto roundUp = [](uint64_t value, uint64_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+  };
+
+  uint64_t available = sectorCount / Layout::kUnitsPerSector;
+  if (available <= kAlignment) {
+    return {};
+  }
+  available -= kAlignment;
+  if (usesGuidPartitionTable<Layout>(sectorCount)) {
+    available -= gptEntrySectors<Layout>() + 1;
+  }
+
+  const uint64_t maxClusters =
+      std::min<uint64_t>(available / kSectorsPerCluster, kExfatMaxClusters);
+  const uint64_t fatOffset =
+      roundUp(2 * kExfatBootRegionSectors, kBlockSectors);
+  const uint64_t fatLength = roundUp(
+      ((maxClusters + kRootCluster) * sizeof(uint32_t) +
+       Layout::kBytesPerSector - 1) / Layout::kBytesPerSector,
+      kBlockSectors);
+  const uint64_t clusterHeapOffset = roundUp(fatOffset + fatLength, kAlignment);
+  if (available <= clusterHeapOffset) {
+    return {};
+  }
+
+  const uint64_t clusterCount = std::min<uint64_t>(
+      (available - clusterHeapOffset) / kSectorsPerCluster, kExfatMaxClusters);
+  const uint64_t bitmapClusters =
+      ((clusterCount + 7) / 8 + kExfatClusterBytes - 1) / kExfatClusterBytes;
+  if (clusterCount <= bitmapClusters + 2) {
+    return {};
+  }
+  return ExfatPlan{
+      .volumeLength =
+          std::min(available, clusterHeapOffset +
+                                  kExfatMaxClusters * kSectorsPerCluster),
+      .fatOffset = static_cast<uint32_t>(fatOffset),
+      .fatLength = static_cast<uint32_t>(fatLength),
+      .clusterHeapOffset = static_cast<uint32_t>(clusterHeapOffset),
+      .clusterCount = static_cast<uint32_t>(clusterCount),
+      .bitmapClusters = static_cast<uint32_t>(bitmapClusters),
+  };
+}
+
+// exfatUpcaseCluster / exfatRootCluster
+// -------------------------------------
+// The clusters after the allocation bitmap.
+
+static constexpr uint32_t exfatUpcaseCluster(const ExfatPlan& plan) {
+  return kRootCluster + plan.bitmapClusters;
+}
+
+static constexpr uint32_t exfatRootCluster(const ExfatPlan& plan) {
+  return exfatUpcaseCluster(plan) + 1;
+}
+
+// exfatClusterLba
+// ---------------
+// Absolute LBA of `cluster`, in logical sectors.
+
+template <typename Layout>
+static constexpr uint64_t exfatClusterLba(const ExfatPlan& plan,
+                                          uint32_t cluster) {
+  return Layout::kAlignmentSectors + plan.clusterHeapOffset +
+         uint64_t{cluster - kRootCluster} *
+             (kExfatClusterBytes / Layout::kBytesPerSector);
+}
+
+// exfatChecksum
+// -------------
+// The rotate-and-add checksum of the specification, used for the boot
+// region (§3.4) and the up-case table (§7.2.2). With `bootSector` set, the
+// fields the driver updates in place, VolumeFlags and PercentInUse, are
+// skipped.
+
+static uint32_t exfatChecksum(std::span<const std::byte> bytes,
+                              bool bootSector) {
+  constexpr size_t kVolumeFlags = offsetof(ExfatBootSector, volumeFlags);
+  constexpr size_t kPercentInUse = offsetof(ExfatBootSector, percentInUse);
+  uint32_t checksum = 0;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    if (bootSector && (i == kVolumeFlags || i == kVolumeFlags + 1 ||
+                       i == kPercentInUse)) {
+      continue;
+    }
+    checksum = std::rotr(checksum, 1) + static_cast<uint8_t>(bytes[i]);
+  }
+  return checksum;
+}
+
+// makeExfatMasterBootRecord
+// -------------------------
+// As makeMasterBootRecord, with the exFAT partition type.
+
+template <typename Layout>
+static MasterBootRecord makeExfatMasterBootRecord(const ExfatPlan& plan) {
+  return MasterBootRecord{
+      .partitions =
+          {
+              PartitionEntry{
+                  .status = 0x80,
+                  .chsStart = {0xFF, 0xFF, 0xFF},
+                  .type = kPartitionTypeExfat,
+                  .chsEnd = {0xFF, 0xFF, 0xFF},
+                  .lbaStart = Layout::kAlignmentSectors,
+                  .sectorCount = static_cast<uint32_t>(plan.volumeLength),
+              },
+          },
+      .signature = kMbrSignature,
+  };
+}
+
+// makeExfatBootRegion
+// -------------------
+// The 12 sectors of a boot region: the boot sector, 8 extended boot
+// sectors (zeros and the signature AA550000h), the OEM parameters and
+// reserved sectors (zeros), and the checksum sector, which repeats the
+// checksum of the other 11. The Main and Backup Boot Regions are
+// identical. The volume serial number is taken from the clock, as in
+// makeVolumeBootRecord.
+
+template <typename Layout>
+static std::vector<std::byte> makeExfatBootRegion(const ExfatPlan& plan) {
+  constexpr size_t kSectorBytes = Layout::kBytesPerSector;
+  const ExfatBootSector boot = {
+      .partitionOffset = Layout::kAlignmentSectors,
+      .volumeLength = plan.volumeLength,
+      .fatOffset = plan.fatOffset,
+      .fatLength = plan.fatLength,
+      .clusterHeapOffset = plan.clusterHeapOffset,
+      .clusterCount = plan.clusterCount,
+      .firstClusterOfRootDirectory = exfatRootCluster(plan),
+      .volumeSerialNumber = static_cast<uint32_t>(time(nullptr)),
+      .bytesPerSectorShift =
+          static_cast<uint8_t>(std::countr_zero(Layout::kBytesPerSector)),
+      .sectorsPerClusterShift = static_cast<uint8_t>(
+          std::countr_zero(kExfatClusterBytes / Layout::kBytesPerSector)),
+      .percentInUse = static_cast<uint8_t>(
+          uint64_t{exfatRootCluster(plan) - 1} * 100 / plan.clusterCount),
+  };
+
+  std::vector<std::byte> region(kExfatBootRegionSectors * kSectorBytes);
+  const auto bootBytes = std::bit_cast<SectorBytes>(boot);
+  std::copy(bootBytes.begin(), bootBytes.end(), region.begin());
+  constexpr std::array<std::byte, 4> kExtendedBootSignature = {
+      std::byte{0x00}, std::byte{0x00}, std::byte{0x55}, std::byte{0xAA}};
+  for (size_t sector = 1; sector <= 8; sector++) {
+    std::copy(kExtendedBootSignature.begin(), kExtendedBootSignature.end(),
+              region.begin() + static_cast<ptrdiff_t>((sector + 1) *
+                                                          kSectorBytes -
+                                                      4));
+  }
+
+  const uint32_t checksum = exfatChecksum(
+      std::span{region}.first(kExfatChecksumSector * kSectorBytes), true);
+  for (size_t offset = kExfatChecksumSector * kSectorBytes;
+       offset < region.size(); offset += sizeof(checksum)) {
+    std::memcpy(&region[offset], &checksum, sizeof(checksum));
+  }
+  return region;
+}
+
+// makeExfatUpcaseTable
+// --------------------
+// The mandatory first 128 entries, uncompressed: each character maps to
+// itself, except a–z. Characters past the table map to themselves too, so
+// names outside ASCII compare case-sensitively.
+
+static constexpr std::array<uint16_t, kExfatUpcaseEntries>
+makeExfatUpcaseTable() {
+  std::array<uint16_t, kExfatUpcaseEntries> table{};
+  for (uint16_t character = 0; character < table.size(); character++) {
+    table[character] = character >= 'a' && character <= 'z'
+                           ? static_cast<uint16_t>(character - 'a' + 'A')
+                           : character;
+  }
+  return table;
+}
+
+static constexpr auto kExfatUpcaseTable = makeExfatUpcaseTable();
+
+// makeExfatRootDirectory
+// ----------------------
+// The first cluster of the root directory: the volume label entry and the
+// allocation bitmap and up-case table entries, then free entries. An empty
+// label gets an unused volume label entry, which means "no label"; a longer
+// one is truncated to 11 UTF-16 units, as prepareVolumeLabel truncates.
+//
+// Returns EINVAL if the label is not a valid file name (see decodeLongName).
+
+static int makeExfatRootDirectory(const ExfatPlan& plan, const char* label,
+                                  std::vector<std::byte>& cluster) {
+  std::u16string name;
+  if (label[0] != '\0') {
+    if (int err = decodeLongName(label, name); err != 0) {
+      return err;
+    }
+    if (name.size() > kExfatMaxLabelChars) {
+      // Do not split a surrogate pair
+      const bool split = (name[kExfatMaxLabelChars - 1] & 0xFC00) == 0xD800;
+      name.resize(kExfatMaxLabelChars - (split ? 1 : 0));
+    }
+  }
+
+  ExfatVolumeLabelEntry volumeLabel = {
+      .entryType = static_cast<uint8_t>(
+          name.empty() ? kExfatEntryVolumeLabel & ~kExfatEntryInUse
+                       : kExfatEntryVolumeLabel),
+      .characterCount = static_cast<uint8_t>(name.size()),
+      .volumeLabel = {},
+      .reserved = {},
+  };
+  std::copy(name.begin(), name.end(), volumeLabel.volumeLabel.begin());
+
+  const ExfatDirectoryEntry bitmap = {
+      .entryType = kExfatEntryAllocationBitmap,
+      .flags = 0,  // The first (only) allocation bitmap
+      .reserved1 = {},
+      .tableChecksum = 0,
+      .reserved2 = {},
+      .firstCluster = kRootCluster,
+      .dataLength = (uint64_t{plan.clusterCount} + 7) / 8,
+  };
+  const ExfatDirectoryEntry upcaseTable = {
+      .entryType = kExfatEntryUpcaseTable,
+      .flags = 0,
+      .reserved1 = {},
+      .tableChecksum =
+          exfatChecksum(std::as_bytes(std::span{kExfatUpcaseTable}), false),
+      .reserved2 = {},
+      .firstCluster = exfatUpcaseCluster(plan),
+      .dataLength = sizeof(kExfatUpcaseTable),
+  };
+
+  cluster.assign(kExfatClusterBytes, std::byte{0});
+  auto place = [&cluster](size_t index, const auto& entry) {
+    const auto bytes = std::as_bytes(std::span{&entry, 1});
+    std::copy(bytes.begin(), bytes.end(),
+              cluster.begin() + static_cast<ptrdiff_t>(index * 32));
+  };
+  place(0, volumeLabel);
+  place(1, bitmap);
+  place(2, upcaseTable);
+  return 0;
+}
+
+// =============================================================================
+// Layout Selection
+// =============================================================================
+
+// gLayoutProfile: The kSDFormatProfile the formatting functions use.
+static std::atomic<uint32_t> gLayoutProfile{kSDFormatProfileR4};
+
+// withProfile
+// -----------
+// Calls `function` with a value of the profile type of `profile`.
+
+template <typename Function>
+static auto withProfile(uint32_t profile, Function function) {
+  switch (profile) {
+    case kSDFormatProfileDSi:
+      return function(DsiProfile{});
+    case kSDFormatProfile3DS:
+      return function(N3dsProfile{});
+    case kSDFormatProfileSDXC:
+      return function(SdxcProfile{});
+    default:
+      return function(R4Profile{});
+  }
+}
+
+// withLayout
+// ----------
+// Calls `function` with a value of the SectorLayout type of `profile` on a
+// device of sector size `size`, so the body is instantiated once per
+// profile and sector format with its layout constant-folded. A device with
+// 512-byte sectors and blocks of 4 KB or more is treated as 512e.
+//
+// Blocks larger than 4 KB are aligned to 4 KB, the largest SectorLayout
+// block. The logical size must be 512 or 4096 (see withFormatLayout).
+
+template <typename Function>
+static auto withLayout(uint32_t profile, const SectorSize& size,
+                       Function function) {
+  return withProfile(profile, [&]<typename Profile>(Profile) {
+    if (size.logicalBytes == 4096) {
+      return function(SectorLayout<Profile, 4096, 4096>{});
+    }
+    if (size.physicalBytes >= 4096) {
+      return function(SectorLayout<Profile, 512, 4096>{});
+    }
+    return function(SectorLayout<Profile, 512, 512>{});
+  });
+}
+
+// withFormatLayout
+// ----------------
+// withLayout for `layout`. Returns EOPNOTSUPP for logical sectors other
+// than 512 and 4096 bytes, which no SD card or USB reader uses.
+
+template <typename Function>
+static int withFormatLayout(const FormatLayout& layout, Function function) {
+  if (layout.sectorSize.logicalBytes != 512 &&
+      layout.sectorSize.logicalBytes != 4096) {
+    return EOPNOTSUPP;
+  }
+  return withLayout(layout.profile, layout.sectorSize, function);
+}
+
+// withDeviceLayout
+// ----------------
+// withFormatLayout for the current profile and the sector size of the
+// device behind `fd`.
+
+template <typename Function>
+static int withDeviceLayout(int fd, Function function) {
+  return withFormatLayout(currentFormatLayout(fd), function);
+}
+
+// currentFormatLayout
+// -------------------
+
+FormatLayout currentFormatLayout(int fd) {
+  return {
+      .profile = gLayoutProfile.load(std::memory_order_relaxed),
+      .sectorSize = deviceSectorSize(fd),
+  };
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatSetLayoutProfile
+// ------------------------
+
+int sdFormatSetLayoutProfile(uint32_t profile) {
+  if (profile >= kSDFormatProfileCount) {
+    return EINVAL;
+  }
+  gLayoutProfile.store(profile, std::memory_order_relaxed);
+  return 0;
+}
+
+// sdFormatGetLayoutProfile
+// ------------------------
+
+uint32_t sdFormatGetLayoutProfile(void) {
+  return gLayoutProfile.load(std::memory_order_relaxed);
+}
+
+// sdFormatGetLayout
+// -----------------
+
+int sdFormatGetLayout(uint32_t profile, SDFormatLayout* layout) {
+  if (profile >= kSDFormatProfileCount) {
+    return EINVAL;
+  }
+  *layout = withProfile(profile, []<typename Profile>(Profile) {
+    return SDFormatLayout{
+        .clusterBytes = Profile::kClusterBytes,
+        .alignmentBytes = Profile::kAlignmentBytes,
+        .reservedSectors = Profile::kReservedSectors,
+        .fatCount = Profile::kFatCount,
+        .maxRootClusters = Profile::kMaxRootClusters,
+    };
+  });
+  return 0;
+}
+
+// sdFormatSetSectorSize
+// ---------------------
+
+int sdFormatSetSectorSize(const SDFormatSectorSize* size) {
+  if (size == nullptr) {
+    setSectorSizeOverride(nullptr);
+    return 0;
+  }
+  const SectorSize value = {
+      .logicalBytes = size->logicalBytes,
+      .physicalBytes = size->physicalBytes,
+  };
+  if ((value.logicalBytes != 512 && value.logicalBytes != 4096) ||
+      !isValidSectorSize(value)) {
+    return EINVAL;
+  }
+  setSectorSizeOverride(&value);
+  return 0;
+}
+
+// sdFormatGetSectorSize
+// ---------------------
+
+int sdFormatGetSectorSize(int fd, SDFormatSectorSize* size) {
+  const SectorSize value = deviceSectorSize(fd);
+  *size = {value.logicalBytes, value.physicalBytes};
+  return 0;
+}
+
+// sdFormatWriteMBR
+// ----------------
+// Writes the Master Boot Record to absolute sector 0.
+//
+// The MBR layout (512 bytes total):
+//   Offset 0x000: 446 bytes of bootstrap code (zeroed — not a boot disk)
+//   Offset 0x1BE: 16-byte partition entry 1 (FAT32 LBA partition)
+//   Offset 0x1CE: 16-byte partition entry 2 (zeroed — unused)
+//   Offset 0x1DE: 16-byte partition entry 3 (zeroed — unused)
+//   Offset 0x1EE: 16-byte partition entry 4 (zeroed — unused)
+//   Offset 0x1FE: 2-byte signature (0xAA55)
+//
+// The single partition entry specifies:
+//   - Active/bootable status (0x80)
+//   - FAT32 LBA type (0x0C)
+//   - Starting at sector 8192 (4 MB alignment; the profile's alignment)
+//   - Extending to the end of the device
+//
+// A device with more sectors than an MBR can address gets a GUID Partition
+// Table instead (see makeGuidPartitionTable): the protective MBR, primary
+// header, and entry array with one write, and the backup entry array and
+// header at the end of the device with another.
+
+int writeFormatMBR(int fd, const FormatLayout& layout, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseMBR);
+  return withFormatLayout(layout, [&]<typename Layout>(Layout) {
+    if (usesGuidPartitionTable<Layout>(sectorCount)) {
+      return writeGuidPartitionTable<Layout>(
+          fd, sectorCount, partitionSectorCount<Layout>(sectorCount));
+    }
+
+    // Write to sector 0 (absolute LBA 0)
+    const MasterBootRecord mbr = makeMasterBootRecord<Layout>(sectorCount);
+    return writeLogicalSector<Layout>(fd, 0, mbr);
+  });
+}
+
+int sdFormatWriteMBR(int fd, uint64_t sectorCount) {
+  return writeFormatMBR(fd, currentFormatLayout(fd), sectorCount);
+}
+
+// sdFormatWriteVolumeBootRecord
+// -----------------------------
+// Writes both the primary VBR (sector 0 of partition) and backup (sector 6).
+//
+// The VBR contains critical filesystem metadata including:
+//   - Jump instruction and OEM name
+//   - Complete BIOS Parameter Block with FAT32 geometry
+//   - Volume serial number and label
+//   - Filesystem type string
+//   - Boot sector signature
+//
+// Both the primary and backup copies are identical. The backup exists for
+// disaster recovery — if sector 0 of the partition becomes unreadable,
+// repair tools can restore the BPB from sector 6.
+
+int writeFormatVolumeBootRecord(int fd, const FormatLayout& layout,
+                                uint64_t sectorCount, const char* label) {
+  PhaseScope scope(kSDFormatPhaseVBR);
+
+  // Write primary VBR (partition sector 0) and backup VBR (partition sector 6)
+  return withFormatLayout(layout, [&]<typename Layout>(Layout) {
+    return writeLogicalSectorAndBackup<Layout>(
+        fd, Layout::kAlignmentSectors,
+        Layout::kAlignmentSectors + kBackupBootSector,
+        makeVolumeBootRecord<Layout>(sectorCount, label));
+  });
+}
+
+int sdFormatWriteVolumeBootRecord(int fd, uint64_t sectorCount,
+                                  const char* label) {
+  return writeFormatVolumeBootRecord(fd, currentFormatLayout(fd), sectorCount,
+                                     label);
+}
+
+// sdFormatWriteFSInfo
+// -------------------
+// Writes both the primary FSInfo (sector 1) and backup (sector 7).
+//
+// The FSInfo structure provides hints to accelerate cluster allocation:
+//   - FSI_freeCount: Number of free clusters on the volume
+//   - FSI_nextFree: Where to start searching for free space
+//
+// For a freshly formatted volume:
+//   - freeCount = total clusters - rootClusters (minus the root directory)
+//   - nextFree = 2 + rootClusters (first cluster after the root directory,
+//     3 for the classic one-cluster root)
+
+int writeFormatFSInfo(int fd, const FormatLayout& layout,
+                      uint64_t sectorCount, uint32_t rootClusters) {
+  PhaseScope scope(kSDFormatPhaseFSInfo);
+  return withFormatLayout(layout, [&]<typename Layout>(Layout) {
+    if (!isValidRootClusterCount<Layout>(rootClusters)) {
+      return EINVAL;
+    }
+
+    // Write primary FSInfo (partition sector 1) and backup (partition
+    // sector 7)
+    return writeLogicalSectorAndBackup<Layout>(
+        fd, Layout::kAlignmentSectors + kFsInfoSector,
+        Layout::kAlignmentSectors + kBackupBootSector + 1,
+        makeFsInfo<Layout>(sectorCount, rootClusters));
+  });
+}
+
+int sdFormatWriteFSInfo(int fd, uint64_t sectorCount, uint32_t rootClusters) {
+  return writeFormatFSInfo(fd, currentFormatLayout(fd), sectorCount,
+                           rootClusters);
+}
+
+// sdFormatWriteFat32Tables
+// ------------------------
+// Initializes both FAT copies (primary and backup).
+//
+// FAT initialization involves:
+//   1. Writing the reserved entries FAT[0], FAT[1], and FAT[2]
+//   2. Zeroing every later FAT sector (marks all clusters as free)
+//
+// Reserved FAT entries:
+//   FAT[0] (FAT_mediaEntry): 0x0FFFFFF8
+//     - Low byte = media descriptor (0xF8 for fixed disk)
+//     - Upper bytes = 0xFFFFFF (all 1s)
+//
+//   FAT[1] (FAT_eocEntry): 0xFFFFFFFF
+//     - End-of-chain marker with dirty volume flags
+//     - Bit 27 set = clean shutdown (volume properly unmounted)
+//     - Bit 26 set = no I/O errors encountered
+//     - All bits set indicates a clean, error-free volume
+//
+//   FAT[2]: 0x0FFFFFFF
+//     - Marks the root directory cluster as allocated
+//     - End-of-chain marker (root directory is one cluster)
+//
+// With rootClusters > 1, FAT[2] instead links to 3, 3 to 4, and so on, and
+// the last root cluster holds the end-of-chain marker. Even the longest
+// chain ends within the first FAT sector, so it is written with the
+// reserved entries.
+//
+// Each copy is written front to back in one pass: its first block, then
+// zeros to its end. Nothing larger than a block is held in memory and no
+// sector is written twice, however large the FAT (two 256 MB copies on a
+// 2 TiB volume).
+
+int writeFormatFat32Tables(int fd, const FormatLayout& layout,
+                           uint64_t sectorCount, uint32_t rootClusters) {
+  PhaseScope scope(kSDFormatPhaseFAT);
+  return withFormatLayout(layout, [&]<typename Layout>(Layout) {
+    if (!isValidRootClusterCount<Layout>(rootClusters)) {
+      return EINVAL;
+    }
+
+    constexpr uint32_t kBlockUnits = Layout::kBlockBytes / kSectorSize;
+    const uint32_t fatSize = fatSizeSectors<Layout>(sectorCount);
+
+    // The first block of each copy: reserved entries, root chain, zeros
+    std::array<std::byte, Layout::kBlockBytes> firstBlock{};
+    const auto firstSector =
+        std::bit_cast<SectorBytes>(makeFirstFatSector(rootClusters));
+    std::copy(firstSector.begin(), firstSector.end(), firstBlock.begin());
+
+    for (uint32_t copy = 0; copy < Layout::kFatCount; copy++) {
+      const uint64_t start = Layout::kFatStartSector + uint64_t{copy} * fatSize;
+      if (int err = writeBytes(
+              fd, static_cast<off_t>(start * Layout::kBytesPerSector),
+              firstBlock);
+          err != 0) {
+        return err;
+      }
+
+      // Zeros to the end of the copy
+      if (int err = zeroSectors(
+              fd, static_cast<off_t>(start * Layout::kUnitsPerSector +
+                                     kBlockUnits),
+              fatSize * Layout::kUnitsPerSector - kBlockUnits);
+          err != 0) {
+        return err;
+      }
+    }
+    return 0;
+  });
+}
+
+int sdFormatWriteFat32Tables(int fd, uint64_t sectorCount,
+                             uint32_t rootClusters) {
+  return writeFormatFat32Tables(fd, currentFormatLayout(fd), sectorCount,
+                                rootClusters);
+}
+
+// sdFormatWriteRootDirectory
+// --------------------------
+// Initializes the root directory cluster (cluster 2) with a volume label.
+//
+// The root directory in FAT32 is stored in the data region like any other
+// directory. Its location is determined by BPB_rootCluster (always 2 here).
+//
+// Initialization steps:
+//   1. Zero every root directory cluster (rootClusters × 32 KB)
+//   2. Create a volume label entry (DIR_attributes = ATTR_VOLUME_ID)
+//
+// The volume label entry appears at the very beginning of the root directory.
+// A freshly formatted volume has only this one entry; all others are free
+// (zeroed, with DIR_name[0] = 0x00 indicating the end of directory entries).
+// A multi-cluster root occupies clusters 2 .. 2 + rootClusters - 1, which
+// are contiguous, so listing it is one sequential read.
+
+int writeFormatRootDirectory(int fd, const FormatLayout& layout,
+                             uint64_t sectorCount, uint32_t rootClusters,
+                             const char* label) {
+  PhaseScope scope(kSDFormatPhaseRootDirectory);
+  return withFormatLayout(layout, [&]<typename Layout>(Layout) {
+    if (!isValidRootClusterCount<Layout>(rootClusters)) {
+      return EINVAL;
+    }
+
+    // Calculate the absolute LBA of cluster 2 (root directory)
+    uint64_t dataStart = dataStartSector<Layout>(sectorCount);
+
+    // Zero the root directory clusters at the start of the data region
+    if (int err = zeroRegion(
+            fd, static_cast<off_t>(dataStart * Layout::kUnitsPerSector),
+            uint64_t{rootClusters} * Layout::kClusterBytes / kSectorSize);
+        err != 0) {
+      return err;
+    }
+
+    // Write the volume label entry to the first sector of the root directory
+    return writeLogicalSector<Layout>(fd, dataStart, makeRootDirSector(label));
+  });
+}
+
+int sdFormatWriteRootDirectory(int fd, uint64_t sectorCount,
+                               uint32_t rootClusters, const char* label) {
+  return writeFormatRootDirectory(fd, currentFormatLayout(fd), sectorCount,
+                                  rootClusters, label);
+}
+
+// sdFormatWriteSaveFiles
+// ----------------------
+// Creates zero-filled save files in the root directory.
+//
+// Everything is planned before the first write: names are converted and
+// checked, short names generated, clusters assigned back to back from the
+// first cluster after the root directory, and the entries sorted by
+// case-folded name. Only then are the data, the FAT chains, the directory
+// entries, and FSInfo written, each as one large transfer.
+
+template <typename Layout>
+static int writeSaveFiles(int fd, uint64_t sectorCount, uint32_t rootClusters,
+                          const SDFormatSaveFile* saves, uint32_t saveCount) {
+  constexpr uint32_t kClusterBytes = Layout::kClusterBytes;
+  constexpr uint32_t kEntriesPerCluster =
+      kClusterBytes / sizeof(DirectoryEntry);
+  if (!isValidRootClusterCount<Layout>(rootClusters)) {
+    return EINVAL;
+  }
+  const uint32_t freeClusters =
+      freeClusterCount<Layout>(sectorCount, rootClusters);
+  const uint32_t firstCluster = kRootCluster + rootClusters;
+
+  // ---------------------------------------------------------------------------
+  // Plan
+  // ---------------------------------------------------------------------------
+
+  std::vector<DirectoryRecord> records;
+  std::vector<uint32_t> lengths;
+  uint32_t nextCluster = firstCluster;
+
+  for (uint32_t i = 0; i < saveCount; i++) {
+    const SDFormatSaveFile& save = saves[i];
+    if (save.saveSize < kSaveSizeMin || save.saveSize > kSaveSizeMax) {
+      return EINVAL;
+    }
+
+    DirectoryRecord record{
+        .longName = {},
+        .attributes = kAttrArchive,
+        .firstCluster = nextCluster,
+        .fileSize = save.saveSize,
+    };
+    if (int err = decodeLongName(saveFileName(save.romName), record.longName);
+        err != 0) {
+      return err;
+    }
+
+    uint32_t clusters = (save.saveSize + kClusterBytes - 1) / kClusterBytes;
+    if (clusters > freeClusters - (nextCluster - firstCluster)) {
+      return ENOSPC;
+    }
+    records.push_back(std::move(record));
+    lengths.push_back(clusters);
+    nextCluster += clusters;
+  }
+
+  // Clusters follow the caller's order; entries are emitted in menu order
+  sortDirectoryRecords(records);
+  const FatTimestamp now = currentFatTimestamp();
+  DirectoryNames names;
+  std::vector<DirectoryEntryBytes> entries;
+  for (const DirectoryRecord& record : records) {
+    if (int err = appendDirectoryRecord(record, now, names, entries);
+        err != 0) {
+      return err;
+    }
+  }
+
+  // Entry 0 of the root directory is the volume label
+  if (entries.size() + 1 > uint64_t{kEntriesPerCluster} * rootClusters) {
+    return ENOSPC;
+  }
+  const uint32_t allocated = nextCluster - firstCluster;
+  const uint64_t dataStart = dataStartSector<Layout>(sectorCount);
+
+  // ---------------------------------------------------------------------------
+  // Write
+  // ---------------------------------------------------------------------------
+
+  constexpr uint32_t kClusterUnits = kClusterBytes / kSectorSize;
+  if (int err = zeroRegion(
+          fd,
+          static_cast<off_t>(dataStart * Layout::kUnitsPerSector +
+                             uint64_t{rootClusters} * kClusterUnits),
+          uint64_t{allocated} * kClusterUnits);
+      err != 0) {
+    return err;
+  }
+
+  if (int err = writeClusterRuns<Layout>(
+          fd, fatSizeSectors<Layout>(sectorCount), firstCluster, lengths);
+      err != 0) {
+    return err;
+  }
+
+  if (int err = writeAlignedBytes(
+          fd, static_cast<off_t>(dataStart * Layout::kBytesPerSector +
+                                 sizeof(DirectoryEntry)),
+          std::as_bytes(std::span{entries}), Layout::kBlockBytes);
+      err != 0) {
+    return err;
+  }
+
+  const FSInfo fsinfo = {
+      .freeCount = freeClusters - allocated,
+      .nextFree = allocated < freeClusters ? nextCluster : kFsInfoUnknown,
+  };
+  return writeLogicalSectorAndBackup<Layout>(
+      fd, Layout::kAlignmentSectors + kFsInfoSector,
+      Layout::kAlignmentSectors + kBackupBootSector + 1, fsinfo);
+}
+
+int writeFormatSaveFiles(int fd, const FormatLayout& layout,
+                         uint64_t sectorCount, uint32_t rootClusters,
+                         const SDFormatSaveFile* saves, uint32_t saveCount) {
+  PhaseScope scope(kSDFormatPhaseSaveFiles);
+  return withFormatLayout(layout, [&]<typename Layout>(Layout) {
+    return writeSaveFiles<Layout>(fd, sectorCount, rootClusters, saves,
+                                  saveCount);
+  });
+}
+
+int sdFormatWriteSaveFiles(int fd, uint64_t sectorCount,
+                           uint32_t rootClusters,
+                           const SDFormatSaveFile* saves, uint32_t saveCount) {
+  return writeFormatSaveFiles(fd, currentFormatLayout(fd), sectorCount,
+                              rootClusters, saves, saveCount);
+}
+
+// reconcileGuidPartitionTable
+// ---------------------------
+// Reconciles both regions of a new GPT. Each region is widened to whole
+// blocks, except at the end of a device whose size is not a whole number
+// of blocks, where it is compared sector by sector. The GUIDs are random,
+// so the headers and the first entry are always rewritten.
+
+template <typename Layout>
+static int reconcileGuidPartitionTable(int fd, uint64_t sectorCount,
+                                       SDFormatIncrementalReport& report) {
+  constexpr uint64_t kBlockUnits = Layout::kBlockBytes / kSectorSize;
+  for (const GptRegion& region : makeGuidPartitionTable<Layout>(
+           sectorCount, partitionSectorCount<Layout>(sectorCount))) {
+    const uint64_t start = region.lba * Layout::kUnitsPerSector;
+    const uint64_t end = start + region.bytes.size() / kSectorSize;
+    const uint64_t first = start / kBlockUnits * kBlockUnits;
+    const uint64_t last = (end + kBlockUnits - 1) / kBlockUnits * kBlockUnits;
+    const bool wholeBlocks = last <= sectorCount;
+
+    std::vector<ExpectedSector> expected;
+    for (uint64_t unit = start; unit < end; unit++) {
+      auto bytes = std::span{region.bytes}.subspan(
+          static_cast<size_t>(unit - start) * kSectorSize, kSectorSize);
+      if (isZeroFilled(bytes)) {
+        continue;
+      }
+      ExpectedSector& sector =
+          expected.emplace_back(unit - (wholeBlocks ? first : start));
+      std::copy(bytes.begin(), bytes.end(), sector.bytes.begin());
+    }
+
+    int err = wholeBlocks
+                  ? reconcileExtent(fd, kSDFormatPhaseMBR, kBlockUnits, first,
+                                    last - first, expected, report)
+                  : reconcileExtent(fd, kSDFormatPhaseMBR, 1, start,
+                                    end - start, expected, report);
+    if (err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+// sdFormatReformatIncremental
+// ---------------------------
+// Reconciles the four metadata extents in the order the individual
+// functions write them. Each extent is described by the few sectors that
+// are not zero, built by the same helpers the formatting functions use.
+//
+// The FATs and the root directory are adjacent, so kSDFormatDiscardTables
+// discards them with one call. The compare then doubles as the read-back
+// check of the discard.
+
+template <typename Layout>
+static int reformatIncremental(int fd, uint64_t sectorCount,
+                               uint32_t rootClusters, const char* label,
+                               uint32_t flags,
+                               SDFormatIncrementalReport* report) {
+  if (!isValidRootClusterCount<Layout>(rootClusters)) {
+    return EINVAL;
+  }
+
+  const auto vbr = std::bit_cast<SectorBytes>(
+      makeVolumeBootRecord<Layout>(sectorCount, label));
+  const auto fsinfo = std::bit_cast<SectorBytes>(
+      makeFsInfo<Layout>(sectorCount, rootClusters));
+  const auto fat =
+      std::bit_cast<SectorBytes>(makeFirstFatSector(rootClusters));
+  // Extents are reconciled in 512-byte units, whole blocks at a time
+  constexpr uint32_t kUnits = Layout::kUnitsPerSector;
+  constexpr uint32_t kBlockUnits = Layout::kBlockBytes / kSectorSize;
+  const uint64_t fatSize = fatSizeSectors<Layout>(sectorCount);
+  const uint64_t fatUnits = Layout::kFatCount * fatSize * kUnits;
+  const uint64_t dataStart = dataStartSector<Layout>(sectorCount);
+  const uint64_t rootUnits =
+      uint64_t{rootClusters} * Layout::kClusterBytes / kSectorSize;
+  constexpr uint64_t kFatStart = uint64_t{Layout::kFatStartSector} * kUnits;
+
+  const ExpectedSector mbr[] = {
+      {0, std::bit_cast<SectorBytes>(
+              makeMasterBootRecord<Layout>(sectorCount))},
+  };
+  const ExpectedSector reserved[] = {
+      {0, vbr},
+      {kFsInfoSector * kUnits, fsinfo},
+      {kBackupBootSector * kUnits, vbr},
+      {(kBackupBootSector + 1) * kUnits, fsinfo},
+  };
+  const ExpectedSector fats[] = {
+      {0, fat},
+      {fatSize * kUnits, fat},
+  };
+  const auto fatCopies = std::span{fats}.first(Layout::kFatCount);
+  const ExpectedSector root[] = {
+      {0, std::bit_cast<SectorBytes>(makeRootDirSector(label))},
+  };
+
+  if (usesGuidPartitionTable<Layout>(sectorCount)) {
+    if (int err = reconcileGuidPartitionTable<Layout>(fd, sectorCount,
+                                                      *report);
+        err != 0) {
+      return err;
+    }
+  } else if (int err = reconcileExtent(fd, kSDFormatPhaseMBR, kBlockUnits, 0,
+                                       kBlockUnits, mbr, *report);
+             err != 0) {
+    return err;
+  }
+  if (int err = reconcileExtent(
+          fd, kSDFormatPhaseVBR, kBlockUnits,
+          uint64_t{Layout::kAlignmentSectors} * kUnits,
+          uint64_t{Layout::kReservedSectors} * kUnits, reserved, *report);
+      err != 0) {
+    return err;
+  }
+
+  if ((flags & kSDFormatDiscardTables) != 0) {
+    PhaseScope scope(kSDFormatPhaseFAT);
+    int err = discardRegion(fd, static_cast<off_t>(kFatStart),
+                            dataStart * kUnits + rootUnits - kFatStart);
+    if (err != 0 && err != EOPNOTSUPP) {
+      return err;
+    }
+    report->tablesDiscarded = err == 0;
+  }
+
+  if (int err = reconcileExtent(fd, kSDFormatPhaseFAT, kBlockUnits, kFatStart,
+                                fatUnits, fatCopies, *report);
+      err != 0) {
+    return err;
+  }
+  return reconcileExtent(fd, kSDFormatPhaseRootDirectory, kBlockUnits,
+                         dataStart * kUnits, rootUnits, root, *report);
+}
+
+int sdFormatReformatIncremental(int fd, uint64_t sectorCount,
+                                uint32_t rootClusters, const char* label,
+                                uint32_t flags,
+                                SDFormatIncrementalReport* report) {
+  *report = {};
+  return withDeviceLayout(fd, [&]<typename Layout>(Layout) {
+    return reformatIncremental<Layout>(fd, sectorCount, rootClusters, label,
+                                       flags, report);
+  });
+}
+
+// sdFormatGetFat16Layout
+// ----------------------
+
+int sdFormatGetFat16Layout(uint64_t sectorCount, SDFormatFat16Layout* layout) {
+  const Fat16Plan plan = planFat16(sectorCount);
+  if (plan.clusterCount == 0) {
+    return EINVAL;
+  }
+  *layout = {
+      .partitionSectors = plan.partitionSectors,
+      .clusterBytes = plan.sectorsPerCluster * kSectorSize,
+      .clusterCount = plan.clusterCount,
+      .fatSectors = plan.fatSize,
+  };
+  return 0;
+}
+
+// sdFormatFat16WriteMBR
+// ---------------------
+
+int sdFormatFat16WriteMBR(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseMBR);
+  return withFat16Plan(fd, sectorCount, [&](const Fat16Plan& plan) {
+    return writeSector(fd, 0, makeFat16MasterBootRecord(plan));
+  });
+}
+
+// sdFormatFat16WriteVolumeBootRecord
+// ----------------------------------
+
+int sdFormatFat16WriteVolumeBootRecord(int fd, uint64_t sectorCount,
+                                       const char* label) {
+  PhaseScope scope(kSDFormatPhaseVBR);
+  return withFat16Plan(fd, sectorCount, [&](const Fat16Plan& plan) {
+    return writeSector(fd, kPartitionAlignmentSectors,
+                       makeFat16VolumeBootRecord(plan, label));
+  });
+}
+
+// sdFormatFat16WriteTables
+// ------------------------
+// Both copies together are at most 512 sectors (256 KB), so they are built
+// in memory and written with one call.
+
+int sdFormatFat16WriteTables(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseFAT);
+  return withFat16Plan(fd, sectorCount, [&](const Fat16Plan& plan) {
+    std::vector<uint16_t> fats(size_t{kFatCount} * plan.fatSize *
+                               kSectorSize / sizeof(uint16_t));
+    for (uint32_t copy = 0; copy < kFatCount; copy++) {
+      auto fat = std::span{fats}.subspan(
+          size_t{copy} * plan.fatSize * kSectorSize / sizeof(uint16_t));
+
+      // FAT[0]: media descriptor; FAT[1]: end-of-chain, clean flags set
+      fat[0] = 0xFF00 | kMediaDescriptor;
+      fat[1] = kFat16EndOfChain;
+    }
+    return writeAlignedBytes(
+        fd, static_cast<off_t>(fat16FatStartSector(plan) * kSectorSize),
+        std::as_bytes(std::span{fats}), deviceSectorSize(fd).physicalBytes);
+  });
+}
+
+// sdFormatFat16WriteRootDirectory
+// -------------------------------
+// The whole root directory region with one write: the volume label entry,
+// then free entries.
+
+int sdFormatFat16WriteRootDirectory(int fd, uint64_t sectorCount,
+                                    const char* label) {
+  PhaseScope scope(kSDFormatPhaseRootDirectory);
+  return withFat16Plan(fd, sectorCount, [&](const Fat16Plan& plan) {
+    std::vector<std::byte> root(kFat16RootSectors * kSectorSize);
+    const auto first = std::bit_cast<SectorBytes>(makeRootDirSector(label));
+    std::copy(first.begin(), first.end(), root.begin());
+    return writeAlignedBytes(
+        fd, static_cast<off_t>(fat16RootStartSector(plan) * kSectorSize),
+        root, deviceSectorSize(fd).physicalBytes);
+  });
+}
+
+// withExfatPlan
+// -------------
+// withDeviceLayout, with the exFAT plan of the layout for `sectorCount`
+// passed along. Returns EINVAL if the device is too small for exFAT.
+
+template <typename Function>
+static int withExfatPlan(int fd, uint64_t sectorCount, Function function) {
+  return withDeviceLayout(fd, [&]<typename Layout>(Layout layout) {
+    const ExfatPlan plan = planExfat<Layout>(sectorCount);
+    if (plan.clusterCount == 0) {
+      return EINVAL;
+    }
+    return function(layout, plan);
+  });
+}
+
+// sdFormatGetExfatLayout
+// ----------------------
+
+int sdFormatGetExfatLayout(int fd, uint64_t sectorCount,
+                           SDFormatExfatLayout* layout) {
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        *layout = {
+            .partitionSectors = plan.volumeLength,
+            .bytesPerSector = Layout::kBytesPerSector,
+            .clusterBytes = kExfatClusterBytes,
+            .clusterCount = plan.clusterCount,
+            .fatSectors = plan.fatLength,
+            .clusterHeapOffset = plan.clusterHeapOffset,
+        };
+        return 0;
+      });
+}
+
+// sdFormatExfatWriteMBR
+// ---------------------
+
+int sdFormatExfatWriteMBR(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseMBR);
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        if (usesGuidPartitionTable<Layout>(sectorCount)) {
+          return writeGuidPartitionTable<Layout>(fd, sectorCount,
+                                                 plan.volumeLength);
+        }
+        return writeLogicalSector<Layout>(
+            fd, 0, makeExfatMasterBootRecord<Layout>(plan));
+      });
+}
+
+// sdFormatExfatWriteBootRegions
+// -----------------------------
+// The Main and Backup Boot Regions are adjacent and identical, so both go
+// out with one write of 24 sectors.
+
+int sdFormatExfatWriteBootRegions(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseVBR);
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        std::vector<std::byte> regions = makeExfatBootRegion<Layout>(plan);
+        regions.insert(regions.end(), regions.begin(), regions.end());
+        return writeAlignedBytes(
+            fd,
+            static_cast<off_t>(uint64_t{Layout::kAlignmentSectors} *
+                               Layout::kBytesPerSector),
+            regions, Layout::kBlockBytes);
+      });
+}
+
+// sdFormatExfatWriteFat
+// ---------------------
+// The entries in use all lie in the first blocks of the FAT, which are
+// written from memory; the rest of the FAT is zeroed with zeroRegion, as
+// sdFormatWriteFat32Tables zeroes a FAT32 copy.
+
+int sdFormatExfatWriteFat(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseFAT);
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        constexpr size_t kBlockBytes = Layout::kBlockBytes;
+        const uint32_t rootCluster = exfatRootCluster(plan);
+        const size_t headBytes =
+            ((rootCluster + 1) * sizeof(uint32_t) + kBlockBytes - 1) /
+            kBlockBytes * kBlockBytes;
+
+        // FAT[0]: media type; FAT[1]: end-of-chain; then the chains of the
+        // allocation bitmap, the up-case table, and the root directory
+        std::vector<uint32_t> head(headBytes / sizeof(uint32_t));
+        head[0] = kExfatMediaEntry;
+        head[1] = kExfatEndOfChain;
+        for (uint32_t cluster = kRootCluster;
+             cluster < exfatUpcaseCluster(plan) - 1; cluster++) {
+          head[cluster] = cluster + 1;
+        }
+        head[exfatUpcaseCluster(plan) - 1] = kExfatEndOfChain;
+        head[exfatUpcaseCluster(plan)] = kExfatEndOfChain;
+        head[rootCluster] = kExfatEndOfChain;
+
+        const uint64_t fatStart =
+            uint64_t{Layout::kAlignmentSectors} + plan.fatOffset;
+        if (int err = writeBytes(
+                fd, static_cast<off_t>(fatStart * Layout::kBytesPerSector),
+                std::as_bytes(std::span{head}));
+            err != 0) {
+          return err;
+        }
+        return zeroRegion(
+            fd,
+            static_cast<off_t>(fatStart * Layout::kUnitsPerSector +
+                               headBytes / kSectorSize),
+            uint64_t{plan.fatLength} * Layout::kUnitsPerSector -
+                headBytes / kSectorSize);
+      });
+}
+
+// sdFormatExfatWriteAllocationBitmap
+// ----------------------------------
+// The bitmap clusters are written front to back in chunks of up to
+// kExfatBitmapChunkBytes from one buffer. Only the first chunk has bits
+// set: the bitmap's own clusters, the up-case table, and the root
+// directory. One bit covers a 128 KB cluster, so the bitmap of a 1 TB card
+// is under 1 MB and goes out with a single write.
+
+static constexpr size_t kExfatBitmapChunkBytes = 8 << 20;
+
+int sdFormatExfatWriteAllocationBitmap(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseFAT);
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        const uint64_t bitmapBytes =
+            uint64_t{plan.bitmapClusters} * kExfatClusterBytes;
+        std::vector<std::byte> chunk(static_cast<size_t>(
+            std::min<uint64_t>(bitmapBytes, kExfatBitmapChunkBytes)));
+        const uint32_t used = exfatRootCluster(plan) + 1 - kRootCluster;
+        for (uint32_t bit = 0; bit < used; bit++) {
+          chunk[bit / 8] |= std::byte{1} << (bit % 8);
+        }
+
+        const uint64_t bitmapOffset =
+            exfatClusterLba<Layout>(plan, kRootCluster) *
+            Layout::kBytesPerSector;
+        for (uint64_t offset = 0; offset < bitmapBytes;) {
+          const auto length = static_cast<size_t>(
+              std::min<uint64_t>(bitmapBytes - offset, chunk.size()));
+          if (int err = writeBytes(
+                  fd, static_cast<off_t>(bitmapOffset + offset),
+                  std::span{chunk}.first(length));
+              err != 0) {
+            return err;
+          }
+          if (offset == 0) {
+            std::fill(chunk.begin(), chunk.end(), std::byte{0});
+          }
+          offset += length;
+        }
+        return 0;
+      });
+}
+
+// sdFormatExfatWriteUpcaseTable
+// -----------------------------
+// The up-case table cluster with one write: the table, then zeros.
+
+int sdFormatExfatWriteUpcaseTable(int fd, uint64_t sectorCount) {
+  PhaseScope scope(kSDFormatPhaseRootDirectory);
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        std::vector<std::byte> cluster(kExfatClusterBytes);
+        const auto table = std::as_bytes(std::span{kExfatUpcaseTable});
+        std::copy(table.begin(), table.end(), cluster.begin());
+        return writeBytes(
+            fd,
+            static_cast<off_t>(
+                exfatClusterLba<Layout>(plan, exfatUpcaseCluster(plan)) *
+                Layout::kBytesPerSector),
+            cluster);
+      });
+}
+
+// sdFormatExfatWriteRootDirectory
+// -------------------------------
+// The root directory cluster with one write (see makeExfatRootDirectory).
+
+int sdFormatExfatWriteRootDirectory(int fd, uint64_t sectorCount,
+                                    const char* label) {
+  PhaseScope scope(kSDFormatPhaseRootDirectory);
+  return withExfatPlan(
+      fd, sectorCount, [&]<typename Layout>(Layout, const ExfatPlan& plan) {
+        std::vector<std::byte> cluster;
+        if (int err = makeExfatRootDirectory(plan, label, cluster); err != 0) {
+          return err;
+        }
+        return writeBytes(
+            fd,
+            static_cast<off_t>(
+                exfatClusterLba<Layout>(plan, exfatRootCluster(plan)) *
+                Layout::kBytesPerSector),
+            cluster);
+      });
+}
+
+// sdFormatRefreshFSInfo
+// ---------------------
+// Recomputes FSI_freeCount and FSI_nextFree from the primary FAT of an
+// existing volume and rewrites both FSInfo copies. See refreshFsInfo.
+
+int sdFormatRefreshFSInfo(int fd) {
+  VolumeGeometry geometry;
+  if (int err = readVolumeGeometry(fd, geometry); err != 0) {
+    return err;
+  }
+  return refreshFsInfo(fd, geometry);
+}
+
+// findLabelSlot
+// -------------
+// Returns the absolute byte offset of the root directory's volume label
+// entry in `labelOffset`, or 0 if there is none. In that case
+// `freeOffset` receives a slot a new label entry can take (a deleted entry,
+// or the end-of-directory entry if the slot after it is free as well), or
+// 0 if there is no such slot.
+//
+// The root chain is followed one FAT entry at a time, so only the root
+// clusters and a few FAT sectors are read.
+
+static int findLabelSlot(int fd, const VolumeGeometry& geometry,
+                         uint64_t& labelOffset, uint64_t& freeOffset) {
+  const size_t clusterBytes = size_t{geometry.sectorsPerCluster} * kSectorSize;
+  std::vector<std::byte> cluster(clusterBytes);
+  labelOffset = 0;
+  freeOffset = 0;
+
+  uint32_t clusterNumber = geometry.rootCluster;
+  for (uint64_t visited = 0; visited < maxDirectoryClusters(geometry) &&
+                             isClusterNumber(geometry, clusterNumber);
+       visited++) {
+    uint64_t clusterOffset = clusterLba(geometry, clusterNumber) * kSectorSize;
+    if (int err = readBytes(fd, static_cast<off_t>(clusterOffset), cluster);
+        err != 0) {
+      return err;
+    }
+
+    for (size_t offset = 0; offset < clusterBytes;
+         offset += sizeof(DirectoryEntry)) {
+      const auto lead = static_cast<uint8_t>(cluster[offset]);
+      const auto attributes = static_cast<uint8_t>(
+          cluster[offset + offsetof(DirectoryEntry, attributes)]);
+
+      if (lead == kDirEntryFree) {
+        size_t next = offset + sizeof(DirectoryEntry);
+        bool nextFree = next == clusterBytes ||
+                        static_cast<uint8_t>(cluster[next]) == kDirEntryFree;
+        if (freeOffset == 0 && nextFree) {
+          freeOffset = clusterOffset + offset;
+        }
+        return 0;
+      }
+      if (lead == kDirEntryDeleted) {
+        if (freeOffset == 0) {
+          freeOffset = clusterOffset + offset;
+        }
+        continue;
+      }
+      if ((attributes & kAttrLongName) != kAttrLongName &&
+          (attributes & kAttrVolumeId) != 0) {
+        labelOffset = clusterOffset + offset;
+        return 0;
+      }
+    }
+
+    if (int err = readFatEntry(fd, geometry, clusterNumber, clusterNumber);
+        err != 0) {
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+// sdFormatRelabel
+// ---------------
+// Changes VBR_volumeLabel in both VBR copies and DIR_name of the root
+// directory's label entry. The three sectors are read, patched in memory,
+// and written back together, followed by a single sync; nothing else on
+// the volume is written.
+
+int sdFormatRelabel(int fd, const char* label) {
+  auto volumeLabel = prepareVolumeLabel(label);
+
+  VolumeGeometry geometry;
+  if (int err = readVolumeGeometry(fd, geometry); err != 0) {
+    return err;
+  }
+
+  // Patch the primary VBR; the backup receives the same sector
+  SectorBytes vbr;
+  if (int err = readSector(fd, geometry.partitionStart, vbr); err != 0) {
+    return err;
+  }
+  std::copy(volumeLabel.begin(), volumeLabel.end(),
+            reinterpret_cast<char*>(vbr.data()) +
+                offsetof(VolumeBootRecord, volumeLabel));
+
+  // Patch (or create) the root directory's label entry
+  uint64_t labelOffset;
+  uint64_t freeOffset;
+  if (int err = findLabelSlot(fd, geometry, labelOffset, freeOffset);
+      err != 0) {
+    return err;
+  }
+  uint64_t entryOffset = labelOffset != 0 ? labelOffset : freeOffset;
+  if (entryOffset == 0) {
+    return ENOSPC;
+  }
+
+  SectorBytes root;
+  const uint64_t rootLba = entryOffset / kSectorSize;
+  const size_t inSector = entryOffset % kSectorSize;
+  if (int err = readSector(fd, static_cast<off_t>(rootLba), root); err != 0) {
+    return err;
+  }
+  if (labelOffset != 0) {
+    std::copy(volumeLabel.begin(), volumeLabel.end(),
+              reinterpret_cast<char*>(root.data()) + inSector);
+  } else {
+    const DirectoryEntry entry = {.name = volumeLabel};
+    const auto bytes = std::bit_cast<DirectoryEntryBytes>(entry);
+    std::copy(bytes.begin(), bytes.end(), root.begin() + inSector);
+  }
+
+  // Write the three sectors back to back (each as whole physical blocks),
+  // then sync once
+  const uint64_t lbas[] = {
+      geometry.partitionStart,
+      geometry.partitionStart + geometry.backupBootSector,
+      rootLba,
+  };
+  const SectorBytes* sectors[] = {&vbr, &vbr, &root};
+  for (size_t i = 0; i < std::size(lbas); i++) {
+    if (int err = writeSector(fd, static_cast<off_t>(lbas[i]), *sectors[i]);
+        err != 0) {
+      return err;
+    }
+  }
+  return syncDevice(fd);
 }
@@ -0,0 +1,400 @@
+// =============================================================================
+// SDProbe.cpp
+// =============================================================================
+//
+// Implementation of the device qualification functions: the fake-capacity
+// probe (sdFormatProbeCapacity) and the surface scan (sdFormatSurfaceScan).
+//
+// Pattern Sectors
+// ---------------
+// Both functions write the same self-describing sector:
+//
+//   Offset 0:  "SDFPROBE" magic
+//   Offset 8:  LBA the sector was written to (little-endian uint64)
+//   Offset 16: per-run nonce
+//   Offset 24: xorshift64 stream seeded from the LBA and the nonce
+//
+// Reading a sector back gives one of three answers: it is the pattern for
+// its own LBA (good), it is the pattern for another LBA of this run (the
+// card maps both addresses to the same flash, and the higher one is the
+// fake), or it is anything else (the write was lost).
+//
+// Counterfeit Cards
+// -----------------
+// A fake card's controller answers for the advertised capacity but has
+// less flash. Depending on the firmware, writes past the real end are
+// dropped, or the address is taken modulo the real capacity, so a write
+// near the end silently replaces data near the start. Writing the samples
+// from the highest LBA down means that when two samples share flash, the
+// lower one is written last and survives, and the higher one reads back
+// with the lower one's tag.
+//
+// =============================================================================
+
+#include <errno.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <random>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "FatStructures.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// kProbeFirstSamples / kProbeRefineSamples: Samples in the first round and
+// in each refining round.
+static constexpr uint32_t kProbeFirstSamples = 256;
+static constexpr uint32_t kProbeRefineSamples = 64;
+
+// kProbeResolution: The probe stops once the capacity is known to within
+// this many sectors (1 MB).
+static constexpr uint64_t kProbeResolution = 2048;
+
+// kScanRegionSectors / kScanTransferSectors: Surface scan region (64 MB,
+// the unit of throughput measurement) and transfer size (4 MB).
+static constexpr uint64_t kScanRegionSectors = 131072;
+static constexpr uint64_t kScanTransferSectors = 8192;
+
+// kScanBufferAlignment: Buffer alignment, enough for O_DIRECT on any
+// device with up to 4 KB logical sectors.
+static constexpr size_t kScanBufferAlignment = 4096;
+
+// =============================================================================
+// Pattern Sectors
+// =============================================================================
+
+static constexpr char kPatternMagic[8] = {'S', 'D', 'F', 'P',
+                                          'R', 'O', 'B', 'E'};
+
+// fillPatternSector
+// -----------------
+
+static void fillPatternSector(std::span<std::byte> sector, uint64_t lba,
+                              uint64_t nonce) {
+  std::memcpy(sector.data(), kPatternMagic, sizeof(kPatternMagic));
+  std::memcpy(sector.data() + 8, &lba, sizeof(lba));
+  std::memcpy(sector.data() + 16, &nonce, sizeof(nonce));
+
+  uint64_t state = (lba * 0x9E3779B97F4A7C15) ^ nonce ^ 0xD1B54A32D192ED03;
+  for (size_t offset = 24; offset < kSectorSize; offset += sizeof(state)) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    std::memcpy(sector.data() + offset, &state, sizeof(state));
+  }
+}
+
+// PatternCheck
+// ------------
+// What a sector read back from `lba` turned out to hold.
+
+enum class PatternCheck {
+  kGood,     // The pattern for this sector
+  kAliased,  // The intact pattern of another sector of this run
+  kLost,     // Anything else
+};
+
+// checkPatternSector
+// ------------------
+// Classifies a sector read back from `lba`. For kAliased, `taggedLba` is
+// the LBA whose pattern it holds.
+
+static PatternCheck checkPatternSector(std::span<const std::byte> sector,
+                                       uint64_t lba, uint64_t nonce,
+                                       uint64_t& taggedLba) {
+  uint64_t storedNonce;
+  std::memcpy(&taggedLba, sector.data() + 8, sizeof(taggedLba));
+  std::memcpy(&storedNonce, sector.data() + 16, sizeof(storedNonce));
+  if (std::memcmp(sector.data(), kPatternMagic, sizeof(kPatternMagic)) != 0 ||
+      storedNonce != nonce) {
+    return PatternCheck::kLost;
+  }
+
+  SectorBytes expected;
+  fillPatternSector(expected, taggedLba, nonce);
+  if (!std::equal(expected.begin(), expected.end(), sector.begin())) {
+    return PatternCheck::kLost;
+  }
+  return taggedLba == lba ? PatternCheck::kGood : PatternCheck::kAliased;
+}
+
+// makeNonce
+// ---------
+// A fresh value per run, so patterns left by an earlier run never verify.
+
+static uint64_t makeNonce() {
+  std::random_device device;
+  return (uint64_t{device()} << 32) ^ device() ^
+         static_cast<uint64_t>(
+             std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+// =============================================================================
+// Capacity Probe
+// =============================================================================
+
+// sdFormatProbeCapacity
+// ---------------------
+// `good` holds every sample that has verified so far; all of them are
+// re-read after each round, since a later write can wrap onto them.
+
+int sdFormatProbeCapacity(int fd, uint64_t sectorCount,
+                          SDFormatCapacityReport* report) {
+  *report = {};
+  if (sectorCount == 0) {
+    return EINVAL;
+  }
+
+  const uint64_t nonce = makeNonce();
+  std::vector<uint64_t> good;
+  uint64_t low = 0;             // Samples below `low` verified
+  uint64_t high = sectorCount;  // `high` is past the end or a bad sample
+  SectorBytes sector;
+
+  for (uint32_t samples = kProbeFirstSamples;;
+       samples = kProbeRefineSamples) {
+    report->rounds++;
+
+    // Evenly spaced samples in [low, high), always including high - 1
+    std::vector<uint64_t> round;
+    const uint64_t span = high - low;
+    const uint64_t count = std::min<uint64_t>(samples, span);
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t lba =
+          low + (count == 1 ? span - 1 : (span - 1) * i / (count - 1));
+      if (round.empty() || round.back() != lba) {
+        round.push_back(lba);
+      }
+    }
+
+    // Highest first, so of two aliased samples the lower one survives
+    for (auto it = round.rbegin(); it != round.rend(); ++it) {
+      fillPatternSector(sector, *it, nonce);
+      // A failed write shows up as a bad sample when it is read back
+      static_cast<void>(writeBytes(fd, static_cast<off_t>(*it * kSectorSize),
+                                   sector));
+      report->samplesWritten++;
+    }
+    // Some fakes fail the flush of dropped writes; that too is a bad sample
+    if (int err = syncDevice(fd); err != 0 && err != EIO) {
+      return err;
+    }
+
+    // Read back this round and every earlier good sample
+    std::vector<uint64_t> all = good;
+    all.insert(all.end(), round.begin(), round.end());
+    uint64_t firstBad = high;
+    for (uint64_t lba : all) {
+      static_cast<void>(dropCachedRange(fd, static_cast<off_t>(lba), 1));
+      uint64_t tagged = lba;
+      PatternCheck check = PatternCheck::kLost;
+      if (readSector(fd, static_cast<off_t>(lba), sector) == 0) {
+        check = checkPatternSector(sector, lba, nonce, tagged);
+      }
+      if (check == PatternCheck::kLost) {
+        firstBad = std::min(firstBad, lba);
+      } else if (check == PatternCheck::kAliased) {
+        firstBad = std::min(firstBad, std::max(lba, tagged));
+      }
+    }
+
+    // Keep the good samples below the first bad one and narrow the interval
+    // (a round that verifies entirely ends with low == high)
+    good.clear();
+    for (uint64_t lba : all) {
+      if (lba < firstBad) {
+        good.push_back(lba);
+      }
+    }
+    std::sort(good.begin(), good.end());
+    high = firstBad;
+    low = good.empty() ? 0 : good.back() + 1;
+    if (high - low <= kProbeResolution) {
+      break;
+    }
+  }
+
+  report->usableSectors = low;
+  return 0;
+}
+
+// =============================================================================
+// Surface Scan
+// =============================================================================
+
+// AlignedBuffer
+// -------------
+// A transfer buffer aligned for O_DIRECT.
+
+using AlignedBuffer = std::unique_ptr<std::byte[], decltype(&std::free)>;
+
+static AlignedBuffer allocateTransferBuffer() {
+  return AlignedBuffer{static_cast<std::byte*>(std::aligned_alloc(
+                           kScanBufferAlignment,
+                           kScanTransferSectors * kSectorSize)),
+                       &std::free};
+}
+
+// secondsSince
+// ------------
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// writeScanRegion
+// ---------------
+// Writes the pattern over `region`, syncs it, and evicts it from the page
+// cache, recording the write rate.
+
+static int writeScanRegion(int fd, uint64_t nonce, std::byte* buffer,
+                           SDFormatScanRegion& region) {
+  auto start = std::chrono::steady_clock::now();
+
+  for (uint64_t done = 0; done < region.sectorCount;) {
+    uint64_t count = std::min(kScanTransferSectors, region.sectorCount - done);
+    for (uint64_t i = 0; i < count; i++) {
+      fillPatternSector(std::span{buffer + i * kSectorSize, kSectorSize},
+                        region.startSector + done + i, nonce);
+    }
+    if (int err = writeBytes(
+            fd,
+            static_cast<off_t>((region.startSector + done) * kSectorSize),
+            std::span{buffer, count * kSectorSize});
+        err != 0) {
+      return err;
+    }
+    done += count;
+  }
+  if (int err = syncDevice(fd); err != 0) {
+    return err;
+  }
+
+  region.writeBytesPerSecond =
+      static_cast<double>(region.sectorCount * kSectorSize) /
+      secondsSince(start);
+  return dropCachedRange(fd, static_cast<off_t>(region.startSector),
+                         region.sectorCount);
+}
+
+// verifyScanRegion
+// ----------------
+// Reads `region` back and counts the sectors that are not their own
+// pattern, recording the read rate.
+
+static int verifyScanRegion(int fd, uint64_t nonce, std::byte* buffer,
+                            SDFormatScanRegion& region) {
+  auto start = std::chrono::steady_clock::now();
+
+  for (uint64_t done = 0; done < region.sectorCount;) {
+    uint64_t count = std::min(kScanTransferSectors, region.sectorCount - done);
+    if (int err = readBytes(
+            fd,
+            static_cast<off_t>((region.startSector + done) * kSectorSize),
+            std::span{buffer, count * kSectorSize});
+        err != 0) {
+      return err;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+      const uint64_t lba = region.startSector + done + i;
+      uint64_t tagged;
+      if (checkPatternSector(std::span{buffer + i * kSectorSize, kSectorSize},
+                             lba, nonce, tagged) != PatternCheck::kGood) {
+        region.firstBadSector = std::min(region.firstBadSector, lba);
+        region.badSectors++;
+      }
+    }
+    done += count;
+  }
+
+  region.readBytesPerSecond =
+      static_cast<double>(region.sectorCount * kSectorSize) /
+      secondsSince(start);
+  return 0;
+}
+
+// sdFormatSurfaceScan
+// -------------------
+// The main thread writes; std::async verifies the previous region. Each
+// side owns its buffer, and the main thread waits for the verification of
+// region N before it starts the one of region N + 1.
+
+int sdFormatSurfaceScan(int fd, uint64_t sectorCount,
+                        SDFormatScanCallback callback, void* context,
+                        SDFormatScanReport* report) {
+  *report = {.firstBadSector = UINT64_MAX};
+
+  AlignedBuffer writeBuffer = allocateTransferBuffer();
+  AlignedBuffer readBuffer = allocateTransferBuffer();
+  if (!writeBuffer || !readBuffer) {
+    return ENOMEM;
+  }
+  const uint64_t nonce = makeNonce();
+
+  auto finish = [&](const SDFormatScanRegion& region) {
+    const bool first = report->sectorsScanned == 0;
+    report->sectorsScanned += region.sectorCount;
+    report->badSectors += region.badSectors;
+    report->firstBadSector =
+        std::min(report->firstBadSector, region.firstBadSector);
+    report->minWriteBytesPerSecond =
+        first ? region.writeBytesPerSecond
+              : std::min(report->minWriteBytesPerSecond,
+                         region.writeBytesPerSecond);
+    report->minReadBytesPerSecond =
+        first ? region.readBytesPerSecond
+              : std::min(report->minReadBytesPerSecond,
+                         region.readBytesPerSecond);
+    if (callback != nullptr) {
+      callback(&region, context);
+    }
+  };
+
+  SDFormatScanRegion pending{};
+  std::future<int> verifying;
+  for (uint64_t start = 0; start < sectorCount; start += kScanRegionSectors) {
+    SDFormatScanRegion region{
+        .startSector = start,
+        .sectorCount = std::min(kScanRegionSectors, sectorCount - start),
+        .firstBadSector = UINT64_MAX,
+    };
+    int err = writeScanRegion(fd, nonce, writeBuffer.get(), region);
+
+    if (verifying.valid()) {
+      if (int verifyErr = verifying.get(); verifyErr != 0) {
+        return verifyErr;
+      }
+      finish(pending);
+    }
+    if (err != 0) {
+      return err;
+    }
+
+    pending = region;
+    try {
+      verifying = std::async(std::launch::async, verifyScanRegion, fd, nonce,
+                             readBuffer.get(), std::ref(pending));
+    } catch (const std::system_error&) {
+      // Out of threads: verify on this thread, when the result is taken
+      verifying = std::async(std::launch::deferred, verifyScanRegion, fd,
+                             nonce, readBuffer.get(), std::ref(pending));
+    }
+  }
+
+  if (verifying.valid()) {
+    if (int err = verifying.get(); err != 0) {
+      return err;
+    }
+    finish(pending);
+  }
+  return 0;
+}
@@ -0,0 +1,234 @@
+// =============================================================================
+// SDRepair.cpp
+// =============================================================================
+//
+// Implementation of sdFormatRepair: restores damaged primary structures
+// from the backups that every FAT32 volume carries.
+//
+// The formatter deliberately writes three kinds of backup:
+//
+//   Primary structure          Backup
+//   ─────────────────────────  ──────────────────────────────────
+//   VBR (partition sector 0)   Backup VBR (BPB_backupBootSector, 6)
+//   FSInfo (sector 1)          Backup FSInfo (sector 7)
+//   Primary FAT                Second FAT copy
+//
+// Repair only ever copies backup → primary, and only when the primary is
+// demonstrably worse than its backup. Copies are issued as large in-file
+// range copies (copyBytes), which become copy_file_range on Linux.
+//
+// =============================================================================
+
+#include <errno.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// kRepairChunkSectors: FAT sectors compared and restored as one unit (1 MB).
+// A clobbered first FAT sector is restored with a single copy of this size.
+static constexpr uint32_t kRepairChunkSectors = 2048;
+
+// countImplausibleEntries
+// -----------------------
+// Counts entries in a FAT chunk that cannot appear on a healthy volume.
+// `firstIndex` is the FAT index of chunk[0].
+
+static uint32_t countImplausibleEntries(const VolumeGeometry& geometry,
+                                        uint64_t firstIndex,
+                                        std::span<const uint32_t> chunk) {
+  uint32_t count = 0;
+  for (size_t i = 0; i < chunk.size(); i++) {
+    count += isPlausibleFatEntry(geometry, firstIndex + i, chunk[i]) ? 0 : 1;
+  }
+  return count;
+}
+
+// countDifferingSectors
+// ---------------------
+// Number of 512-byte sectors at which two equally sized buffers differ.
+
+static uint32_t countDifferingSectors(std::span<const std::byte> a,
+                                      std::span<const std::byte> b) {
+  uint32_t count = 0;
+  for (size_t offset = 0; offset < a.size(); offset += kSectorSize) {
+    if (std::memcmp(a.data() + offset, b.data() + offset, kSectorSize) != 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// restoreSector
+// -------------
+// Copies one partition-relative logical sector (all of it, on a volume
+// with sectors larger than 512 bytes) over another.
+
+static int restoreSector(int fd, const VolumeGeometry& geometry,
+                         uint32_t backupSector, uint32_t primarySector) {
+  return copyBytes(
+      fd, static_cast<off_t>((geometry.partitionStart + backupSector) *
+                             kSectorSize),
+      static_cast<off_t>((geometry.partitionStart + primarySector) *
+                         kSectorSize),
+      uint64_t{geometry.unitsPerSector} * kSectorSize);
+}
+
+// restorePrimaryFat
+// -----------------
+// Compares the primary FAT with the second copy chunk by chunk. A chunk
+// that differs is restored from the backup when the primary chunk holds
+// more implausible entries (out-of-range links, a broken FAT[0]/FAT[1],
+// non-zero padding) than the backup chunk. Otherwise the difference is
+// most likely a backup that lagged behind the primary, and the chunk is
+// left alone and reported as unresolved.
+
+static int restorePrimaryFat(int fd, const VolumeGeometry& geometry,
+                             SDFormatRepairReport& report) {
+  constexpr size_t kEntriesPerSector = kSectorSize / sizeof(uint32_t);
+  std::vector<uint32_t> primary(kRepairChunkSectors * kEntriesPerSector);
+  std::vector<uint32_t> backup(primary.size());
+  const uint64_t backupDistance =
+      uint64_t{geometry.fatSizeSectors} * kSectorSize;
+
+  for (uint32_t sector = 0; sector < geometry.fatSizeSectors;
+       sector += kRepairChunkSectors) {
+    uint32_t sectors =
+        std::min(kRepairChunkSectors, geometry.fatSizeSectors - sector);
+    size_t entries = size_t{sectors} * kEntriesPerSector;
+    auto primaryEntries = std::span{primary}.first(entries);
+    auto backupEntries = std::span{backup}.first(entries);
+    auto primaryBytes = std::as_writable_bytes(primaryEntries);
+    auto backupBytes = std::as_writable_bytes(backupEntries);
+
+    auto primaryOffset =
+        static_cast<off_t>((geometry.fatStart + sector) * kSectorSize);
+    auto backupOffset = primaryOffset + static_cast<off_t>(backupDistance);
+    if (int err = readBytes(fd, primaryOffset, primaryBytes); err != 0) {
+      return err;
+    }
+    if (int err = readBytes(fd, backupOffset, backupBytes); err != 0) {
+      return err;
+    }
+    if (std::memcmp(primaryBytes.data(), backupBytes.data(),
+                    primaryBytes.size()) == 0) {
+      continue;
+    }
+
+    uint64_t firstIndex = uint64_t{sector} * kEntriesPerSector;
+    uint32_t differing = countDifferingSectors(primaryBytes, backupBytes);
+    if (countImplausibleEntries(geometry, firstIndex, primaryEntries) <=
+        countImplausibleEntries(geometry, firstIndex, backupEntries)) {
+      report.fatSectorsUnresolved += differing;
+      continue;
+    }
+
+    if (int err = copyBytes(fd, backupOffset, primaryOffset,
+                            primaryBytes.size());
+        err != 0) {
+      return err;
+    }
+    report.fatSectorsRestored += differing;
+  }
+
+  return 0;
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatRepair
+// --------------
+// Restores, in order: the VBR (so the rest of the repair has a geometry),
+// the FSInfo sector, and the primary FAT. FSInfo is recomputed at the end
+// whenever anything it summarizes may have changed.
+
+int sdFormatRepair(int fd, SDFormatRepairReport* report) {
+  *report = {};
+  SectorBytes raw;
+
+  // Locate the partition; without a usable partition table assume the
+  // standard layout
+  PartitionLocation partition;
+  uint64_t partitionStart = kPartitionAlignmentSectors;
+  if (int err = findFat32Partition(fd, partition); err == 0) {
+    partitionStart = partition.start;
+  } else if (err != EINVAL) {
+    return err;
+  }
+
+  // ---------------------------------------------------------------------------
+  // VBR
+  // ---------------------------------------------------------------------------
+
+  VolumeGeometry geometry;
+  if (int err = readSector(fd, partitionStart, raw); err != 0) {
+    return err;
+  }
+  if (decodeVolumeGeometry(std::bit_cast<VolumeBootRecord>(raw),
+                           partitionStart, geometry) != 0) {
+    // The backup is at logical sector 6, 24 KB in on a 4Kn device
+    const uint32_t units = deviceSectorSize(fd).logicalBytes / kSectorSize;
+    if (int err =
+            readSector(fd, partitionStart + kBackupBootSector * units, raw);
+        err != 0) {
+      return err;
+    }
+    if (decodeVolumeGeometry(std::bit_cast<VolumeBootRecord>(raw),
+                             partitionStart, geometry) != 0) {
+      return EINVAL;  // Neither copy is usable; nothing to restore from
+    }
+    if (int err = restoreSector(fd, geometry, geometry.backupBootSector, 0);
+        err != 0) {
+      return err;
+    }
+    report->vbrRestored = true;
+  }
+
+  // ---------------------------------------------------------------------------
+  // FSInfo
+  // ---------------------------------------------------------------------------
+
+  if (int err = readSector(fd, partitionStart + geometry.fsInfoSector, raw);
+      err != 0) {
+    return err;
+  }
+  if (!hasFsInfoSignatures(std::bit_cast<FSInfo>(raw))) {
+    if (int err =
+            readSector(fd, partitionStart + geometry.backupFsInfoSector, raw);
+        err != 0) {
+      return err;
+    }
+    if (hasFsInfoSignatures(std::bit_cast<FSInfo>(raw))) {
+      if (int err = restoreSector(fd, geometry, geometry.backupFsInfoSector,
+                                  geometry.fsInfoSector);
+          err != 0) {
+        return err;
+      }
+      report->fsInfoRestored = true;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+  // FAT
+  // ---------------------------------------------------------------------------
+
+  if (geometry.fatCount >= 2) {
+    if (int err = restorePrimaryFat(fd, geometry, *report); err != 0) {
+      return err;
+    }
+  }
+
+  if (report->fsInfoRestored || report->fatSectorsRestored != 0) {
+    return refreshFsInfo(fd, geometry);
+  }
+  return 0;
+}
@@ -0,0 +1,322 @@
+// =============================================================================
+// SDSort.cpp
+// =============================================================================
+//
+// Implementation of sdFormatSortDirectories: rewrites every directory with
+// its entries sorted by case-folded long name and packed.
+//
+// DS flashcart menus read a folder in on-disk order and sort it on the
+// ARM9 every time it is opened, which takes seconds for a folder of
+// hundreds of ROMs. A directory that is already in display order makes
+// that sort a single pass (or lets the menu skip it), and a packed
+// directory is usually one 32 KB cluster, so listing it is one read.
+//
+// Entry Groups
+// ------------
+// A directory is parsed into groups: a short entry together with the long
+// name entries in front of it. Groups are the unit that is sorted, so each
+// long name set stays immediately before its short entry. Long name
+// entries that do not belong to the short entry after them (wrong order or
+// checksum) and deleted entries are dropped.
+//
+// The volume label (root directory) and the "." and ".." entries
+// (subdirectories) are pinned: they stay first, in their original order.
+//
+// Writing
+// -------
+// The packed directory is written back over its own cluster chain, with
+// every slot after the last entry zeroed, followed by a sync. Only then
+// are clusters the packed directory no longer needs cut from the end of
+// the chain, in every FAT copy. An interruption before the FAT update
+// leaves a valid directory with trailing free slots.
+//
+// =============================================================================
+
+#include <errno.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "FatDirectory.h"
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// =============================================================================
+// Parsing
+// =============================================================================
+
+// EntryGroup
+// ----------
+// A short entry and the long name set in front of it.
+
+struct EntryGroup {
+  // The group's slots in on-disk order (long name entries first).
+  std::vector<DirectoryEntryBytes> slots;
+
+  // Case-folded long name, or the short name as "NAME.EXT".
+  std::u16string key;
+
+  // Volume label and dot entries keep their place at the front.
+  bool pinned;
+};
+
+// shortNameKey
+// ------------
+// "GAME    SAV" → u"GAME.SAV". Bytes above 0x7F (OEM code page) are kept
+// as their code unit, which sorts them after ASCII.
+
+static std::u16string shortNameKey(const ShortName& name) {
+  std::u16string key;
+  auto append = [&key](std::span<const char> part) {
+    size_t length = part.size();
+    while (length > 0 && part[length - 1] == ' ') {
+      length--;
+    }
+    for (size_t i = 0; i < length; i++) {
+      key.push_back(static_cast<unsigned char>(part[i]));
+    }
+  };
+
+  append(std::span{name}.first(8));
+  if (name[8] != ' ') {
+    key.push_back(u'.');
+    append(std::span{name}.subspan(8));
+  }
+  return key;
+}
+
+// longNameKey
+// -----------
+// Reassembles the long name from a set stored highest-order first, and
+// returns it case-folded. An empty result means the set is not valid for
+// the short entry with checksum `checksum`.
+
+static std::u16string longNameKey(std::span<const DirectoryEntryBytes> set,
+                                  uint8_t checksum) {
+  const auto last = std::bit_cast<LongNameEntry>(set.front());
+  if ((last.order & kLongNameLastEntry) == 0 ||
+      (last.order & ~kLongNameLastEntry) != set.size()) {
+    return {};
+  }
+
+  std::u16string name;
+  for (size_t i = set.size(); i-- > 0;) {
+    const auto entry = std::bit_cast<LongNameEntry>(set[i]);
+    if (entry.checksum != checksum ||
+        (entry.order & ~kLongNameLastEntry) != set.size() - i) {
+      return {};
+    }
+    for (uint16_t c : entry.name1) name.push_back(c);
+    for (uint16_t c : entry.name2) name.push_back(c);
+    for (uint16_t c : entry.name3) name.push_back(c);
+  }
+
+  size_t end = name.find(u'\0');
+  if (end != std::u16string::npos) {
+    name.resize(end);
+  }
+  return foldLongName(name);
+}
+
+// parseDirectory
+// --------------
+// Splits a directory into entry groups, stopping at the first free slot.
+// Returns the number of slots dropped (deleted or orphaned long name).
+
+static uint32_t parseDirectory(std::span<const std::byte> bytes,
+                               std::vector<EntryGroup>& groups) {
+  uint32_t dropped = 0;
+  std::vector<DirectoryEntryBytes> pending;
+
+  for (size_t offset = 0; offset + sizeof(DirectoryEntry) <= bytes.size();
+       offset += sizeof(DirectoryEntry)) {
+    DirectoryEntryBytes raw;
+    std::memcpy(raw.data(), bytes.data() + offset, raw.size());
+    const auto entry = std::bit_cast<DirectoryEntry>(raw);
+    const auto lead = static_cast<uint8_t>(entry.name[0]);
+
+    if (lead == kDirEntryFree) {
+      break;
+    }
+    if (lead == kDirEntryDeleted) {
+      dropped += static_cast<uint32_t>(pending.size()) + 1;
+      pending.clear();
+      continue;
+    }
+    if ((entry.attributes & kAttrLongName) == kAttrLongName) {
+      if ((lead & kLongNameLastEntry) != 0) {
+        dropped += static_cast<uint32_t>(pending.size());
+        pending.clear();
+      }
+      pending.push_back(raw);
+      continue;
+    }
+
+    EntryGroup group{{}, {}, false};
+    group.pinned = (entry.attributes & kAttrVolumeId) != 0 || lead == '.';
+    if (!pending.empty() && !group.pinned) {
+      group.key = longNameKey(pending, shortNameChecksum(entry.name));
+    }
+    if (group.key.empty()) {
+      dropped += static_cast<uint32_t>(pending.size());
+      group.key = shortNameKey(entry.name);
+    } else {
+      group.slots = pending;
+    }
+    pending.clear();
+    group.slots.push_back(raw);
+    groups.push_back(std::move(group));
+  }
+
+  return dropped + static_cast<uint32_t>(pending.size());
+}
+
+// =============================================================================
+// Rewriting
+// =============================================================================
+
+// sortDirectory
+// -------------
+// Sorts and packs the directory whose chain is `chain`. Rewrites it only
+// if the packed image differs from what is on disk.
+
+static int sortDirectory(int fd, const VolumeGeometry& geometry,
+                         std::vector<uint32_t>& fat,
+                         std::span<const uint32_t> chain,
+                         SDFormatSortReport& report) {
+  const size_t clusterBytes = size_t{geometry.sectorsPerCluster} * kSectorSize;
+  std::vector<std::byte> current(chain.size() * clusterBytes);
+  for (size_t i = 0; i < chain.size(); i++) {
+    auto offset =
+        static_cast<off_t>(clusterLba(geometry, chain[i]) * kSectorSize);
+    if (int err = readBytes(fd, offset,
+                            std::span{current}.subspan(i * clusterBytes,
+                                                       clusterBytes));
+        err != 0) {
+      return err;
+    }
+  }
+
+  std::vector<EntryGroup> groups;
+  uint32_t dropped = parseDirectory(current, groups);
+  std::stable_sort(groups.begin(), groups.end(),
+                   [](const EntryGroup& a, const EntryGroup& b) {
+                     if (a.pinned || b.pinned) {
+                       return a.pinned && !b.pinned;
+                     }
+                     return a.key < b.key;
+                   });
+
+  // Pack, leaving every slot after the last entry zeroed
+  std::vector<std::byte> packed(current.size());
+  size_t used = 0;
+  for (const EntryGroup& group : groups) {
+    for (const DirectoryEntryBytes& slot : group.slots) {
+      std::memcpy(packed.data() + used, slot.data(), slot.size());
+      used += slot.size();
+    }
+  }
+  if (packed == current) {
+    return 0;
+  }
+
+  // Write the clusters back, one write per contiguous run
+  for (size_t i = 0; i < chain.size();) {
+    size_t j = i + 1;
+    while (j < chain.size() && chain[j] == chain[j - 1] + 1) {
+      j++;
+    }
+    auto offset =
+        static_cast<off_t>(clusterLba(geometry, chain[i]) * kSectorSize);
+    if (int err = writeBytes(fd, offset,
+                             std::span{packed}.subspan(i * clusterBytes,
+                                                       (j - i) * clusterBytes));
+        err != 0) {
+      return err;
+    }
+    i = j;
+  }
+  if (int err = syncDevice(fd); err != 0) {
+    return err;
+  }
+  report.directoriesRewritten++;
+  report.entriesDropped += dropped;
+
+  // Cut the clusters the packed directory no longer needs
+  size_t needed = std::max<size_t>(1, (used + clusterBytes - 1) / clusterBytes);
+  if (needed >= chain.size()) {
+    return 0;
+  }
+  std::vector<uint32_t> dirty;
+  setFatEntry(fat, chain[needed - 1], kFat32EndOfChain, dirty);
+  for (size_t i = needed; i < chain.size(); i++) {
+    setFatEntry(fat, chain[i], 0, dirty);
+  }
+  report.clustersFreed += static_cast<uint32_t>(chain.size() - needed);
+  return flushFatSectors(fd, geometry, fat, dirty);
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatSortDirectories
+// -----------------------
+// The tree is walked once to collect every directory, then each directory
+// is sorted on its own. A directory whose chain is broken is skipped.
+
+int sdFormatSortDirectories(int fd, SDFormatSortReport* report) {
+  *report = {};
+
+  VolumeGeometry geometry;
+  if (int err = readVolumeGeometry(fd, geometry); err != 0) {
+    return err;
+  }
+  std::vector<uint32_t> fat;
+  if (int err = readFat(fd, geometry, 0, fat); err != 0) {
+    return err;
+  }
+
+  std::vector<uint32_t> directories{geometry.rootCluster};
+  int err = walkDirectoryTree(
+      fd, geometry, fat, [&](const DirectorySlot& slot) {
+        uint32_t firstCluster = firstClusterOf(slot.entry);
+        if ((slot.entry.attributes & kAttrDirectory) != 0 &&
+            isClusterNumber(geometry, firstCluster)) {
+          directories.push_back(firstCluster);
+        }
+        return true;
+      });
+  if (err != 0) {
+    return err;
+  }
+  std::sort(directories.begin(), directories.end());
+  directories.erase(std::unique(directories.begin(), directories.end()),
+                    directories.end());
+
+  std::vector<uint32_t> chain;
+  for (uint32_t firstCluster : directories) {
+    report->directoriesExamined++;
+    chain.clear();
+    if (followChain(geometry, fat, firstCluster,
+                    maxDirectoryClusters(geometry), chain) != 0) {
+      report->directoriesSkipped++;
+      continue;
+    }
+    if (int err = sortDirectory(fd, geometry, fat, chain, *report);
+        err != 0) {
+      return err;
+    }
+  }
+
+  if (report->clustersFreed == 0) {
+    return 0;
+  }
+  return refreshFsInfo(fd, geometry);
+}
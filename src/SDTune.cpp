@@ -0,0 +1,255 @@
+// =============================================================================
+// SDTune.cpp
+// =============================================================================
+//
+// Implementation of the write tuning functions: sdFormatSetWriteTuning and
+// the autotuner, sdFormatAutotune.
+//
+// Benchmark
+// ---------
+// Every combination of transfer size and queue depth zeroes the scratch
+// range twice, each pass followed by a sync, and is scored by its faster
+// pass (the first pass of a combination can pay for the previous one's
+// garbage collection). The scratch range is 3 MB of the alignment gap,
+// starting 1 MB in, so the MBR and its neighbourhood are never touched.
+//
+// Tuning Cache
+// ------------
+// A text file with one line per card model:
+//
+//   <cid-model> <transferBytes> <queueDepth>
+//
+// where <cid-model> is the first 18 hex digits of the CID: MID, OID, PNM,
+// and PRV. The remaining digits (serial number, manufacturing date, CRC)
+// differ between cards of the same model and are left out. The file is
+// rewritten atomically (write, fsync, rename).
+//
+// =============================================================================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "FatStructures.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// kScratchStartSector / kScratchSectorCount: The benchmark range, sectors
+// 2048–8191 of the alignment gap.
+static constexpr off_t kScratchStartSector = 2048;
+static constexpr uint32_t kScratchSectorCount =
+    kPartitionAlignmentSectors - kScratchStartSector;
+
+// kCandidateTransferBytes / kCandidateQueueDepths: The combinations tried.
+static constexpr uint32_t kCandidateTransferBytes[] = {
+    32 << 10, 64 << 10, 128 << 10, 256 << 10, 512 << 10, 1 << 20,
+};
+static constexpr uint32_t kCandidateQueueDepths[] = {1, 2, 4};
+
+// kCidModelDigits: Hex digits of the CID that identify the card model.
+static constexpr size_t kCidModelDigits = 18;
+
+// =============================================================================
+// Card Identity
+// =============================================================================
+
+// cardModelKey
+// ------------
+// The model part of the CID of the card behind `fd`, or an empty string
+// if there is none. For a partition, the CID is found on its parent disk.
+
+static std::string cardModelKey(int fd) {
+#if defined(__linux__)
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISBLK(info.st_mode)) {
+    return {};
+  }
+  std::string device = "/sys/dev/block/" +
+                       std::to_string(major(info.st_rdev)) + ":" +
+                       std::to_string(minor(info.st_rdev));
+  if (access((device + "/partition").c_str(), F_OK) == 0) {
+    device += "/..";
+  }
+
+  std::ifstream file(device + "/device/cid");
+  std::string cid;
+  if (!(file >> cid) || cid.size() < kCidModelDigits) {
+    return {};
+  }
+  return cid.substr(0, kCidModelDigits);
+#else
+  static_cast<void>(fd);
+  return {};
+#endif
+}
+
+// =============================================================================
+// Tuning Cache
+// =============================================================================
+
+// CacheEntry
+// ----------
+
+struct CacheEntry {
+  std::string model;
+  WriteTuning tuning;
+};
+
+// readCache
+// ---------
+// Loads every well-formed line of the cache. A missing file is empty.
+
+static std::vector<CacheEntry> readCache(const char* path) {
+  std::vector<CacheEntry> entries;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    CacheEntry entry{};
+    if (fields >> entry.model >> entry.tuning.transferBytes >>
+        entry.tuning.queueDepth) {
+      entries.push_back(entry);
+    }
+  }
+  return entries;
+}
+
+// writeCache
+// ----------
+// Replaces the cache atomically with `entries`.
+
+static int writeCache(const char* path,
+                      const std::vector<CacheEntry>& entries) {
+  std::string contents;
+  for (const CacheEntry& entry : entries) {
+    contents += entry.model + " " +
+                std::to_string(entry.tuning.transferBytes) + " " +
+                std::to_string(entry.tuning.queueDepth) + "\n";
+  }
+
+  const std::string temporary = std::string{path} + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+  int err = writeBytes(fd, 0, std::as_bytes(std::span{contents}));
+  if (err == 0) {
+    err = syncDevice(fd);
+  }
+  close(fd);
+  if (err == 0 && std::rename(temporary.c_str(), path) != 0) {
+    err = errno;
+  }
+  return err;
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// isValidWriteTuning
+// ------------------
+
+static bool isValidWriteTuning(const WriteTuning& tuning) {
+  return tuning.transferBytes >= kSectorSize &&
+         tuning.transferBytes <= kMaxTransferBytes &&
+         tuning.transferBytes % kSectorSize == 0 && tuning.queueDepth >= 1 &&
+         tuning.queueDepth <= kMaxQueueDepth;
+}
+
+// sdFormatSetWriteTuning
+// ----------------------
+
+int sdFormatSetWriteTuning(const SDFormatWriteTuning* tuning) {
+  if (tuning == nullptr) {
+    setWriteTuning(kDefaultWriteTuning);
+    return 0;
+  }
+  const WriteTuning value = {
+      .transferBytes = tuning->transferBytes,
+      .queueDepth = tuning->queueDepth,
+  };
+  if (!isValidWriteTuning(value)) {
+    return EINVAL;
+  }
+  setWriteTuning(value);
+  return 0;
+}
+
+// sdFormatAutotune
+// ----------------
+
+int sdFormatAutotune(int fd, const char* cachePath,
+                     SDFormatAutotuneReport* report) {
+  *report = {};
+  const std::string model = cardModelKey(fd);
+  std::vector<CacheEntry> cache;
+
+  // A cached tuning for this model skips the benchmark
+  if (cachePath != nullptr && !model.empty()) {
+    cache = readCache(cachePath);
+    for (const CacheEntry& entry : cache) {
+      if (entry.model == model && isValidWriteTuning(entry.tuning)) {
+        setWriteTuning(entry.tuning);
+        report->tuning = {entry.tuning.transferBytes, entry.tuning.queueDepth};
+        report->fromCache = true;
+        report->cached = true;
+        return 0;
+      }
+    }
+  }
+
+  // Benchmark every combination; keep the best pass of each
+  WriteTuning best = kDefaultWriteTuning;
+  double bestRate = 0;
+  for (uint32_t transferBytes : kCandidateTransferBytes) {
+    for (uint32_t queueDepth : kCandidateQueueDepths) {
+      const WriteTuning tuning = {transferBytes, queueDepth};
+      for (int pass = 0; pass < 2; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        if (int err = zeroSectors(fd, kScratchStartSector, kScratchSectorCount,
+                                  tuning);
+            err != 0) {
+          return err;
+        }
+        if (int err = syncDevice(fd); err != 0) {
+          return err;
+        }
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        double rate = kScratchSectorCount * double{kSectorSize} / seconds;
+        if (rate > bestRate) {
+          best = tuning;
+          bestRate = rate;
+        }
+      }
+    }
+  }
+
+  setWriteTuning(best);
+  report->tuning = {best.transferBytes, best.queueDepth};
+  report->bytesPerSecond = bestRate;
+
+  if (cachePath != nullptr && !model.empty()) {
+    std::erase_if(cache, [&model](const CacheEntry& entry) {
+      return entry.model == model;
+    });
+    cache.push_back({model, best});
+    report->cached = writeCache(cachePath, cache) == 0;
+  }
+  return 0;
+}
@@ -0,0 +1,275 @@
+// =============================================================================
+// SDWipe.cpp
+// =============================================================================
+//
+// Implementation of sdFormatWipeFreeClusters: zeroes (or discards) every
+// free cluster of a formatted volume, throttled and resumable.
+//
+// A "secure reprovision" used to mean writing zeros over the whole card
+// before formatting it, which ties up a station for the full write time of
+// the card. Formatting only writes metadata, so it can finish first; the
+// free clusters are wiped afterwards, on any reader, at whatever rate the
+// host can spare.
+//
+// What Is Wiped
+// -------------
+// Every cluster that is free in the primary FAT when the wipe starts, from
+// the first data cluster upward. The root directory and any files created
+// at format time (save files) are allocated and therefore left alone. The
+// volume should not be in use while it is wiped: a file written to a free
+// cluster after the FAT was read would be overwritten.
+//
+// Progress
+// --------
+// The wipe walks the clusters in order and checkpoints the next cluster to
+// wipe in a small text file:
+//
+//   sdformat-wipe <volumeId> <clusterCount> <nextCluster>
+//
+// A checkpoint is written only after the wiped range has been synced, and
+// replaces the previous one atomically (write, fsync, rename), so a resumed
+// wipe never skips a cluster. A file that names another volume (a different
+// VBR_volumeId or cluster count, e.g. after a reformat) is ignored.
+//
+// =============================================================================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FatStructures.h"
+#include "FatVolume.h"
+#include "SDFormat.h"
+#include "SectorIO.h"
+
+// kWipeChunkClusters: Largest range handed to one zero or discard call
+// (8 MB). Bounds the time between rate-limit checks.
+static constexpr uint32_t kWipeChunkClusters = 256;
+
+// kWipeCheckpointClusters: Clusters wiped between checkpoints (256 MB).
+// Each checkpoint costs a device sync and a progress file rewrite.
+static constexpr uint32_t kWipeCheckpointClusters = 8192;
+
+// =============================================================================
+// Progress File
+// =============================================================================
+
+// WipeProgress
+// ------------
+// The identity of the volume being wiped and the next cluster to wipe.
+
+struct WipeProgress {
+  uint32_t volumeId;
+  uint32_t clusterCount;
+  uint32_t nextCluster;
+};
+
+// readProgress
+// ------------
+// Loads a checkpoint. A missing or unreadable file yields false, which
+// starts the wipe from the beginning.
+
+static bool readProgress(const char* path, WipeProgress& progress) {
+  std::FILE* file = std::fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  int fields = std::fscanf(file,
+                           "sdformat-wipe %" SCNu32 " %" SCNu32 " %" SCNu32,
+                           &progress.volumeId, &progress.clusterCount,
+                           &progress.nextCluster);
+  std::fclose(file);
+  return fields == 3;
+}
+
+// writeProgress
+// -------------
+// Replaces the checkpoint atomically: the new contents go to "<path>.tmp",
+// which is synced and then renamed over `path`.
+
+static int writeProgress(const char* path, const WipeProgress& progress) {
+  const std::string temporary = std::string{path} + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+
+  char line[64];
+  int length = std::snprintf(line, sizeof(line),
+                             "sdformat-wipe %" PRIu32 " %" PRIu32 " %" PRIu32
+                             "\n",
+                             progress.volumeId, progress.clusterCount,
+                             progress.nextCluster);
+  auto bytes = std::as_bytes(std::span{line}.first(
+      static_cast<size_t>(std::clamp(length, 0, int{sizeof(line)} - 1))));
+  int err = writeBytes(fd, 0, bytes);
+  if (err == 0) {
+    err = syncDevice(fd);
+  }
+  close(fd);
+  if (err == 0 && std::rename(temporary.c_str(), path) != 0) {
+    err = errno;
+  }
+  return err;
+}
+
+// =============================================================================
+// Wiping
+// =============================================================================
+
+// Wiper
+// -----
+// Clears cluster ranges with the requested method and paces them against
+// the rate limit.
+
+struct Wiper {
+  using Clock = std::chrono::steady_clock;
+
+  int fd;
+  const VolumeGeometry& geometry;
+  uint64_t bytesPerSecond;
+  bool discard;
+
+  Clock::time_point start = Clock::now();
+  uint64_t bytesWiped = 0;
+
+  // wipe
+  // ----
+  // Clears `count` clusters from `firstCluster`. A target that cannot
+  // discard is zeroed instead, for this and every later range.
+  int wipe(uint32_t firstCluster, uint32_t count) {
+    const uint64_t lba = clusterLba(geometry, firstCluster);
+    const uint64_t sectors = uint64_t{count} * geometry.sectorsPerCluster;
+
+    int err = EOPNOTSUPP;
+    if (discard) {
+      err = discardRegion(fd, static_cast<off_t>(lba), sectors);
+      discard = err != EOPNOTSUPP;
+    }
+    if (err == EOPNOTSUPP) {
+      err = zeroRegion(fd, static_cast<off_t>(lba), sectors);
+    }
+    if (err != 0) {
+      return err;
+    }
+
+    // Sleep until the average rate is back under the limit
+    bytesWiped += sectors * kSectorSize;
+    if (bytesPerSecond != 0) {
+      std::chrono::duration<double> due{static_cast<double>(bytesWiped) /
+                                        static_cast<double>(bytesPerSecond)};
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<Clock::duration>(due));
+    }
+    return 0;
+  }
+};
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatWipeFreeClusters
+// ------------------------
+// The FAT is read once. Free runs are wiped in chunks of at most
+// kWipeChunkClusters; after every kWipeCheckpointClusters (and at the end)
+// the device is synced and the progress file advanced.
+
+int sdFormatWipeFreeClusters(int fd, const SDFormatWipeOptions* options,
+                             SDFormatWipeReport* report) {
+  *report = {};
+
+  VolumeGeometry geometry;
+  if (int err = readVolumeGeometry(fd, geometry); err != 0) {
+    return err;
+  }
+  SectorBytes raw;
+  if (int err = readSector(fd, static_cast<off_t>(geometry.partitionStart),
+                           raw);
+      err != 0) {
+    return err;
+  }
+  std::vector<uint32_t> fat;
+  if (int err = readFat(fd, geometry, 0, fat); err != 0) {
+    return err;
+  }
+
+  const uint32_t endCluster = geometry.clusterCount + kRootCluster;
+  auto isFree = [&fat](uint32_t cluster) {
+    return (fat[cluster] & kFat32EntryMask) == 0;
+  };
+  for (uint32_t cluster = kRootCluster; cluster < endCluster; cluster++) {
+    report->clustersFree += isFree(cluster) ? 1 : 0;
+  }
+
+  // Resume from a checkpoint of this volume
+  WipeProgress progress = {
+      .volumeId = std::bit_cast<VolumeBootRecord>(raw).volumeId,
+      .clusterCount = geometry.clusterCount,
+      .nextCluster = kRootCluster,
+  };
+  WipeProgress saved;
+  if (options->progressPath != nullptr &&
+      readProgress(options->progressPath, saved) &&
+      saved.volumeId == progress.volumeId &&
+      saved.clusterCount == progress.clusterCount &&
+      saved.nextCluster > kRootCluster) {
+    progress.nextCluster = std::min(saved.nextCluster, endCluster);
+    report->resumedAtCluster = progress.nextCluster;
+  }
+
+  Wiper wiper{
+      .fd = fd,
+      .geometry = geometry,
+      .bytesPerSecond = options->bytesPerSecond,
+      .discard = (options->flags & kSDFormatWipeDiscard) != 0,
+  };
+  uint32_t sinceCheckpoint = 0;
+  auto checkpoint = [&](uint32_t nextCluster) {
+    sinceCheckpoint = 0;
+    if (int err = syncDevice(fd); err != 0) {
+      return err;
+    }
+    progress.nextCluster = nextCluster;
+    if (options->progressPath == nullptr) {
+      return 0;
+    }
+    return writeProgress(options->progressPath, progress);
+  };
+
+  uint32_t cluster = progress.nextCluster;
+  while (cluster < endCluster) {
+    if (!isFree(cluster)) {
+      cluster++;
+      continue;
+    }
+    uint32_t runEnd = cluster + 1;
+    while (runEnd < endCluster && runEnd - cluster < kWipeChunkClusters &&
+           isFree(runEnd)) {
+      runEnd++;
+    }
+
+    if (int err = wiper.wipe(cluster, runEnd - cluster); err != 0) {
+      return err;
+    }
+    report->clustersWiped += runEnd - cluster;
+    sinceCheckpoint += runEnd - cluster;
+    cluster = runEnd;
+
+    if (sinceCheckpoint >= kWipeCheckpointClusters) {
+      if (int err = checkpoint(cluster); err != 0) {
+        return err;
+      }
+    }
+  }
+  return checkpoint(endCluster);
+}
@@ -0,0 +1,707 @@
+// =============================================================================
+// SectorIO.cpp
+// =============================================================================
+//
+// Low-level functions for reading and writing the block device or image
+// file. All public functions in the library use these helpers for I/O.
+//
+// =============================================================================
+
+#include "SectorIO.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#elif defined(__APPLE__)
+#include <sys/disk.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "HashManifest.h"
+#include "IOStats.h"
+#include "IOTrace.h"
+#include "SimulatedDevice.h"
+#include "Tracepoints.h"
+
+// deviceCall
+// ----------
+// Runs `call`, a wrapper around a flush, zero-out, or discard system call
+// that returns 0 or errno. If `fd` is simulated, a successful call then
+// takes as long as the simulated device would; if `fd` is being traced,
+// the call is recorded as `operation`.
+
+template <typename Call>
+static int deviceCall(int fd, uint16_t operation, uint64_t offset,
+                      uint64_t length, Call call) {
+  const bool tracing = ioTraceEnabled(fd);
+  const uint64_t start = tracing ? monotonicNanoseconds() : 0;
+  const int result = call();
+  if (result == 0 && isSimulated(fd)) {
+    simulateCommand(operation == kTraceSync ? kSimulatedFlush : kSimulatedErase,
+                    offset, length);
+  }
+  if (tracing) {
+    traceOperation(operation, offset, length, start,
+                   monotonicNanoseconds() - start, result);
+  }
+  return result;
+}
+
+// writeAll
+// --------
+// The pwrite loop of writeBytes, without hash manifest recording.
+// zeroSectors writes through it and records its range as zeros once,
+// rather than once per transfer of the shared zero buffer.
+
+static int writeAll(int fd, off_t offset, std::span<const std::byte> data) {
+  // Write data, handling partial writes and interrupts
+  const std::byte* ptr = data.data();
+  size_t remaining = data.size();
+
+  const bool recording = ioStatsEnabled();
+  const bool tracing = ioTraceEnabled(fd);
+  const bool simulating = isSimulated(fd);
+
+  while (remaining > 0) {
+    const bool timing =
+        recording || tracing || SDFORMAT_TRACE_ENABLED(write_complete);
+    const uint64_t lba = static_cast<uint64_t>(offset) / kSectorSize;
+    SDFORMAT_TRACE3(write_submit, fd, lba, remaining);
+    uint64_t start = timing ? monotonicNanoseconds() : 0;
+    ssize_t written = pwrite(fd, ptr, remaining, offset);
+    const int error = written == -1 ? errno : 0;
+    if (simulating && written > 0) {
+      simulateCommand(kSimulatedWrite, static_cast<uint64_t>(offset),
+                      static_cast<uint64_t>(written));
+    }
+    if (timing) {
+      const size_t bytes = written > 0 ? static_cast<size_t>(written) : 0;
+      const uint64_t latency = monotonicNanoseconds() - start;
+      SDFORMAT_TRACE5(write_complete, fd, lba, bytes, latency, error);
+      if (recording) {
+        recordWriteCall(bytes, latency);
+      }
+      if (tracing) {
+        traceOperation(kTraceWrite, static_cast<uint64_t>(offset),
+                       error == 0 ? bytes : remaining, start, latency, error);
+      }
+    }
+
+    if (written == -1) {
+      if (error == EINTR) {
+        continue;  // Interrupted; retry
+      }
+      return error;
+    }
+
+    ptr += written;
+    offset += written;
+    remaining -= static_cast<size_t>(written);
+  }
+
+  return 0;
+}
+
+// writeBytes
+// ----------
+// Writes a span of bytes to a specific byte offset in the file.
+//
+// Handles partial writes by looping until all bytes are written or an
+// error occurs. Also handles EINTR (interrupted system call) by retrying.
+// With statistics or tracing enabled, each pwrite call is timed and
+// recorded; each call also fires the write_submit and write_complete
+// probes. While a hash manifest records `fd`, the written bytes are
+// recorded once the whole span is written.
+//
+// Parameters:
+//   fd:     File descriptor open for writing
+//   offset: Byte offset from the start of the file
+//   data:   Span of bytes to write
+//
+// Returns:
+//   0 on success, or errno from the failed pwrite call.
+
+int writeBytes(int fd, off_t offset, std::span<const std::byte> data) {
+  if (int err = writeAll(fd, offset, data); err != 0) {
+    return err;
+  }
+  if (hashManifestEnabled(fd)) {
+    recordContent(static_cast<uint64_t>(offset), data);
+  }
+  return 0;
+}
+
+// readBytes
+// ---------
+// Reads a span of bytes from a specific byte offset in the file.
+//
+// The read-side counterpart of writeBytes: handles short reads and EINTR
+// by looping until the span is full. Reaching end-of-file before the span
+// is full is reported as EIO, since every caller reads structures that
+// must exist on a formatted volume.
+//
+// Parameters:
+//   fd:     File descriptor open for reading
+//   offset: Byte offset from the start of the file
+//   data:   Span of bytes to fill
+//
+// Returns:
+//   0 on success, or errno from the failed pread call.
+
+int readBytes(int fd, off_t offset, std::span<std::byte> data) {
+  // Read data, handling partial reads and interrupts
+  std::byte* ptr = data.data();
+  size_t remaining = data.size();
+
+  const bool tracing = ioTraceEnabled(fd);
+  const bool simulating = isSimulated(fd);
+
+  while (remaining > 0) {
+    uint64_t start = tracing ? monotonicNanoseconds() : 0;
+    ssize_t got = pread(fd, ptr, remaining, offset);
+    const int error = got == -1 ? errno : 0;
+    if (simulating && got > 0) {
+      simulateCommand(kSimulatedRead, static_cast<uint64_t>(offset),
+                      static_cast<uint64_t>(got));
+    }
+    const size_t bytes = got > 0 ? static_cast<size_t>(got) : 0;
+    if (ioStatsEnabled()) {
+      recordReadCall(bytes);
+    }
+    if (tracing) {
+      traceOperation(kTraceRead, static_cast<uint64_t>(offset),
+                     error == 0 ? bytes : remaining, start,
+                     monotonicNanoseconds() - start, error);
+    }
+
+    if (got == -1) {
+      if (error == EINTR) {
+        continue;  // Interrupted; retry
+      }
+      return error;
+    }
+    if (got == 0) {
+      return EIO;  // Unexpected end of file
+    }
+
+    ptr += got;
+    offset += got;
+    remaining -= static_cast<size_t>(got);
+  }
+
+  return 0;
+}
+
+// isValidSectorSize
+// -----------------
+
+bool isValidSectorSize(const SectorSize& size) {
+  return std::has_single_bit(size.logicalBytes) &&
+         std::has_single_bit(size.physicalBytes) &&
+         size.logicalBytes >= kSectorSize && size.logicalBytes <= 4096 &&
+         size.physicalBytes >= size.logicalBytes &&
+         size.physicalBytes <= kMaxPhysicalBlockBytes;
+}
+
+// gSectorSizeOverride: logicalBytes << 32 | physicalBytes, or 0 for none.
+static std::atomic<uint64_t> gSectorSizeOverride{0};
+
+void setSectorSizeOverride(const SectorSize* size) {
+  gSectorSizeOverride.store(
+      size == nullptr
+          ? 0
+          : uint64_t{size->logicalBytes} << 32 | size->physicalBytes,
+      std::memory_order_relaxed);
+}
+
+// deviceSectorSize
+// ----------------
+// A device that reports an unusable size (or none) is treated as having
+// 512-byte sectors; a physical size below the logical one is raised to it.
+
+SectorSize deviceSectorSize(int fd) {
+  if (uint64_t packed = gSectorSizeOverride.load(std::memory_order_relaxed);
+      packed != 0) {
+    return {static_cast<uint32_t>(packed >> 32),
+            static_cast<uint32_t>(packed)};
+  }
+
+  SectorSize size = kDefaultSectorSize;
+  // macOS exposes disks as character devices (/dev/rdiskN) as well
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      !(S_ISBLK(info.st_mode) || S_ISCHR(info.st_mode))) {
+    return size;
+  }
+#if defined(__linux__)
+  int logical = 0;
+  unsigned int physical = 0;
+  if (ioctl(fd, BLKSSZGET, &logical) == 0 && logical > 0) {
+    size.logicalBytes = static_cast<uint32_t>(logical);
+  }
+  if (ioctl(fd, BLKPBSZGET, &physical) == 0 && physical > 0) {
+    size.physicalBytes = physical;
+  }
+#elif defined(__APPLE__)
+  uint32_t logical = 0;
+  uint32_t physical = 0;
+  if (ioctl(fd, DKIOCGETBLOCKSIZE, &logical) == 0 && logical > 0) {
+    size.logicalBytes = logical;
+  }
+  if (ioctl(fd, DKIOCGETPHYSICALBLOCKSIZE, &physical) == 0 && physical > 0) {
+    size.physicalBytes = physical;
+  }
+#endif
+  size.physicalBytes = std::max(size.physicalBytes, size.logicalBytes);
+  return isValidSectorSize(size) ? size : kDefaultSectorSize;
+}
+
+// writeAlignedBytes
+// -----------------
+// The common case, a write that is already aligned, goes straight to
+// writeBytes. Otherwise the covering block range is read, patched, and
+// written back with one call.
+
+int writeAlignedBytes(int fd, off_t offset, std::span<const std::byte> data,
+                      uint32_t blockBytes) {
+  const auto block = static_cast<off_t>(blockBytes);
+  const off_t start = offset / block * block;
+  const off_t end =
+      (offset + static_cast<off_t>(data.size()) + block - 1) / block * block;
+  if (start == offset && end == offset + static_cast<off_t>(data.size())) {
+    return writeBytes(fd, offset, data);
+  }
+
+  std::vector<std::byte> blocks(static_cast<size_t>(end - start));
+  if (int err = readBytes(fd, start, blocks); err != 0) {
+    return err;
+  }
+  std::copy(data.begin(), data.end(),
+            blocks.begin() + static_cast<ptrdiff_t>(offset - start));
+  return writeBytes(fd, start, blocks);
+}
+
+// currentWriteTuning / setWriteTuning
+// -----------------------------------
+// The two fields are stored separately; a reader racing a writer can see a
+// mix of old and new values, which is still a valid tuning.
+static std::atomic<uint32_t> gTransferBytes{kDefaultWriteTuning.transferBytes};
+static std::atomic<uint32_t> gQueueDepth{kDefaultWriteTuning.queueDepth};
+
+WriteTuning currentWriteTuning() {
+  return WriteTuning{
+      .transferBytes = gTransferBytes.load(std::memory_order_relaxed),
+      .queueDepth = gQueueDepth.load(std::memory_order_relaxed),
+  };
+}
+
+void setWriteTuning(const WriteTuning& tuning) {
+  gTransferBytes.store(tuning.transferBytes, std::memory_order_relaxed);
+  gQueueDepth.store(tuning.queueDepth, std::memory_order_relaxed);
+}
+
+// zeroBuffer
+// ----------
+// kMaxTransferBytes of zeros, allocated on first use and shared by every
+// writer (it is only ever read).
+
+static std::span<const std::byte> zeroBuffer() {
+  static const std::vector<std::byte> zeros(kMaxTransferBytes);
+  return zeros;
+}
+
+// zeroSectors
+// -----------
+// Writes zeros to a contiguous range of sectors.
+//
+// The range is cut into transfers of tuning.transferBytes. With a queue
+// depth of N, N threads (the caller's and N - 1 more) take every Nth
+// transfer, so N writes to neighbouring addresses are in flight at once.
+// Cards behind USB readers with command queuing, and UHS cards on a native
+// host, often need more than one outstanding write to reach full speed;
+// sdFormatAutotune finds the combination that suits a card. If a thread
+// cannot be created, the caller writes that thread's transfers itself.
+//
+// Parameters:
+//   fd:          File descriptor open for writing
+//   startSector: First sector (LBA) to zero
+//   sectorCount: Number of sectors to zero
+//   tuning:      Transfer size and queue depth (process-wide by default)
+//
+// Returns:
+//   0 on success, or errno from the first failed I/O call.
+
+int zeroSectors(int fd, off_t startSector, uint32_t sectorCount) {
+  return zeroSectors(fd, startSector, sectorCount, currentWriteTuning());
+}
+
+int zeroSectors(int fd, off_t startSector, uint32_t sectorCount,
+                const WriteTuning& tuning) {
+  if (sectorCount == 0) {
+    return 0;
+  }
+
+  const uint32_t transferSectors = tuning.transferBytes / kSectorSize;
+  const uint32_t transfers =
+      (sectorCount + transferSectors - 1) / transferSectors;
+  const uint32_t workers = std::clamp(tuning.queueDepth, 1u, transfers);
+  const auto zeros = zeroBuffer();
+  SDFORMAT_TRACE6(zero_strategy, fd, startSector, sectorCount,
+                  kZeroStrategyBuffered, tuning.transferBytes, workers);
+
+  // Worker `first` writes transfers first, first + workers, ...
+  auto writeTransfers = [&](uint32_t first) {
+    for (uint32_t t = first; t < transfers; t += workers) {
+      uint32_t sector = t * transferSectors;
+      uint32_t count = std::min(transferSectors, sectorCount - sector);
+      off_t offset = (startSector + sector) * kSectorSize;
+      if (int err = writeAll(fd, offset, zeros.first(count * kSectorSize));
+          err != 0) {
+        return err;
+      }
+    }
+    return 0;
+  };
+
+  auto recordZeroed = [&] {
+    if (hashManifestEnabled(fd)) {
+      recordZeros(static_cast<uint64_t>(startSector) * kSectorSize,
+                  uint64_t{sectorCount} * kSectorSize);
+    }
+  };
+  if (workers <= 1) {
+    int err = writeTransfers(0);
+    if (err == 0) {
+      recordZeroed();
+    }
+    return err;
+  }
+  const uint32_t phase = activePhase();
+  std::vector<int> errors(workers, 0);
+  std::vector<std::thread> threads;
+  threads.reserve(workers - 1);
+  for (uint32_t worker = 1; worker < workers; worker++) {
+    auto write = [&, worker] {
+      adoptPhase(phase);
+      errors[worker] = writeTransfers(worker);
+    };
+    try {
+      threads.emplace_back(write);
+    } catch (const std::system_error&) {
+      // Out of threads: this worker's transfers are written here, with
+      // fewer writes in flight
+      errors[worker] = writeTransfers(worker);
+    }
+  }
+  errors[0] = writeTransfers(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int err : errors) {
+    if (err != 0) {
+      return err;
+    }
+  }
+  recordZeroed();
+  return 0;
+}
+
+// zeroRegion
+// ----------
+// Zeroes a contiguous range of sectors, offloading the work when possible.
+//
+// Writing zeros through the page cache costs one full transfer per byte.
+// On Linux, BLKZEROOUT lets a block device zero the range itself (SD hosts
+// issue an erase or a write-zeroes command where the card supports it, and
+// the kernel falls back to writing zero pages otherwise), and on an image
+// file FALLOC_FL_ZERO_RANGE turns the range into unwritten extents without
+// writing any data. Other hosts, and any target that rejects both, use the
+// buffered zeroSectors path.
+//
+// Parameters:
+//   fd:          File descriptor open for writing
+//   startSector: First sector (LBA) to zero
+//   sectorCount: Number of sectors to zero
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+
+int zeroRegion(int fd, off_t startSector, uint64_t sectorCount) {
+  if (sectorCount == 0) {
+    return 0;
+  }
+
+#if defined(__linux__)
+  struct stat info;
+  const bool canOffload = !isSimulated(fd) || simulatedDeviceCanErase();
+  if (canOffload && fstat(fd, &info) == 0) {
+    uint64_t range[2] = {static_cast<uint64_t>(startSector) * kSectorSize,
+                         sectorCount * kSectorSize};
+    if (S_ISBLK(info.st_mode) &&
+        deviceCall(fd, kTraceZeroDevice, range[0], range[1], [&] {
+          return ioctl(fd, BLKZEROOUT, range) == 0 ? 0 : errno;
+        }) == 0) {
+      SDFORMAT_TRACE6(zero_strategy, fd, startSector, sectorCount,
+                      kZeroStrategyDeviceZeroOut, 0, 0);
+      if (ioStatsEnabled()) {
+        recordOffloadCall(range[1]);
+      }
+      if (hashManifestEnabled(fd)) {
+        recordZeros(range[0], range[1]);
+      }
+      return 0;
+    }
+    if (S_ISREG(info.st_mode) &&
+        deviceCall(fd, kTraceZeroFile, range[0], range[1], [&] {
+          return fallocate(fd, FALLOC_FL_ZERO_RANGE,
+                           static_cast<off_t>(range[0]),
+                           static_cast<off_t>(range[1])) == 0
+                     ? 0
+                     : errno;
+        }) == 0) {
+      SDFORMAT_TRACE6(zero_strategy, fd, startSector, sectorCount,
+                      kZeroStrategyFileZeroRange, 0, 0);
+      if (ioStatsEnabled()) {
+        recordOffloadCall(range[1]);
+      }
+      if (hashManifestEnabled(fd)) {
+        recordZeros(range[0], range[1]);
+      }
+      return 0;
+    }
+  }
+#endif
+
+  // Buffered fallback, in chunks zeroSectors can express
+  while (sectorCount > 0) {
+    auto chunk = static_cast<uint32_t>(
+        std::min<uint64_t>(sectorCount, uint64_t{1} << 30));
+    if (int err = zeroSectors(fd, startSector, chunk); err != 0) {
+      return err;
+    }
+    startSector += chunk;
+    sectorCount -= chunk;
+  }
+  return 0;
+}
+
+// discardRegion
+// -------------
+// Deallocates a contiguous range of sectors.
+//
+// On an SD card, BLKDISCARD becomes an ERASE or DISCARD command: the card
+// drops the mapping for the range and can reuse those flash pages without
+// copying them, which also keeps later writes fast. On an image file the
+// equivalent is punching a hole, which frees the blocks and makes the range
+// read as zeros. Unlike zeroRegion there is no fallback, since writing
+// data is the opposite of what the caller asked for; callers decide what
+// to do when discard is not available.
+//
+// Parameters:
+//   fd:          File descriptor open for writing
+//   startSector: First sector (LBA) to discard
+//   sectorCount: Number of sectors to discard
+//
+// Returns:
+//   0 on success, EOPNOTSUPP if the target cannot discard, or errno from
+//   the failed ioctl or fallocate call.
+
+int discardRegion(int fd, off_t startSector, uint64_t sectorCount) {
+  if (sectorCount == 0) {
+    return 0;
+  }
+
+#if defined(__linux__)
+  if (isSimulated(fd) && !simulatedDeviceCanErase()) {
+    return EOPNOTSUPP;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    return errno;
+  }
+  uint64_t range[2] = {static_cast<uint64_t>(startSector) * kSectorSize,
+                       sectorCount * kSectorSize};
+  int result = EOPNOTSUPP;
+  if (S_ISBLK(info.st_mode)) {
+    result = deviceCall(fd, kTraceDiscardDevice, range[0], range[1], [&] {
+      return ioctl(fd, BLKDISCARD, range) == 0 ? 0 : errno;
+    });
+  } else if (S_ISREG(info.st_mode)) {
+    result = deviceCall(fd, kTraceDiscardFile, range[0], range[1], [&] {
+      return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       static_cast<off_t>(range[0]),
+                       static_cast<off_t>(range[1])) == 0
+                 ? 0
+                 : errno;
+    });
+  }
+  if (result == 0 && ioStatsEnabled()) {
+    recordOffloadCall(range[1]);
+  }
+  if (result == 0 && hashManifestEnabled(fd)) {
+    forgetContent(range[0], range[1]);  // Discarded sectors may not read 0
+  }
+  return result;
+#else
+  static_cast<void>(fd);
+  static_cast<void>(startSector);
+  return EOPNOTSUPP;
+#endif
+}
+
+// dropCachedRange
+// ---------------
+// Read-back verification is meaningless if the read is served from the
+// page cache. On Linux, POSIX_FADV_DONTNEED drops the clean pages of the
+// range (including those of a block device's own mapping), so the range
+// must have been synced first. macOS has no equivalent for a buffered
+// descriptor, but its raw disk nodes (/dev/rdiskN) are not cached at all.
+
+int dropCachedRange(int fd, off_t startSector, uint64_t sectorCount) {
+#if defined(__linux__)
+  return posix_fadvise(fd, startSector * kSectorSize,
+                       static_cast<off_t>(sectorCount * kSectorSize),
+                       POSIX_FADV_DONTNEED);
+#else
+  static_cast<void>(fd);
+  static_cast<void>(startSector);
+  static_cast<void>(sectorCount);
+  return 0;
+#endif
+}
+
+// isZeroFilled
+// ------------
+// Tests a buffer for zeros a block at a time.
+//
+// Within a 4 KB block, 64-bit words are ORed together with no branch, a loop
+// the compiler vectorizes; the early exit is taken only between blocks. A
+// FAT read back from a blank volume is zero almost everywhere, so nearly
+// every block runs to completion and the scan is limited by memory speed.
+//
+// Returns:
+//   true if every byte of `data` is zero.
+
+bool isZeroFilled(std::span<const std::byte> data) {
+  static constexpr size_t kBlockBytes = 4096;
+
+  for (size_t block = 0; block < data.size(); block += kBlockBytes) {
+    size_t end = std::min(data.size(), block + kBlockBytes);
+    uint64_t accumulated = 0;
+    size_t i = block;
+    for (; i + sizeof(uint64_t) <= end; i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, data.data() + i, sizeof(word));
+      accumulated |= word;
+    }
+    for (; i < end; i++) {
+      accumulated |= static_cast<uint8_t>(data[i]);
+    }
+    if (accumulated != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// copyBytes
+// ---------
+// Copies a range within the file using the cheapest mechanism available.
+//
+// On Linux, copy_file_range lets the kernel move the data without bouncing
+// it through user space, and on filesystems with reflink support (XFS,
+// Btrfs) an image-file copy becomes a metadata operation. The call is not
+// supported everywhere (block devices on many kernels, older kernels, and
+// every non-Linux host), so any "not supported" error falls back to a
+// buffered pread/pwrite loop with 1 MB transfers.
+//
+// Parameters:
+//   fd:                File descriptor open for reading and writing
+//   sourceOffset:      Byte offset of the range to copy
+//   destinationOffset: Byte offset of the copy; must not overlap the source
+//   length:            Number of bytes to copy
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+
+int copyBytes(int fd, off_t sourceOffset, off_t destinationOffset,
+              uint64_t length) {
+#if defined(__linux__)
+  // A simulated card has no copy offload; copy through the buffered path
+  while (length > 0 && !isSimulated(fd)) {
+    off_t in = sourceOffset;
+    off_t out = destinationOffset;
+    ssize_t copied = copy_file_range(fd, &in, fd, &out, length, 0);
+
+    if (copied > 0) {
+      if (hashManifestEnabled(fd)) {
+        forgetContent(static_cast<uint64_t>(destinationOffset),
+                      static_cast<uint64_t>(copied));
+      }
+      sourceOffset += copied;
+      destinationOffset += copied;
+      length -= static_cast<uint64_t>(copied);
+      continue;
+    }
+    if (copied == -1 && errno == EINTR) {
+      continue;  // Interrupted; retry
+    }
+    if (copied == -1 && errno != EINVAL && errno != EXDEV &&
+        errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) {
+      return errno;
+    }
+    break;  // Unsupported here (or no progress): use the buffered path
+  }
+#endif
+
+  static constexpr size_t kCopyChunkBytes = 1 << 20;
+  std::vector<std::byte> buffer(
+      static_cast<size_t>(std::min<uint64_t>(length, kCopyChunkBytes)));
+
+  while (length > 0) {
+    auto chunk = std::span{buffer}.first(
+        static_cast<size_t>(std::min<uint64_t>(length, buffer.size())));
+    if (int err = readBytes(fd, sourceOffset, chunk); err != 0) {
+      return err;
+    }
+    if (int err = writeBytes(fd, destinationOffset, chunk); err != 0) {
+      return err;
+    }
+    sourceOffset += static_cast<off_t>(chunk.size());
+    destinationOffset += static_cast<off_t>(chunk.size());
+    length -= chunk.size();
+  }
+
+  return 0;
+}
+
+// syncDevice
+// ----------
+// fsync on the descriptor, retried on EINTR. On a block device this pushes
+// the kernel's buffered writes to the card; on an image file it makes the
+// preceding writes durable before the next ordered step begins.
+
+int syncDevice(int fd) {
+  if (ioStatsEnabled()) {
+    recordSyncCall();
+  }
+  int err;
+  do {
+    err = deviceCall(fd, kTraceSync, 0, 0,
+                     [fd] { return fsync(fd) == 0 ? 0 : errno; });
+  } while (err == EINTR);
+  return err;
+}
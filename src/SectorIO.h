@@ -0,0 +1,245 @@
+// =============================================================================
+// SectorIO.h
+// =============================================================================
+//
+// Internal header: positioned I/O helpers shared by the library's translation
+// units. Not part of the public API.
+//
+// All helpers use pread/pwrite, which never move the file offset, so several
+// threads may issue I/O against the same file descriptor concurrently (the
+// consistency checker compares FAT copies this way).
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_SECTOR_IO_H
+#define SD_FORMAT_SECTOR_IO_H
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "FatStructures.h"
+
+// writeBytes
+// ----------
+// Writes a span of bytes to a specific byte offset in the file.
+//
+// Returns:
+//   0 on success, or errno from the failed pwrite call.
+int writeBytes(int fd, off_t offset, std::span<const std::byte> data);
+
+// readBytes
+// ---------
+// Fills a span of bytes from a specific byte offset in the file.
+//
+// Returns:
+//   0 on success, EIO on a premature end-of-file, or errno from the failed
+//   pread call.
+int readBytes(int fd, off_t offset, std::span<std::byte> data);
+
+// SectorSize
+// ----------
+// A device's logical sector size (the unit of its LBAs and of
+// BPB_bytesPerSector) and its physical block size (the unit it programs;
+// a smaller write costs a read-modify-write inside the device or the USB
+// bridge in front of it). The helpers below address the device in 512-byte
+// units whatever its sector size; only the formatter's layout and the
+// partition table use logical sectors.
+struct SectorSize {
+  uint32_t logicalBytes;
+  uint32_t physicalBytes;
+};
+
+// kDefaultSectorSize: 512-byte sectors and blocks, as on an image file.
+inline constexpr SectorSize kDefaultSectorSize = {kSectorSize, kSectorSize};
+
+// kMaxPhysicalBlockBytes: Largest physical block the library aligns to.
+inline constexpr uint32_t kMaxPhysicalBlockBytes = 64 << 10;
+
+// isValidSectorSize
+// -----------------
+// A logical size that is a power of two from 512 to 4096, and a physical
+// size that is a power of two from the logical size to
+// kMaxPhysicalBlockBytes.
+bool isValidSectorSize(const SectorSize& size);
+
+// deviceSectorSize / setSectorSizeOverride
+// ----------------------------------------
+// The sector size of the device behind `fd`: the process-wide override if
+// one is set (see sdFormatSetSectorSize), otherwise what the block device
+// reports (BLKSSZGET and BLKPBSZGET on Linux, DKIOCGETBLOCKSIZE and
+// DKIOCGETPHYSICALBLOCKSIZE on macOS), otherwise kDefaultSectorSize.
+// Pass nullptr to setSectorSizeOverride to remove the override.
+SectorSize deviceSectorSize(int fd);
+void setSectorSizeOverride(const SectorSize* size);
+
+// writeAlignedBytes
+// -----------------
+// Like writeBytes, but every write covers whole `blockBytes` blocks: a
+// block the data covers only partly is read first and patched in memory,
+// so the device never has to merge a partial write itself.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int writeAlignedBytes(int fd, off_t offset, std::span<const std::byte> data,
+                      uint32_t blockBytes);
+
+// WriteTuning
+// -----------
+// How bulk zero writes are issued: bytes per pwrite and the number of
+// writes in flight at once. Process-wide; see sdFormatSetWriteTuning.
+struct WriteTuning {
+  uint32_t transferBytes;
+  uint32_t queueDepth;
+};
+
+// kDefaultWriteTuning: One 32 KB cluster per write, one write at a time.
+inline constexpr WriteTuning kDefaultWriteTuning = {
+    .transferBytes = kSectorsPerCluster * kSectorSize,
+    .queueDepth = 1,
+};
+
+// kMaxTransferBytes / kMaxQueueDepth: Limits on a WriteTuning.
+inline constexpr uint32_t kMaxTransferBytes = 16 << 20;
+inline constexpr uint32_t kMaxQueueDepth = 32;
+
+// currentWriteTuning / setWriteTuning
+// -----------------------------------
+// Read and replace the process-wide tuning. The tuning must be within the
+// limits above, with transferBytes a multiple of kSectorSize.
+WriteTuning currentWriteTuning();
+void setWriteTuning(const WriteTuning& tuning);
+
+// zeroSectors
+// -----------
+// Writes zeros to a contiguous range of sectors, issuing the writes as
+// `tuning` describes (the process-wide tuning by default).
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int zeroSectors(int fd, off_t startSector, uint32_t sectorCount);
+int zeroSectors(int fd, off_t startSector, uint32_t sectorCount,
+                const WriteTuning& tuning);
+
+// zeroRegion
+// ----------
+// Zeroes a large range of sectors, asking the device to do it where it can
+// (BLKZEROOUT on a Linux block device, FALLOC_FL_ZERO_RANGE on an image
+// file) and falling back to zeroSectors otherwise.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int zeroRegion(int fd, off_t startSector, uint64_t sectorCount);
+
+// discardRegion
+// -------------
+// Tells the device that a range of sectors no longer holds data (BLKDISCARD
+// on a Linux block device, a punched hole in an image file). What the range
+// reads back as afterwards depends on the device.
+//
+// Returns:
+//   0 on success, EOPNOTSUPP if the target cannot discard, or errno from
+//   the failed call.
+int discardRegion(int fd, off_t startSector, uint64_t sectorCount);
+
+// dropCachedRange
+// ---------------
+// Evicts a range the caller has already synced from the host's page cache,
+// so the next read of it goes to the device rather than returning the data
+// just written.
+//
+// Returns:
+//   0 on success, or the error from posix_fadvise.
+int dropCachedRange(int fd, off_t startSector, uint64_t sectorCount);
+
+// isZeroFilled
+// ------------
+// True if every byte of `data` is zero. Fast enough to scan a whole FAT
+// that was read back, so unchanged zero ranges need not be rewritten.
+bool isZeroFilled(std::span<const std::byte> data);
+
+// copyBytes
+// ---------
+// Copies `length` bytes within the same file, from `sourceOffset` to
+// `destinationOffset`. The two ranges must not overlap.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+int copyBytes(int fd, off_t sourceOffset, off_t destinationOffset,
+              uint64_t length);
+
+// syncDevice
+// ----------
+// Flushes completed writes to stable storage. Used between the steps of
+// a crash-ordered update.
+//
+// Returns:
+//   0 on success, or errno from the failed fsync call.
+int syncDevice(int fd);
+
+// writeSector
+// -----------
+// Writes a single 512-byte structure to a specific LBA on the device.
+//
+// Accepts any type that is exactly kSectorSize bytes, enforced at compile
+// time via static_assert. Converts the sector number to a byte offset and
+// delegates to writeAlignedBytes with the device's physical block size, so
+// on a 4K device the structure's block is rewritten whole.
+//
+// Parameters:
+//   fd:        File descriptor open for writing
+//   sectorLba: Sector number in 512-byte units, 0-based
+//   sector:    Reference to a 512-byte structure to write
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+
+template <typename T>
+int writeSector(int fd, off_t sectorLba, const T& sector) {
+  static_assert(sizeof(T) == kSectorSize);
+  off_t offset = sectorLba * kSectorSize;
+  return writeAlignedBytes(fd, offset, std::as_bytes(std::span{&sector, 1}),
+                           deviceSectorSize(fd).physicalBytes);
+}
+
+// writeSectorAndBackupSector
+// --------------------------
+// Writes the same 512-byte structure to two LBAs (primary and backup).
+//
+// FAT32 stores backup copies of critical structures (VBR at sector 6,
+// FSInfo at sector 7, FAT reserved entries at the start of FAT 2).
+// This helper ensures both copies are written identically.
+
+template <typename T>
+int writeSectorAndBackupSector(int fd, off_t primaryLba, off_t backupLba,
+                               const T& sector) {
+  if (int err = writeSector(fd, primaryLba, sector); err != 0) {
+    return err;
+  }
+  return writeSector(fd, backupLba, sector);
+}
+
+// SectorBytes
+// -----------
+// Raw contents of one sector as read from the device.
+//
+// The on-disk structures have const members, so they cannot be filled in
+// place. Readers fetch a SectorBytes and decode it with std::bit_cast, e.g.
+// `auto vbr = std::bit_cast<VolumeBootRecord>(raw);`.
+using SectorBytes = std::array<std::byte, kSectorSize>;
+
+// readSector
+// ----------
+// Reads one sector from a specific LBA on the device.
+//
+// Returns:
+//   0 on success, or errno from the failed I/O call.
+
+inline int readSector(int fd, off_t sectorLba, SectorBytes& sector) {
+  return readBytes(fd, sectorLba * kSectorSize, sector);
+}
+
+#endif  // SD_FORMAT_SECTOR_IO_H
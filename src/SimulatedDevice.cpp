@@ -0,0 +1,237 @@
+// =============================================================================
+// SimulatedDevice.cpp
+// =============================================================================
+//
+// Implementation of the simulated device: the model simulateCommand runs,
+// and the public functions sdFormatLoadDeviceProfile,
+// sdFormatAttachSimulator, and sdFormatDetachSimulator.
+//
+// Model
+// -----
+// A command first waits for one of queueDepth slots. It then pays the
+// fixed command overhead, which overlaps with other commands in flight,
+// and transfers its data over a bus that carries one transfer at a time,
+// at bytesPerSecond (eraseBytesPerSecond for zero-out and discard). So a
+// deeper queue hides per-command overhead but never adds bandwidth, and
+// small transfers are dominated by overhead. That is how SD cards behind
+// USB readers behave.
+//
+// Read-Modify-Write
+// -----------------
+// A card writes flash an erase block at a time. It accepts a sequential
+// stream of writes into the open block cheaply, but a write that leaves
+// the open block partly written, or that starts in the middle of another
+// block, forces the controller to merge the block with its old contents.
+// Each such write costs rmwMicroseconds of bus time. Writes are sequential
+// when each starts where the previous one ended, so interleaved writers can
+// cost merges that one writer would not.
+//
+// =============================================================================
+
+#include "SimulatedDevice.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "SDFormat.h"
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<int> gSimulatedFd{-1};
+
+// Simulator
+// ---------
+// The attached profile and the device state. Everything below `mutex`
+// is guarded by it.
+
+struct Simulator {
+  SDFormatDeviceProfile profile;
+
+  std::mutex mutex;
+  std::condition_variable slotFreed;
+  uint32_t inFlight = 0;
+  Clock::time_point busFreeAt;
+  uint64_t writePointer = 0;  // Byte after the last write
+  bool blockOpen = false;     // The last write ended inside an erase block
+  SDFormatSimulatorReport report = {};
+};
+
+static Simulator gSimulator;
+
+// =============================================================================
+// Model
+// =============================================================================
+
+// transferTime
+// ------------
+// Time to move `bytes` at `bytesPerSecond` (0: unlimited).
+
+static Clock::duration transferTime(uint64_t bytes, uint64_t bytesPerSecond) {
+  if (bytesPerSecond == 0) {
+    return Clock::duration::zero();
+  }
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(static_cast<double>(bytes) /
+                                    static_cast<double>(bytesPerSecond)));
+}
+
+// countMerges
+// -----------
+// Read-modify-write merges a write of `bytes` at `offset` causes, and the
+// new write pointer. Requires the lock.
+
+static uint32_t countMerges(Simulator& simulator, uint64_t offset,
+                            uint64_t bytes) {
+  const uint64_t blockBytes = simulator.profile.eraseBlockBytes;
+  if (blockBytes == 0) {
+    return 0;
+  }
+  uint32_t merges = 0;
+  if (offset != simulator.writePointer) {
+    merges += simulator.blockOpen ? 1 : 0;       // Abandons the open block
+    merges += offset % blockBytes != 0 ? 1 : 0;  // Starts mid-block
+  }
+  simulator.writePointer = offset + bytes;
+  simulator.blockOpen = simulator.writePointer % blockBytes != 0;
+  return merges;
+}
+
+bool simulatedDeviceCanErase() {
+  return gSimulator.profile.eraseBytesPerSecond != 0;
+}
+
+void simulateCommand(uint32_t command, uint64_t offset, uint64_t bytes) {
+  Simulator& simulator = gSimulator;
+  const SDFormatDeviceProfile& profile = simulator.profile;
+  Clock::time_point done;
+  {
+    std::unique_lock lock(simulator.mutex);
+    simulator.slotFreed.wait(lock, [&simulator] {
+      return simulator.inFlight < simulator.profile.queueDepth;
+    });
+    simulator.inFlight++;
+
+    Clock::duration busy = transferTime(
+        command == kSimulatedFlush ? 0 : bytes,
+        command == kSimulatedErase ? profile.eraseBytesPerSecond
+                                   : profile.bytesPerSecond);
+    if (command == kSimulatedWrite) {
+      uint32_t merges = countMerges(simulator, offset, bytes);
+      busy += merges * std::chrono::microseconds(profile.rmwMicroseconds);
+      simulator.report.readModifyWrites += merges;
+    } else if (command == kSimulatedErase) {
+      simulator.writePointer = offset + bytes;
+      simulator.blockOpen = false;
+    }
+
+    const auto overhead =
+        std::chrono::microseconds(profile.commandMicroseconds);
+    done = std::max(Clock::now() + overhead, simulator.busFreeAt) + busy;
+    simulator.busFreeAt = done;
+
+    simulator.report.commands++;
+    simulator.report.bytesTransferred +=
+        command == kSimulatedFlush ? 0 : bytes;
+    simulator.report.busyNanoseconds += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(overhead + busy)
+            .count());
+  }
+
+  std::this_thread::sleep_until(done);
+
+  {
+    std::lock_guard lock(simulator.mutex);
+    simulator.inFlight--;
+  }
+  simulator.slotFreed.notify_one();
+}
+
+// =============================================================================
+// Public API Implementation
+// =============================================================================
+
+// sdFormatLoadDeviceProfile
+// -------------------------
+// Fields missing from the file keep the defaults: no overhead, unlimited
+// bandwidth, queue depth 1, no erase command, no erase blocks.
+
+int sdFormatLoadDeviceProfile(const char* path,
+                              SDFormatDeviceProfile* profile) {
+  std::ifstream file(path);
+  if (!file) {
+    return ENOENT;
+  }
+
+  SDFormatDeviceProfile loaded = {};
+  loaded.queueDepth = 1;
+  std::string line;
+  while (std::getline(file, line)) {
+    line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+    std::istringstream fields(line);
+    std::string key;
+    uint64_t value;
+    if (!(fields >> key)) {
+      continue;  // Blank or comment
+    }
+    if (!(fields >> value)) {
+      return EINVAL;
+    }
+    if (key == "command_us") {
+      loaded.commandMicroseconds = static_cast<uint32_t>(value);
+    } else if (key == "queue_depth") {
+      loaded.queueDepth = static_cast<uint32_t>(value);
+    } else if (key == "bytes_per_second") {
+      loaded.bytesPerSecond = value;
+    } else if (key == "erase_bytes_per_second") {
+      loaded.eraseBytesPerSecond = value;
+    } else if (key == "erase_block_bytes") {
+      loaded.eraseBlockBytes = static_cast<uint32_t>(value);
+    } else if (key == "rmw_us") {
+      loaded.rmwMicroseconds = static_cast<uint32_t>(value);
+    } else {
+      return EINVAL;
+    }
+  }
+  *profile = loaded;
+  return 0;
+}
+
+// sdFormatAttachSimulator
+// -----------------------
+
+int sdFormatAttachSimulator(int fd, const SDFormatDeviceProfile* profile) {
+  if (profile->queueDepth == 0) {
+    return EINVAL;
+  }
+  std::lock_guard lock(gSimulator.mutex);
+  if (gSimulatedFd.load(std::memory_order_relaxed) >= 0) {
+    return EBUSY;
+  }
+  gSimulator.profile = *profile;
+  gSimulator.busFreeAt = Clock::now();
+  gSimulator.writePointer = 0;
+  gSimulator.blockOpen = false;
+  gSimulator.report = {};
+  gSimulatedFd.store(fd, std::memory_order_relaxed);
+  return 0;
+}
+
+// sdFormatDetachSimulator
+// -----------------------
+
+int sdFormatDetachSimulator(SDFormatSimulatorReport* report) {
+  std::lock_guard lock(gSimulator.mutex);
+  gSimulatedFd.store(-1, std::memory_order_relaxed);
+  if (report != nullptr) {
+    *report = gSimulator.report;
+  }
+  return 0;
+}
@@ -0,0 +1,50 @@
+// =============================================================================
+// SimulatedDevice.h
+// =============================================================================
+//
+// Internal header: the simulated device behind sdFormatAttachSimulator. Not
+// part of the public API.
+//
+// SectorIO performs every call on the simulated descriptor for real (it is
+// normally an image file, which holds the data) and then calls
+// simulateCommand, which sleeps until the modeled device would have
+// completed the command. Timing therefore shows up everywhere real timing
+// would: wall clock, statistics, traces, and the autotuner.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_SIMULATED_DEVICE_H
+#define SD_FORMAT_SIMULATED_DEVICE_H
+
+#include <atomic>
+#include <cstdint>
+
+// SimulatedCommand: What simulateCommand models.
+inline constexpr uint32_t kSimulatedWrite = 1;
+inline constexpr uint32_t kSimulatedRead = 2;
+inline constexpr uint32_t kSimulatedFlush = 3;
+inline constexpr uint32_t kSimulatedErase = 4;  // Zero-out or discard
+
+// gSimulatedFd: The descriptor with a simulator attached, or -1.
+extern std::atomic<int> gSimulatedFd;
+
+// isSimulated
+// -----------
+inline bool isSimulated(int fd) {
+  return gSimulatedFd.load(std::memory_order_relaxed) == fd;
+}
+
+// simulatedDeviceCanErase
+// -----------------------
+// Whether the attached profile supports zero-out and discard commands. If
+// not, SectorIO behaves as it does on a target that rejects them.
+bool simulatedDeviceCanErase();
+
+// simulateCommand
+// ---------------
+// Blocks until the modeled device has completed `command` on `bytes` bytes
+// at `offset`. Safe to call from several threads at once; at most the
+// profile's queue depth of them are serviced concurrently.
+void simulateCommand(uint32_t command, uint64_t offset, uint64_t bytes);
+
+#endif  // SD_FORMAT_SIMULATED_DEVICE_H
@@ -0,0 +1,26 @@
+// =============================================================================
+// Tracepoints.cpp
+// =============================================================================
+//
+// Storage for the USDT probe semaphores declared in Tracepoints.h. Each one
+// lives in the ELF ".probes" section, where tracers look for it.
+//
+// =============================================================================
+
+#include "Tracepoints.h"
+
+#if SD_FORMAT_HAS_USDT
+
+#define SDFORMAT_SEMAPHORE(name)                               \
+  __attribute__((section(".probes"))) volatile unsigned short \
+      sdformat_##name##_semaphore = 0
+
+extern "C" {
+SDFORMAT_SEMAPHORE(phase_start);
+SDFORMAT_SEMAPHORE(phase_end);
+SDFORMAT_SEMAPHORE(write_submit);
+SDFORMAT_SEMAPHORE(write_complete);
+SDFORMAT_SEMAPHORE(zero_strategy);
+}
+
+#endif
@@ -0,0 +1,89 @@
+// =============================================================================
+// Tracepoints.h
+// =============================================================================
+//
+// Internal header: USDT (SystemTap-style static) probes for tracing a live
+// format with bpftrace, perf, or SystemTap. Not part of the public API.
+//
+// Probes (provider "sdformat"):
+//
+//   phase_start(phase)                 A kSDFormatPhase begins
+//   phase_end(phase)                   ... and ends
+//   write_submit(fd, lba, bytes)       A pwrite is about to be issued
+//   write_complete(fd, lba, bytes,     It returned; bytes is what was
+//                  latencyNs, err)     written, err is 0 or errno
+//   zero_strategy(fd, lba, sectors,    A range is about to be zeroed with
+//                 strategy,            kZeroStrategy... (the tuning fields
+//                 transferBytes,       are 0 for offloaded strategies)
+//                 queueDepth)
+//
+// The library is static, so the probes live in the binary that links it.
+// For example, the write latency of each phase of a running format_image:
+//
+//   bpftrace -e '
+//     usdt:./format_image:sdformat:phase_start { @phase = arg0; }
+//     usdt:./format_image:sdformat:write_complete {
+//       @us[@phase] = hist(arg3 / 1000); }'
+//
+// A probe site is a single nop until a tracer attaches. Arguments that cost
+// something to compute (the write latency needs two clock reads) are only
+// computed while the probe's semaphore says a tracer is attached.
+//
+// The probes are compiled in on Linux when <sys/sdt.h> is available
+// (systemtap-sdt-dev or systemtap-sdt-devel); elsewhere every macro expands
+// to nothing and SDFORMAT_TRACE_ENABLED is false.
+//
+// =============================================================================
+
+#ifndef SD_FORMAT_TRACEPOINTS_H
+#define SD_FORMAT_TRACEPOINTS_H
+
+#include <cstdint>
+
+// ZeroStrategy: How a range of sectors is zeroed (the zero_strategy probe).
+inline constexpr uint32_t kZeroStrategyDeviceZeroOut = 1;  // BLKZEROOUT
+inline constexpr uint32_t kZeroStrategyFileZeroRange = 2;  // fallocate
+inline constexpr uint32_t kZeroStrategyBuffered = 3;       // pwrite of zeros
+
+#if defined(__linux__) && __has_include(<sys/sdt.h>)
+
+#define SD_FORMAT_HAS_USDT 1
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Semaphores, defined in Tracepoints.cpp. The kernel increments a probe's
+// semaphore while a tracer is attached to it.
+extern "C" {
+extern volatile unsigned short sdformat_phase_start_semaphore;
+extern volatile unsigned short sdformat_phase_end_semaphore;
+extern volatile unsigned short sdformat_write_submit_semaphore;
+extern volatile unsigned short sdformat_write_complete_semaphore;
+extern volatile unsigned short sdformat_zero_strategy_semaphore;
+}
+
+#define SDFORMAT_TRACE_ENABLED(name) (sdformat_##name##_semaphore != 0)
+#define SDFORMAT_TRACE1(name, a) DTRACE_PROBE1(sdformat, name, a)
+#define SDFORMAT_TRACE3(name, a, b, c) DTRACE_PROBE3(sdformat, name, a, b, c)
+#define SDFORMAT_TRACE5(name, a, b, c, d, e) \
+  DTRACE_PROBE5(sdformat, name, a, b, c, d, e)
+#define SDFORMAT_TRACE6(name, a, b, c, d, e, f) \
+  DTRACE_PROBE6(sdformat, name, a, b, c, d, e, f)
+
+#else
+
+#define SD_FORMAT_HAS_USDT 0
+
+// traceDisabled: Swallows the arguments of a compiled-out probe, so that
+// values computed only for a probe do not trigger unused warnings.
+template <typename... Args>
+inline void traceDisabled(const Args&...) {}
+
+#define SDFORMAT_TRACE_ENABLED(name) false
+#define SDFORMAT_TRACE1(name, ...) traceDisabled(__VA_ARGS__)
+#define SDFORMAT_TRACE3(name, ...) traceDisabled(__VA_ARGS__)
+#define SDFORMAT_TRACE5(name, ...) traceDisabled(__VA_ARGS__)
+#define SDFORMAT_TRACE6(name, ...) traceDisabled(__VA_ARGS__)
+
+#endif
+
+#endif  // SD_FORMAT_TRACEPOINTS_H
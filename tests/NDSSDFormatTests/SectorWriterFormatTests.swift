@@ -0,0 +1,136 @@
+import Foundation
+import NDSSDFormatCore
+import Testing
+@testable import NDSSDFormat
+
+/// A sparse image file, open for reading and writing, removed when it goes
+/// away.
+private struct ImageFile: ~Copyable {
+  let path: String
+  let fd: Int32
+
+  init(byteCount: UInt64) throws {
+    let path = FileManager.default.temporaryDirectory
+      .appendingPathComponent("sdformat-\(UUID().uuidString).img").path
+    let fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0o600)
+    guard fd >= 0 else {
+      throw POSIXError(POSIXErrorCode(rawValue: errno) ?? .EIO)
+    }
+    guard ftruncate(fd, off_t(byteCount)) == 0 else {
+      let error = POSIXError(POSIXErrorCode(rawValue: errno) ?? .EIO)
+      close(fd)
+      unlink(path)
+      throw error
+    }
+    self.path = path
+    self.fd = fd
+  }
+
+  deinit {
+    close(fd)
+    unlink(path)
+  }
+}
+
+@Suite("SectorWriter.format(progress:)", .serialized)
+struct SectorWriterFormatTests {
+  /// A 4 GB card, the smallest size every layout profile formats.
+  static let cardBytes: UInt64 = 4 << 30
+
+  @Test func reportsEveryStepButTheLast() async throws {
+    let image = try ImageFile(byteCount: Self.cardBytes)
+    let writer = try SectorWriter(
+      fd: image.fd, byteCount: Self.cardBytes,
+      volumeLabel: VolumeLabel("NDS"))
+    let (events, progress) = AsyncStream.makeStream(of: FormatProgress.self)
+    try await writer.format(progress: progress)
+
+    // The stream is finished by the time format(progress:) returns, so
+    // this loop ends
+    var received: [FormatProgress] = []
+    for await event in events {
+      received.append(event)
+    }
+    #expect(received.map(\.step) ==
+      [.masterBootRecord, .volumeBootRecord, .fsInfo, .fatTables])
+    #expect(received.map(\.stepsDone) == [1, 2, 3, 4])
+    #expect(received.allSatisfy { $0.stepCount == 5 })
+
+    var report = SDFormatCheckReport()
+    #expect(sdFormatCheck(image.fd, &report) == 0)
+    #expect(report.vbrValid && report.fatMismatchSectors == 0)
+  }
+
+  @Test func streamEndsWhileFormatIsAwaited() async throws {
+    let image = try ImageFile(byteCount: Self.cardBytes)
+    let writer = try SectorWriter(
+      fd: image.fd, byteCount: Self.cardBytes,
+      volumeLabel: VolumeLabel("NDS"))
+    let (events, progress) = AsyncStream.makeStream(of: FormatProgress.self)
+    async let formatted: Void = writer.format(progress: progress)
+    var stepsDone: [Int] = []
+    for await event in events {
+      stepsDone.append(event.stepsDone)
+    }
+    try await formatted
+    #expect(stepsDone == [1, 2, 3, 4])
+  }
+
+  /// Every command of the simulated device takes 50 ms, so the format is
+  /// still in its first step when the cancellation reaches it.
+  @Test func cancellingTheTaskThrowsCancelled() async throws {
+    let image = try ImageFile(byteCount: Self.cardBytes)
+    let writer = try SectorWriter(
+      fd: image.fd, byteCount: Self.cardBytes,
+      volumeLabel: VolumeLabel("NDS"))
+    var profile = SDFormatDeviceProfile()
+    profile.commandMicroseconds = 50_000
+    profile.queueDepth = 1
+    try #require(sdFormatAttachSimulator(image.fd, &profile) == 0)
+    defer { _ = sdFormatDetachSimulator(nil) }
+
+    let (events, progress) = AsyncStream.makeStream(of: FormatProgress.self)
+    let task = Task {
+      while !Task.isCancelled {
+        await Task.yield()
+      }
+      try await writer.format(progress: progress)
+    }
+    task.cancel()
+    await #expect(throws: FormatterError.cancelled) {
+      try await task.value
+    }
+    var received = 0
+    for await _ in events {
+      received += 1
+    }
+    #expect(received <= 1)
+  }
+
+  /// A descriptor open only for reading fails the first write at once, so
+  /// the final event often arrives before sdFormatBegin has returned to
+  /// FormatOperation.begin. Every call must still return the error once
+  /// and finish its stream, whichever comes first.
+  @Test func returnsWhenFinishedBeforeBeginReturns() async throws {
+    let image = try ImageFile(byteCount: Self.cardBytes)
+    let readOnly = open(image.path, O_RDONLY)
+    try #require(readOnly >= 0)
+    defer { close(readOnly) }
+    let writer = try SectorWriter(
+      fd: readOnly, byteCount: Self.cardBytes,
+      volumeLabel: VolumeLabel("NDS"))
+
+    for _ in 0..<1000 {
+      let (events, progress) = AsyncStream.makeStream(
+        of: FormatProgress.self)
+      await #expect(throws: FormatterError.ioError(EBADF)) {
+        try await writer.format(progress: progress)
+      }
+      var received = 0
+      for await _ in events {
+        received += 1
+      }
+      #expect(received == 0)
+    }
+  }
+}
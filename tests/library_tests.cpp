@@ -0,0 +1,1973 @@
+// =============================================================================
+// library_tests.cpp
+// =============================================================================
+//
+// Tests of the C++ library against sparse image files. Unlike the
+// integration runner, which formats with format_image and verifies with
+// the host's fsck and mount (macOS only), these call the library directly
+// and run on any host the library builds on.
+//
+// Usage: library_tests [<name-filter>]
+//
+// Each test is a function returning true if it passed. Images are created
+// in the system's temporary directory and removed afterwards. Build with
+// -fsanitize=address,undefined to have the concurrency tests check for
+// memory errors as well. The volumes are decoded here from the on-disk
+// fields rather than with the library's own readers, and the hash tests
+// use the published known-answer vectors of SHA-256 and BLAKE3.
+//
+// =============================================================================
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "SDFormat.h"
+#include "SDFormatAsync.h"
+#include "../src/ContentHash.h"
+
+namespace fs = std::filesystem;
+using std::println;
+
+// =============================================================================
+// Helpers
+// =============================================================================
+
+// check
+// -----
+// Prints `what` if `condition` is false, and returns `condition`, so a test
+// can keep going after a failure and report all of them.
+
+static bool check(bool condition, std::string_view what) {
+  if (!condition) {
+    println(stderr, "    [!] {}", what);
+  }
+  return condition;
+}
+
+// Image
+// -----
+// A sparse image file of `sectorCount` 512-byte sectors, open for reading
+// and writing, removed when the Image goes away.
+
+struct Image {
+  explicit Image(uint64_t sectorCount) : sectorCount(sectorCount) {
+    static std::atomic<int> counter{0};
+    path = fs::temp_directory_path() /
+           std::format("sdformat-test-{}-{}.img", getpid(), counter++);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0 &&
+        ftruncate(fd, static_cast<off_t>(sectorCount * 512)) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  ~Image() {
+    if (fd >= 0) {
+      close(fd);
+    }
+    std::error_code error;
+    fs::remove(path, error);
+  }
+
+  Image(const Image&) = delete;
+  Image& operator=(const Image&) = delete;
+
+  fs::path path;
+  uint64_t sectorCount;
+  int fd = -1;
+};
+
+// kCardSectors: A 4 GB card, the smallest size every profile formats.
+static constexpr uint64_t kCardSectors = 8388608;
+
+// checkCleanVolume
+// ----------------
+// Runs sdFormatCheck on `fd` and checks that it found a consistent volume.
+
+static bool checkCleanVolume(int fd, std::string_view what) {
+  SDFormatCheckReport report;
+  const int err = sdFormatCheck(fd, &report);
+  bool passed = check(err == 0, std::format("{}: check returned {}", what,
+                                            err));
+  passed &= check(report.mbrValid && report.vbrValid &&
+                      report.backupVbrValid && report.backupVbrMatches &&
+                      report.mbrMatchesVbr,
+                  std::format("{}: boot region inconsistent", what));
+  passed &= check(report.fatMismatchSectors == 0,
+                  std::format("{}: {} FAT sectors differ", what,
+                              report.fatMismatchSectors));
+  passed &= check(report.brokenChains == 0 && report.loopedChains == 0 &&
+                      report.crossLinkedChains == 0 &&
+                      report.sizeMismatches == 0 && report.lostClusters == 0,
+                  std::format("{}: cluster chains inconsistent", what));
+  passed &= check(report.fsInfoValid &&
+                      report.fsInfoFreeCount == report.freeClusters,
+                  std::format("{}: FSInfo free count {} for {} free "
+                              "clusters",
+                              what, report.fsInfoFreeCount,
+                              report.freeClusters));
+  return passed;
+}
+
+// formatCard
+// ----------
+// Formats `image` with the synchronous FAT32 functions, in the order
+// format_image calls them. Returns the first error.
+
+static int formatCard(const Image& image, const char* label) {
+  const int fd = image.fd;
+  const uint64_t sectors = image.sectorCount;
+  for (int err : {sdFormatWriteMBR(fd, sectors),
+                  sdFormatWriteVolumeBootRecord(fd, sectors, label),
+                  sdFormatWriteFSInfo(fd, sectors, 1),
+                  sdFormatWriteFat32Tables(fd, sectors, 1),
+                  sdFormatWriteRootDirectory(fd, sectors, 1, label)}) {
+    if (err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+// SectorFormat
+// ------------
+// A sector size the tests run under, set with sdFormatSetSectorSize.
+
+struct SectorFormat {
+  const char* name;
+  SDFormatSectorSize size;
+};
+
+static constexpr SectorFormat kSectorFormats[] = {
+    {"512n", {512, 512}},
+    {"512e", {512, 4096}},
+    {"4Kn", {4096, 4096}},
+};
+
+// readBytes / writeBytes
+// ----------------------
+// pread and pwrite of a whole buffer. readBytes returns an empty buffer if
+// it cannot read all `length` bytes.
+
+static std::vector<std::byte> readBytes(int fd, uint64_t offset,
+                                        size_t length) {
+  std::vector<std::byte> bytes(length);
+  if (pread(fd, bytes.data(), length, static_cast<off_t>(offset)) !=
+      static_cast<ssize_t>(length)) {
+    bytes.clear();
+  }
+  return bytes;
+}
+
+static bool writeBytes(int fd, uint64_t offset,
+                       std::span<const std::byte> bytes) {
+  return pwrite(fd, bytes.data(), bytes.size(),
+                static_cast<off_t>(offset)) ==
+         static_cast<ssize_t>(bytes.size());
+}
+
+// load / store
+// ------------
+// The little-endian value at `offset` of an on-disk structure (0 past the
+// end of `bytes`, so a failed read fails the checks rather than the test).
+
+template <typename T>
+static T load(std::span<const std::byte> bytes, size_t offset) {
+  T value = 0;
+  if (offset + sizeof(T) <= bytes.size()) {
+    std::memcpy(&value, bytes.data() + offset, sizeof(T));
+  }
+  return value;
+}
+
+template <typename T>
+static void store(std::span<std::byte> bytes, size_t offset, T value) {
+  std::memcpy(bytes.data() + offset, &value, sizeof(T));
+}
+
+// text
+// ----
+// `length` bytes at `offset` as characters, for names and signatures.
+
+static std::string text(std::span<const std::byte> bytes, size_t offset,
+                        size_t length) {
+  if (offset + length > bytes.size()) {
+    return "";
+  }
+  return {reinterpret_cast<const char*>(bytes.data()) + offset, length};
+}
+
+// Fat32Volume
+// -----------
+// Where the structures of the FAT32 volume on an image are, from its first
+// MBR entry and its BPB.
+
+struct Fat32Volume {
+  uint64_t start;         // Byte offset of the primary VBR
+  uint32_t sectorBytes;   // BPB_bytesPerSector
+  uint32_t clusterBytes;  // BPB_sectorsPerCluster × BPB_bytesPerSector
+  uint32_t reservedSectors;
+  uint32_t fatCount;
+  uint64_t fatBytes;      // One FAT copy
+  uint32_t rootCluster;
+  uint32_t clusterCount;
+
+  uint64_t fatStart() const {
+    return start + uint64_t{reservedSectors} * sectorBytes;
+  }
+  uint64_t fatEntry(uint32_t copy, uint32_t cluster) const {
+    return fatStart() + copy * fatBytes + uint64_t{cluster} * 4;
+  }
+  uint64_t cluster(uint32_t cluster) const {
+    return fatStart() + fatCount * fatBytes +
+           uint64_t{cluster - 2} * clusterBytes;
+  }
+};
+
+static std::optional<Fat32Volume> readFat32Volume(int fd) {
+  SDFormatSectorSize size;
+  const auto mbr = readBytes(fd, 0, 512);
+  if (sdFormatGetSectorSize(fd, &size) != 0 || mbr.empty()) {
+    return std::nullopt;
+  }
+  const uint64_t start = uint64_t{load<uint32_t>(mbr, 0x1C6)} *
+                         size.logicalBytes;
+  const auto vbr = readBytes(fd, start, 512);
+  if (load<uint16_t>(vbr, 510) != 0xAA55 ||
+      text(vbr, 82, 8) != "FAT32   ") {
+    return std::nullopt;
+  }
+  Fat32Volume volume;
+  volume.start = start;
+  volume.sectorBytes = load<uint16_t>(vbr, 11);
+  volume.clusterBytes = volume.sectorBytes * load<uint8_t>(vbr, 13);
+  volume.reservedSectors = load<uint16_t>(vbr, 14);
+  volume.fatCount = load<uint8_t>(vbr, 16);
+  volume.fatBytes = uint64_t{load<uint32_t>(vbr, 36)} * volume.sectorBytes;
+  volume.rootCluster = load<uint32_t>(vbr, 44);
+  const uint64_t dataSectors =
+      load<uint32_t>(vbr, 32) - volume.reservedSectors -
+      volume.fatCount * volume.fatBytes / volume.sectorBytes;
+  volume.clusterCount = static_cast<uint32_t>(
+      dataSectors / load<uint8_t>(vbr, 13));
+  return volume;
+}
+
+// fatEntry / setFatEntry
+// ----------------------
+// Reads an entry of the primary FAT, or writes one to every FAT copy.
+
+static uint32_t fatEntry(int fd, const Fat32Volume& volume,
+                         uint32_t cluster) {
+  return load<uint32_t>(readBytes(fd, volume.fatEntry(0, cluster), 4), 0) &
+         0x0FFFFFFF;
+}
+
+static bool setFatEntry(int fd, const Fat32Volume& volume, uint32_t cluster,
+                        uint32_t value) {
+  std::array<std::byte, 4> bytes;
+  store(std::span{bytes}, 0, value);
+  bool written = true;
+  for (uint32_t copy = 0; copy < volume.fatCount; copy++) {
+    written &= writeBytes(fd, volume.fatEntry(copy, cluster), bytes);
+  }
+  return written;
+}
+
+// findEntry
+// ---------
+// Offset of the short entry named `shortName` (11 characters, space
+// padded) in `directory`, or nullopt.
+
+static std::optional<size_t> findEntry(std::span<const std::byte> directory,
+                                       std::string_view shortName) {
+  for (size_t offset = 0; offset + 32 <= directory.size(); offset += 32) {
+    if (load<uint8_t>(directory, offset) == 0) {
+      break;
+    }
+    if (load<uint8_t>(directory, offset + 11) != 0x0F &&
+        text(directory, offset, 11) == shortName) {
+      return offset;
+    }
+  }
+  return std::nullopt;
+}
+
+// firstCluster
+// ------------
+// DIR_firstClusterHigh:DIR_firstClusterLow of the entry at `offset`.
+
+static uint32_t firstCluster(std::span<const std::byte> directory,
+                             size_t offset) {
+  return uint32_t{load<uint16_t>(directory, offset + 20)} << 16 |
+         load<uint16_t>(directory, offset + 26);
+}
+
+// formatCardWithSaves
+// -------------------
+// formatCard, then sdFormatWriteSaveFiles with `saves`.
+
+static int formatCardWithSaves(const Image& image,
+                               const std::vector<SDFormatSaveFile>& saves) {
+  int err = formatCard(image, "NDS");
+  if (err == 0) {
+    err = sdFormatWriteSaveFiles(image.fd, image.sectorCount, 1,
+                                 saves.data(),
+                                 static_cast<uint32_t>(saves.size()));
+  }
+  return err;
+}
+
+// toHex
+// -----
+
+static std::string toHex(std::span<const uint8_t> digest) {
+  std::string hex;
+  for (uint8_t byte : digest) {
+    hex += std::format("{:02x}", byte);
+  }
+  return hex;
+}
+
+// unalignedWrites
+// ---------------
+// The number of writes in the trace at `path` that do not cover whole
+// `blockBytes` blocks, or -1 if it cannot be read. The records are decoded
+// from the documented layout: a 16-byte header, then 32-byte records of
+// timestamp, offset, length, duration, and operation (1 for pwrite).
+
+static int unalignedWrites(const fs::path& path, uint32_t blockBytes) {
+  std::ifstream file(path, std::ios::binary);
+  const std::string contents{std::istreambuf_iterator<char>(file), {}};
+  const auto bytes = std::as_bytes(std::span{contents});
+  const uint32_t recordBytes = load<uint32_t>(bytes, 12);
+  if (bytes.size() < 16 || recordBytes < 32) {
+    return -1;
+  }
+  int count = 0;
+  for (size_t at = 16; at + recordBytes <= bytes.size(); at += recordBytes) {
+    const uint64_t offset = load<uint64_t>(bytes, at + 8);
+    const uint64_t length = load<uint64_t>(bytes, at + 16);
+    if (load<uint16_t>(bytes, at + 28) == 1 &&
+        (offset % blockBytes != 0 || length % blockBytes != 0)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// =============================================================================
+// Hash Functions
+// =============================================================================
+
+// hashInPieces
+// ------------
+// The digest of `data` fed to a Hash `pieceBytes` at a time, in hex.
+
+template <typename Hash>
+static std::string hashInPieces(std::span<const std::byte> data,
+                                size_t pieceBytes) {
+  Hash hash;
+  for (size_t offset = 0; offset < data.size(); offset += pieceBytes) {
+    hash.update(data.subspan(offset,
+                             std::min(pieceBytes, data.size() - offset)));
+  }
+  return toHex(hash.finish());
+}
+
+// KnownAnswer
+// -----------
+// A published test vector: the digest of `input`.
+
+struct KnownAnswer {
+  std::vector<std::byte> input;
+  std::string_view digest;
+};
+
+// checkKnownAnswers
+// -----------------
+// Checks a Hash against `answers`, with each input fed whole and in pieces
+// that straddle the 64-byte block and 1 KB chunk boundaries.
+
+template <typename Hash>
+static bool checkKnownAnswers(std::string_view name,
+                              const std::vector<KnownAnswer>& answers) {
+  bool passed = true;
+  for (const KnownAnswer& answer : answers) {
+    for (size_t pieceBytes : {answer.input.size(), size_t{1}, size_t{63},
+                              size_t{64}, size_t{65}, size_t{1025}}) {
+      const std::string digest =
+          hashInPieces<Hash>(answer.input, std::max<size_t>(pieceBytes, 1));
+      passed &= check(digest == answer.digest,
+                      std::format("{} of {} bytes in pieces of {}: {}", name,
+                                  answer.input.size(), pieceBytes, digest));
+    }
+  }
+  return passed;
+}
+
+// bytesOf / patternBytes
+// ----------------------
+// The inputs of the test vectors: a string, and `length` bytes of the
+// BLAKE3 test pattern (byte i is i % 251).
+
+static std::vector<std::byte> bytesOf(std::string_view string) {
+  const auto bytes = std::as_bytes(std::span{string});
+  return {bytes.begin(), bytes.end()};
+}
+
+static std::vector<std::byte> patternBytes(size_t length) {
+  std::vector<std::byte> bytes(length);
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = static_cast<std::byte>(i % 251);
+  }
+  return bytes;
+}
+
+// testSha256KnownAnswers
+// ----------------------
+// The FIPS 180-4 example messages, and one million "a".
+
+static bool testSha256KnownAnswers() {
+  const std::vector<KnownAnswer> answers = {
+      {bytesOf(""),
+       "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+      {bytesOf("abc"),
+       "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+      {bytesOf("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+       "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+      {bytesOf("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+               "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu"),
+       "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+      {bytesOf(std::string(1000000, 'a')),
+       "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+  };
+  return checkKnownAnswers<Sha256>("SHA-256", answers);
+}
+
+// testBlake3KnownAnswers
+// ----------------------
+// The hash-mode vectors of the BLAKE3 reference test_vectors.json, which
+// cover one block, one chunk, and trees of up to 100 chunks.
+
+static bool testBlake3KnownAnswers() {
+  const std::vector<std::pair<size_t, std::string_view>> vectors = {
+      {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+      {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+      {1023,
+       "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+      {1024,
+       "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+      {1025,
+       "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+      {2048,
+       "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+      {2049,
+       "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+      {3072,
+       "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+      {3073,
+       "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+      {4096,
+       "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969"},
+      {4097,
+       "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995"},
+      {5120,
+       "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833"},
+      {5121,
+       "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff"},
+      {6144,
+       "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205"},
+      {6145,
+       "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f"},
+      {7168,
+       "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a"},
+      {7169,
+       "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817"},
+      {8192,
+       "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+      {8193,
+       "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+      {16384,
+       "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4"},
+      {31744,
+       "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+      {102400,
+       "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+  };
+  std::vector<KnownAnswer> answers;
+  for (const auto& [length, digest] : vectors) {
+    answers.push_back({patternBytes(length), digest});
+  }
+  return checkKnownAnswers<Blake3>("BLAKE3", answers);
+}
+
+// contentHashOf
+// -------------
+// The content hash of `data` as ContentHash.h defines it, built from
+// Hasher directly.
+
+static Digest contentHashOf(uint32_t algorithm,
+                            std::span<const std::byte> data) {
+  Hasher list(algorithm);
+  for (size_t offset = 0; offset < data.size();
+       offset += kContentBlockBytes) {
+    Hasher block(algorithm);
+    block.update(data.subspan(
+        offset, std::min<size_t>(kContentBlockBytes, data.size() - offset)));
+    const Digest digest = block.finish();
+    list.update(std::as_bytes(std::span{digest}));
+  }
+  return list.finish();
+}
+
+// testContentHash
+// ---------------
+// ContentHasher must give the hash of the list of block digests whether
+// the range is fed as bytes or as runs of zeros, wherever the pieces and
+// the zero runs fall relative to the blocks: here a range of 3 blocks and
+// a bit, with a zero run from the middle of block 0 to the start of block
+// 2, so block 1 takes the precomputed zero digest.
+
+static bool testContentHash() {
+  constexpr size_t kZeroStart = kContentBlockBytes / 2;
+  constexpr size_t kZeroEnd = 2 * kContentBlockBytes + 100;
+  std::vector<std::byte> data = patternBytes(3 * kContentBlockBytes + 12345);
+  std::fill(data.begin() + kZeroStart, data.begin() + kZeroEnd, std::byte{0});
+  const std::span<const std::byte> bytes = data;
+
+  bool passed = true;
+  for (uint32_t algorithm = 0; algorithm < kSDFormatHashCount; algorithm++) {
+    const std::string expected = toHex(contentHashOf(algorithm, bytes));
+
+    ContentHasher whole(algorithm);
+    whole.update(bytes);
+    passed &= check(toHex(whole.finish()) == expected,
+                    std::format("algorithm {}: bytes fed whole", algorithm));
+
+    ContentHasher pieces(algorithm);
+    for (size_t offset = 0; offset < kZeroStart; offset += 65537) {
+      pieces.update(bytes.subspan(
+          offset, std::min<size_t>(65537, kZeroStart - offset)));
+    }
+    pieces.updateZeros(kContentBlockBytes);
+    pieces.updateZeros(kZeroEnd - kZeroStart - kContentBlockBytes);
+    pieces.update(bytes.subspan(kZeroEnd));
+    passed &= check(toHex(pieces.finish()) == expected,
+                    std::format("algorithm {}: zeros fed as runs",
+                                algorithm));
+
+    Hasher zeros(algorithm);
+    zeros.update(std::vector<std::byte>(kContentBlockBytes));
+    passed &= check(zeros.finish() == zeroBlockDigest(algorithm),
+                    std::format("algorithm {}: zero block digest",
+                                algorithm));
+
+    ContentHasher empty(algorithm);
+    passed &= check(empty.finish() == contentHashOf(algorithm, {}),
+                    std::format("algorithm {}: empty range", algorithm));
+  }
+  return passed;
+}
+
+// =============================================================================
+// FAT32 Formatting
+// =============================================================================
+
+// testFormatProfiles
+// ------------------
+// Every profile under every sector format must give a volume that passes
+// the check, laid out as sdFormatGetLayout says: the partition at the
+// alignment, and the profile's cluster size, reserved region, and FAT
+// count in a BPB of the device's logical sector size. The card is 8 GB,
+// enough for FAT32 with the 64 KB clusters of the 3DS profile.
+
+static bool testFormatProfiles() {
+  bool passed = true;
+  for (uint32_t profile = 0; profile < kSDFormatProfileCount; profile++) {
+    SDFormatLayout layout;
+    sdFormatGetLayout(profile, &layout);
+    for (const SectorFormat& format : kSectorFormats) {
+      sdFormatSetLayoutProfile(profile);
+      sdFormatSetSectorSize(&format.size);
+      const std::string what = std::format("profile {} {}", profile,
+                                           format.name);
+      Image image(2 * kCardSectors);
+      if (!check(image.fd >= 0, "cannot create the image")) {
+        return false;
+      }
+      const int err = formatCard(image, "NDS");
+      if (!check(err == 0, std::format("{}: format returned {}", what,
+                                       err))) {
+        passed = false;
+        continue;
+      }
+      passed &= checkCleanVolume(image.fd, what);
+      const auto volume = readFat32Volume(image.fd);
+      passed &= check(volume && volume->start == layout.alignmentBytes &&
+                          volume->sectorBytes == format.size.logicalBytes &&
+                          volume->clusterBytes == layout.clusterBytes &&
+                          volume->reservedSectors == layout.reservedSectors &&
+                          volume->fatCount == layout.fatCount &&
+                          volume->clusterCount >= 65525,
+                      std::format("{}: BPB disagrees with the profile",
+                                  what));
+    }
+  }
+  return passed;
+}
+
+// testFormatGpt
+// -------------
+// A device with more sectors than an MBR can address gets a protective MBR
+// and a GPT, with the backup header in its last sector, and still passes
+// the check. The 2.5 TB image is sparse; the format writes about 500 MB.
+
+static bool testFormatGpt() {
+  Image image(5242880000);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  const int err = formatCard(image, "NDS");
+  if (!check(err == 0, std::format("format returned {}", err))) {
+    return false;
+  }
+  const auto mbr = readBytes(image.fd, 0, 512);
+  const auto primary = readBytes(image.fd, 512, 512);
+  const auto backup =
+      readBytes(image.fd, (image.sectorCount - 1) * 512, 512);
+  bool passed = check(load<uint8_t>(mbr, 0x1C2) == 0xEE,
+                      "no protective MBR entry");
+  passed &= check(text(primary, 0, 8) == "EFI PART",
+                  "no primary GPT header");
+  passed &= check(text(backup, 0, 8) == "EFI PART" &&
+                      load<uint64_t>(backup, 24) == image.sectorCount - 1 &&
+                      load<uint64_t>(primary, 32) == image.sectorCount - 1,
+                  "no backup GPT header in the last sector");
+  passed &= checkCleanVolume(image.fd, "GPT");
+  return passed;
+}
+
+// testReformatIncremental
+// -----------------------
+// Reformatting a formatted card rewrites only what differs: a FAT sector
+// and the label sector changed since the format, and the VBR copies. A
+// second pass finds nothing but the VBR copies to write.
+
+static bool testReformatIncremental() {
+  Image image(kCardSectors);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  int err = formatCard(image, "NDS");
+  const auto volume = readFat32Volume(image.fd);
+  if (!check(err == 0 && volume, std::format("format returned {}", err))) {
+    return false;
+  }
+  const uint64_t fatSector = volume->fatStart() + 100 * 512;
+  const std::vector<std::byte> garbage(512, std::byte{0xA5});
+  bool passed = check(writeBytes(image.fd, fatSector, garbage),
+                      "cannot clobber the FAT");
+
+  SDFormatIncrementalReport report;
+  err = sdFormatReformatIncremental(image.fd, image.sectorCount, 1, "GAMES",
+                                    0, &report);
+  passed &= check(err == 0, std::format("reformat returned {}", err));
+  passed &= check(report.sectorsCompared > volume->fatCount *
+                                               volume->fatBytes / 512,
+                  std::format("{} sectors compared", report.sectorsCompared));
+  // The clobbered FAT sector, the root directory's label sector, and both
+  // VBRs (whose label changed)
+  passed &= check(report.sectorsWritten == 4,
+                  std::format("{} sectors written for 4 that differ",
+                              report.sectorsWritten));
+  passed &= check(readBytes(image.fd, fatSector, 512) ==
+                      std::vector<std::byte>(512),
+                  "the FAT sector was not zeroed");
+  const auto root = readBytes(image.fd, volume->cluster(2), 32);
+  passed &= check(text(root, 0, 11) == "GAMES      ",
+                  "the root directory label was not changed");
+  passed &= checkCleanVolume(image.fd, "reformatted");
+
+  err = sdFormatReformatIncremental(image.fd, image.sectorCount, 1, "GAMES",
+                                    0, &report);
+  passed &= check(err == 0 && report.sectorsWritten <= 2,
+                  std::format("second reformat returned {} and wrote {} "
+                              "sectors",
+                              err, report.sectorsWritten));
+  return passed;
+}
+
+// =============================================================================
+// FAT16 and exFAT Formatting
+// =============================================================================
+
+// testFormatFat16
+// ---------------
+// The FAT16 functions must write the layout sdFormatGetFat16Layout
+// reports, with the data region on a 4 MB boundary, from the smallest card
+// they format to one larger than the largest FAT16 volume.
+
+static bool testFormatFat16() {
+  bool passed = true;
+  for (uint64_t sectors : {uint64_t{kSDFormatFat16MinSectors},
+                           uint64_t{2097152}, uint64_t{4194304},
+                           uint64_t{kCardSectors}}) {
+    Image image(sectors);
+    if (!check(image.fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    SDFormatFat16Layout layout;
+    int err = sdFormatGetFat16Layout(sectors, &layout);
+    for (auto step : {+[](int fd, uint64_t count) {
+                        return sdFormatFat16WriteMBR(fd, count);
+                      },
+                      +[](int fd, uint64_t count) {
+                        return sdFormatFat16WriteVolumeBootRecord(fd, count,
+                                                                  "NDS");
+                      },
+                      +[](int fd, uint64_t count) {
+                        return sdFormatFat16WriteTables(fd, count);
+                      },
+                      +[](int fd, uint64_t count) {
+                        return sdFormatFat16WriteRootDirectory(fd, count,
+                                                               "NDS");
+                      }}) {
+      err = err != 0 ? err : step(image.fd, sectors);
+    }
+    if (!check(err == 0, std::format("{} sectors: format returned {}",
+                                      sectors, err))) {
+      passed = false;
+      continue;
+    }
+
+    const auto mbr = readBytes(image.fd, 0, 512);
+    const auto vbr = readBytes(image.fd, 8192 * 512, 512);
+    const uint32_t totalSectors = load<uint16_t>(vbr, 19) != 0
+                                      ? load<uint16_t>(vbr, 19)
+                                      : load<uint32_t>(vbr, 32);
+    const uint32_t reserved = load<uint16_t>(vbr, 14);
+    const uint32_t fatSectors = load<uint16_t>(vbr, 22);
+    const uint32_t rootSectors = load<uint16_t>(vbr, 17) * 32 / 512;
+    const uint32_t dataStart = reserved + 2 * fatSectors + rootSectors;
+    const uint32_t clusterSectors = load<uint8_t>(vbr, 13);
+    const std::string what = std::format("{} sectors", sectors);
+    passed &= check(load<uint32_t>(mbr, 0x1C6) == 8192 &&
+                        load<uint32_t>(mbr, 0x1CA) ==
+                            layout.partitionSectors &&
+                        load<uint8_t>(mbr, 0x1C2) ==
+                            (layout.partitionSectors < 65536 ? 0x04 : 0x06),
+                    std::format("{}: MBR entry", what));
+    passed &= check(text(vbr, 54, 8) == "FAT16   " &&
+                        load<uint16_t>(vbr, 510) == 0xAA55 &&
+                        load<uint16_t>(vbr, 11) == 512 &&
+                        load<uint8_t>(vbr, 16) == 2 && rootSectors == 32 &&
+                        totalSectors == layout.partitionSectors &&
+                        fatSectors == layout.fatSectors &&
+                        clusterSectors * 512 == layout.clusterBytes,
+                    std::format("{}: BPB disagrees with the layout", what));
+    const uint32_t clusterCount =
+        (totalSectors - dataStart) / std::max(clusterSectors, 1u);
+    passed &= check(clusterCount == layout.clusterCount &&
+                        clusterCount >= 4085 && clusterCount <= 65524 &&
+                        uint64_t{clusterCount + 2} * 2 <=
+                            uint64_t{fatSectors} * 512,
+                    std::format("{}: {} clusters, layout says {}", what,
+                                clusterCount, layout.clusterCount));
+    passed &= check((8192 + dataStart) % 8192 == 0,
+                    std::format("{}: data region at sector {}, not on a "
+                                "4 MB boundary",
+                                what, 8192 + dataStart));
+    for (uint32_t copy = 0; copy < 2; copy++) {
+      const auto fat = readBytes(
+          image.fd, (8192 + reserved + copy * fatSectors) * 512ull, 8);
+      passed &= check(load<uint16_t>(fat, 0) == 0xFFF8 &&
+                          load<uint16_t>(fat, 2) == 0xFFFF &&
+                          load<uint32_t>(fat, 4) == 0,
+                      std::format("{}: FAT {} media entries", what, copy));
+    }
+    const auto root = readBytes(
+        image.fd, (8192 + reserved + 2 * fatSectors) * 512ull, 32);
+    passed &= check(text(root, 0, 11) == "NDS        " &&
+                        load<uint8_t>(root, 11) == 0x08,
+                    std::format("{}: no label entry", what));
+  }
+  return passed;
+}
+
+// exfatChecksum
+// -------------
+// The boot checksum of the first 11 sectors of a boot region, skipping
+// VolumeFlags and PercentInUse.
+
+static uint32_t exfatChecksum(std::span<const std::byte> region,
+                              uint32_t sectorBytes) {
+  uint32_t checksum = 0;
+  for (size_t i = 0; i < 11 * size_t{sectorBytes}; i++) {
+    if (i == 106 || i == 107 || i == 112) {
+      continue;
+    }
+    checksum = ((checksum & 1) ? 0x80000000 : 0) + (checksum >> 1) +
+               std::to_integer<uint32_t>(region[i]);
+  }
+  return checksum;
+}
+
+// testFormatExfat
+// ---------------
+// The exFAT functions must write the layout sdFormatGetExfatLayout
+// reports, with a boot checksum that matches, a backup boot region equal
+// to the main one, and the label in the root directory, on 512n and 4Kn.
+
+static bool testFormatExfat() {
+  bool passed = true;
+  for (const SectorFormat& format : {kSectorFormats[0], kSectorFormats[2]}) {
+    sdFormatSetSectorSize(&format.size);
+    Image image(kCardSectors);
+    if (!check(image.fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    const uint64_t sectors = image.sectorCount;
+    SDFormatExfatLayout layout;
+    int err = sdFormatGetExfatLayout(image.fd, sectors, &layout);
+    err = err != 0 ? err : sdFormatExfatWriteMBR(image.fd, sectors);
+    err = err != 0 ? err : sdFormatExfatWriteBootRegions(image.fd, sectors);
+    err = err != 0 ? err : sdFormatExfatWriteFat(image.fd, sectors);
+    err = err != 0 ? err
+                   : sdFormatExfatWriteAllocationBitmap(image.fd, sectors);
+    err = err != 0 ? err : sdFormatExfatWriteUpcaseTable(image.fd, sectors);
+    err = err != 0 ? err
+                   : sdFormatExfatWriteRootDirectory(image.fd, sectors,
+                                                     "Games");
+    if (!check(err == 0, std::format("{}: format returned {}", format.name,
+                                     err))) {
+      passed = false;
+      continue;
+    }
+
+    const uint32_t sectorBytes = format.size.logicalBytes;
+    const auto mbr = readBytes(image.fd, 0, 512);
+    const uint64_t start =
+        uint64_t{load<uint32_t>(mbr, 0x1C6)} * sectorBytes;
+    const auto main = readBytes(image.fd, start, 12 * size_t{sectorBytes});
+    const auto backup = readBytes(image.fd, start + 12 * sectorBytes,
+                                  12 * size_t{sectorBytes});
+    passed &= check(load<uint8_t>(mbr, 0x1C2) == 0x07,
+                    std::format("{}: MBR entry", format.name));
+    passed &= check(
+        text(main, 3, 8) == "EXFAT   " &&
+            load<uint16_t>(main, 510) == 0xAA55 &&
+            (1u << load<uint8_t>(main, 108)) == sectorBytes &&
+            layout.bytesPerSector == sectorBytes &&
+            (sectorBytes << load<uint8_t>(main, 109)) ==
+                layout.clusterBytes &&
+            load<uint64_t>(main, 72) == layout.partitionSectors &&
+            load<uint32_t>(main, 84) == layout.fatSectors &&
+            load<uint32_t>(main, 88) == layout.clusterHeapOffset &&
+            load<uint32_t>(main, 92) == layout.clusterCount,
+        std::format("{}: boot sector disagrees with the layout",
+                    format.name));
+    bool checksumValid = !main.empty();
+    const uint32_t checksum =
+        checksumValid ? exfatChecksum(main, sectorBytes) : 0;
+    for (uint32_t i = 0; checksumValid && i < sectorBytes / 4; i++) {
+      checksumValid = load<uint32_t>(main, 11 * sectorBytes + i * 4) ==
+                      checksum;
+    }
+    passed &= check(checksumValid,
+                    std::format("{}: boot checksum", format.name));
+    passed &= check(main == backup,
+                    std::format("{}: backup boot region differs",
+                                format.name));
+
+    // The label entry is the first of the root directory
+    const uint64_t heap = start + uint64_t{layout.clusterHeapOffset} *
+                                      sectorBytes;
+    const uint32_t rootCluster = load<uint32_t>(main, 96);
+    const auto root = readBytes(
+        image.fd, heap + uint64_t{rootCluster - 2} * layout.clusterBytes, 32);
+    std::u16string label;
+    for (uint32_t i = 0; i < load<uint8_t>(root, 1) && i < 11; i++) {
+      label += static_cast<char16_t>(load<uint16_t>(root, 2 + 2 * i));
+    }
+    passed &= check(load<uint8_t>(root, 0) == 0x83 && label == u"Games",
+                    std::format("{}: no label entry", format.name));
+  }
+  return passed;
+}
+
+// =============================================================================
+// Maintenance
+// =============================================================================
+
+// testRepairPrimaryVbr
+// --------------------
+// With the primary VBR overwritten, the check must find the backup and run on
+// it, and the repair must restore the whole logical sector from it, under
+// every sector format.
+
+static bool testRepairPrimaryVbr() {
+  bool passed = true;
+  for (const SectorFormat& format : kSectorFormats) {
+    sdFormatSetSectorSize(&format.size);
+    Image image(kCardSectors);
+    if (!check(image.fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    int err = formatCard(image, "NDS");
+    if (!check(err == 0, std::format("{}: format returned {}", format.name,
+                                     err))) {
+      passed = false;
+      continue;
+    }
+
+    SDFormatLayout layout;
+    sdFormatGetLayout(sdFormatGetLayoutProfile(), &layout);
+    const size_t sectorBytes = format.size.logicalBytes;
+    const off_t primary = layout.alignmentBytes;
+    const off_t backup = primary + 6 * static_cast<off_t>(sectorBytes);
+    const std::vector<char> garbage(sectorBytes, '\xFF');
+    passed &= check(pwrite(image.fd, garbage.data(), sectorBytes, primary) ==
+                        static_cast<ssize_t>(sectorBytes),
+                    "cannot clobber the VBR");
+
+    SDFormatCheckReport checkReport;
+    err = sdFormatCheck(image.fd, &checkReport);
+    passed &= check(err == 0 && !checkReport.vbrValid &&
+                        checkReport.backupVbrValid,
+                    std::format("{}: check returned {}, primary {} backup {}",
+                                format.name, err, checkReport.vbrValid,
+                                checkReport.backupVbrValid));
+
+    SDFormatRepairReport repairReport;
+    err = sdFormatRepair(image.fd, &repairReport);
+    passed &= check(err == 0 && repairReport.vbrRestored,
+                    std::format("{}: repair returned {}, restored {}",
+                                format.name, err, repairReport.vbrRestored));
+    std::vector<char> primaryBytes(sectorBytes);
+    std::vector<char> backupBytes(sectorBytes);
+    passed &= check(
+        pread(image.fd, primaryBytes.data(), sectorBytes, primary) ==
+                static_cast<ssize_t>(sectorBytes) &&
+            pread(image.fd, backupBytes.data(), sectorBytes, backup) ==
+                static_cast<ssize_t>(sectorBytes) &&
+            primaryBytes == backupBytes,
+        std::format("{}: restored VBR differs from the backup", format.name));
+    passed &= checkCleanVolume(image.fd, format.name);
+  }
+  return passed;
+}
+
+// testRelabel
+// -----------
+// sdFormatRelabel must change the label in both VBRs and in the root
+// directory, and nothing else of the VBR, under every sector format, with
+// writes of whole physical blocks.
+
+static bool testRelabel() {
+  bool passed = true;
+  for (const SectorFormat& format : kSectorFormats) {
+    sdFormatSetSectorSize(&format.size);
+    Image image(kCardSectors);
+    if (!check(image.fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    int err = formatCard(image, "NDS");
+    const auto volume = readFat32Volume(image.fd);
+    if (!check(err == 0 && volume, std::format("{}: format returned {}",
+                                               format.name, err))) {
+      passed = false;
+      continue;
+    }
+    const uint64_t backupOffset = volume->start + 6 * volume->sectorBytes;
+    auto before = readBytes(image.fd, volume->start, volume->sectorBytes);
+
+    const fs::path trace = image.path.string() + ".trace";
+    passed &= check(sdFormatStartTrace(image.fd, trace.c_str()) == 0,
+                    "cannot start the trace");
+    err = sdFormatRelabel(image.fd, "Mario Kart");
+    sdFormatStopTrace();
+    passed &= check(err == 0, std::format("{}: relabel returned {}",
+                                          format.name, err));
+    const int unaligned = unalignedWrites(trace, format.size.physicalBytes);
+    std::error_code error;
+    fs::remove(trace, error);
+    passed &= check(unaligned == 0,
+                    std::format("{}: {} writes of partial blocks",
+                                format.name, unaligned));
+    const auto primary = readBytes(image.fd, volume->start,
+                                   volume->sectorBytes);
+    const auto backup = readBytes(image.fd, backupOffset,
+                                  volume->sectorBytes);
+    const auto root = readBytes(image.fd, volume->cluster(2), 32);
+    passed &= check(text(primary, 71, 11) == "MARIO KART " &&
+                        primary == backup,
+                    std::format("{}: VBR label", format.name));
+    passed &= check(text(root, 0, 11) == "MARIO KART " &&
+                        load<uint8_t>(root, 11) == 0x08,
+                    std::format("{}: root directory label", format.name));
+    std::ranges::copy(std::span{primary}.subspan(71, 11),
+                      before.begin() + 71);
+    passed &= check(primary == before,
+                    std::format("{}: VBR changed beyond the label",
+                                format.name));
+    passed &= checkCleanVolume(image.fd, format.name);
+  }
+  return passed;
+}
+
+// defragmentUnder
+// ---------------
+// The defragment test under one sector format.
+
+static bool defragmentUnder(const SectorFormat& format) {
+  constexpr uint32_t kClusters = 16;
+  sdFormatSetSectorSize(&format.size);
+  Image image(kCardSectors);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  int err = formatCardWithSaves(image, {{"MARIO", kClusters * 32768},
+                                        {"ZELDA", 65536}});
+  const auto volume = readFat32Volume(image.fd);
+  if (!check(err == 0 && volume, std::format("{}: format returned {}",
+                                             format.name, err))) {
+    return false;
+  }
+  const auto directory = readBytes(image.fd, volume->cluster(2), 32768);
+  const auto entry = findEntry(directory, "MARIO   SAV");
+  if (!check(entry.has_value(), "no MARIO.SAV entry")) {
+    return false;
+  }
+  const uint32_t first = firstCluster(directory, *entry);
+
+  // Fill cluster k of the file with k + 1, then move clusters 8… to the
+  // free clusters from 1000, in both FATs
+  constexpr uint32_t kMoved = 1000;
+  bool passed = true;
+  for (uint32_t k = 0; k < kClusters; k++) {
+    const uint32_t cluster = k < kClusters / 2 ? first + k
+                                               : kMoved + k - kClusters / 2;
+    const std::vector<std::byte> data(volume->clusterBytes,
+                                      static_cast<std::byte>(k + 1));
+    passed &= writeBytes(image.fd, volume->cluster(cluster), data);
+    const uint32_t next = k + 1 == kClusters ? 0x0FFFFFFF
+                          : k + 1 == kClusters / 2 ? kMoved
+                                                   : cluster + 1;
+    passed &= setFatEntry(image.fd, *volume, cluster, next);
+    if (k >= kClusters / 2) {
+      passed &= setFatEntry(image.fd, *volume, first + k, 0);
+    }
+  }
+  if (!check(passed, "cannot fragment the file") ||
+      !checkCleanVolume(image.fd, "fragmented")) {
+    return false;
+  }
+
+  const fs::path trace = image.path.string() + ".trace";
+  passed &= check(sdFormatStartTrace(image.fd, trace.c_str()) == 0,
+                  "cannot start the trace");
+  SDFormatDefragReport report;
+  err = sdFormatDefragment(image.fd, 0, &report);
+  sdFormatStopTrace();
+  const int unaligned = unalignedWrites(trace, format.size.physicalBytes);
+  std::error_code error;
+  fs::remove(trace, error);
+  passed &= check(unaligned == 0,
+                  std::format("{}: {} writes of partial blocks", format.name,
+                              unaligned));
+  passed &= check(err == 0 && report.filesExamined == 2 &&
+                      report.filesFragmented == 1 &&
+                      report.filesDefragmented == 1 &&
+                      report.clustersMoved == kClusters / 2,
+                  std::format("{}: defragment returned {}: {} examined, {} "
+                              "fragmented, {} defragmented, {} moved",
+                              format.name, err, report.filesExamined,
+                              report.filesFragmented,
+                              report.filesDefragmented,
+                              report.clustersMoved));
+  const auto after = readBytes(image.fd, volume->cluster(2), 32768);
+  const uint32_t start = firstCluster(after, *entry);
+  for (uint32_t k = 0; k < kClusters; k++) {
+    const uint32_t next = fatEntry(image.fd, *volume, start + k);
+    passed &= check(next == (k + 1 == kClusters ? 0x0FFFFFFF
+                                                : start + k + 1),
+                    std::format("cluster {} of the file is not contiguous",
+                                k));
+    passed &= check(readBytes(image.fd, volume->cluster(start + k),
+                              volume->clusterBytes) ==
+                        std::vector<std::byte>(volume->clusterBytes,
+                                               static_cast<std::byte>(k + 1)),
+                    std::format("cluster {} of the file has the wrong data",
+                                k));
+  }
+  passed &= checkCleanVolume(image.fd, format.name);
+  return passed;
+}
+
+// testDefragment
+// --------------
+// A save whose second half was moved away must be made contiguous again,
+// in place since its old clusters are free, with its data intact, under
+// every sector format, with writes of whole physical blocks.
+
+static bool testDefragment() {
+  bool passed = true;
+  for (const SectorFormat& format : kSectorFormats) {
+    passed &= defragmentUnder(format);
+  }
+  return passed;
+}
+
+// testSortDirectories
+// -------------------
+// The root directory of a fresh format is already in display order. With
+// its entry sets reversed, sorting must restore it byte for byte.
+
+static bool testSortDirectories() {
+  Image image(kCardSectors);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  int err = formatCardWithSaves(image, {{"Zelda", 8192},
+                                        {"Castlevania", 8192},
+                                        {"Mario Kart", 8192}});
+  const auto volume = readFat32Volume(image.fd);
+  if (!check(err == 0 && volume, std::format("format returned {}", err))) {
+    return false;
+  }
+  const uint64_t rootOffset = volume->cluster(volume->rootCluster);
+  const auto sorted = readBytes(image.fd, rootOffset, volume->clusterBytes);
+
+  SDFormatSortReport report;
+  err = sdFormatSortDirectories(image.fd, &report);
+  bool passed = check(err == 0 && report.directoriesExamined == 1 &&
+                          report.directoriesRewritten == 0,
+                      std::format("sorting a fresh format returned {}, "
+                                  "rewrote {}",
+                                  err, report.directoriesRewritten));
+
+  // The label entry, then the sets of long name entries and their short
+  // entry, reversed
+  std::vector<std::span<const std::byte>> sets;
+  size_t setStart = 32;
+  size_t end = 32;
+  for (; end + 32 <= sorted.size() && load<uint8_t>(sorted, end) != 0;
+       end += 32) {
+    if (load<uint8_t>(sorted, end + 11) != 0x0F) {
+      sets.push_back(std::span{sorted}.subspan(setStart, end + 32 - setStart));
+      setStart = end + 32;
+    }
+  }
+  std::vector<std::byte> reversed(sorted.begin(), sorted.begin() + 32);
+  for (auto set = sets.rbegin(); set != sets.rend(); ++set) {
+    reversed.insert(reversed.end(), set->begin(), set->end());
+  }
+  reversed.insert(reversed.end(), sorted.begin() + end, sorted.end());
+  passed &= check(sets.size() == 3 && reversed != sorted &&
+                      writeBytes(image.fd, rootOffset, reversed),
+                  std::format("cannot reverse {} entry sets", sets.size()));
+
+  err = sdFormatSortDirectories(image.fd, &report);
+  passed &= check(err == 0 && report.directoriesRewritten == 1,
+                  std::format("sort returned {}, rewrote {}", err,
+                              report.directoriesRewritten));
+  passed &= check(readBytes(image.fd, rootOffset, volume->clusterBytes) ==
+                      sorted,
+                  "the sorted directory differs from the format's");
+  passed &= checkCleanVolume(image.fd, "sorted");
+  return passed;
+}
+
+// testWipeFreeClusters
+// --------------------
+// The wipe must clear every free cluster and leave allocated ones alone.
+
+static bool testWipeFreeClusters() {
+  Image image(kCardSectors);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  int err = formatCardWithSaves(image, {{"MARIO", 65536}});
+  const auto volume = readFat32Volume(image.fd);
+  if (!check(err == 0 && volume, std::format("format returned {}", err))) {
+    return false;
+  }
+  const auto directory = readBytes(image.fd, volume->cluster(2), 32768);
+  const auto entry = findEntry(directory, "MARIO   SAV");
+  if (!check(entry.has_value(), "no MARIO.SAV entry")) {
+    return false;
+  }
+  const uint32_t save = firstCluster(directory, *entry);
+  const std::vector<std::byte> garbage(volume->clusterBytes, std::byte{0xA5});
+  const std::vector<std::byte> zeros(volume->clusterBytes);
+  const uint32_t lastCluster = volume->clusterCount + 1;
+  bool passed = true;
+  for (uint32_t cluster : {save, save + 2, uint32_t{5000}, lastCluster}) {
+    passed &= writeBytes(image.fd, volume->cluster(cluster), garbage);
+  }
+  if (!check(passed, "cannot write the old data")) {
+    return false;
+  }
+
+  const SDFormatWipeOptions options = {0, 0, nullptr};
+  SDFormatWipeReport report;
+  err = sdFormatWipeFreeClusters(image.fd, &options, &report);
+  passed &= check(err == 0 && report.clustersFree == volume->clusterCount - 3 &&
+                      report.clustersWiped == report.clustersFree &&
+                      report.resumedAtCluster == 0,
+                  std::format("wipe returned {}: {} of {} free clusters "
+                              "wiped",
+                              err, report.clustersWiped,
+                              report.clustersFree));
+  passed &= check(readBytes(image.fd, volume->cluster(save),
+                            volume->clusterBytes) == garbage,
+                  "the save was wiped");
+  for (uint32_t cluster : {save + 2, uint32_t{5000}, lastCluster}) {
+    passed &= check(readBytes(image.fd, volume->cluster(cluster),
+                              volume->clusterBytes) == zeros,
+                    std::format("free cluster {} was not wiped", cluster));
+  }
+  passed &= checkCleanVolume(image.fd, "wiped");
+  return passed;
+}
+
+// =============================================================================
+// Asynchronous Formatting
+// =============================================================================
+
+// DetachedTask
+// ------------
+// The smallest coroutine type that can co_await: starts at once, and frees
+// its frame when it returns.
+
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// awaitFailingFormat
+// ------------------
+// Awaits a format of an invalid descriptor, which fails in its first step,
+// often before sdFormatBegin has returned. `resumes` counts the times the
+// coroutine got past co_await: once per call if it is resumed correctly.
+
+static DetachedTask awaitFailingFormat(std::atomic<int>& resumes,
+                                       std::atomic<int>& wrongResults,
+                                       sdformat::Format::Resumer resumer) {
+  const SDFormatParameters parameters = {-1, 16777216, 1, "NDS", nullptr, 0};
+  const int err = co_await sdformat::Format(parameters, {}, resumer);
+  if (err != EBADF) {
+    wrongResults++;
+  }
+  resumes++;
+}
+
+// testCoroutineFastFailure
+// ------------------------
+// A format that finishes before await_suspend returns must resume the
+// coroutine exactly once, without await_suspend touching the destroyed
+// Format (AddressSanitizer reports the use-after-free if it does). Runs
+// both with direct resumption and with a Resumer that posts to a queue
+// drained by this thread.
+
+static bool testCoroutineFastFailure() {
+  constexpr int kFormats = 20000;
+  bool passed = true;
+
+  std::atomic<int> resumes{0};
+  std::atomic<int> wrongResults{0};
+  for (int i = 0; i < kFormats; i++) {
+    awaitFailingFormat(resumes, wrongResults, {});
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  while (resumes.load() < kFormats &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  passed &= check(resumes.load() == kFormats,
+                  std::format("direct: {} resumes for {} formats",
+                              resumes.load(), kFormats));
+  passed &= check(wrongResults.load() == 0,
+                  std::format("direct: {} results other than EBADF",
+                              wrongResults.load()));
+
+  std::mutex mutex;
+  std::deque<std::coroutine_handle<>> posted;
+  auto post = [&](std::coroutine_handle<> handle) {
+    std::lock_guard lock(mutex);
+    posted.push_back(handle);
+  };
+  resumes = 0;
+  wrongResults = 0;
+  for (int i = 0; i < kFormats; i++) {
+    awaitFailingFormat(resumes, wrongResults, post);
+  }
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  while (resumes.load() < kFormats &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::coroutine_handle<> handle;
+    {
+      std::lock_guard lock(mutex);
+      if (!posted.empty()) {
+        handle = posted.front();
+        posted.pop_front();
+      }
+    }
+    if (handle) {
+      handle.resume();
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  {
+    std::lock_guard lock(mutex);
+    passed &= check(posted.empty(), "resumer: handles posted twice");
+  }
+  passed &= check(resumes.load() == kFormats,
+                  std::format("resumer: {} resumes for {} formats",
+                              resumes.load(), kFormats));
+  passed &= check(wrongResults.load() == 0,
+                  std::format("resumer: {} results other than EBADF",
+                              wrongResults.load()));
+  return passed;
+}
+
+// testAsyncLayoutPinned
+// ---------------------
+// An operation formats with the profile and sector size in effect when it
+// began: changing both after its first step must not give the card an MBR
+// and a VBR or FAT built for different layouts.
+
+static bool testAsyncLayoutPinned() {
+  Image image(kCardSectors);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  const SDFormatSectorSize kSector4Kn = {4096, 4096};
+  auto changeLayout = [](void* context, const SDFormatEvent* event) {
+    if (!event->finished && event->stepsDone == 1) {
+      sdFormatSetLayoutProfile(kSDFormatProfile3DS);
+      sdFormatSetSectorSize(static_cast<const SDFormatSectorSize*>(context));
+    }
+  };
+  const SDFormatParameters parameters = {image.fd, image.sectorCount, 1,
+                                         "NDS", nullptr, 0};
+  SDFormatOperation* operation;
+  int err = sdFormatBegin(&parameters, changeLayout,
+                          const_cast<SDFormatSectorSize*>(&kSector4Kn),
+                          &operation);
+  if (!check(err == 0, std::format("sdFormatBegin returned {}", err))) {
+    return false;
+  }
+  err = sdFormatFinish(operation);
+  bool passed = check(err == 0, std::format("format returned {}", err));
+
+  sdFormatSetLayoutProfile(kSDFormatProfileR4);
+  sdFormatSetSectorSize(nullptr);
+  passed &= checkCleanVolume(image.fd, "512n R4");
+  return passed;
+}
+
+// testAsyncCancellation
+// ---------------------
+// Cancelling from the callback of the first event must stop the format
+// before its second step, and the event descriptor must deliver that event
+// and the final ECANCELED one.
+
+static bool testAsyncCancellation() {
+  Image image(kCardSectors);
+  if (!check(image.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  auto cancel = [](void* context, const SDFormatEvent* event) {
+    if (!event->finished && event->stepsDone == 1) {
+      sdFormatCancel(*static_cast<SDFormatOperation**>(context));
+    }
+  };
+  const SDFormatParameters parameters = {image.fd, image.sectorCount, 1,
+                                         "NDS", nullptr, 0};
+  SDFormatOperation* operation = nullptr;
+  int err = sdFormatBegin(&parameters, cancel, &operation, &operation);
+  if (!check(err == 0, std::format("sdFormatBegin returned {}", err))) {
+    return false;
+  }
+  std::vector<SDFormatEvent> events;
+  pollfd descriptor = {sdFormatEventFd(operation), POLLIN, 0};
+  while ((events.empty() || !events.back().finished) &&
+         poll(&descriptor, 1, 10000) > 0) {
+    SDFormatEvent event;
+    while (sdFormatPollEvent(operation, &event)) {
+      events.push_back(event);
+    }
+  }
+  err = sdFormatFinish(operation);
+
+  bool passed = check(err == ECANCELED,
+                      std::format("format returned {}", err));
+  passed &= check(events.size() == 2 && !events[0].finished &&
+                      events[0].stepsDone == 1 && events[1].finished &&
+                      events[1].result == ECANCELED,
+                  std::format("{} events polled", events.size()));
+  SDFormatLayout layout;
+  sdFormatGetLayout(sdFormatGetLayoutProfile(), &layout);
+  passed &= check(readBytes(image.fd, layout.alignmentBytes, 512) ==
+                      std::vector<std::byte>(512),
+                  "the VBR was written after the cancel");
+  return passed;
+}
+
+// awaitFormat
+// -----------
+// Awaits a format of `image` with one save, counting the progress events,
+// and cancels it after the first step if `cancel` is set.
+
+static DetachedTask awaitFormat(const Image& image, bool cancel,
+                                std::atomic<int>& progressEvents,
+                                std::atomic<int>& result) {
+  const SDFormatSaveFile save = {"MARIO", 65536};
+  const SDFormatParameters parameters = {image.fd, image.sectorCount, 1,
+                                         "NDS", &save, 1};
+  sdformat::Format* self = nullptr;
+  sdformat::Format format(parameters, [&](const SDFormatEvent&) {
+    progressEvents++;
+    if (cancel) {
+      self->cancel();
+    }
+  });
+  self = &format;
+  result = co_await format;
+}
+
+// testCoroutineFormat
+// -------------------
+// A Format awaited to completion reports every step but the last as
+// progress and leaves a clean volume; one cancelled from its progress
+// function yields ECANCELED after the first step.
+
+static bool testCoroutineFormat() {
+  bool passed = true;
+  for (bool cancel : {false, true}) {
+    Image image(kCardSectors);
+    if (!check(image.fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    std::atomic<int> progressEvents{0};
+    std::atomic<int> result{-1};
+    awaitFormat(image, cancel, progressEvents, result);
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (result.load() == -1 &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const int expectedResult = cancel ? ECANCELED : 0;
+    const int expectedEvents = cancel ? 1 : 5;
+    passed &= check(result.load() == expectedResult &&
+                        progressEvents.load() == expectedEvents,
+                    std::format("cancel {}: result {} after {} progress "
+                                "events",
+                                cancel, result.load(),
+                                progressEvents.load()));
+    if (!cancel) {
+      passed &= checkCleanVolume(image.fd, "coroutine format");
+    }
+  }
+  return passed;
+}
+
+// awaitCancelledFormat
+// --------------------
+// Awaits a format of an invalid descriptor while another thread calls
+// cancel() until the coroutine resumes, so that cancel() races the final
+// event releasing the operation. Sets `result` to what co_await yields.
+
+static DetachedTask awaitCancelledFormat(std::atomic<int>& result) {
+  const SDFormatParameters parameters = {-1, 16777216, 1, "NDS", nullptr, 0};
+  sdformat::Format format(parameters);
+  std::atomic<bool> resumed{false};
+  std::thread canceller([&] {
+    while (!resumed.load()) {
+      format.cancel();
+    }
+  });
+  const int err = co_await format;
+  resumed = true;
+  canceller.join();
+  result = err;
+}
+
+// testCancelDuringFinish
+// ----------------------
+// cancel() called while the final event is being delivered must neither
+// use the released operation (AddressSanitizer reports it if it does) nor
+// lose the result: each format ends with EBADF, or ECANCELED if the cancel
+// came before its first step.
+
+static bool testCancelDuringFinish() {
+  constexpr int kFormats = 2000;
+  int wrongResults = 0;
+  int unfinished = 0;
+  for (int i = 0; i < kFormats; i++) {
+    std::atomic<int> result{-1};
+    awaitCancelledFormat(result);
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (result.load() == -1 &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    if (result.load() == -1) {
+      unfinished++;
+      break;
+    }
+    if (result.load() != EBADF && result.load() != ECANCELED) {
+      wrongResults++;
+    }
+  }
+  bool passed = check(unfinished == 0, "a cancelled format never resumed");
+  passed &= check(wrongResults == 0,
+                  std::format("{} results other than EBADF or ECANCELED",
+                              wrongResults));
+  return passed;
+}
+
+// formatConcurrently
+// ------------------
+// Formats every image in `images` at the same time, with the asynchronous
+// API. Returns the first error.
+
+static int formatConcurrently(const std::vector<Image*>& images) {
+  std::vector<SDFormatOperation*> operations;
+  int result = 0;
+  for (Image* image : images) {
+    const SDFormatParameters parameters = {image->fd, image->sectorCount, 1,
+                                           "NDS", nullptr, 0};
+    SDFormatOperation* operation;
+    if (int err = sdFormatBegin(&parameters, nullptr, nullptr, &operation);
+        err != 0) {
+      result = err;
+      break;
+    }
+    operations.push_back(operation);
+  }
+  for (SDFormatOperation* operation : operations) {
+    if (int err = sdFormatFinish(operation); err != 0 && result == 0) {
+      result = err;
+    }
+  }
+  return result;
+}
+
+// testConcurrentPhaseStats
+// ------------------------
+// Concurrent formats must each count their I/O against their own phases:
+// four at once make exactly four times the writes of one, phase by phase,
+// and the reads of a check running on this thread meanwhile stay in
+// kSDFormatPhaseOther (a format makes none).
+
+static bool testConcurrentPhaseStats() {
+  constexpr int kFormats = 4;
+  std::vector<std::unique_ptr<Image>> images;
+  std::vector<Image*> pointers;
+  for (int i = 0; i <= kFormats; i++) {
+    images.push_back(std::make_unique<Image>(kCardSectors));
+    if (!check(images.back()->fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    pointers.push_back(images.back().get());
+  }
+  Image& checked = *pointers.back();
+  pointers.pop_back();
+  int err = formatConcurrently({&checked});
+
+  // Sector-sized transfers from two threads each make the FAT phase long
+  // enough to overlap the checks, and have zeroSectors use workers
+  const SDFormatWriteTuning tuning = {512, 2};
+  sdFormatSetWriteTuning(&tuning);
+
+  sdFormatEnableStats(true);
+  sdFormatResetStats();
+  err = err != 0 ? err : formatConcurrently({pointers[0]});
+  SDFormatStats single;
+  sdFormatGetStats(&single);
+  sdFormatResetStats();
+  std::atomic<bool> formatting{true};
+  std::thread formatter([&] {
+    const int formatErr = formatConcurrently(pointers);
+    err = err != 0 ? err : formatErr;
+    formatting = false;
+  });
+  uint32_t checks = 0;
+  while (formatting.load()) {
+    SDFormatCheckReport report;
+    sdFormatCheck(checked.fd, &report);
+    checks++;
+  }
+  formatter.join();
+  SDFormatStats concurrent;
+  sdFormatGetStats(&concurrent);
+  sdFormatEnableStats(false);
+  sdFormatSetWriteTuning(nullptr);
+  bool passed = check(err == 0, std::format("format returned {}", err));
+
+  for (uint32_t phase = 0; phase < kSDFormatPhaseCount; phase++) {
+    const SDFormatPhaseStats& one = single.phases[phase];
+    const SDFormatPhaseStats& all = concurrent.phases[phase];
+    if (phase == kSDFormatPhaseOther) {
+      passed &= check(all.writeCalls == 0, "writes outside any phase");
+      continue;
+    }
+    passed &= check(
+        all.writeCalls == kFormats * one.writeCalls &&
+            all.bytesWritten == kFormats * one.bytesWritten &&
+            all.offloadBytes == kFormats * one.offloadBytes,
+        std::format("phase {}: {} writes of {} bytes for {} formats, one "
+                    "makes {} of {}",
+                    phase, all.writeCalls, all.bytesWritten, kFormats,
+                    one.writeCalls, one.bytesWritten));
+    passed &= check(all.readCalls == 0,
+                    std::format("phase {}: {} reads of {} checks", phase,
+                                all.readCalls, checks));
+  }
+  for (Image* image : pointers) {
+    passed &= checkCleanVolume(image->fd, "concurrent format");
+  }
+  return passed;
+}
+
+// =============================================================================
+// Hash Manifest
+// =============================================================================
+
+// Manifest
+// --------
+// The records of a manifest file that the tests look at.
+
+struct ManifestExtent {
+  uint64_t offset;
+  uint64_t length;
+  std::string structure;
+  std::string digest;
+};
+
+struct Manifest {
+  std::vector<ManifestExtent> extents;
+  std::map<std::string, std::string> structures;  // Name to digest
+  uint64_t prefixBytes = 0;
+  std::string prefixDigest;
+};
+
+// readManifest
+// ------------
+
+static Manifest readManifest(const fs::path& path) {
+  Manifest manifest;
+  std::ifstream file(path);
+  std::string record;
+  while (file >> record) {
+    if (record == "extent") {
+      ManifestExtent extent;
+      file >> extent.offset >> extent.length >> extent.structure >>
+          extent.digest;
+      manifest.extents.push_back(extent);
+    } else if (record == "structure") {
+      std::string name;
+      file >> name;
+      file >> manifest.structures[name];
+    } else if (record == "prefix") {
+      uint64_t unrecorded;
+      file >> manifest.prefixBytes >> unrecorded >> manifest.prefixDigest;
+    } else {
+      std::getline(file, record);
+    }
+  }
+  return manifest;
+}
+
+// structureAt
+// -----------
+// The structure of the extent holding byte `offset`, or "" if none does.
+
+static std::string structureAt(const Manifest& manifest, uint64_t offset) {
+  for (const ManifestExtent& extent : manifest.extents) {
+    if (offset >= extent.offset && offset - extent.offset < extent.length) {
+      return extent.structure;
+    }
+  }
+  return "";
+}
+
+// recordFormat
+// ------------
+// Formats `image` with `saves` while recording a manifest to `path`, with
+// `algorithm` (SHA-256 by default). Returns the first error.
+
+static int recordFormat(const Image& image,
+                        const std::vector<SDFormatSaveFile>& saves,
+                        const fs::path& path,
+                        SDFormatHashManifestReport* report = nullptr,
+                        uint32_t algorithm = kSDFormatHashSHA256) {
+  if (int err = sdFormatStartHashManifest(image.fd, algorithm); err != 0) {
+    return err;
+  }
+  int err = saves.empty() ? formatCard(image, "NDS")
+                          : formatCardWithSaves(image, saves);
+  SDFormatHashManifestReport stopReport;
+  const int stopErr = sdFormatStopHashManifest(
+      path.c_str(), 0, report != nullptr ? report : &stopReport);
+  return err != 0 ? err : stopErr;
+}
+
+// testManifestStructures
+// ----------------------
+// Ranges are grouped by the structure the layout puts there, not by the
+// step that last wrote them: with saves, FSInfo and the first sectors of
+// the FAT and root directory are rewritten by the save file step, and
+// must still be reported as fsinfo, fat, and root.
+
+static bool testManifestStructures() {
+  Image blank(kCardSectors);
+  Image withSaves(kCardSectors);
+  if (!check(blank.fd >= 0 && withSaves.fd >= 0, "cannot create the image")) {
+    return false;
+  }
+  const fs::path blankPath = blank.path.string() + ".manifest";
+  const fs::path savesPath = withSaves.path.string() + ".manifest";
+  const std::vector<SDFormatSaveFile> saves = {{"MARIO", 524288},
+                                               {"ZELDA", 65536}};
+  int err = recordFormat(blank, {}, blankPath);
+  err = err != 0 ? err : recordFormat(withSaves, saves, savesPath);
+  const Manifest blankManifest = readManifest(blankPath);
+  const Manifest savesManifest = readManifest(savesPath);
+  std::error_code error;
+  fs::remove(blankPath, error);
+  fs::remove(savesPath, error);
+  if (!check(err == 0, std::format("format returned {}", err))) {
+    return false;
+  }
+
+  SDFormatLayout layout;
+  sdFormatGetLayout(sdFormatGetLayoutProfile(), &layout);
+  const uint64_t vbr = layout.alignmentBytes;
+  const uint64_t fat = vbr + uint64_t{layout.reservedSectors} * 512;
+  bool passed = true;
+  for (const Manifest* manifest : {&blankManifest, &savesManifest}) {
+    const char* name = manifest == &blankManifest ? "blank" : "saves";
+    for (const auto& [offset, structure] :
+         std::initializer_list<std::pair<uint64_t, std::string_view>>{
+             {0, "mbr"},
+             {vbr, "vbr"},
+             {vbr + 512, "fsinfo"},
+             {vbr + 6 * 512, "vbr"},
+             {vbr + 7 * 512, "fsinfo"},
+             {fat, "fat"}}) {
+      passed &= check(structureAt(*manifest, offset) == structure,
+                      std::format("{}: byte {} is in \"{}\", not {}", name,
+                                  offset, structureAt(*manifest, offset),
+                                  structure));
+    }
+    passed &= check(manifest->structures.contains("fsinfo") &&
+                        manifest->structures.contains("root"),
+                    std::format("{}: no fsinfo or root structure", name));
+  }
+
+  // The root directory starts where the FAT region ends; the save data
+  // follows it
+  auto fatExtent = std::ranges::find_if(
+      savesManifest.extents,
+      [](const ManifestExtent& extent) { return extent.structure == "fat"; });
+  if (check(fatExtent != savesManifest.extents.end(), "saves: no FAT")) {
+    const uint64_t root = fatExtent->offset + fatExtent->length;
+    passed &= check(structureAt(savesManifest, root) == "root",
+                    std::format("saves: byte {} is in \"{}\", not root",
+                                root, structureAt(savesManifest, root)));
+    passed &= check(structureAt(savesManifest, root + 32768) == "saves",
+                    "saves: the first save cluster is not in saves");
+  }
+  passed &= check(!blankManifest.structures.contains("saves"),
+                  "blank: a saves structure");
+  passed &= check(blankManifest.structures.at("mbr") ==
+                      savesManifest.structures.at("mbr"),
+                  "the MBR digests differ");
+  return passed;
+}
+
+// contentHashAt
+// -------------
+// The content hash of `length` bytes at `offset` of `fd`, read back.
+
+static Digest contentHashAt(int fd, uint32_t algorithm, uint64_t offset,
+                            uint64_t length) {
+  ContentHasher hasher(algorithm);
+  std::vector<std::byte> buffer(1 << 20);
+  while (length > 0) {
+    const size_t piece = std::min<uint64_t>(buffer.size(), length);
+    if (pread(fd, buffer.data(), piece, static_cast<off_t>(offset)) !=
+        static_cast<ssize_t>(piece)) {
+      break;
+    }
+    hasher.update(std::span{buffer}.first(piece));
+    offset += piece;
+    length -= piece;
+  }
+  return hasher.finish();
+}
+
+// testManifestReadBack
+// --------------------
+// Every digest of a manifest must match what reading the card back gives,
+// with either algorithm: each extent, each structure (the hash of its
+// extents' digests), and the prefix, also as reported by
+// sdFormatStopHashManifest.
+
+static bool testManifestReadBack() {
+  bool passed = true;
+  for (uint32_t algorithm = 0; algorithm < kSDFormatHashCount; algorithm++) {
+    Image image(kCardSectors);
+    if (!check(image.fd >= 0, "cannot create the image")) {
+      return false;
+    }
+    const fs::path path = image.path.string() + ".manifest";
+    SDFormatHashManifestReport report;
+    const int err = recordFormat(image, {{"MARIO", 524288}, {"ZELDA", 8192}},
+                                 path, &report, algorithm);
+    const Manifest manifest = readManifest(path);
+    std::error_code error;
+    fs::remove(path, error);
+    if (!check(err == 0 && !manifest.extents.empty(),
+               std::format("algorithm {}: format returned {}", algorithm,
+                           err))) {
+      passed = false;
+      continue;
+    }
+
+    std::map<std::string, Hasher> structures;
+    for (const ManifestExtent& extent : manifest.extents) {
+      const Digest digest = contentHashAt(image.fd, algorithm, extent.offset,
+                                          extent.length);
+      passed &= check(toHex(digest) == extent.digest,
+                      std::format("algorithm {}: extent {}+{} ({})",
+                                  algorithm, extent.offset, extent.length,
+                                  extent.structure));
+      structures.try_emplace(extent.structure, algorithm)
+          .first->second.update(std::as_bytes(std::span{digest}));
+    }
+    passed &= check(structures.size() == manifest.structures.size(),
+                    std::format("algorithm {}: {} structures for {}",
+                                algorithm, manifest.structures.size(),
+                                structures.size()));
+    for (auto& [name, hasher] : structures) {
+      passed &= check(manifest.structures.contains(name) &&
+                          manifest.structures.at(name) ==
+                              toHex(hasher.finish()),
+                      std::format("algorithm {}: structure {}", algorithm,
+                                  name));
+    }
+
+    const std::string prefix = toHex(
+        contentHashAt(image.fd, algorithm, 0, manifest.prefixBytes));
+    passed &= check(manifest.prefixBytes == report.prefixBytes &&
+                        manifest.prefixDigest == prefix &&
+                        toHex(report.prefixDigest) == prefix,
+                    std::format("algorithm {}: prefix of {} bytes",
+                                algorithm, manifest.prefixBytes));
+  }
+  return passed;
+}
+
+// =============================================================================
+// Runner
+// =============================================================================
+
+struct TestCase {
+  const char* name;
+  bool (*run)();
+};
+
+static constexpr TestCase kTests[] = {
+    {"sha256-known-answers", testSha256KnownAnswers},
+    {"blake3-known-answers", testBlake3KnownAnswers},
+    {"content-hash", testContentHash},
+    {"format-profiles", testFormatProfiles},
+    {"format-gpt", testFormatGpt},
+    {"reformat-incremental", testReformatIncremental},
+    {"format-fat16", testFormatFat16},
+    {"format-exfat", testFormatExfat},
+    {"repair-primary-vbr", testRepairPrimaryVbr},
+    {"relabel", testRelabel},
+    {"defragment", testDefragment},
+    {"sort-directories", testSortDirectories},
+    {"wipe-free-clusters", testWipeFreeClusters},
+    {"coroutine-fast-failure", testCoroutineFastFailure},
+    {"async-layout-pinned", testAsyncLayoutPinned},
+    {"async-cancellation", testAsyncCancellation},
+    {"coroutine-format", testCoroutineFormat},
+    {"cancel-during-finish", testCancelDuringFinish},
+    {"concurrent-phase-stats", testConcurrentPhaseStats},
+    {"manifest-structures", testManifestStructures},
+    {"manifest-read-back", testManifestReadBack},
+};
+
+int main(int argc, char* argv[]) {
+  const std::string_view filter = argc > 1 ? argv[1] : "";
+  int failed = 0;
+  int ran = 0;
+  for (const TestCase& test : kTests) {
+    if (std::string_view{test.name}.find(filter) == std::string_view::npos) {
+      continue;
+    }
+    println("[*] {}", test.name);
+    // Every test starts from the default layout, sector size, and tuning
+    sdFormatSetLayoutProfile(kSDFormatProfileR4);
+    sdFormatSetSectorSize(nullptr);
+    sdFormatSetWriteTuning(nullptr);
+    ran++;
+    if (test.run()) {
+      println("RESULT: [PASSED] {}", test.name);
+    } else {
+      println("RESULT: [FAILED] {}", test.name);
+      failed++;
+    }
+  }
+
+  println("------------------------------------------------");
+  if (failed == 0) {
+    println("ALL {} TESTS PASSED", ran);
+    return 0;
+  }
+  println("{} OF {} TESTS FAILED", failed, ran);
+  return 1;
+}
@@ -0,0 +1,111 @@
+/// @file CheckImage.cpp
+/// @brief Minimal C++ CLI for checking a FAT32 image or card.
+///
+/// Usage: check_image [--repair] <path>
+///
+/// Opens the file or device at @p path, runs sdFormatCheck, and prints
+/// the findings.  Exits 0 if the volume is consistent, 2 if the check
+/// found problems, and 1 if the check could not run.
+///
+/// With --repair, sdFormatRepair first restores damaged primary
+/// structures (VBR, FSInfo, FAT) from their backups; the check then runs
+/// on the repaired volume.  Without it the path is opened read-only.
+///
+/// Like format_image, this tool is intentionally minimal.  It is meant
+/// for triaging returned cards without fsck.fat.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <print>
+#include <string>
+
+#include "SDFormat.h"
+
+// Prints one finding and returns 1 if it counts as a problem.
+static int report(const char* name, bool ok, const std::string& detail = "") {
+  std::println("  {:<22} {}{}", name, ok ? "ok" : "PROBLEM",
+               detail.empty() ? "" : " (" + detail + ")");
+  return ok ? 0 : 1;
+}
+
+static int reportCount(const char* name, uint32_t count) {
+  return report(name, count == 0, count == 0 ? "" : std::to_string(count));
+}
+
+int main(int argc, char* argv[]) {
+  const bool repair = argc == 3 && std::string(argv[1]) == "--repair";
+  if (argc != 2 && !repair) {
+    std::println(stderr, "Usage: check_image [--repair] <path>");
+    return 1;
+  }
+
+  const std::string path = argv[argc - 1];
+  int fd = open(path.c_str(), repair ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    std::println(stderr, "Error: Failed to open '{}': {}", path,
+                 strerror(errno));
+    return 1;
+  }
+
+  if (repair) {
+    SDFormatRepairReport restored;
+    int err = sdFormatRepair(fd, &restored);
+    if (err != 0) {
+      std::println(stderr, "Error: Repair failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[CheckImage] Repair");
+    std::println("  VBR restored           {}", restored.vbrRestored);
+    std::println("  FSInfo restored        {}", restored.fsInfoRestored);
+    std::println("  FAT sectors restored   {}", restored.fatSectorsRestored);
+    std::println("  FAT sectors unresolved {}", restored.fatSectorsUnresolved);
+  }
+
+  SDFormatCheckReport r;
+  int err = sdFormatCheck(fd, &r);
+  close(fd);
+
+  int problems = 0;
+
+  std::println("[CheckImage] Boot region");
+  problems += report("MBR", r.mbrValid);
+  problems += report("VBR", r.vbrValid);
+  problems += report("Backup VBR", r.backupVbrValid);
+  problems += report("Backup VBR matches", r.backupVbrMatches);
+  problems += report("MBR matches VBR", r.mbrMatchesVbr);
+  if (err != 0) {
+    std::println(stderr, "Error: Check failed: {}", strerror(err));
+    return 1;
+  }
+
+  std::println("[CheckImage] FAT region ({} clusters)", r.clusterCount);
+  problems += reportCount("FAT mirror mismatches", r.fatMismatchSectors);
+
+  std::println("[CheckImage] Directory tree ({} files, {} directories)",
+               r.fileCount, r.directoryCount);
+  problems += reportCount("Broken chains", r.brokenChains);
+  problems += reportCount("Looped chains", r.loopedChains);
+  problems += reportCount("Cross-linked chains", r.crossLinkedChains);
+  problems += reportCount("Size mismatches", r.sizeMismatches);
+  problems += reportCount("Lost clusters", r.lostClusters);
+
+  std::println("[CheckImage] FSInfo");
+  problems += report("Signatures", r.fsInfoValid);
+  bool freeCountOk = r.fsInfoFreeCount == 0xFFFFFFFF ||
+                     r.fsInfoFreeCount == r.freeClusters;
+  problems += report("Free count", freeCountOk,
+                     std::format("stored {}, actual {}", r.fsInfoFreeCount,
+                                 r.freeClusters));
+
+  if (problems != 0) {
+    std::println("[CheckImage] {} problem(s) found.", problems);
+    return 2;
+  }
+  std::println("[CheckImage] Clean.");
+  return 0;
+}
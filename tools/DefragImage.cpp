@@ -0,0 +1,101 @@
+/// @file DefragImage.cpp
+/// @brief Minimal C++ CLI for defragmenting ROMs and saves on a FAT32 image.
+///
+/// Usage: defrag_image [--all] [--sort] <path>
+///
+/// Checks the volume at @p path with sdFormatCheck and, if its cluster
+/// chains are consistent, runs sdFormatDefragment.  By default only .NDS
+/// and .SAV files are made contiguous; --all processes every file.  With
+/// --sort, sdFormatSortDirectories then puts every directory in menu
+/// order.  Exits 0 on success, 1 on any failure (including a volume that
+/// fails the check).
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <print>
+#include <string>
+
+#include "SDFormat.h"
+
+int main(int argc, char* argv[]) {
+  bool allFiles = false;
+  bool sort = false;
+  int arg = 1;
+  for (; arg < argc - 1; arg++) {
+    std::string option = argv[arg];
+    if (option == "--all") {
+      allFiles = true;
+    } else if (option == "--sort") {
+      sort = true;
+    } else {
+      break;
+    }
+  }
+  if (arg != argc - 1) {
+    std::println(stderr, "Usage: defrag_image [--all] [--sort] <path>");
+    return 1;
+  }
+
+  const std::string path = argv[argc - 1];
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    std::println(stderr, "Error: Failed to open '{}': {}", path,
+                 strerror(errno));
+    return 1;
+  }
+
+  std::println("[DefragImage] Checking volume...");
+  SDFormatCheckReport check;
+  int err = sdFormatCheck(fd, &check);
+  if (err != 0) {
+    std::println(stderr, "Error: Check failed: {}", strerror(err));
+    close(fd);
+    return 1;
+  }
+  if (check.brokenChains != 0 || check.loopedChains != 0 ||
+      check.crossLinkedChains != 0 || check.fatMismatchSectors != 0) {
+    std::println(stderr,
+                 "Error: Volume has inconsistent cluster chains; run "
+                 "check_image first.");
+    close(fd);
+    return 1;
+  }
+
+  std::println("[DefragImage] Defragmenting...");
+  SDFormatDefragReport report;
+  err = sdFormatDefragment(fd, allFiles ? kSDFormatDefragAllFiles : 0,
+                           &report);
+  if (err != 0) {
+    std::println(stderr, "Error: Defragment failed: {}", strerror(err));
+    close(fd);
+    return 1;
+  }
+
+  std::println("[DefragImage] {} file(s) examined, {} fragmented, "
+               "{} defragmented, {} skipped, {} cluster(s) moved.",
+               report.filesExamined, report.filesFragmented,
+               report.filesDefragmented, report.filesSkipped,
+               report.clustersMoved);
+
+  if (sort) {
+    std::println("[DefragImage] Sorting directories...");
+    SDFormatSortReport sorted;
+    err = sdFormatSortDirectories(fd, &sorted);
+    if (err != 0) {
+      std::println(stderr, "Error: Sort failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[DefragImage] {} director(ies) examined, {} rewritten, "
+                 "{} skipped, {} slot(s) dropped, {} cluster(s) freed.",
+                 sorted.directoriesExamined, sorted.directoriesRewritten,
+                 sorted.directoriesSkipped, sorted.entriesDropped,
+                 sorted.clustersFreed);
+  }
+
+  close(fd);
+  return 0;
+}
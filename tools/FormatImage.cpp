@@ -1,15 +1,52 @@
 /// @file FormatImage.cpp
 /// @brief Minimal C++ CLI for formatting a file image as FAT32.
 ///
-/// Usage: format_image <path> <label> <sector-count>
+/// Usage: format_image [--probe] [--autotune=<cache-file>] [--stats=json]
+///                     [--trace=<file>] [--simulate=<profile>]
+///                     [--manifest=<file> [--hash=sha256|blake3]]
+///                     [--incremental [--discard]] [--fat16 | --exfat]
+///                     [--layout=r4|dsi|3ds|sdxc] [--root-clusters=<n>]
+///                     [--sector-size=<logical>[/<physical>]]
+///                     [--save=<rom-name>:<bytes>]... <path> <label>
+///                     <sector-count>
 ///
 /// Opens the file at @p path and writes all five filesystem structures
-/// (MBR, VBR, FSInfo, FAT tables, root directory).  Exits 0 on
-/// success, 1 on any failure.
+/// (MBR, VBR, FSInfo, FAT tables, root directory).  Exits 0 on success, 1
+/// on any failure.
 ///
-/// This tool is intentionally minimal: no simulation, no device support,
-/// no confirmation prompt.  It exists to test the C++ library in
-/// isolation, without the Swift CLI.
+/// Layout: --root-clusters preallocates a contiguous root directory of
+/// that many clusters (default 1).  --layout selects the layout profile
+/// (default r4).  --sector-size makes the image behave as a device with
+/// that sector size (e.g. 4096 for 4Kn, 512/4096 for 512e); the sector
+/// count stays in 512-byte sectors.  Each --save option preallocates a
+/// zero-filled save file for the named ROM with sdFormatWriteSaveFiles.
+///
+/// File systems: --incremental formats with sdFormatReformatIncremental,
+/// writing only the metadata sectors that differ; with --discard the FATs
+/// and root directory are discarded first.  --fat16 formats the image
+/// FAT16 with the sdFormatFat16 functions instead (for cards under 2 GB);
+/// it cannot be combined with --incremental or --save.  --exfat formats
+/// the image exFAT with the sdFormatExfat functions (for large cards
+/// outside the DS), under the same restrictions.
+///
+/// Before the format: --probe runs sdFormatProbeCapacity and lays the
+/// volume out over the usable sectors only, for cards that may be
+/// counterfeit.  --autotune runs sdFormatAutotune with the given tuning
+/// cache.  --simulate attaches a simulated device loaded from the profile
+/// file, so every later step (including --probe and --autotune) runs at
+/// the modeled device's speed, and prints the simulator's totals at the
+/// end.
+///
+/// Measurement: --stats=json collects I/O statistics for the format itself
+/// and prints them as one line of JSON after "Done.".  --trace records the
+/// format's I/O to a trace file for sdformat_replay.  --manifest writes a
+/// content hash manifest of everything the format wrote
+/// (sdFormatStartHashManifest) and prints its prefix digest; --hash
+/// selects the hash (default sha256).
+///
+/// There is no confirmation prompt and no disk discovery or unmounting;
+/// those are left to the Swift CLI.  The tool exists to test the C++
+/// library in isolation.
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -17,20 +54,195 @@
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <format>
 #include <print>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "SDFormat.h"
 
+/// @brief Prints the statistics as one JSON object: per-phase counters and
+/// the non-empty write latency buckets.
+static void printStatsJson(const SDFormatStats& stats) {
+  static constexpr const char* kPhaseNames[kSDFormatPhaseCount] = {
+      "other", "mbr", "vbr", "fsinfo", "fat", "root", "saves",
+  };
+  std::string json = "{\"phases\":{";
+  for (uint32_t i = 0; i < kSDFormatPhaseCount; i++) {
+    const SDFormatPhaseStats& phase = stats.phases[i];
+    json += std::format(
+        "{}\"{}\":{{\"writeCalls\":{},\"bytesWritten\":{},"
+        "\"readCalls\":{},\"bytesRead\":{},\"syncCalls\":{},"
+        "\"offloadCalls\":{},\"offloadBytes\":{},\"elapsedNs\":{}}}",
+        i == 0 ? "" : ",", kPhaseNames[i], phase.writeCalls,
+        phase.bytesWritten, phase.readCalls, phase.bytesRead,
+        phase.syncCalls, phase.offloadCalls, phase.offloadBytes,
+        phase.elapsedNanoseconds);
+  }
+  json += "},\"writeLatencyUs\":[";
+  bool first = true;
+  for (uint32_t i = 0; i < kSDFormatLatencyBuckets; i++) {
+    if (stats.writeLatency[i] == 0) {
+      continue;
+    }
+    json += std::format("{}[{},{}]", first ? "" : ",",
+                        sdFormatLatencyBucketMicroseconds(i),
+                        stats.writeLatency[i]);
+    first = false;
+  }
+  json += "]}";
+  std::println("{}", json);
+}
+
 int main(int argc, char* argv[]) {
-  if (argc != 4) {
-    std::println(stderr, "Usage: format_image <path> <label> <sector-count>");
+  // Leading --probe, --autotune=<cache-file>, --stats=json,
+  // --trace=<file>, --manifest=<file>, --hash=<name>,
+  // --simulate=<profile>, --incremental, --discard,
+  // --fat16, --exfat, --layout=<name>, --root-clusters=<n>,
+  // --sector-size=<size>, and --save=<rom-name>:<bytes> options
+  bool probe = false;
+  bool stats = false;
+  std::string tracePath;
+  std::string manifestPath;
+  uint32_t hashAlgorithm = kSDFormatHashSHA256;
+  std::string profilePath;
+  std::string tuneCache;
+  bool incremental = false;
+  uint32_t incrementalFlags = 0;
+  bool fat16 = false;
+  bool exfat = false;
+  uint32_t layoutProfile = kSDFormatProfileR4;
+  uint32_t rootClusters = 1;
+  SDFormatSectorSize sectorSize = {};
+  std::vector<std::string> romNames;
+  std::vector<SDFormatSaveFile> saves;
+  int arg = 1;
+  for (; arg < argc; arg++) {
+    std::string_view option = argv[arg];
+    if (option == "--probe") {
+      probe = true;
+      continue;
+    }
+    if (option == "--stats=json") {
+      stats = true;
+      continue;
+    }
+    if (option.starts_with("--simulate=")) {
+      profilePath = option.substr(11);
+      continue;
+    }
+    if (option.starts_with("--trace=")) {
+      tracePath = option.substr(8);
+      continue;
+    }
+    if (option.starts_with("--manifest=")) {
+      manifestPath = option.substr(11);
+      continue;
+    }
+    if (option.starts_with("--hash=")) {
+      static constexpr std::string_view kHashNames[kSDFormatHashCount] = {
+          "sha256", "blake3"};
+      std::string_view name = option.substr(7);
+      hashAlgorithm = 0;
+      while (hashAlgorithm < kSDFormatHashCount &&
+             kHashNames[hashAlgorithm] != name) {
+        hashAlgorithm++;
+      }
+      if (hashAlgorithm == kSDFormatHashCount) {
+        break;
+      }
+      continue;
+    }
+    if (option.starts_with("--autotune=")) {
+      tuneCache = option.substr(11);
+      continue;
+    }
+    if (option == "--incremental") {
+      incremental = true;
+      continue;
+    }
+    if (option == "--discard") {
+      incremental = true;
+      incrementalFlags |= kSDFormatDiscardTables;
+      continue;
+    }
+    if (option == "--fat16") {
+      fat16 = true;
+      continue;
+    }
+    if (option == "--exfat") {
+      exfat = true;
+      continue;
+    }
+    if (option.starts_with("--layout=")) {
+      static constexpr std::string_view kLayoutNames[kSDFormatProfileCount] = {
+          "r4", "dsi", "3ds", "sdxc"};
+      std::string_view name = option.substr(9);
+      layoutProfile = 0;
+      while (layoutProfile < kSDFormatProfileCount &&
+             kLayoutNames[layoutProfile] != name) {
+        layoutProfile++;
+      }
+      if (layoutProfile == kSDFormatProfileCount) {
+        break;
+      }
+      continue;
+    }
+    if (option.starts_with("--sector-size=")) {
+      std::string_view size = option.substr(14);
+      size_t slash = size.find('/');
+      sectorSize.logicalBytes = static_cast<uint32_t>(
+          std::stoul(std::string(size.substr(0, slash))));
+      sectorSize.physicalBytes =
+          slash == std::string_view::npos
+              ? sectorSize.logicalBytes
+              : static_cast<uint32_t>(
+                    std::stoul(std::string(size.substr(slash + 1))));
+      continue;
+    }
+    if (option.starts_with("--root-clusters=")) {
+      rootClusters = static_cast<uint32_t>(
+          std::stoul(std::string(option.substr(16))));
+      continue;
+    }
+    if (!option.starts_with("--save=")) {
+      break;
+    }
+    std::string_view spec = option.substr(7);
+    size_t colon = spec.rfind(':');
+    if (colon == std::string_view::npos || colon == 0) {
+      break;
+    }
+    romNames.emplace_back(spec.substr(0, colon));
+    saves.push_back({nullptr, static_cast<uint32_t>(std::stoul(
+                                  std::string(spec.substr(colon + 1))))});
+  }
+  for (size_t i = 0; i < saves.size(); i++) {
+    saves[i].romName = romNames[i].c_str();
+  }
+
+  if (argc - arg != 3 || layoutProfile == kSDFormatProfileCount ||
+      hashAlgorithm == kSDFormatHashCount ||
+      ((fat16 || exfat) && (incremental || !saves.empty())) ||
+      (fat16 && exfat)) {
+    std::println(stderr,
+                 "Usage: format_image [--probe] [--autotune=<cache-file>] "
+                 "[--stats=json] [--trace=<file>] "
+                 "[--manifest=<file> [--hash=sha256|blake3]] "
+                 "[--simulate=<profile>] "
+                 "[--incremental [--discard]] [--fat16 | --exfat] "
+                 "[--layout=r4|dsi|3ds|sdxc] [--root-clusters=<n>] "
+                 "[--sector-size=<logical>[/<physical>]] "
+                 "[--save=<rom-name>:<bytes>]... "
+                 "<path> <label> "
+                 "<sector-count>");
     return 1;
   }
 
-  const std::string path = argv[1];
-  const char* label = argv[2];
-  const uint64_t sectorCount = std::stoull(argv[3]);
+  const std::string path = argv[arg];
+  const char* label = argv[arg + 1];
+  uint64_t sectorCount = std::stoull(argv[arg + 2]);
 
   int fd = open(path.c_str(), O_RDWR);
   if (fd < 0) {
@@ -39,49 +251,288 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  int err;
-
-  std::println("[FormatImage] Writing MBR...");
-  err = sdFormatWriteMBR(fd, sectorCount);
+  int err = sdFormatSetLayoutProfile(layoutProfile);
+  if (err == 0 && sectorSize.logicalBytes != 0) {
+    err = sdFormatSetSectorSize(&sectorSize);
+  }
   if (err != 0) {
-    std::println(stderr, "Error: MBR failed: {}", strerror(err));
+    std::println(stderr, "Error: Layout failed: {}", strerror(err));
     close(fd);
     return 1;
   }
 
-  std::println("[FormatImage] Writing VBR...");
-  err = sdFormatWriteVolumeBootRecord(fd, sectorCount, label);
-  if (err != 0) {
-    std::println(stderr, "Error: VBR failed: {}", strerror(err));
-    close(fd);
-    return 1;
+  if (!profilePath.empty()) {
+    SDFormatDeviceProfile profile;
+    err = sdFormatLoadDeviceProfile(profilePath.c_str(), &profile);
+    if (err == 0) {
+      err = sdFormatAttachSimulator(fd, &profile);
+    }
+    if (err != 0) {
+      std::println(stderr, "Error: Simulator failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
   }
 
-  std::println("[FormatImage] Writing FSInfo...");
-  err = sdFormatWriteFSInfo(fd, sectorCount);
-  if (err != 0) {
-    std::println(stderr, "Error: FSInfo failed: {}", strerror(err));
-    close(fd);
-    return 1;
+  if (probe) {
+    std::println("[FormatImage] Probing capacity...");
+    SDFormatCapacityReport capacity;
+    err = sdFormatProbeCapacity(fd, sectorCount, &capacity);
+    if (err != 0) {
+      std::println(stderr, "Error: Probe failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    if (capacity.usableSectors < sectorCount) {
+      std::println("[FormatImage] Only {} of {} sectors hold data; formatting "
+                   "those",
+                   capacity.usableSectors, sectorCount);
+      sectorCount = capacity.usableSectors;
+    }
   }
 
-  std::println("[FormatImage] Writing FAT Tables...");
-  err = sdFormatWriteFat32Tables(fd, sectorCount);
-  if (err != 0) {
-    std::println(stderr, "Error: FAT Tables failed: {}", strerror(err));
-    close(fd);
-    return 1;
+  if (!tuneCache.empty()) {
+    std::println("[FormatImage] Tuning writes...");
+    SDFormatAutotuneReport tune;
+    err = sdFormatAutotune(fd, tuneCache.c_str(), &tune);
+    if (err != 0) {
+      std::println(stderr, "Error: Autotune failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[FormatImage] {} KB writes, queue depth {}{}",
+                 tune.tuning.transferBytes >> 10, tune.tuning.queueDepth,
+                 tune.fromCache ? " (cached)" : "");
   }
 
-  std::println("[FormatImage] Writing Root Directory...");
-  err = sdFormatWriteRootDirectory(fd, sectorCount, label);
-  if (err != 0) {
-    std::println(stderr, "Error: Root Directory failed: {}", strerror(err));
-    close(fd);
-    return 1;
+  if (stats) {
+    sdFormatResetStats();
+    sdFormatEnableStats(true);
   }
+  if (!tracePath.empty()) {
+    err = sdFormatStartTrace(fd, tracePath.c_str());
+    if (err != 0) {
+      std::println(stderr, "Error: Failed to start trace: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+  }
+  if (!manifestPath.empty()) {
+    err = sdFormatStartHashManifest(fd, hashAlgorithm);
+    if (err != 0) {
+      std::println(stderr, "Error: Failed to start manifest: {}",
+                   strerror(err));
+      close(fd);
+      return 1;
+    }
+  }
+
+  if (fat16) {
+    SDFormatFat16Layout layout;
+    err = sdFormatGetFat16Layout(sectorCount, &layout);
+    if (err != 0) {
+      std::println(stderr, "Error: FAT16 layout failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[FormatImage] FAT16: {} clusters of {} KB",
+                 layout.clusterCount, layout.clusterBytes >> 10);
+
+    std::println("[FormatImage] Writing MBR...");
+    err = sdFormatFat16WriteMBR(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: MBR failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing VBR...");
+    err = sdFormatFat16WriteVolumeBootRecord(fd, sectorCount, label);
+    if (err != 0) {
+      std::println(stderr, "Error: VBR failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing FAT Tables...");
+    err = sdFormatFat16WriteTables(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: FAT Tables failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing Root Directory...");
+    err = sdFormatFat16WriteRootDirectory(fd, sectorCount, label);
+    if (err != 0) {
+      std::println(stderr, "Error: Root Directory failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+  } else if (exfat) {
+    SDFormatExfatLayout layout;
+    err = sdFormatGetExfatLayout(fd, sectorCount, &layout);
+    if (err != 0) {
+      std::println(stderr, "Error: exFAT layout failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[FormatImage] exFAT: {} clusters of {} KB",
+                 layout.clusterCount, layout.clusterBytes >> 10);
+
+    std::println("[FormatImage] Writing MBR...");
+    err = sdFormatExfatWriteMBR(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: MBR failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing Boot Regions...");
+    err = sdFormatExfatWriteBootRegions(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: Boot Regions failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing FAT...");
+    err = sdFormatExfatWriteFat(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: FAT failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing Allocation Bitmap...");
+    err = sdFormatExfatWriteAllocationBitmap(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: Allocation Bitmap failed: {}",
+                   strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing Up-case Table...");
+    err = sdFormatExfatWriteUpcaseTable(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: Up-case Table failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
 
+    std::println("[FormatImage] Writing Root Directory...");
+    err = sdFormatExfatWriteRootDirectory(fd, sectorCount, label);
+    if (err != 0) {
+      std::println(stderr, "Error: Root Directory failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+  } else if (incremental) {
+    std::println("[FormatImage] Reconciling metadata...");
+    SDFormatIncrementalReport report;
+    err = sdFormatReformatIncremental(fd, sectorCount, rootClusters, label,
+                                      incrementalFlags, &report);
+    if (err != 0) {
+      std::println(stderr, "Error: Incremental format failed: {}",
+                   strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[FormatImage] Compared {} sectors, wrote {}{}",
+                 report.sectorsCompared, report.sectorsWritten,
+                 report.tablesDiscarded ? " (tables discarded)" : "");
+  } else {
+    std::println("[FormatImage] Writing MBR...");
+    err = sdFormatWriteMBR(fd, sectorCount);
+    if (err != 0) {
+      std::println(stderr, "Error: MBR failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing VBR...");
+    err = sdFormatWriteVolumeBootRecord(fd, sectorCount, label);
+    if (err != 0) {
+      std::println(stderr, "Error: VBR failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing FSInfo...");
+    err = sdFormatWriteFSInfo(fd, sectorCount, rootClusters);
+    if (err != 0) {
+      std::println(stderr, "Error: FSInfo failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing FAT Tables...");
+    err = sdFormatWriteFat32Tables(fd, sectorCount, rootClusters);
+    if (err != 0) {
+      std::println(stderr, "Error: FAT Tables failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+
+    std::println("[FormatImage] Writing Root Directory...");
+    err = sdFormatWriteRootDirectory(fd, sectorCount, rootClusters, label);
+    if (err != 0) {
+      std::println(stderr, "Error: Root Directory failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+  }
+
+  if (!saves.empty()) {
+    std::println("[FormatImage] Writing {} Save File(s)...", saves.size());
+    err = sdFormatWriteSaveFiles(fd, sectorCount, rootClusters, saves.data(),
+                                 static_cast<uint32_t>(saves.size()));
+    if (err != 0) {
+      std::println(stderr, "Error: Save Files failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+  }
+
+  if (!tracePath.empty()) {
+    err = sdFormatStopTrace();
+    if (err != 0) {
+      std::println(stderr, "Error: Trace incomplete: {}", strerror(err));
+    }
+  }
+  if (!manifestPath.empty()) {
+    SDFormatHashManifestReport manifest;
+    err = sdFormatStopHashManifest(manifestPath.c_str(), 0, &manifest);
+    if (err != 0) {
+      std::println(stderr, "Error: Manifest failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::string digest;
+    for (uint8_t byte : manifest.prefixDigest) {
+      digest += std::format("{:02x}", byte);
+    }
+    std::println("[FormatImage] Manifest: {} extents, {} byte prefix "
+                 "({} unrecorded), {}",
+                 manifest.extentCount, manifest.prefixBytes,
+                 manifest.unrecordedBytes, digest);
+  }
+  if (!profilePath.empty()) {
+    SDFormatSimulatorReport simulated;
+    sdFormatDetachSimulator(&simulated);
+    std::println("[FormatImage] Simulated {} commands, {} bytes, {} "
+                 "read-modify-writes, {:.3f} s busy",
+                 simulated.commands, simulated.bytesTransferred,
+                 simulated.readModifyWrites,
+                 simulated.busyNanoseconds / 1e9);
+  }
   close(fd);
   std::println("[FormatImage] Done.");
+  if (stats) {
+    SDFormatStats snapshot;
+    sdFormatGetStats(&snapshot);
+    printStatsJson(snapshot);
+  }
   return 0;
 }
@@ -0,0 +1,87 @@
+/// @file ProbeImage.cpp
+/// @brief Minimal C++ CLI for qualifying a card before it is formatted.
+///
+/// Usage: probe_image [--scan] <path> <sector-count>
+///
+/// Runs sdFormatProbeCapacity on the file or device at @p path and prints
+/// the usable sector count.  With --scan, sdFormatSurfaceScan then writes
+/// and verifies every usable sector, printing the throughput of each
+/// 64 MB region.  Destroys the contents of @p path.  Exits 0 if the card
+/// holds all @p sector-count sectors (and, with --scan, has no bad
+/// sectors), 1 otherwise.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <print>
+#include <string>
+
+#include "SDFormat.h"
+
+// printRegion
+// -----------
+// Surface scan callback: one line per 64 MB region.
+static void printRegion(const SDFormatScanRegion* region, void*) {
+  std::println("[ProbeImage] {:>6} MB  write {:6.1f} MB/s  read {:6.1f} MB/s"
+               "  bad {}",
+               region->startSector / 2048,
+               region->writeBytesPerSecond / 1e6,
+               region->readBytesPerSecond / 1e6, region->badSectors);
+}
+
+int main(int argc, char* argv[]) {
+  bool scan = argc == 4 && std::string(argv[1]) == "--scan";
+  if (argc != 3 + (scan ? 1 : 0)) {
+    std::println(stderr, "Usage: probe_image [--scan] <path> <sector-count>");
+    return 1;
+  }
+
+  const std::string path = argv[argc - 2];
+  const uint64_t sectorCount = std::stoull(argv[argc - 1]);
+
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    std::println(stderr, "Error: Failed to open '{}': {}", path,
+                 strerror(errno));
+    return 1;
+  }
+
+  std::println("[ProbeImage] Probing capacity...");
+  SDFormatCapacityReport capacity;
+  int err = sdFormatProbeCapacity(fd, sectorCount, &capacity);
+  if (err != 0) {
+    std::println(stderr, "Error: Probe failed: {}", strerror(err));
+    close(fd);
+    return 1;
+  }
+  std::println("[ProbeImage] Usable sectors: {} of {} ({} samples, {} "
+               "rounds)",
+               capacity.usableSectors, sectorCount, capacity.samplesWritten,
+               capacity.rounds);
+  bool genuine = capacity.usableSectors == sectorCount;
+
+  if (scan) {
+    std::println("[ProbeImage] Scanning surface...");
+    SDFormatScanReport report;
+    err = sdFormatSurfaceScan(fd, capacity.usableSectors, printRegion,
+                              nullptr, &report);
+    if (err != 0) {
+      std::println(stderr, "Error: Scan failed: {}", strerror(err));
+      close(fd);
+      return 1;
+    }
+    std::println("[ProbeImage] Scanned {} sectors, {} bad",
+                 report.sectorsScanned, report.badSectors);
+    genuine = genuine && report.badSectors == 0;
+  }
+
+  close(fd);
+  if (genuine) {
+    std::println("[ProbeImage] Done.");
+  } else {
+    std::println("[ProbeImage] Card failed.");
+  }
+  return genuine ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+/// @file RelabelImage.cpp
+/// @brief Minimal C++ CLI for changing the label of a FAT32 image or card.
+///
+/// Usage: relabel_image <path> <label>
+///
+/// Opens the file or device at @p path and runs sdFormatRelabel, which
+/// rewrites only the two VBR copies and the root directory's label entry.
+/// Exits 0 on success, 1 on any failure.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <print>
+#include <string>
+
+#include "SDFormat.h"
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    std::println(stderr, "Usage: relabel_image <path> <label>");
+    return 1;
+  }
+
+  const std::string path = argv[1];
+  const char* label = argv[2];
+
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    std::println(stderr, "Error: Failed to open '{}': {}", path,
+                 strerror(errno));
+    return 1;
+  }
+
+  std::println("[RelabelImage] Writing label...");
+  int err = sdFormatRelabel(fd, label);
+  close(fd);
+  if (err != 0) {
+    std::println(stderr, "Error: Relabel failed: {}", strerror(err));
+    return 1;
+  }
+
+  std::println("[RelabelImage] Done.");
+  return 0;
+}
@@ -0,0 +1,12 @@
+# A class 10 card behind a UAS USB 3 reader: about 1.5 ms per command,
+# 40 MB/s sequential writes, four commands in flight, no write-zeroes or
+# discard, 4 MB erase blocks with a 20 ms merge.
+#
+#   format_image --simulate=tools/profiles/usb_reader.profile ...
+
+command_us 1500
+queue_depth 4
+bytes_per_second 40000000
+erase_bytes_per_second 0
+erase_block_bytes 4194304
+rmw_us 20000